@@ -4,9 +4,12 @@
 
 #include "bench.h"
 #include "coins.h"
+#include "crypto/common.h"
 #include "policy/policy.h"
 #include "wallet/crypter.h"
 
+#include <deque>
+#include <unordered_map>
 #include <vector>
 
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
@@ -84,4 +87,63 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// IBD-like churn on a coins map: every block creates OUTPUTS_PER_BLOCK new
+// coins and spends the ones created UTXO_LIFETIME_BLOCKS earlier, so the map
+// holds about 100k entries once warmed up. Run against the pool allocated
+// CCoinsMap and the same map with std::allocator to compare the two.
+static const int OUTPUTS_PER_BLOCK = 200;
+static const int UTXO_LIFETIME_BLOCKS = 500;
+
+template <typename Map>
+static void ConnectDummyBlock(Map& map, std::deque<COutPoint>& outpoints, uint32_t& nBlock)
+{
+    CCoinsCacheEntry entry;
+    entry.coin.out.nValue = 1 * CENT;
+    entry.coin.out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0) << OP_EQUALVERIFY << OP_CHECKSIG;
+    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+
+    uint256 hash;
+    WriteLE32(hash.begin(), ++nBlock);
+    for (int i = 0; i < OUTPUTS_PER_BLOCK; i++) {
+        outpoints.emplace_back(hash, i);
+        map.emplace(outpoints.back(), entry);
+    }
+    if (outpoints.size() > (size_t)OUTPUTS_PER_BLOCK * UTXO_LIFETIME_BLOCKS) {
+        for (int i = 0; i < OUTPUTS_PER_BLOCK; i++) {
+            auto it = map.find(outpoints.front());
+            assert(it != map.end());
+            map.erase(it);
+            outpoints.pop_front();
+        }
+    }
+}
+
+template <typename Map>
+static void CoinsMapChurn(benchmark::State& state, Map& map)
+{
+    std::deque<COutPoint> outpoints;
+    uint32_t nBlock = 0;
+    for (int i = 0; i < UTXO_LIFETIME_BLOCKS; i++) {
+        ConnectDummyBlock(map, outpoints, nBlock);
+    }
+    while (state.KeepRunning()) {
+        ConnectDummyBlock(map, outpoints, nBlock);
+    }
+}
+
+static void CCoinsMapPoolAllocatorIBD(benchmark::State& state)
+{
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    CoinsMapChurn(state, map);
+}
+
+static void CCoinsMapStdAllocatorIBD(benchmark::State& state)
+{
+    std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> map;
+    CoinsMapChurn(state, map);
+}
+
 BENCHMARK(CCoinsCaching);
+BENCHMARK(CCoinsMapPoolAllocatorIBD);
+BENCHMARK(CCoinsMapStdAllocatorIBD);
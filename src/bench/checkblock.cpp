@@ -8,6 +8,10 @@
 #include "validation.h"
 #include "streams.h"
 #include "consensus/validation.h"
+#include "consensus/merkle.h"
+#include "random.h"
+
+#include <boost/thread.hpp>
 
 namespace block_bench {
 #include "bench/data/block413567.raw.h"
@@ -52,5 +56,60 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+/** A large block of transactions with several inputs and outputs each. */
+static CBlock LargeBlock()
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (int i = 0; i < 1500; i++) {
+        CMutableTransaction tx;
+        for (int j = 0; j < 3; j++) {
+            tx.vin.emplace_back(COutPoint(GetRandHash(), j));
+            tx.vin.back().scriptSig = CScript() << std::vector<unsigned char>(72) << std::vector<unsigned char>(33);
+        }
+        for (int j = 0; j < 2; j++)
+            tx.vout.emplace_back(COIN, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20) << OP_EQUALVERIFY << OP_CHECKSIG);
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+static void CheckLargeBlock(benchmark::State& state, int nThreads)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const CBlock block = LargeBlock();
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(&ThreadBlockTxCheck);
+    nScriptCheckThreads = nThreads;
+
+    while (state.KeepRunning()) {
+        block.fChecked = false;
+        CValidationState validationState;
+        assert(CheckBlock(block, validationState, chainParams->GetConsensus(), false));
+    }
+
+    nScriptCheckThreads = 0;
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+static void CheckLargeBlockSerial(benchmark::State& state)
+{
+    CheckLargeBlock(state, 0);
+}
+
+static void CheckLargeBlockParallel(benchmark::State& state)
+{
+    CheckLargeBlock(state, 4);
+}
+
 BENCHMARK(DeserializeBlockTest);
 BENCHMARK(DeserializeAndCheckBlockTest);
+BENCHMARK(CheckLargeBlockSerial);
+BENCHMARK(CheckLargeBlockParallel);
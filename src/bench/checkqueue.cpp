@@ -6,7 +6,13 @@
 #include "util.h"
 #include "validation.h"
 #include "checkqueue.h"
+#include "key.h"
+#include "policy/policy.h"
 #include "prevector.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "keystore.h"
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include "random.h"
@@ -99,5 +105,117 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+// The no-work benchmark with a given number of threads, to see how the
+// overhead of handing out checks grows with them.
+static void CheckQueueNoWork(benchmark::State& state, int nThreads)
+{
+    struct FakeJobNoWork {
+        bool operator()()
+        {
+            return true;
+        }
+        void swap(FakeJobNoWork& x){};
+    };
+    CCheckQueue<FakeJobNoWork> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<FakeJobNoWork> control(&queue);
+        std::vector<std::vector<FakeJobNoWork>> vBatches(BATCHES);
+        for (auto& vChecks : vBatches) {
+            vChecks.resize(BATCH_SIZE);
+        }
+        for (auto& vChecks : vBatches) {
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+// Verifies the signatures of a block of 1000 transactions spending two P2PKH
+// outputs each, adding the checks of one transaction at a time the way
+// ConnectBlock does, with the master and nThreads - 1 workers.
+static const int CONNECT_TXS = 1000;
+static const int CONNECT_INPUTS_PER_TX = 2;
+
+static void CheckQueueConnect(benchmark::State& state, int nThreads)
+{
+    static bool fSigCacheInit = false;
+    if (!fSigCacheInit) {
+        InitSignatureCache();
+        fSigCacheInit = true;
+    }
+
+    CBasicKeyStore keystore;
+    std::vector<CScript> vScriptPubKeys;
+    FastRandomContext rand(true);
+    for (int i = 0; i < 16; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        vScriptPubKeys.push_back(GetScriptForDestination(key.GetPubKey().GetID()));
+    }
+
+    std::vector<CTransaction> vTxs;
+    std::vector<std::vector<CScript>> vPrevScripts;
+    for (int i = 0; i < CONNECT_TXS; i++) {
+        CMutableTransaction tx;
+        std::vector<CScript> vPrev;
+        for (int j = 0; j < CONNECT_INPUTS_PER_TX; j++) {
+            tx.vin.emplace_back(COutPoint(rand.rand256(), j));
+            vPrev.push_back(vScriptPubKeys[rand.randrange(vScriptPubKeys.size())]);
+        }
+        tx.vout.emplace_back(CONNECT_INPUTS_PER_TX * COIN, vScriptPubKeys[0]);
+        for (int j = 0; j < CONNECT_INPUTS_PER_TX; j++)
+            assert(SignSignature(keystore, vPrev[j], tx, j, COIN, SIGHASH_ALL));
+        vTxs.emplace_back(tx);
+        vPrevScripts.push_back(vPrev);
+    }
+    std::vector<PrecomputedTransactionData> vTxData;
+    vTxData.reserve(vTxs.size());
+    for (const CTransaction& tx : vTxs)
+        vTxData.emplace_back(tx);
+
+    CCheckQueue<CScriptCheck> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < nThreads - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CScriptCheck> control(&queue);
+        for (size_t i = 0; i < vTxs.size(); i++) {
+            std::vector<CScriptCheck> vChecks;
+            for (int j = 0; j < CONNECT_INPUTS_PER_TX; j++)
+                vChecks.emplace_back(vPrevScripts[i][j], COIN, vTxs[i], j, STANDARD_SCRIPT_VERIFY_FLAGS, false, &vTxData[i]);
+            control.Add(vChecks);
+        }
+        assert(control.Wait());
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueSpeed_1Thread(benchmark::State& state) { CheckQueueNoWork(state, 1); }
+static void CCheckQueueSpeed_4Threads(benchmark::State& state) { CheckQueueNoWork(state, 4); }
+static void CCheckQueueSpeed_16Threads(benchmark::State& state) { CheckQueueNoWork(state, 16); }
+static void CCheckQueueSpeed_64Threads(benchmark::State& state) { CheckQueueNoWork(state, 64); }
+static void CCheckQueueConnect_1Thread(benchmark::State& state) { CheckQueueConnect(state, 1); }
+static void CCheckQueueConnect_4Threads(benchmark::State& state) { CheckQueueConnect(state, 4); }
+static void CCheckQueueConnect_16Threads(benchmark::State& state) { CheckQueueConnect(state, 16); }
+static void CCheckQueueConnect_64Threads(benchmark::State& state) { CheckQueueConnect(state, 64); }
+
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+BENCHMARK(CCheckQueueSpeed_1Thread);
+BENCHMARK(CCheckQueueSpeed_4Threads);
+BENCHMARK(CCheckQueueSpeed_16Threads);
+BENCHMARK(CCheckQueueSpeed_64Threads);
+BENCHMARK(CCheckQueueConnect_1Thread);
+BENCHMARK(CCheckQueueConnect_4Threads);
+BENCHMARK(CCheckQueueConnect_16Threads);
+BENCHMARK(CCheckQueueConnect_64Threads);
@@ -0,0 +1,121 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "coinsprefetch.h"
+#include "dbwrapper.h"
+#include "primitives/block.h"
+#include "random.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Looks up the inputs of a large block in a cold cache the way ConnectBlock
+// does, with and without the prefetcher warming the cache first. The coins
+// live in an in-memory LevelDB, so lookups pay for the database work; the
+// SlowDisk variants add a delay to every lookup in the way a random read
+// from disk would during a reindex with a cold cache.
+static const int NUM_COINS = 100000;
+static const int NUM_TXS = 1000;
+static const int INPUTS_PER_TX = 4;
+static const int SLOW_DISK_READ_MICROS = 100;
+
+class CCoinsViewMemDB : public CCoinsView
+{
+private:
+    CDBWrapper db;
+    const int nReadMicros;
+
+public:
+    explicit CCoinsViewMemDB(int nReadMicrosIn) : db(fs::path("bench_coins"), 1 << 20, true), nReadMicros(nReadMicrosIn) {}
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override
+    {
+        if (nReadMicros)
+            std::this_thread::sleep_for(std::chrono::microseconds(nReadMicros));
+        return db.Read(outpoint, coin);
+    }
+
+    void WriteCoins(const std::vector<std::pair<COutPoint, Coin>>& vCoins)
+    {
+        CDBBatch batch(db);
+        for (const auto& entry : vCoins)
+            batch.Write(entry.first, entry.second);
+        db.WriteBatch(batch);
+    }
+};
+
+static void SetupBlock(CCoinsViewMemDB& db, CBlock& block)
+{
+    // Block hashes depend on the chain's parameters.
+    SelectParams(CBaseChainParams::MAIN);
+    FastRandomContext rand(true);
+    std::vector<std::pair<COutPoint, Coin>> vCoins;
+    for (int i = 0; i < NUM_COINS; i++) {
+        CTxOut out(rand.randrange(100 * COIN), CScript() << OP_DUP << OP_HASH160 << ToByteVector(rand.rand256()) << OP_EQUALVERIFY << OP_CHECKSIG);
+        vCoins.emplace_back(COutPoint(rand.rand256(), rand.randrange(4)), Coin(std::move(out), 1000 + i, false));
+    }
+    db.WriteCoins(vCoins);
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    for (int i = 0; i < NUM_TXS; i++) {
+        CMutableTransaction tx;
+        for (int j = 0; j < INPUTS_PER_TX; j++)
+            tx.vin.emplace_back(vCoins[rand.randrange(vCoins.size())].first);
+        tx.vout.resize(1);
+        block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+}
+
+static void FetchInputs(const CBlock& block, const CCoinsViewCache& cache)
+{
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin)
+            assert(!cache.AccessCoin(txin.prevout).IsSpent());
+    }
+}
+
+static void FetchSerial(benchmark::State& state, int nReadMicros)
+{
+    CCoinsViewMemDB db(nReadMicros);
+    CBlock block;
+    SetupBlock(db, block);
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&db);
+        FetchInputs(block, cache);
+    }
+}
+
+static void FetchPrefetch(benchmark::State& state, int nReadMicros)
+{
+    CCoinsViewMemDB db(nReadMicros);
+    CBlock block;
+    SetupBlock(db, block);
+    CCoinsPrefetcher prefetcher(&db);
+    prefetcher.Start(DEFAULT_PREFETCH_THREADS);
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&db);
+        prefetcher.Warm(block, cache);
+        FetchInputs(block, cache);
+    }
+    prefetcher.Stop();
+}
+
+static void CoinsFetchSerial(benchmark::State& state) { FetchSerial(state, 0); }
+static void CoinsFetchPrefetch(benchmark::State& state) { FetchPrefetch(state, 0); }
+static void CoinsFetchSerialSlowDisk(benchmark::State& state) { FetchSerial(state, SLOW_DISK_READ_MICROS); }
+static void CoinsFetchPrefetchSlowDisk(benchmark::State& state) { FetchPrefetch(state, SLOW_DISK_READ_MICROS); }
+
+BENCHMARK(CoinsFetchSerial);
+BENCHMARK(CoinsFetchPrefetch);
+BENCHMARK(CoinsFetchSerialSlowDisk);
+BENCHMARK(CoinsFetchPrefetchSlowDisk);
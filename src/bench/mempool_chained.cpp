@@ -0,0 +1,67 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "policy/policy.h"
+#include "txmempool.h"
+
+#include <vector>
+
+// Longest chain accepted by the default -limitancestorcount.
+static const size_t CHAIN_LENGTH = 25;
+
+static std::vector<CTransactionRef> CreateChain(size_t nLength)
+{
+    std::vector<CTransactionRef> chain;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = 50 * COIN;
+    for (size_t i = 0; i < nLength; i++) {
+        chain.push_back(MakeTransactionRef(tx));
+        tx.vin[0].prevout = COutPoint(chain.back()->GetHash(), 0);
+        tx.vout[0].nValue -= COIN / 100;
+    }
+    return chain;
+}
+
+static void AddChain(const std::vector<CTransactionRef>& chain, CTxMemPool& pool)
+{
+    LockPoints lp;
+    for (const CTransactionRef& tx : chain) {
+        // Goes through CalculateMemPoolAncestors, walking the whole chain so far.
+        pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, 1000LL, 0, 1, false, 4, lp));
+    }
+}
+
+// Accept a maximum-length chain of unconfirmed transactions, one at a time,
+// then evict it again.
+static void MempoolChainedAcceptance(benchmark::State& state)
+{
+    std::vector<CTransactionRef> chain = CreateChain(CHAIN_LENGTH);
+    CTxMemPool pool;
+
+    while (state.KeepRunning()) {
+        AddChain(chain, pool);
+        pool.removeRecursive(*chain.front());
+    }
+}
+
+// Accept a maximum-length chain, then confirm it in a block, which updates
+// the ancestor state of every remaining descendant for each removed entry.
+static void MempoolChainedBlockRemoval(benchmark::State& state)
+{
+    std::vector<CTransactionRef> chain = CreateChain(CHAIN_LENGTH);
+    CTxMemPool pool;
+
+    while (state.KeepRunning()) {
+        AddChain(chain, pool);
+        pool.removeForBlock(chain, 1);
+    }
+}
+
+BENCHMARK(MempoolChainedAcceptance);
+BENCHMARK(MempoolChainedBlockRemoval);
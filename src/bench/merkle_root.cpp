@@ -0,0 +1,49 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/merkle.h"
+#include "merkleblock.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <vector>
+
+// The Merkle root of a block with 9001 transactions, and a partial Merkle
+// tree matching a few of them as sent for a filtered block.
+static const int NUM_LEAVES = 9001;
+
+static std::vector<uint256> RandomLeaves()
+{
+    FastRandomContext rng(true);
+    std::vector<uint256> leaves(NUM_LEAVES);
+    for (auto& leaf : leaves)
+        leaf = rng.rand256();
+    return leaves;
+}
+
+static void MerkleRoot(benchmark::State& state)
+{
+    const std::vector<uint256> leaves = RandomLeaves();
+    while (state.KeepRunning()) {
+        bool mutation = false;
+        uint256 hash = ComputeMerkleRoot(leaves, &mutation);
+        assert(!hash.IsNull() && !mutation);
+    }
+}
+
+static void PartialMerkleTree(benchmark::State& state)
+{
+    const std::vector<uint256> leaves = RandomLeaves();
+    std::vector<bool> vMatch(NUM_LEAVES);
+    for (int i = 0; i < NUM_LEAVES; i += 1000)
+        vMatch[i] = true;
+    while (state.KeepRunning()) {
+        CPartialMerkleTree tree(leaves, vMatch);
+    }
+}
+
+BENCHMARK(MerkleRoot);
+BENCHMARK(PartialMerkleTree);
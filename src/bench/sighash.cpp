@@ -0,0 +1,49 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+
+#include <memory>
+
+// Computes the legacy SIGHASH_ALL signature hash of every input of a
+// transaction with 1000 P2PKH inputs, the way verifying all of its signatures
+// does. Without the precomputed data, each one hashes the whole transaction.
+static const int NUM_INPUTS = 1000;
+
+static CTransaction BuildTransaction()
+{
+    FastRandomContext rand(true);
+    CMutableTransaction tx;
+    for (int i = 0; i < NUM_INPUTS; i++) {
+        tx.vin.emplace_back(COutPoint(rand.rand256(), rand.randrange(4)));
+        // Signature and public key
+        tx.vin.back().scriptSig = CScript() << std::vector<unsigned char>(72) << std::vector<unsigned char>(33);
+    }
+    tx.vout.emplace_back(NUM_INPUTS * COIN, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20) << OP_EQUALVERIFY << OP_CHECKSIG);
+    return CTransaction(tx);
+}
+
+static void HashAllInputs(benchmark::State& state, bool fPrecompute)
+{
+    const CTransaction tx = BuildTransaction();
+    const CScript scriptCode = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20) << OP_EQUALVERIFY << OP_CHECKSIG;
+    while (state.KeepRunning()) {
+        // The precomputation is part of the cost, as it is per transaction.
+        std::unique_ptr<PrecomputedTransactionData> txdata;
+        if (fPrecompute)
+            txdata.reset(new PrecomputedTransactionData(tx));
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+            SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL, 0, SIGVERSION_BASE, txdata.get());
+    }
+}
+
+static void SigHashLegacy1000Inputs(benchmark::State& state) { HashAllInputs(state, false); }
+static void SigHashLegacy1000InputsPrecomputed(benchmark::State& state) { HashAllInputs(state, true); }
+
+BENCHMARK(SigHashLegacy1000Inputs);
+BENCHMARK(SigHashLegacy1000InputsPrecomputed);
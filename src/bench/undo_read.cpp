@@ -0,0 +1,129 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "blockfilecache.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "fs.h"
+#include "hash.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "undo.h"
+
+#include <vector>
+
+// Reads the undo data of random blocks out of a rev file the way a reorg
+// does: by opening the file and reading through stdio, or through a
+// CBlockFileCache that has the file mapped, in the legacy and the compact
+// undo formats. The file is freshly written, so it is in the page cache.
+static const int NUM_BLOCKS = 200;
+static const int TXS_PER_BLOCK = 500;
+static const int READS_PER_RUN = 20;
+static const unsigned int BLOCK_HEIGHT = 500000;
+
+static CBlockUndo RandomBlockUndo(FastRandomContext& rng)
+{
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(TXS_PER_BLOCK);
+    for (CTxUndo& txundo : blockundo.vtxundo) {
+        txundo.vprevout.resize(1 + rng.randrange(3));
+        for (Coin& coin : txundo.vprevout) {
+            coin.nHeight = BLOCK_HEIGHT - (rng.randbool() ? rng.randrange(100) : rng.randrange(BLOCK_HEIGHT));
+            coin.fCoinBase = rng.randrange(20) == 0;
+            coin.out.nValue = rng.randrange(100 * COIN);
+            const uint256 hash = rng.rand256();
+            coin.out.scriptPubKey = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20))));
+        }
+    }
+    return blockundo;
+}
+
+/** Write undo records the way UndoWriteToDisk does, returning their positions */
+static std::vector<uint64_t> WriteUndoFile(const fs::path& path, bool fCompact)
+{
+    FastRandomContext rng(true);
+    CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    assert(!fileout.IsNull());
+    std::vector<uint64_t> vPos;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        const CBlockUndo blockundo = RandomBlockUndo(rng);
+        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        if (fCompact)
+            ss << BlockUndoCompactSerializer(&blockundo, BLOCK_HEIGHT);
+        else
+            ss << blockundo;
+        hasher << uint256();
+        hasher.write(ss.data(), ss.size());
+        fileout << uint32_t{0xd9b4bef9} << (uint32_t)ss.size();
+        vPos.push_back(ftell(fileout.Get()));
+        fileout.write(ss.data(), ss.size());
+        fileout << hasher.GetHash();
+    }
+    return vPos;
+}
+
+template<typename Stream>
+static void ReadUndo(Stream& s, bool fCompact)
+{
+    CHashVerifier<Stream> verifier(&s);
+    CBlockUndo blockundo;
+    verifier << uint256();
+    if (fCompact)
+        verifier >> REF(BlockUndoCompactDeserializer(&blockundo, BLOCK_HEIGHT));
+    else
+        verifier >> blockundo;
+    uint256 hashChecksum;
+    s >> hashChecksum;
+    assert(hashChecksum == verifier.GetHash());
+}
+
+static void UndoRead(benchmark::State& state, bool fCompact, bool fCache)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path();
+    const std::vector<uint64_t> vPos = WriteUndoFile(path, fCompact);
+    CBlockFileCache cache;
+    FastRandomContext rng(true);
+
+    while (state.KeepRunning()) {
+        for (int i = 0; i < READS_PER_RUN; i++) {
+            const uint64_t nPos = vPos[rng.randrange(vPos.size())];
+            if (fCache) {
+                CDiskRecord record;
+                assert(cache.ReadRecord(path, nPos, 32, true, record));
+                CSpanReader reader(SER_DISK, CLIENT_VERSION, record.data(), record.size());
+                ReadUndo(reader, fCompact);
+            } else {
+                CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+                assert(!filein.IsNull() && fseek(filein.Get(), nPos, SEEK_SET) == 0);
+                ReadUndo(filein, fCompact);
+            }
+        }
+    }
+
+    cache.Clear();
+    fs::remove(path);
+}
+
+static void UndoReadFile(benchmark::State& state)
+{
+    UndoRead(state, false, false);
+}
+
+static void UndoReadMapped(benchmark::State& state)
+{
+    UndoRead(state, false, true);
+}
+
+static void UndoReadMappedCompact(benchmark::State& state)
+{
+    UndoRead(state, true, true);
+}
+
+BENCHMARK(UndoReadFile);
+BENCHMARK(UndoReadMapped);
+BENCHMARK(UndoReadMappedCompact);
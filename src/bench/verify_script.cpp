@@ -4,14 +4,20 @@
 
 #include "bench.h"
 #include "key.h"
+#include "keystore.h"
+#include "random.h"
 #if defined(HAVE_CONSENSUS_LIB)
 #include "script/fabcoinconsensus.h"
 #endif
 #include "script/script.h"
+#include "script/sigcache.h"
 #include "script/sign.h"
+#include "script/standard.h"
 #include "streams.h"
+#include "validation.h"
 
 #include <array>
+#include <memory>
 
 // FIXME: Dedup with BuildCreditingTransaction in test/script_tests.cpp.
 static CMutableTransaction BuildCreditingTransaction(const CScript& scriptPubKey)
@@ -106,3 +112,88 @@ static void VerifyScriptBench(benchmark::State& state)
 }
 
 BENCHMARK(VerifyScriptBench);
+
+// The script checks of a block of 500 single-input transactions spending a
+// mix of output types roughly like that of the chain: 60% P2PKH, 20% P2WPKH,
+// 10% P2SH-P2WPKH and 10% P2SH 2-of-3 multisig, half of those signed by the
+// first two keys and half by the last two.
+static void VerifyScriptBlock(benchmark::State& state, bool fBatch)
+{
+    static bool fSigCache = false;
+    if (!fSigCache) {
+        InitSignatureCache();
+        fSigCache = true;
+    }
+    const int NUM_TXS = 500;
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS;
+
+    CKey keys[3];
+    CBasicKeyStore keystore;
+    std::vector<CPubKey> vMultisigKeys;
+    for (CKey& key : keys) {
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        vMultisigKeys.push_back(key.GetPubKey());
+    }
+    const CScript scriptMultisig = GetScriptForMultisig(2, vMultisigKeys);
+    const CScript scriptWitness = GetScriptForWitness(GetScriptForDestination(keys[0].GetPubKey().GetID()));
+    keystore.AddCScript(scriptMultisig);
+    keystore.AddCScript(scriptWitness);
+
+    std::vector<CScript> vScriptPubKey;
+    std::vector<std::unique_ptr<CTransaction>> vtx;
+    std::vector<std::unique_ptr<PrecomputedTransactionData>> vtxdata;
+    for (int i = 0; i < NUM_TXS; i++) {
+        CScript scriptPubKey;
+        CBasicKeyStore keystoreMultisig;
+        const CKeyStore* pkeystore = &keystore;
+        switch (i % 10) {
+        case 0:
+        case 1:
+            scriptPubKey = scriptWitness;
+            break;
+        case 2:
+            scriptPubKey = GetScriptForDestination(CScriptID(scriptWitness));
+            break;
+        case 3:
+            scriptPubKey = GetScriptForDestination(CScriptID(scriptMultisig));
+            keystoreMultisig.AddCScript(scriptMultisig);
+            keystoreMultisig.AddKey(keys[i % 20 == 3 ? 0 : 2]);
+            keystoreMultisig.AddKey(keys[1]);
+            pkeystore = &keystoreMultisig;
+            break;
+        default:
+            scriptPubKey = GetScriptForDestination(keys[i % 3].GetPubKey().GetID());
+        }
+        CMutableTransaction mtx;
+        mtx.nVersion = 1;
+        mtx.vin.emplace_back(COutPoint(GetRandHash(), 0));
+        mtx.vout.emplace_back(1000, CScript() << OP_1);
+        bool fSigned = SignSignature(*pkeystore, scriptPubKey, mtx, 0, 1000, SIGHASH_ALL);
+        assert(fSigned);
+        vScriptPubKey.push_back(scriptPubKey);
+        vtx.emplace_back(new CTransaction(mtx));
+        vtxdata.emplace_back(new PrecomputedTransactionData(*vtx.back()));
+    }
+
+    while (state.KeepRunning()) {
+        std::vector<CScriptCheck> vChecks;
+        for (int i = 0; i < NUM_TXS; i++)
+            vChecks.emplace_back(vScriptPubKey[i], 1000, *vtx[i], 0, flags, false, vtxdata[i].get());
+        bool fValid = VerifyScriptChecksBatched(vChecks, fBatch);
+        assert(fValid);
+    }
+}
+
+static void VerifyScriptBlockMix(benchmark::State& state)
+{
+    VerifyScriptBlock(state, false);
+}
+
+static void VerifyScriptBlockMixBatch(benchmark::State& state)
+{
+    VerifyScriptBlock(state, true);
+}
+
+BENCHMARK(VerifyScriptBlockMix);
+BENCHMARK(VerifyScriptBlockMixBatch);
@@ -0,0 +1,201 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilecache.h"
+
+#include "crypto/common.h"
+#include "serialize.h"
+
+#ifdef WIN32
+#include <stdio.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifndef WIN32
+/** A read-only mapping of a whole file */
+struct Mapping
+{
+    const char* pbegin;
+    size_t nSize;
+
+    Mapping(const char* pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+    ~Mapping() { munmap((void*)pbegin, nSize); }
+};
+
+//! Only map files where there is address space to spare
+const bool fMapFiles = sizeof(void*) >= 8;
+
+/** Read exactly nSize bytes at nPos */
+bool ReadAt(int fd, char* pch, size_t nSize, uint64_t nPos)
+{
+    while (nSize > 0) {
+        ssize_t nRead = pread(fd, pch, nSize, nPos);
+        if (nRead < 0 && errno == EINTR)
+            continue;
+        if (nRead <= 0)
+            return false;
+        pch += nRead;
+        nSize -= nRead;
+        nPos += nRead;
+    }
+    return true;
+}
+#endif
+
+} // namespace
+
+struct CBlockFileCache::File
+{
+#ifdef WIN32
+    FILE* file = nullptr;
+#else
+    int fd = -1;
+    std::shared_ptr<const Mapping> pmapping;
+#endif
+
+    ~File()
+    {
+#ifdef WIN32
+        if (file)
+            fclose(file);
+#else
+        if (fd >= 0)
+            close(fd);
+#endif
+    }
+};
+
+CBlockFileCache::CBlockFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) {}
+
+CBlockFileCache::~CBlockFileCache()
+{
+    Clear();
+}
+
+std::shared_ptr<CBlockFileCache::File> CBlockFileCache::Open(const fs::path& path)
+{
+    auto it = mapFiles.find(path);
+    if (it != mapFiles.end()) {
+        listFiles.splice(listFiles.begin(), listFiles, it->second);
+        return it->second->second;
+    }
+
+    std::shared_ptr<File> file = std::make_shared<File>();
+#ifdef WIN32
+    file->file = fsbridge::fopen(path, "rb");
+    if (!file->file)
+        return nullptr;
+#else
+    file->fd = open(path.string().c_str(), O_RDONLY | O_CLOEXEC);
+    if (file->fd < 0)
+        return nullptr;
+#endif
+    listFiles.emplace_front(path, file);
+    mapFiles[path] = listFiles.begin();
+    while (listFiles.size() > nMaxFiles) {
+        mapFiles.erase(listFiles.back().first);
+        listFiles.pop_back();
+    }
+    return file;
+}
+
+bool CBlockFileCache::ReadRecord(const fs::path& path, uint64_t nPos, size_t nTrailing, bool fFinal, CDiskRecord& record)
+{
+    if (nPos < 4)
+        return false;
+    record = CDiskRecord();
+
+    std::shared_ptr<File> file;
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        file = Open(path);
+        if (!file)
+            return false;
+#ifdef WIN32
+        // Reads go through the shared FILE, under the lock.
+        char header[4];
+        if (fseek(file->file, nPos - 4, SEEK_SET) || fread(header, 1, 4, file->file) != 4)
+            return false;
+        uint32_t nSize = ReadLE32((const unsigned char*)header);
+        if (nSize > MAX_SIZE)
+            return false;
+        record.vch.resize(nSize + nTrailing);
+        if (fread(record.vch.data(), 1, record.vch.size(), file->file) != record.vch.size())
+            return false;
+        record.pbegin = record.vch.data();
+        record.nSize = record.vch.size();
+        return true;
+#else
+        if (fFinal && fMapFiles) {
+            // Map the file, or map it again if it grew past the record.
+            for (int i = 0; i < 2; i++) {
+                const std::shared_ptr<const Mapping>& pmapping = file->pmapping;
+                if (pmapping && nPos <= pmapping->nSize) {
+                    uint32_t nSize = ReadLE32((const unsigned char*)pmapping->pbegin + nPos - 4);
+                    if (nSize <= MAX_SIZE && nPos + nSize + nTrailing <= pmapping->nSize) {
+                        record.pmapping = pmapping;
+                        record.pbegin = pmapping->pbegin + nPos;
+                        record.nSize = nSize + nTrailing;
+                        return true;
+                    }
+                }
+                struct stat st;
+                if (i > 0 || fstat(file->fd, &st) != 0 || st.st_size == 0 || (pmapping && (size_t)st.st_size <= pmapping->nSize))
+                    break;
+                void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+                if (p == MAP_FAILED)
+                    break;
+                file->pmapping = std::make_shared<const Mapping>((const char*)p, st.st_size);
+            }
+        }
+#endif
+    }
+
+#ifndef WIN32
+    // Other files are read without holding the lock; the shared File keeps
+    // the descriptor open even if it is closed in the meantime.
+    char header[4];
+    if (!ReadAt(file->fd, header, 4, nPos - 4))
+        return false;
+    uint32_t nSize = ReadLE32((const unsigned char*)header);
+    if (nSize > MAX_SIZE)
+        return false;
+    record.vch.resize(nSize + nTrailing);
+    if (!ReadAt(file->fd, record.vch.data(), record.vch.size(), nPos))
+        return false;
+    record.pbegin = record.vch.data();
+    record.nSize = record.vch.size();
+    return true;
+#endif
+}
+
+void CBlockFileCache::Forget(const fs::path& path)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    auto it = mapFiles.find(path);
+    if (it != mapFiles.end()) {
+        listFiles.erase(it->second);
+        mapFiles.erase(it);
+    }
+}
+
+void CBlockFileCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    mapFiles.clear();
+    listFiles.clear();
+}
+
+size_t CBlockFileCache::Size()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return listFiles.size();
+}
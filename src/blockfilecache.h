@@ -0,0 +1,88 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FABCOIN_BLOCKFILECACHE_H
+#define FABCOIN_BLOCKFILECACHE_H
+
+#include "fs.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+/** Number of blk/rev files a CBlockFileCache keeps open */
+static const size_t DEFAULT_BLOCKFILE_CACHE_FILES = 16;
+
+/**
+ * A record read from a block or undo file. Its bytes are either in a mapping
+ * of the file, which the record keeps alive, or copied into the record.
+ */
+class CDiskRecord
+{
+private:
+    friend class CBlockFileCache;
+
+    std::shared_ptr<const void> pmapping;
+    std::vector<char> vch;
+    const char* pbegin = nullptr;
+    size_t nSize = 0;
+
+public:
+    const char* data() const { return pbegin; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Keeps the blk?????.dat and rev?????.dat files that were read last open, so
+ * that reading a block or its undo data does not open, seek and close its
+ * file every time.
+ *
+ * Files that are only read from now on are mapped into memory read-only, and
+ * their records are handed out from the mapping without any copy or system
+ * call. Others are read with pread. A record past the end of a mapping, as
+ * undo data appended to a rev file after it was mapped, maps the file again;
+ * mappings in use by records stay valid until the records are gone.
+ *
+ * Files must only grow while they are in the cache: Forget() them before
+ * they are truncated or deleted.
+ */
+class CBlockFileCache
+{
+public:
+    explicit CBlockFileCache(size_t nMaxFilesIn = DEFAULT_BLOCKFILE_CACHE_FILES);
+    ~CBlockFileCache();
+
+    /**
+     * Read the record at nPos of the file at path, whose size is in the four
+     * bytes in front of it, plus nTrailing bytes after it. fFinal says that
+     * the file is not written to anymore, except for appends, so it may be
+     * mapped. Returns false if the file cannot be read or is too short.
+     */
+    bool ReadRecord(const fs::path& path, uint64_t nPos, size_t nTrailing, bool fFinal, CDiskRecord& record);
+
+    /** Close the file at path, if it is open */
+    void Forget(const fs::path& path);
+
+    /** Close all files */
+    void Clear();
+
+    /** Number of files open */
+    size_t Size();
+
+private:
+    struct File;
+
+    std::mutex cs;
+    const size_t nMaxFiles;
+    //! Open files, the most recently used first
+    std::list<std::pair<fs::path, std::shared_ptr<File>>> listFiles;
+    std::map<fs::path, std::list<std::pair<fs::path, std::shared_ptr<File>>>::iterator> mapFiles;
+
+    std::shared_ptr<File> Open(const fs::path& path);
+};
+
+#endif // FABCOIN_BLOCKFILECACHE_H
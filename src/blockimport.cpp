@@ -0,0 +1,310 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/consensus.h"
+#include "consensus/validation.h"
+#include "primitives/block.h"
+#include "protocol.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+
+/** How often the throughput of the stages is logged under -debug=reindex */
+static const int64_t IMPORT_LOG_INTERVAL = 10 * 1000000;
+
+CBlockImporter::Item::Item() : ssRaw(SER_DISK, CLIENT_VERSION) {}
+
+CBlockImporter::CBlockImporter(const CChainParams& chainparamsIn, const std::vector<CBlockImportFile>& files, int nCheckThreads, int nReadersIn) :
+    chainparams(chainparamsIn), vFiles(files), nReaders(std::max(1, std::min<int>(nReadersIn, files.size()))),
+    vFileState(files.size()), nNextFile(0), nHeadFile(0), nBuffered(0), fStop(false)
+{
+    nStartTime = nLastLog = GetTimeMicros();
+    nLastReturn = 0;
+    for (int i = 0; i < nReaders; i++)
+        vThreads.emplace_back(&CBlockImporter::ThreadRead, this);
+    for (int i = 0; i < nCheckThreads; i++)
+        vThreads.emplace_back(&CBlockImporter::ThreadCheck, this);
+}
+
+CBlockImporter::~CBlockImporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fStop = true;
+    }
+    condRead.notify_all();
+    condCheck.notify_all();
+    condReady.notify_all();
+    for (std::thread& thread : vThreads)
+        thread.join();
+}
+
+void CBlockImporter::ThreadRead()
+{
+    RenameThread("fabcoin-importread");
+    while (true) {
+        size_t nIndex;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fStop || nNextFile >= vFiles.size())
+                return;
+            nIndex = nNextFile++;
+        }
+        ReadFile(nIndex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            vFileState[nIndex].fDone = true;
+        }
+        condReady.notify_all();
+    }
+}
+
+void CBlockImporter::ReadFile(size_t nIndex)
+{
+    FILE* fileIn = fsbridge::fopen(vFiles[nIndex].path, "rb");
+    if (!fileIn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        vFileState[nIndex].fOpenFailed = true;
+        return;
+    }
+
+    // This scans for records like LoadExternalBlockFile, but takes the size in
+    // front of a record for granted rather than deserializing it.
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        int64_t nTimeStart = GetTimeMicros();
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        std::shared_ptr<Item> item = std::make_shared<Item>();
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            item->nMagicPos = blkdat.GetPos();
+            nRewind = item->nMagicPos + 1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> item->nSize;
+            if (item->nSize < 80 || item->nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        bool fTruncated = false;
+        try {
+            item->pos = CDiskBlockPos(vFiles[nIndex].nFile, blkdat.GetPos());
+            blkdat.SetLimit(item->pos.nPos + item->nSize);
+            item->ssRaw.resize(item->nSize);
+            blkdat.read(&item->ssRaw[0], item->nSize);
+            nRewind = blkdat.GetPos();
+        } catch (const std::exception&) {
+            // The file ends within the record. It fails to deserialize, so
+            // the caller scans the rest of the file itself.
+            item->ssRaw.clear();
+            fTruncated = true;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            int64_t nTimeRead = GetTimeMicros();
+            stats.nReadMicros += nTimeRead - nTimeStart;
+            condRead.wait(lock, [this, nIndex] { return fStop || vFileState[nIndex].fSkip || nIndex == nHeadFile || nBuffered < IMPORT_BUFFER_SIZE; });
+            stats.nReadStallMicros += GetTimeMicros() - nTimeRead;
+            if (fStop || vFileState[nIndex].fSkip)
+                break;
+            nBuffered += item->nSize;
+            stats.nReadBlocks++;
+            stats.nReadBytes += item->nSize + 8;
+            vFileState[nIndex].items.push_back(item);
+            queueCheck.push_back(item);
+        }
+        condCheck.notify_one();
+        condReady.notify_all();
+        if (fTruncated)
+            break;
+    }
+}
+
+void CBlockImporter::ThreadCheck()
+{
+    RenameThread("fabcoin-importcheck");
+    while (true) {
+        std::shared_ptr<Item> item;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condCheck.wait(lock, [this] { return fStop || !queueCheck.empty(); });
+            if (fStop)
+                return;
+            item = queueCheck.front();
+            queueCheck.pop_front();
+            // Taken by NextBlock() already, or dropped.
+            if (item->state != Item::QUEUED)
+                continue;
+            item->state = Item::CHECKING;
+        }
+        Check(*item);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            item->state = Item::DONE;
+        }
+        condReady.notify_all();
+    }
+}
+
+void CBlockImporter::Check(Item& item)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    try {
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        item.ssRaw >> *pblock;
+        item.nConsumed = item.nSize - item.ssRaw.size();
+        item.pblock = pblock;
+    } catch (const std::exception&) {
+        // Left for the caller to rescan.
+    }
+    // Free the record's memory.
+    item.ssRaw = CDataStream(SER_DISK, CLIENT_VERSION);
+
+    if (item.pblock) {
+        // This marks the block fChecked if it passes. One that does not is
+        // checked again by AcceptBlock, which then records the failure.
+        CValidationState state;
+        CheckBlock(*item.pblock, state, chainparams.GetConsensus());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.nCheckedBlocks++;
+    stats.nCheckMicros += GetTimeMicros() - nTimeStart;
+}
+
+bool CBlockImporter::NextBlock(size_t nIndex, Item& item)
+{
+    std::shared_ptr<Item> pitem;
+    bool fHelp = false;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        int64_t nTimeStart = GetTimeMicros();
+        if (nLastReturn)
+            stats.nAcceptMicros += nTimeStart - nLastReturn;
+        if (nHeadFile != nIndex) {
+            assert(nIndex > nHeadFile);
+            nHeadFile = nIndex;
+            condRead.notify_all();
+        }
+        File& file = vFileState[nIndex];
+        condReady.wait(lock, [&file] { return !file.items.empty() || file.fDone; });
+        if (file.items.empty()) {
+            nLastReturn = GetTimeMicros();
+            stats.nAcceptStallMicros += nLastReturn - nTimeStart;
+            return false;
+        }
+        pitem = file.items.front();
+        file.items.pop_front();
+        nBuffered -= pitem->nSize;
+        if (pitem->state == Item::QUEUED) {
+            // No check thread got to it yet; rather than wait, do it here.
+            pitem->state = Item::CHECKING;
+            fHelp = true;
+        } else {
+            condReady.wait(lock, [&pitem] { return pitem->state == Item::DONE; });
+        }
+        stats.nAcceptStallMicros += GetTimeMicros() - nTimeStart;
+    }
+    condRead.notify_all();
+    if (fHelp)
+        Check(*pitem);
+
+    item = *pitem;
+    int64_t nNow = GetTimeMicros();
+    bool fLog = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pitem->state = Item::DONE;
+        stats.nAcceptedBlocks++;
+        nLastReturn = nNow;
+        if (nNow - nLastLog >= IMPORT_LOG_INTERVAL) {
+            nLastLog = nNow;
+            fLog = true;
+        }
+    }
+    if (fLog && LogAcceptCategory(BCLog::REINDEX))
+        LogStats(false);
+    return true;
+}
+
+void CBlockImporter::SkipFile(size_t nIndex)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        File& file = vFileState[nIndex];
+        file.fSkip = true;
+        for (const auto& item : file.items) {
+            nBuffered -= item->nSize;
+            if (item->state == Item::QUEUED)
+                item->state = Item::DONE;
+        }
+        file.items.clear();
+    }
+    condRead.notify_all();
+}
+
+bool CBlockImporter::OpenFailed(size_t nIndex) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return vFileState[nIndex].fOpenFailed;
+}
+
+CBlockImportStats CBlockImporter::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    CBlockImportStats ret = stats;
+    ret.nElapsedMicros = GetTimeMicros() - nStartTime;
+    return ret;
+}
+
+void CBlockImporter::LogStats(bool fTotal)
+{
+    CBlockImportStats total = GetStats();
+    CBlockImportStats s = total;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!fTotal) {
+            s.nReadBlocks -= statsLogged.nReadBlocks;
+            s.nReadBytes -= statsLogged.nReadBytes;
+            s.nReadMicros -= statsLogged.nReadMicros;
+            s.nReadStallMicros -= statsLogged.nReadStallMicros;
+            s.nCheckedBlocks -= statsLogged.nCheckedBlocks;
+            s.nCheckMicros -= statsLogged.nCheckMicros;
+            s.nAcceptedBlocks -= statsLogged.nAcceptedBlocks;
+            s.nAcceptMicros -= statsLogged.nAcceptMicros;
+            s.nAcceptStallMicros -= statsLogged.nAcceptStallMicros;
+            s.nElapsedMicros -= statsLogged.nElapsedMicros;
+        }
+        statsLogged = total;
+    }
+    if (s.nElapsedMicros <= 0)
+        return;
+
+    // Percentages are of the wall clock time of the stage's threads: a stage
+    // near 100% busy while the others stall is the bottleneck.
+    const double nSeconds = s.nElapsedMicros * 0.000001;
+    const double nReaderMicros = (double)s.nElapsedMicros * nReaders;
+    LogPrintf("Block import%s: read %u blocks (%.1fMB/s, %.0f%% busy, %.0f%% waiting for buffer space), "
+              "checked %u (%.1f blocks/s, %.2f threads busy), accepted %u (%.1f blocks/s, %.0f%% busy, %.0f%% waiting for blocks)\n",
+        fTotal ? "" : " progress",
+        s.nReadBlocks, s.nReadBytes / nSeconds / 1000000, 100.0 * s.nReadMicros / nReaderMicros, 100.0 * s.nReadStallMicros / nReaderMicros,
+        s.nCheckedBlocks, s.nCheckedBlocks / nSeconds, (double)s.nCheckMicros / s.nElapsedMicros,
+        s.nAcceptedBlocks, s.nAcceptedBlocks / nSeconds, 100.0 * s.nAcceptMicros / s.nElapsedMicros, 100.0 * s.nAcceptStallMicros / s.nElapsedMicros);
+}
@@ -0,0 +1,152 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FABCOIN_BLOCKIMPORT_H
+#define FABCOIN_BLOCKIMPORT_H
+
+#include "chain.h"
+#include "fs.h"
+#include "streams.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CBlock;
+class CChainParams;
+
+/** Default for -importthreads, the number of threads deserializing and checking blocks during -reindex and -loadblock (0 = one per core) */
+static const int DEFAULT_IMPORT_CHECK_THREADS = 0;
+/** Maximum for -importthreads */
+static const int MAX_IMPORT_CHECK_THREADS = 16;
+/** Default for -importreadahead, the number of block files read at the same time */
+static const int DEFAULT_IMPORT_READAHEAD_FILES = 2;
+/** Maximum for -importreadahead */
+static const int MAX_IMPORT_READAHEAD_FILES = 8;
+/** Bytes of blocks read but not accepted yet above which readers wait */
+static const uint64_t IMPORT_BUFFER_SIZE = 64 * 1024 * 1024;
+
+/** A file of serialized blocks to import: a blk?????.dat when reindexing, or a -loadblock file */
+struct CBlockImportFile
+{
+    fs::path path;
+    int nFile; //!< Number of the blk?????.dat, or -1 for a file outside the block directory
+
+    CBlockImportFile(const fs::path& pathIn, int nFileIn) : path(pathIn), nFile(nFileIn) {}
+};
+
+/** Throughput of the stages of a CBlockImporter */
+struct CBlockImportStats
+{
+    uint64_t nReadBlocks = 0;
+    uint64_t nReadBytes = 0;
+    int64_t nReadMicros = 0;        //!< Time readers spent reading, summed over readers
+    int64_t nReadStallMicros = 0;   //!< Time readers waited for buffer space
+    uint64_t nCheckedBlocks = 0;
+    int64_t nCheckMicros = 0;       //!< Time spent deserializing and checking, summed over threads
+    uint64_t nAcceptedBlocks = 0;
+    int64_t nAcceptMicros = 0;      //!< Time the caller spent between NextBlock() calls
+    int64_t nAcceptStallMicros = 0; //!< Time NextBlock() waited for a block to be read or checked
+    int64_t nElapsedMicros = 0;
+};
+
+/**
+ * Reads, deserializes and checks the blocks in a list of files on a pipeline
+ * of threads, and hands them out in file order.
+ *
+ * A few reader threads each take the next file and scan it for blocks the way
+ * LoadExternalBlockFile does, buffering the raw records; they run ahead of the
+ * caller by up to IMPORT_BUFFER_SIZE bytes and into following files. A pool
+ * of check threads deserializes the records and runs CheckBlock on them,
+ * which includes the Equihash verification, so blocks that pass are marked
+ * fChecked and AcceptBlock does not check them again. The caller accepts the
+ * blocks one at a time through NextBlock(), which helps with the check of the
+ * block it needs if no thread has taken it yet.
+ *
+ * Readers assume a record is exactly as long as the size in front of it. When
+ * a record does not deserialize, or deserializes from fewer bytes, the
+ * caller has to scan the rest of that file again from GetResumePos() on its
+ * own, as the file's following records may be off.
+ */
+class CBlockImporter
+{
+public:
+    struct Item
+    {
+        std::shared_ptr<CBlock> pblock; //!< Null if the record did not deserialize
+        CDiskBlockPos pos;              //!< Position of the block data in the file
+        uint64_t nMagicPos = 0;         //!< Position of the message start in front of it
+        unsigned int nSize = 0;         //!< Size of the record
+        uint64_t nConsumed = 0;         //!< Bytes the block deserialized from
+        CDataStream ssRaw;              //!< The record, until it is deserialized
+        enum { QUEUED, CHECKING, DONE } state = QUEUED;
+
+        Item();
+
+        //! Whether the rest of the file has to be scanned again after this record
+        bool NeedsRescan() const { return !pblock || nConsumed != nSize; }
+        //! Where that scan starts, as LoadExternalBlockFile would continue
+        uint64_t GetResumePos() const { return pblock ? pos.nPos + nConsumed : nMagicPos + 1; }
+    };
+
+    CBlockImporter(const CChainParams& chainparams, const std::vector<CBlockImportFile>& files, int nCheckThreads, int nReaders);
+    ~CBlockImporter();
+
+    /**
+     * Wait for the next block of file nIndex. Returns false once all of the
+     * file's blocks were handed out, or if it could not be opened. Files have
+     * to be taken in order.
+     */
+    bool NextBlock(size_t nIndex, Item& item);
+    //! Drop what is left of file nIndex and stop reading it
+    void SkipFile(size_t nIndex);
+    //! Whether file nIndex could not be opened; valid once NextBlock returned false for it
+    bool OpenFailed(size_t nIndex) const;
+
+    CBlockImportStats GetStats() const;
+    //! Log the throughput of each stage, either the total or since the last call
+    void LogStats(bool fTotal);
+
+private:
+    struct File
+    {
+        std::deque<std::shared_ptr<Item>> items;
+        bool fDone = false;
+        bool fOpenFailed = false;
+        bool fSkip = false;
+    };
+
+    const CChainParams& chainparams;
+    const std::vector<CBlockImportFile> vFiles;
+    const int nReaders;
+
+    mutable std::mutex mutex;
+    std::condition_variable condRead;  //!< Buffer space freed, or stopping
+    std::condition_variable condCheck; //!< Record queued for checking, or stopping
+    std::condition_variable condReady; //!< Block checked or file finished
+    std::vector<File> vFileState;
+    std::deque<std::shared_ptr<Item>> queueCheck;
+    size_t nNextFile;
+    size_t nHeadFile; //!< The file the caller is at, whose reader never waits for buffer space
+    uint64_t nBuffered;
+    bool fStop;
+
+    CBlockImportStats stats;
+    CBlockImportStats statsLogged;
+    int64_t nStartTime;
+    int64_t nLastReturn;
+    int64_t nLastLog;
+
+    std::vector<std::thread> vThreads;
+
+    void ThreadRead();
+    void ThreadCheck();
+    void ReadFile(size_t nIndex);
+    void Check(Item& item);
+};
+
+#endif // FABCOIN_BLOCKIMPORT_H
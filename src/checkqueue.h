@@ -8,6 +8,11 @@
 #include "sync.h"
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -16,7 +21,7 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,12 +30,43 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has a deque of its own, and the master hands each batch to
+  * the next worker's deque in turn, so workers mostly take work from their
+  * own deque without contending with each other. A worker whose deque is
+  * empty steals half of another one's. Out of work, workers spin for a bit
+  * before they sleep, as the next batch is often only microseconds away.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! Deques, of which the first belongs to the master
+    static const int MAX_SLOTS = 128;
+    //! Times an idle thread looks for work before it sleeps
+    static const int SPIN_ROUNDS = 256;
+
+    struct Slot
+    {
+        std::mutex mutex;
+        std::deque<T> queue;
+        //! Size of queue, to look for work without locking
+        std::atomic<size_t> nSize{0};
+        //! Whether a worker owns this deque
+        std::atomic<bool> fActive{false};
+        //! Keep slots on separate cache lines
+        char padding[64];
+    };
+
+    std::vector<Slot> slots;
+
+    //! Slots that were ever handed to a worker, plus the master's
+    std::atomic<int> nSlotsUsed;
+
+    //! Worker whose deque gets the next batch
+    int nNextSlot;
+
+    //! Mutex to protect sleeping and slot assignment
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,125 +75,263 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Number of workers sleeping on condWorker
+    std::atomic<int> nParked;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Number of verifications in the deques, not taken by any thread yet
+    std::atomic<int64_t> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<int64_t> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Runs a batch of checks all at once, if set
+    std::function<bool(std::vector<T>&)> runBatch;
+
+    /** Move checks from one end of a slot's deque into vChecks, at most nBatchSize. */
+    bool TakeFrom(Slot& slot, std::vector<T>& vChecks, bool fSteal)
+    {
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        const size_t nSize = slot.queue.size();
+        if (nSize == 0)
+            return false;
+        // The owner leaves half for others to steal, thieves take half.
+        const size_t nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, fSteal ? (nSize + 1) / 2 : nSize / 2));
+        vChecks.resize(nNow);
+        for (size_t i = 0; i < nNow; i++) {
+            // The owner works from the back and thieves from the front,
+            // swapping rather than copying to keep the lock short.
+            if (fSteal) {
+                vChecks[i].swap(slot.queue.front());
+                slot.queue.pop_front();
+            } else {
+                vChecks[i].swap(slot.queue.back());
+                slot.queue.pop_back();
+            }
+        }
+        slot.nSize = slot.queue.size();
+        nQueued -= nNow;
+        return true;
+    }
+
+    /** Take checks from our own deque, or steal them from another. */
+    bool Take(int nSlot, std::vector<T>& vChecks)
+    {
+        if (nSlot >= 0 && TakeFrom(slots[nSlot], vChecks, false))
+            return true;
+        const int nSlots = nSlotsUsed;
+        for (int i = 1; i <= nSlots; i++) {
+            Slot& victim = slots[(std::max(nSlot, 0) + i) % nSlots];
+            if (victim.nSize > 0 && TakeFrom(victim, vChecks, true))
+                return true;
+        }
+        return false;
+    }
+
+    /** Run a batch, and report it as done once the checks are destroyed. */
+    void Run(std::vector<T>& vChecks)
+    {
+        bool fOk = fAllOk;
+        if (fOk && runBatch) {
+            fOk = runBatch(vChecks);
+        } else {
+            for (T& check : vChecks)
+                if (fOk)
+                    fOk = check();
+        }
+        if (!fOk)
+            fAllOk = false;
+        const int64_t nNow = vChecks.size();
+        vChecks.clear();
+        if (nTodo.fetch_sub(nNow) == nNow) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::lock_guard<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+    /** Hand a worker's deque back, passing on what is left in it. */
+    void ReleaseSlot(int nSlot)
+    {
+        std::vector<T> vLeft;
+        {
+            std::lock_guard<std::mutex> lock(slots[nSlot].mutex);
+            slots[nSlot].fActive = false;
+            vLeft.resize(slots[nSlot].queue.size());
+            for (size_t i = 0; i < vLeft.size(); i++)
+                vLeft[i].swap(slots[nSlot].queue[i]);
+            slots[nSlot].queue.clear();
+            slots[nSlot].nSize = 0;
+        }
+        if (!vLeft.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(slots[0].mutex);
+                for (T& check : vLeft) {
+                    slots[0].queue.push_back(T());
+                    check.swap(slots[0].queue.back());
+                }
+                slots[0].nSize = slots[0].queue.size();
+            }
+            boost::lock_guard<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+            condWorker.notify_all();
+        }
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    void Loop(int nSlot, bool fMaster)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+        int nSpins = 0;
+        while (true) {
+            if (fMaster && nTodo == 0)
+                return;
+            if (Take(nSlot, vChecks)) {
+                Run(vChecks);
+                nSpins = 0;
+                continue;
+            }
+            if (++nSpins < SPIN_ROUNDS) {
+                std::this_thread::yield();
+                continue;
+            }
+            nSpins = 0;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                while (nTodo != 0 && nQueued == 0)
+                    condMaster.wait(lock);
+            } else {
+                nParked++;
+                try {
+                    while (nQueued == 0)
+                        condWorker.wait(lock); // wait
+                } catch (...) {
+                    // Interrupted while waiting for work
+                    nParked--;
+                    throw;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nParked--;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
+    }
+
+    //! Hands a worker thread a deque of its own for as long as it runs
+    class SlotGuard
+    {
+    private:
+        CCheckQueue& queue;
+
+    public:
+        const int nSlot;
+
+        explicit SlotGuard(CCheckQueue& queueIn) : queue(queueIn), nSlot(queueIn.ClaimSlot()) {}
+        ~SlotGuard()
+        {
+            if (nSlot > 0)
+                queue.ReleaseSlot(nSlot);
+        }
+    };
+
+    /** Find a deque for a new worker, or -1 if all are taken and it can only steal. */
+    int ClaimSlot()
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        const int nSlots = nSlotsUsed;
+        for (int i = 1; i < nSlots; i++) {
+            if (!slots[i].fActive) {
+                slots[i].fActive = true;
+                return i;
+            }
+        }
+        if (nSlots == MAX_SLOTS)
+            return -1;
+        slots[nSlots].fActive = true;
+        nSlotsUsed = nSlots + 1;
+        return nSlots;
     }
 
 public:
     //! Mutex to ensure only one concurrent CCheckQueueControl
     boost::mutex ControlMutex;
 
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    /**
+     * Create a new check queue. If runBatchIn is given, it runs the batches
+     * the threads take instead of running their checks one by one, returning
+     * whether all of them pass.
+     */
+    CCheckQueue(unsigned int nBatchSizeIn, std::function<bool(std::vector<T>&)> runBatchIn = nullptr) :
+        slots(MAX_SLOTS), nSlotsUsed(1), nNextSlot(0), nParked(0), nQueued(0), nTodo(0), fAllOk(true), nBatchSize(nBatchSizeIn), runBatch(runBatchIn)
+    {
+        slots[0].fActive = true;
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        SlotGuard guard(*this);
+        Loop(guard.nSlot, false);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        Loop(0, true);
+        // reset the status for new work later
+        return fAllOk.exchange(true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        nQueued += vChecks.size();
+
+        // Split the batch over the workers' deques, taking each one's lock
+        // once. Without workers, it all goes to the master.
+        const int nSlots = nSlotsUsed;
+        const size_t nWorkers = std::max(1, nSlots - 1);
+        const size_t nChunk = (vChecks.size() + nWorkers - 1) / nWorkers;
+        size_t nPos = 0;
+        int nInactive = 0;
+        while (nPos < vChecks.size()) {
+            Slot* pslot = &slots[0];
+            if (nInactive < nSlots - 1) {
+                nNextSlot = nNextSlot % (nSlots - 1) + 1;
+                pslot = &slots[nNextSlot];
+            }
+            std::lock_guard<std::mutex> lock(pslot->mutex);
+            if (!pslot->fActive) {
+                // Its worker exited.
+                nInactive++;
+                continue;
+            }
+            const size_t nEnd = std::min(nPos + nChunk, vChecks.size());
+            for (; nPos < nEnd; nPos++) {
+                pslot->queue.push_back(T());
+                vChecks[nPos].swap(pslot->queue.back());
+            }
+            pslot->nSize = pslot->queue.size();
+        }
+
+        if (nParked > 0) {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
@@ -166,7 +340,7 @@ public:
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -7,6 +7,8 @@
 #include "consensus/consensus.h"
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
+#include "version.h"
 
 #include <assert.h>
 
@@ -34,7 +36,8 @@ size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn),
+    cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource), cachedCoinsUsage(0), nFlushGeneration(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -57,6 +60,13 @@ CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const
     return ret;
 }
 
+void CCoinsViewCache::AddPrefetchedCoin(const COutPoint& outpoint, Coin&& coin) {
+    assert(!coin.IsSpent());
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (ret.second)
+        cachedCoinsUsage += ret.first->second.coin.DynamicMemoryUsage();
+}
+
 bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
@@ -202,12 +212,56 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 }
 
 bool CCoinsViewCache::Flush() {
+    nFlushGeneration++;
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
     return fOk;
 }
 
+uint256 CCoinsViewCache::ExtractDirty(CCoinsMap& mapDirty, size_t nMaxCleanUsage)
+{
+    assert(mapDirty.empty());
+    nFlushGeneration++;
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            ++it;
+            continue;
+        }
+        CCoinsCacheEntry& entry = mapDirty[it->first];
+        entry.flags = CCoinsCacheEntry::DIRTY;
+        if (it->second.coin.IsSpent() || nMaxCleanUsage == 0) {
+            // Nothing to keep warm.
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            entry.coin = std::move(it->second.coin);
+            cacheCoins.erase(it++);
+        } else {
+            // Once the base view has it, the cached copy is no longer FRESH.
+            entry.coin = it->second.coin;
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    if (DynamicMemoryUsage() > nMaxCleanUsage) {
+        cacheCoins.clear();
+        cachedCoinsUsage = 0;
+        ReallocateCache();
+    }
+    return GetBestBlock();
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    // The pool never returns chunks on its own; start over with a fresh
+    // resource so the memory of the flushed entries goes back to the system.
+    assert(cacheCoins.empty());
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource);
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -258,3 +312,53 @@ const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
     }
     return coinEmpty;
 }
+
+/** Size gettxoutsetinfo has always reported for a coin, as "bogosize" */
+static int64_t GetBogoSize(const Coin& coin)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + coin.out.scriptPubKey.size() /* scriptPubKey */;
+}
+
+static CDataStream SerializeForDigest(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    return ss;
+}
+
+void CCoinsSetDigest::Insert(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = SerializeForDigest(outpoint, coin);
+    muhash.Insert((const unsigned char*)ss.data(), ss.size());
+    nTransactionOutputs++;
+    nBogoSize += GetBogoSize(coin);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CCoinsSetDigest::Remove(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss = SerializeForDigest(outpoint, coin);
+    muhash.Remove((const unsigned char*)ss.data(), ss.size());
+    nTransactionOutputs--;
+    nBogoSize -= GetBogoSize(coin);
+    nTotalAmount -= coin.out.nValue;
+}
+
+void CCoinsSetDigest::Apply(const CCoinsSetDigest& delta)
+{
+    muhash *= delta.muhash;
+    nTransactionOutputs += delta.nTransactionOutputs;
+    nBogoSize += delta.nBogoSize;
+    nTotalAmount += delta.nTotalAmount;
+}
+
+uint256 CCoinsSetDigest::GetHash() const
+{
+    MuHash3072 copy(muhash);
+    uint256 hash;
+    copy.Finalize(hash.begin());
+    return hash;
+}
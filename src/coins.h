@@ -9,9 +9,11 @@
 #include "primitives/transaction.h"
 #include "compressor.h"
 #include "core_memusage.h"
+#include "crypto/muhash.h"
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
@@ -119,7 +121,17 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The coins cache allocates its nodes from a PoolResource. The largest block
+ * the pool serves is the entry plus four pointers: the node layout of
+ * std::unordered_map is implementation defined, but the node overhead (next
+ * pointer, sometimes a cached hash) stays well below that everywhere.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                      sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4>
+    CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -206,11 +218,16 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Backs the nodes of cacheCoins; declared first so it outlives the map */
+    mutable CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Bumped whenever modified entries are handed to the base view. */
+    unsigned int nFlushGeneration;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -269,6 +286,27 @@ public:
      */
     void Uncache(const COutPoint &outpoint);
 
+    /**
+     * Move every modified entry into mapDirty (which must be empty) and
+     * return the best block they correspond to, for writing to the base view
+     * by other means than Flush(). Unspent entries stay cached as clean
+     * entries, unless the cache still uses more than nMaxCleanUsage bytes
+     * afterwards, in which case it is emptied (with nMaxCleanUsage 0 the
+     * entries are moved rather than copied).
+     */
+    uint256 ExtractDirty(CCoinsMap& mapDirty, size_t nMaxCleanUsage);
+
+    //! Changes whenever Flush() or ExtractDirty() modify the base view
+    unsigned int GetFlushGeneration() const { return nFlushGeneration; }
+
+    /**
+     * Add an unspent coin read from the base view outside of this cache (e.g.
+     * by another thread), unless the outpoint is already cached. The caller
+     * must make sure the read is current: GetFlushGeneration() has to be the
+     * same as before the read started.
+     */
+    void AddPrefetchedCoin(const COutPoint& outpoint, Coin&& coin);
+
     //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
@@ -291,6 +329,9 @@ public:
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
 
+    //! Replace the (empty) cache and its memory pool with fresh ones
+    void ReallocateCache();
+
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
@@ -311,4 +352,42 @@ void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool
 // lookups to database, so it should be used with care.
 const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
 
+/**
+ * Running summary of a set of coins that is updated one coin at a time: an
+ * order independent MuHash3072 of the coins plus a few totals.
+ *
+ * The same type describes what a block changes; Apply() adds such a delta to
+ * a running summary. hashBlock is the block the summary describes the UTXO
+ * set at, and is left null on deltas.
+ */
+class CCoinsSetDigest
+{
+public:
+    uint256 hashBlock;
+    MuHash3072 muhash;
+    int64_t nTransactionOutputs;
+    int64_t nBogoSize;
+    CAmount nTotalAmount;
+
+    CCoinsSetDigest() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void Insert(const COutPoint& outpoint, const Coin& coin);
+    void Remove(const COutPoint& outpoint, const Coin& coin);
+    void Apply(const CCoinsSetDigest& delta);
+
+    //! Finalize a copy of the MuHash; this takes a modular inversion (milliseconds).
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(muhash);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+    }
+};
+
 #endif // FABCOIN_COINS_H
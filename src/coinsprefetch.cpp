@@ -0,0 +1,197 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "coins.h"
+#include "primitives/block.h"
+#include "util.h"
+
+#include <algorithm>
+#include <set>
+
+/** Lookups a thread claims at once */
+static const size_t PREFETCH_CHUNK_SIZE = 16;
+/** Blocks whose lookups are kept around until they are warmed */
+static const size_t MAX_PENDING_BATCHES = 2 * PREFETCH_BLOCKS_AHEAD + 16;
+
+CCoinsPrefetcher::Batch::Batch(const CBlock& block, const CCoinsViewCache& cache) :
+    hashBlock(block.GetHash()), nFlushGeneration(cache.GetFlushGeneration()), nNext(0), nDone(0), fCancelled(false)
+{
+    // Outputs created by the block itself are not in the base view yet.
+    std::set<uint256> setBlockTxids;
+    for (const auto& tx : block.vtx)
+        setBlockTxids.insert(tx->GetHash());
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash))
+                vOutPoints.push_back(txin.prevout);
+        }
+    }
+    vCoins.resize(vOutPoints.size());
+    vFound.resize(vOutPoints.size(), 0);
+}
+
+CCoinsPrefetcher::CCoinsPrefetcher(CCoinsView* baseIn) : base(baseIn), fStop(false) {}
+
+CCoinsPrefetcher::~CCoinsPrefetcher()
+{
+    Stop();
+}
+
+void CCoinsPrefetcher::Start(int nThreads)
+{
+    assert(vThreads.empty());
+    fStop = false;
+    for (int i = 0; i < nThreads; i++)
+        vThreads.emplace_back(&CCoinsPrefetcher::ThreadFetch, this);
+}
+
+void CCoinsPrefetcher::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fStop = true;
+    }
+    condWork.notify_all();
+    for (std::thread& thread : vThreads)
+        thread.join();
+    vThreads.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& batch : vPending)
+        batch->fCancelled = true;
+    queueWork.clear();
+    vPending.clear();
+}
+
+bool CCoinsPrefetcher::FetchChunk(Batch& batch)
+{
+    const size_t nSize = batch.vOutPoints.size();
+    const size_t nBegin = batch.nNext.fetch_add(PREFETCH_CHUNK_SIZE);
+    if (nBegin >= nSize)
+        return false;
+    const size_t nEnd = std::min(nBegin + PREFETCH_CHUNK_SIZE, nSize);
+    for (size_t i = nBegin; i < nEnd; i++) {
+        // A cancelled batch still counts its lookups as done, so nobody
+        // waiting for it gets stuck.
+        if (!batch.fCancelled)
+            batch.vFound[i] = base->GetCoin(batch.vOutPoints[i], batch.vCoins[i]);
+    }
+    if (batch.nDone.fetch_add(nEnd - nBegin) + (nEnd - nBegin) == nSize) {
+        std::lock_guard<std::mutex> lock(mutex);
+        condDone.notify_all();
+    }
+    return true;
+}
+
+void CCoinsPrefetcher::ThreadFetch()
+{
+    RenameThread("fabcoin-prefetch");
+    while (true) {
+        std::shared_ptr<Batch> batch;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condWork.wait(lock, [this] { return fStop || !queueWork.empty(); });
+            if (fStop)
+                return;
+            batch = queueWork.front();
+        }
+        if (!FetchChunk(*batch)) {
+            // Everything is claimed; move on to the next block.
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!queueWork.empty() && queueWork.front() == batch)
+                queueWork.pop_front();
+        }
+    }
+}
+
+void CCoinsPrefetcher::Prefetch(const std::shared_ptr<const CBlock>& pblock, const CCoinsViewCache& cache)
+{
+    const uint256 hash = pblock->GetHash();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (vThreads.empty())
+            return;
+        for (const auto& pending : vPending) {
+            if (pending->hashBlock == hash)
+                return;
+        }
+    }
+    std::shared_ptr<Batch> batch = std::make_shared<Batch>(*pblock, cache);
+    batch->pblock = pblock;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (vPending.size() >= MAX_PENDING_BATCHES) {
+            vPending.front()->fCancelled = true;
+            vPending.pop_front();
+        }
+        vPending.push_back(batch);
+        if (!batch->vOutPoints.empty())
+            queueWork.push_back(batch);
+    }
+    condWork.notify_one();
+}
+
+std::shared_ptr<const CBlock> CCoinsPrefetcher::GetPendingBlock(const uint256& hash) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& pending : vPending) {
+        if (pending->hashBlock == hash)
+            return pending->pblock;
+    }
+    return nullptr;
+}
+
+size_t CCoinsPrefetcher::Warm(const CBlock& block, CCoinsViewCache& cache)
+{
+    const uint256 hash = block.GetHash();
+    std::shared_ptr<Batch> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = vPending.begin(); it != vPending.end(); ++it) {
+            if ((*it)->hashBlock == hash) {
+                batch = *it;
+                vPending.erase(it);
+                break;
+            }
+        }
+    }
+    if (batch && batch->nFlushGeneration != cache.GetFlushGeneration()) {
+        // The cache wrote to its base since these lookups were queued, so
+        // they may be out of date. Start over.
+        LogPrint(BCLog::BENCH, "    - Prefetched inputs of %s are stale, fetching them again\n", hash.ToString());
+        batch->fCancelled = true;
+        batch.reset();
+    }
+    if (!batch) {
+        batch = std::make_shared<Batch>(block, cache);
+        if (batch->vOutPoints.empty())
+            return 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!vThreads.empty())
+                queueWork.push_front(batch);
+        }
+        condWork.notify_all();
+    }
+
+    // Help with our own block rather than sitting idle.
+    while (FetchChunk(*batch)) {}
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condDone.wait(lock, [&batch] { return batch->nDone == batch->vOutPoints.size(); });
+    }
+
+    // The cache cannot have flushed meanwhile, the caller holds its lock.
+    size_t nAdded = 0;
+    for (size_t i = 0; i < batch->vOutPoints.size(); i++) {
+        if (batch->vFound[i] && !batch->vCoins[i].IsSpent()) {
+            cache.AddPrefetchedCoin(batch->vOutPoints[i], std::move(batch->vCoins[i]));
+            nAdded++;
+        }
+    }
+    return nAdded;
+}
@@ -0,0 +1,100 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FABCOIN_COINSPREFETCH_H
+#define FABCOIN_COINSPREFETCH_H
+
+#include "coins.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CBlock;
+
+/** Default for -prefetchthreads, the number of threads looking up block inputs ahead of ConnectBlock */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum for -prefetchthreads */
+static const int MAX_PREFETCH_THREADS = 16;
+/** How many blocks ahead of the tip ActivateBestChain hands to the prefetcher */
+static const int PREFETCH_BLOCKS_AHEAD = 8;
+
+/**
+ * Looks up the coins spent by a block in parallel, before the block gets
+ * connected.
+ *
+ * ConnectBlock fetches its inputs one at a time, and with a cold cache every
+ * miss is a random database read on the validation thread. Blocks handed to
+ * Prefetch() have their inputs read from the base view by a few worker
+ * threads meanwhile; Warm() then waits for the block's lookups and adds what
+ * was found to the cache, so ConnectBlock finds its inputs in memory.
+ *
+ * The base view must be safe to read from several threads while its owner
+ * writes to it (CCoinsViewDB and CCoinsViewBackgroundFlush are). Lookups are
+ * thrown away if the cache flushed to its base while they ran, as they may
+ * predate that write.
+ *
+ * Prefetch() and Warm() must be called with the cache's lock (cs_main) held.
+ */
+class CCoinsPrefetcher
+{
+public:
+    explicit CCoinsPrefetcher(CCoinsView* baseIn);
+    ~CCoinsPrefetcher();
+
+    void Start(int nThreads);
+    void Stop();
+
+    /**
+     * Queue lookups of the inputs of pblock for cache. Does nothing if the
+     * block is already queued. If too many blocks are pending, the oldest
+     * one is forgotten.
+     */
+    void Prefetch(const std::shared_ptr<const CBlock>& pblock, const CCoinsViewCache& cache);
+
+    //! A block passed to Prefetch() that has not been warmed yet, if any
+    std::shared_ptr<const CBlock> GetPendingBlock(const uint256& hash) const;
+
+    /**
+     * Make sure the inputs of block are in cache, helping with (and queueing,
+     * if needed) their lookups. Returns the number of coins added.
+     */
+    size_t Warm(const CBlock& block, CCoinsViewCache& cache);
+
+private:
+    struct Batch
+    {
+        uint256 hashBlock;
+        std::shared_ptr<const CBlock> pblock;
+        unsigned int nFlushGeneration;
+        std::vector<COutPoint> vOutPoints;
+        std::vector<Coin> vCoins;
+        std::vector<char> vFound;
+        std::atomic<size_t> nNext;
+        std::atomic<size_t> nDone;
+        std::atomic<bool> fCancelled;
+
+        Batch(const CBlock& block, const CCoinsViewCache& cache);
+    };
+
+    CCoinsView* base;
+    std::vector<std::thread> vThreads;
+
+    mutable std::mutex mutex;
+    std::condition_variable condWork;
+    std::condition_variable condDone;
+    std::deque<std::shared_ptr<Batch>> queueWork;  //!< Batches with lookups left to claim
+    std::deque<std::shared_ptr<Batch>> vPending;   //!< Batches not warmed yet, oldest first
+    bool fStop;
+
+    void ThreadFetch();
+    bool FetchChunk(Batch& batch);
+};
+
+#endif // FABCOIN_COINSPREFETCH_H
@@ -0,0 +1,208 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/chacha20.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <limits>
+
+namespace {
+
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+
+/** 2^3072 - 1103717 is the largest 3072-bit safe prime */
+const limb_t MAX_PRIME_DIFF = 1103717;
+const limb_t LIMB_MAX = std::numeric_limits<limb_t>::max();
+
+limb_t ReadLimb(const unsigned char* data)
+{
+    return Num3072::LIMB_SIZE == 64 ? (limb_t)ReadLE64(data) : (limb_t)ReadLE32(data);
+}
+
+void WriteLimb(unsigned char* data, limb_t limb)
+{
+    if (Num3072::LIMB_SIZE == 64) {
+        WriteLE64(data, (uint64_t)limb);
+    } else {
+        WriteLE32(data, (uint32_t)limb);
+    }
+}
+
+/** [c0,c1,c2] += a * b */
+inline void MulAdd3(limb_t& c0, limb_t& c1, limb_t& c2, limb_t a, limb_t b)
+{
+    const double_limb_t t = (double_limb_t)a * b;
+    limb_t th = (limb_t)(t >> Num3072::LIMB_SIZE);
+    const limb_t tl = (limb_t)t;
+    c0 += tl;
+    th += (c0 < tl);
+    c1 += th;
+    c2 += (c1 < th);
+}
+
+} // namespace
+
+Num3072::Num3072()
+{
+    SetToOne();
+}
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLimb(data + i * (LIMB_SIZE / 8));
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) {
+        limbs[i] = 0;
+    }
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLimb(out + i * (LIMB_SIZE / 8), limbs[i]);
+    }
+}
+
+/** Whether the value is at least the modulus (it is always below 2^3072) */
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= LIMB_MAX - MAX_PRIME_DIFF) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != LIMB_MAX) return false;
+    }
+    return true;
+}
+
+/** Subtract the modulus, which is adding MAX_PRIME_DIFF modulo 2^3072 */
+void Num3072::FullReduce()
+{
+    double_limb_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += limbs[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Product into 6144 bits, one column at a time so the multiplications of
+    // a column do not wait on each other's carries. a may be *this.
+    limb_t tmp[2 * LIMBS];
+    limb_t c0 = 0, c1 = 0, c2 = 0;
+    for (int k = 0; k < 2 * LIMBS - 1; ++k) {
+        const int i_min = k < LIMBS ? 0 : k - LIMBS + 1;
+        const int i_max = k < LIMBS ? k : LIMBS - 1;
+        for (int i = i_min; i <= i_max; ++i) {
+            MulAdd3(c0, c1, c2, limbs[i], a.limbs[k - i]);
+        }
+        tmp[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    tmp[2 * LIMBS - 1] = c0;
+
+    // As 2^3072 == MAX_PRIME_DIFF (mod p), fold the high half onto the low
+    // half. This leaves a carry of at most 22 bits above 2^3072, which gets
+    // folded once more.
+    double_limb_t c = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += (double_limb_t)tmp[LIMBS + i] * MAX_PRIME_DIFF + tmp[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+    c *= MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += limbs[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+    if (c) {
+        // Wrapped past 2^3072, so the value is now tiny and this cannot
+        // carry out again.
+        c = MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && c; ++i) {
+            c += limbs[i];
+            limbs[i] = (limb_t)c;
+            c >>= LIMB_SIZE;
+        }
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+/** Compute the inverse as this^(p - 2) (Fermat). Slow: about 6000 multiplications. */
+Num3072 Num3072::GetInverse() const
+{
+    Num3072 out;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        // p - 2 = 2^3072 - (MAX_PRIME_DIFF + 2): all ones except the lowest limb.
+        const limb_t e = i == 0 ? (limb_t)(0 - (MAX_PRIME_DIFF + 2)) : LIMB_MAX;
+        for (int bit = LIMB_SIZE - 1; bit >= 0; --bit) {
+            out.Multiply(out);
+            if ((e >> bit) & 1) out.Multiply(*this);
+        }
+    }
+    return out;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    unsigned char tmp[Num3072::BYTE_SIZE];
+    ChaCha20(key, sizeof(key)).Output(tmp, sizeof(tmp));
+    return Num3072(tmp);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[OUTPUT_SIZE])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
@@ -31,4 +31,11 @@ public:
  */
 std::string SHA256AutoDetect();
 
+/** Compute the double-SHA256 of a number of 64-byte inputs, such as pairs of
+ *  hashes in a Merkle tree, several at a time where the CPU allows.
+ *  output: blocks * 32 bytes, which may start at input
+ *  input:  blocks * 64 bytes
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // FABCOIN_CRYPTO_SHA256_H
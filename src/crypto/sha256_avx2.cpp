@@ -0,0 +1,192 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Double-SHA256 of eight 64-byte inputs at once, one in each 32-bit lane of
+// the AVX2 registers.
+
+#include "crypto/common.h"
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace sha256d64_avx2 {
+namespace {
+
+static const uint32_t K256[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t INIT[] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+uint32_t inline sigma0(uint32_t x) { return (x >> 7 | x << 25) ^ (x >> 18 | x << 14) ^ (x >> 3); }
+uint32_t inline sigma1(uint32_t x) { return (x >> 17 | x << 15) ^ (x >> 19 | x << 13) ^ (x >> 10); }
+
+/**
+ * The round constants plus the message schedule of the block that pads a
+ * 64-byte message. Its words are the same for every input, so they do not
+ * have to be computed in the vector registers.
+ */
+struct PaddingSchedule
+{
+    uint32_t kw[64];
+
+    PaddingSchedule()
+    {
+        uint32_t w[64] = {0x80000000ul};
+        w[15] = 512;
+        for (int i = 16; i < 64; i++)
+            w[i] = sigma1(w[i - 2]) + w[i - 7] + sigma0(w[i - 15]) + w[i - 16];
+        for (int i = 0; i < 64; i++)
+            kw[i] = K256[i] + w[i];
+    }
+};
+
+static const PaddingSchedule padding;
+
+__m256i inline Set1(uint32_t x) { return _mm256_set1_epi32(x); }
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z) { return Add(Add(x, y), z); }
+__m256i inline Add(__m256i x, __m256i y, __m256i z, __m256i w) { return Add(Add(x, y), Add(z, w)); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline Xor(__m256i x, __m256i y, __m256i z) { return Xor(Xor(x, y), z); }
+__m256i inline Or(__m256i x, __m256i y) { return _mm256_or_si256(x, y); }
+__m256i inline And(__m256i x, __m256i y) { return _mm256_and_si256(x, y); }
+__m256i inline ShR(__m256i x, int n) { return _mm256_srli_epi32(x, n); }
+__m256i inline ShL(__m256i x, int n) { return _mm256_slli_epi32(x, n); }
+
+__m256i inline Ch(__m256i x, __m256i y, __m256i z) { return Xor(z, And(x, Xor(y, z))); }
+__m256i inline Maj(__m256i x, __m256i y, __m256i z) { return Or(And(x, y), And(z, Or(x, y))); }
+__m256i inline Sigma0(__m256i x) { return Xor(Or(ShR(x, 2), ShL(x, 30)), Or(ShR(x, 13), ShL(x, 19)), Or(ShR(x, 22), ShL(x, 10))); }
+__m256i inline Sigma1(__m256i x) { return Xor(Or(ShR(x, 6), ShL(x, 26)), Or(ShR(x, 11), ShL(x, 21)), Or(ShR(x, 25), ShL(x, 7))); }
+__m256i inline sigma0(__m256i x) { return Xor(Or(ShR(x, 7), ShL(x, 25)), Or(ShR(x, 18), ShL(x, 14)), ShR(x, 3)); }
+__m256i inline sigma1(__m256i x) { return Xor(Or(ShR(x, 17), ShL(x, 15)), Or(ShR(x, 19), ShL(x, 13)), ShR(x, 10)); }
+
+/** One round of SHA-256, kw being the round constant plus the message word. */
+void inline Round(__m256i a, __m256i b, __m256i c, __m256i& d, __m256i e, __m256i f, __m256i g, __m256i& h, __m256i kw)
+{
+    __m256i t1 = Add(h, Sigma1(e), Ch(e, f, g), kw);
+    __m256i t2 = Add(Sigma0(a), Maj(a, b, c));
+    d = Add(d, t1);
+    h = Add(t1, t2);
+}
+
+void inline Initialize(__m256i* s)
+{
+    for (int i = 0; i < 8; i++)
+        s[i] = Set1(INIT[i]);
+}
+
+/** Eight rounds, rotating the roles of the state words like the scalar code does. */
+template<typename KW>
+void inline Rounds8(__m256i* v, int i, KW kw)
+{
+    Round(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], kw(i + 0));
+    Round(v[7], v[0], v[1], v[2], v[3], v[4], v[5], v[6], kw(i + 1));
+    Round(v[6], v[7], v[0], v[1], v[2], v[3], v[4], v[5], kw(i + 2));
+    Round(v[5], v[6], v[7], v[0], v[1], v[2], v[3], v[4], kw(i + 3));
+    Round(v[4], v[5], v[6], v[7], v[0], v[1], v[2], v[3], kw(i + 4));
+    Round(v[3], v[4], v[5], v[6], v[7], v[0], v[1], v[2], kw(i + 5));
+    Round(v[2], v[3], v[4], v[5], v[6], v[7], v[0], v[1], kw(i + 6));
+    Round(v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[0], kw(i + 7));
+}
+
+/** Transform the states in s with the blocks whose message words are in w. */
+void inline Transform(__m256i* s, __m256i* w)
+{
+    __m256i v[8];
+    for (int i = 0; i < 8; i++)
+        v[i] = s[i];
+    auto kw = [w](int i) {
+        if (i >= 16)
+            w[i & 15] = Add(Add(w[i & 15], sigma1(w[(i + 14) & 15])), Add(w[(i + 9) & 15], sigma0(w[(i + 1) & 15])));
+        return Add(Set1(K256[i]), w[i & 15]);
+    };
+    for (int i = 0; i < 64; i += 8)
+        Rounds8(v, i, kw);
+    for (int i = 0; i < 8; i++)
+        s[i] = Add(s[i], v[i]);
+}
+
+/** Transform the states in s with the block padding a 64-byte message. */
+void inline TransformPadding(__m256i* s)
+{
+    __m256i v[8];
+    for (int i = 0; i < 8; i++)
+        v[i] = s[i];
+    auto kw = [](int i) { return Set1(padding.kw[i]); };
+    for (int i = 0; i < 64; i += 8)
+        Rounds8(v, i, kw);
+    for (int i = 0; i < 8; i++)
+        s[i] = Add(s[i], v[i]);
+}
+
+/** Read the big-endian word at offset of each of the eight 64-byte inputs. */
+__m256i inline Read8(const unsigned char* in, int offset)
+{
+    return _mm256_set_epi32(
+        ReadBE32(in + 448 + offset), ReadBE32(in + 384 + offset), ReadBE32(in + 320 + offset), ReadBE32(in + 256 + offset),
+        ReadBE32(in + 192 + offset), ReadBE32(in + 128 + offset), ReadBE32(in + 64 + offset), ReadBE32(in + 0 + offset));
+}
+
+/** Write the words in v at offset of each of the eight 32-byte outputs. */
+void inline Write8(unsigned char* out, int offset, __m256i v)
+{
+    WriteBE32(out + 0 + offset, _mm256_extract_epi32(v, 0));
+    WriteBE32(out + 32 + offset, _mm256_extract_epi32(v, 1));
+    WriteBE32(out + 64 + offset, _mm256_extract_epi32(v, 2));
+    WriteBE32(out + 96 + offset, _mm256_extract_epi32(v, 3));
+    WriteBE32(out + 128 + offset, _mm256_extract_epi32(v, 4));
+    WriteBE32(out + 160 + offset, _mm256_extract_epi32(v, 5));
+    WriteBE32(out + 192 + offset, _mm256_extract_epi32(v, 6));
+    WriteBE32(out + 224 + offset, _mm256_extract_epi32(v, 7));
+}
+
+} // namespace
+
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    __m256i s[8], w[16];
+
+    // The inputs, then the padding block.
+    Initialize(s);
+    for (int i = 0; i < 16; i++)
+        w[i] = Read8(in, 4 * i);
+    Transform(s, w);
+    TransformPadding(s);
+
+    // The 32-byte hashes and their padding.
+    for (int i = 0; i < 8; i++)
+        w[i] = s[i];
+    w[8] = Set1(0x80000000ul);
+    for (int i = 9; i < 15; i++)
+        w[i] = Set1(0);
+    w[15] = Set1(256);
+    Initialize(s);
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++)
+        Write8(out, 4 * i, s[i]);
+}
+
+} // namespace sha256d64_avx2
+
+#endif
@@ -0,0 +1,203 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// SHA-256 with the Intel SHA Extensions, following the flow of the sample code
+// in Intel's "New Instructions Supporting the Secure Hash Algorithm on Intel
+// Architecture Processors".
+
+#include "crypto/common.h"
+
+#ifdef ENABLE_SHANI
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace {
+
+alignas(__m128i) const uint32_t K256[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+alignas(__m128i) const uint32_t INIT[] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+//! Byte order of the message words
+alignas(__m128i) const uint8_t MASK[16] = {0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04, 0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c};
+
+//! The block padding a 64-byte message
+alignas(__m128i) const unsigned char PADDING_64[64] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0
+};
+
+//! The padding of a 32-byte message, which makes up the second half of its block
+alignas(__m128i) const unsigned char PADDING_32[32] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0
+};
+
+/** Four rounds, with the message words in m. */
+void inline __attribute__((always_inline)) QuadRound(__m128i& state0, __m128i& state1, __m128i m, int i)
+{
+    const __m128i msg = _mm_add_epi32(m, _mm_load_si128((const __m128i*)&K256[4 * i]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+/** First half of computing message words: the sigma0 part. */
+void inline __attribute__((always_inline)) ShiftMessageA(__m128i& m0, __m128i m1)
+{
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+/** Second half: the next four message words, into m2. */
+void inline __attribute__((always_inline)) ShiftMessageC(__m128i& m0, __m128i m1, __m128i& m2)
+{
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)), m1);
+}
+
+void inline __attribute__((always_inline)) ShiftMessageB(__m128i& m0, __m128i m1, __m128i& m2)
+{
+    ShiftMessageC(m0, m1, m2);
+    ShiftMessageA(m0, m1);
+}
+
+/** Turn the state words ABCD, EFGH into the ABEF, CDGH the instructions work on. */
+void inline __attribute__((always_inline)) Shuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0xB1);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0x1B);
+    s0 = _mm_alignr_epi8(t1, t2, 0x08);
+    s1 = _mm_blend_epi16(t2, t1, 0xF0);
+}
+
+/** The reverse of Shuffle. */
+void inline __attribute__((always_inline)) Unshuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0x1B);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0xB1);
+    s0 = _mm_blend_epi16(t1, t2, 0xF0);
+    s1 = _mm_alignr_epi8(t2, t1, 0x08);
+}
+
+__m128i inline __attribute__((always_inline)) Load(const unsigned char* in)
+{
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), _mm_load_si128((const __m128i*)MASK));
+}
+
+void inline __attribute__((always_inline)) Save(unsigned char* out, __m128i s)
+{
+    _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(s, _mm_load_si128((const __m128i*)MASK)));
+}
+
+/**
+ * Transform N states (shuffled) with a block each. The N computations are
+ * independent, so interleaving them hides the latency of the instructions.
+ */
+template<int N>
+void inline __attribute__((always_inline)) TransformBlocks(__m128i* s0, __m128i* s1, const unsigned char* const* chunk)
+{
+    __m128i m0[N], m1[N], m2[N], m3[N], so0[N], so1[N];
+    for (int j = 0; j < N; j++) {
+        so0[j] = s0[j];
+        so1[j] = s1[j];
+        m0[j] = Load(chunk[j]);
+        m1[j] = Load(chunk[j] + 16);
+        m2[j] = Load(chunk[j] + 32);
+        m3[j] = Load(chunk[j] + 48);
+    }
+    for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m0[j], 0);
+    for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m1[j], 1); ShiftMessageA(m0[j], m1[j]); }
+    for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m2[j], 2); ShiftMessageA(m1[j], m2[j]); }
+    for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m3[j], 3); ShiftMessageB(m2[j], m3[j], m0[j]); }
+    for (int i = 4; i < 12; i += 4) {
+        for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m0[j], i + 0); ShiftMessageB(m3[j], m0[j], m1[j]); }
+        for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m1[j], i + 1); ShiftMessageB(m0[j], m1[j], m2[j]); }
+        for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m2[j], i + 2); ShiftMessageB(m1[j], m2[j], m3[j]); }
+        for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m3[j], i + 3); ShiftMessageB(m2[j], m3[j], m0[j]); }
+    }
+    for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m0[j], 12); ShiftMessageB(m3[j], m0[j], m1[j]); }
+    // The last message words need no more sigma0 parts.
+    for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m1[j], 13); ShiftMessageC(m0[j], m1[j], m2[j]); }
+    for (int j = 0; j < N; j++) { QuadRound(s0[j], s1[j], m2[j], 14); ShiftMessageC(m1[j], m2[j], m3[j]); }
+    for (int j = 0; j < N; j++) QuadRound(s0[j], s1[j], m3[j], 15);
+    for (int j = 0; j < N; j++) {
+        s0[j] = _mm_add_epi32(s0[j], so0[j]);
+        s1[j] = _mm_add_epi32(s1[j], so1[j]);
+    }
+}
+
+} // namespace
+
+namespace sha256_shani {
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i s0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i s1 = _mm_loadu_si128((const __m128i*)(s + 4));
+    Shuffle(s0, s1);
+    while (blocks--) {
+        TransformBlocks<1>(&s0, &s1, &chunk);
+        chunk += 64;
+    }
+    Unshuffle(s0, s1);
+    _mm_storeu_si128((__m128i*)s, s0);
+    _mm_storeu_si128((__m128i*)(s + 4), s1);
+}
+}
+
+namespace sha256d64_shani {
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s0[2], s1[2];
+    alignas(__m128i) unsigned char buf[2][64];
+
+    // The inputs, then the padding block.
+    for (int j = 0; j < 2; j++) {
+        s0[j] = _mm_load_si128((const __m128i*)INIT);
+        s1[j] = _mm_load_si128((const __m128i*)(INIT + 4));
+        Shuffle(s0[j], s1[j]);
+    }
+    const unsigned char* chunks[2] = {in, in + 64};
+    TransformBlocks<2>(s0, s1, chunks);
+    const unsigned char* padding[2] = {PADDING_64, PADDING_64};
+    TransformBlocks<2>(s0, s1, padding);
+
+    // The 32-byte hashes and their padding.
+    for (int j = 0; j < 2; j++) {
+        Unshuffle(s0[j], s1[j]);
+        Save(buf[j], s0[j]);
+        Save(buf[j] + 16, s1[j]);
+        memcpy(buf[j] + 32, PADDING_32, 32);
+        s0[j] = _mm_load_si128((const __m128i*)INIT);
+        s1[j] = _mm_load_si128((const __m128i*)(INIT + 4));
+        Shuffle(s0[j], s1[j]);
+    }
+    const unsigned char* hashes[2] = {buf[0], buf[1]};
+    TransformBlocks<2>(s0, s1, hashes);
+
+    for (int j = 0; j < 2; j++) {
+        Unshuffle(s0[j], s1[j]);
+        Save(out + 32 * j, s0[j]);
+        Save(out + 32 * j + 16, s1[j]);
+    }
+}
+}
+
+#endif
@@ -475,6 +475,23 @@ public:
             }
         return false;
     }
+
+    /** get_live appends the elements which are not marked for erasure to out,
+     * so that they can be saved and inserted into a new cache later.
+     * Threadsafe without any concurrent insert or erase.
+     *
+     * Elements of the current epoch come last, so inserting them in order
+     * leaves them in the current epoch again.
+     *
+     * @param out the vector to append the elements to
+     */
+    void get_live(std::vector<Element>& out) const
+    {
+        for (int recent = 0; recent < 2; ++recent)
+            for (uint32_t i = 0; i < size; ++i)
+                if (epoch_flags[i] == (recent != 0) && !collection_flags.bit_is_set(i))
+                    out.push_back(table[i]);
+    }
 };
 } // namespace CuckooCache
 
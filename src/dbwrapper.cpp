@@ -74,14 +74,33 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+DBOptions::DBOptions(size_t nCacheSize) :
+    nBlockCacheSize(nCacheSize / 2),
+    nWriteBufferSize(nCacheSize / 4), // up to two write buffers may be held in memory simultaneously
+    nBloomBits(10),
+    nMaxOpenFiles(64)
+{
+}
+
+DBOptions DBOptions::FromArgs(const std::string& strName, size_t nCacheSize)
+{
+    DBOptions dbOptions(nCacheSize);
+    if (gArgs.IsArgSet("-" + strName + "blockcache"))
+        dbOptions.nBlockCacheSize = std::max<int64_t>(0, gArgs.GetArg("-" + strName + "blockcache", 0)) << 20;
+    if (gArgs.IsArgSet("-" + strName + "writebuffer"))
+        dbOptions.nWriteBufferSize = std::max<int64_t>(1, gArgs.GetArg("-" + strName + "writebuffer", 0)) << 20;
+    dbOptions.nBloomBits = std::max<int64_t>(0, std::min<int64_t>(gArgs.GetArg("-" + strName + "bloombits", dbOptions.nBloomBits), 64));
+    return dbOptions;
+}
+
+static leveldb::Options GetOptions(const DBOptions& dbOptions)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.block_cache = leveldb::NewLRUCache(dbOptions.nBlockCacheSize);
+    options.write_buffer_size = dbOptions.nWriteBufferSize;
+    options.filter_policy = dbOptions.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits) : nullptr;
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
     options.info_log = new CFabcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -91,14 +110,20 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate) :
+    CDBWrapper(path, DBOptions(nCacheSize), fMemory, fWipe, obfuscate)
+{
+}
+
+CDBWrapper::CDBWrapper(const fs::path& path, const DBOptions& dbOptionsIn, bool fMemory, bool fWipe, bool obfuscate) :
+    dbOptions(dbOptionsIn)
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(dbOptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -114,7 +139,8 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    LogPrintf("Opened LevelDB successfully (block cache %.1fMiB, write buffer %.1fMiB, %d bloom bits per key)\n",
+        dbOptions.nBlockCacheSize * (1.0 / 1024 / 1024), dbOptions.nWriteBufferSize * (1.0 / 1024 / 1024), dbOptions.nBloomBits);
 
     if (gArgs.GetBoolArg("-forcecompactdb", false)) {
         LogPrintf("Starting database compaction of %s\n", path.string());
@@ -190,6 +216,45 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
+bool CDBWrapper::GetProperty(const std::string& strName, std::string& strValue) const
+{
+    return pdb->GetProperty(strName, &strValue);
+}
+
+size_t CDBWrapper::GetBlockCacheUsage() const
+{
+    return options.block_cache->TotalCharge();
+}
+
+uint64_t CDBWrapper::EstimatePrefixSize(unsigned char chPrefix) const
+{
+    const char chBegin = chPrefix;
+    const char chEnd = chPrefix + 1;
+    // The range of the last prefix ends at the first key longer than one 0xff
+    leveldb::Range range(leveldb::Slice(&chBegin, 1), chPrefix == 0xff ? leveldb::Slice("\xff\xff", 2) : leveldb::Slice(&chEnd, 1));
+    uint64_t size = 0;
+    pdb->GetApproximateSizes(&range, 1, &size);
+    return size;
+}
+
+std::map<unsigned char, DBPrefixStats> CDBWrapper::GetPrefixStats() const
+{
+    std::map<unsigned char, DBPrefixStats> mapStats;
+    for (unsigned int i = 0; i < prefixCounters.size(); i++) {
+        const PrefixCounters& counters = prefixCounters[i];
+        DBPrefixStats stats;
+        stats.nReads = counters.nReads.load(std::memory_order_relaxed);
+        stats.nReadHits = counters.nReadHits.load(std::memory_order_relaxed);
+        stats.nReadBytes = counters.nReadBytes.load(std::memory_order_relaxed);
+        stats.nWrites = counters.nWrites.load(std::memory_order_relaxed);
+        stats.nWriteBytes = counters.nWriteBytes.load(std::memory_order_relaxed);
+        stats.nErases = counters.nErases.load(std::memory_order_relaxed);
+        if (stats.nReads || stats.nWrites || stats.nErases)
+            mapStats.emplace(i, stats);
+    }
+    return mapStats;
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
@@ -220,4 +285,15 @@ const std::vector<unsigned char>& GetObfuscateKey(const CDBWrapper &w)
     return w.obfuscate_key;
 }
 
+void CountWrite(const CDBWrapper &w, const leveldb::Slice& key, const leveldb::Slice* value)
+{
+    CDBWrapper::PrefixCounters& counters = w.prefixCounters[key.empty() ? 0 : (unsigned char)key[0]];
+    if (value) {
+        counters.nWrites.fetch_add(1, std::memory_order_relaxed);
+        counters.nWriteBytes.fetch_add(key.size() + value->size(), std::memory_order_relaxed);
+    } else {
+        counters.nErases.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
 } // namespace dbwrapper_private
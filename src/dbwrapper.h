@@ -13,6 +13,10 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <array>
+#include <atomic>
+#include <map>
+
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
@@ -25,6 +29,38 @@ public:
     dbwrapper_error(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+/** LevelDB tunables of a CDBWrapper */
+struct DBOptions
+{
+    size_t nBlockCacheSize;  //!< LRU cache of uncompressed table blocks, in bytes
+    size_t nWriteBufferSize; //!< Size of the memtable; up to two may be held in memory at once
+    int nBloomBits;          //!< Bloom filter bits per key, 0 for no filter
+    int nMaxOpenFiles;
+
+    //! Split nCacheSize between the block cache (1/2) and the write buffers (2 * 1/4)
+    explicit DBOptions(size_t nCacheSize);
+
+    /**
+     * The defaults for nCacheSize, overridden by -<strName>blockcache,
+     * -<strName>writebuffer (both in MiB) and -<strName>bloombits.
+     */
+    static DBOptions FromArgs(const std::string& strName, size_t nCacheSize);
+
+    //! Memory the block cache and write buffers can take up at most
+    size_t MemoryUsage() const { return nBlockCacheSize + 2 * nWriteBufferSize; }
+};
+
+/** Use of the keys starting with one prefix byte, as counted by CDBWrapper */
+struct DBPrefixStats
+{
+    uint64_t nReads;      //!< Point lookups (Read and Exists)
+    uint64_t nReadHits;   //!< Point lookups that found a value
+    uint64_t nReadBytes;  //!< Value bytes returned by lookups
+    uint64_t nWrites;     //!< Values queued for writing
+    uint64_t nWriteBytes; //!< Key and value bytes queued for writing
+    uint64_t nErases;     //!< Erasures queued
+};
+
 class CDBWrapper;
 
 /** These should be considered an implementation detail of the specific database.
@@ -41,6 +77,9 @@ void HandleError(const leveldb::Status& status);
  */
 const std::vector<unsigned char>& GetObfuscateKey(const CDBWrapper &w);
 
+/** Account a write of value (an erase if nullptr) to key in w's prefix counters. */
+void CountWrite(const CDBWrapper &w, const leveldb::Slice& key, const leveldb::Slice* value);
+
 };
 
 /** Batch of changes queued to be written to a CDBWrapper */
@@ -82,6 +121,7 @@ public:
         leveldb::Slice slValue(ssValue.data(), ssValue.size());
 
         batch.Put(slKey, slValue);
+        dbwrapper_private::CountWrite(parent, slKey, &slValue);
         // LevelDB serializes writes as:
         // - byte: header
         // - varint: key length (1 byte up to 127B, 2 bytes up to 16383B, ...)
@@ -102,6 +142,7 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         batch.Delete(slKey);
+        dbwrapper_private::CountWrite(parent, slKey, nullptr);
         // LevelDB serializes erases as:
         // - byte: header
         // - varint: key length
@@ -176,6 +217,7 @@ public:
 class CDBWrapper
 {
     friend const std::vector<unsigned char>& dbwrapper_private::GetObfuscateKey(const CDBWrapper &w);
+    friend void dbwrapper_private::CountWrite(const CDBWrapper &w, const leveldb::Slice& key, const leveldb::Slice* value);
 private:
     //! custom environment this database is using (may be nullptr in case of default environment)
     leveldb::Env* penv;
@@ -183,6 +225,9 @@ private:
     //! database options used
     leveldb::Options options;
 
+    //! the tunables options was made from
+    DBOptions dbOptions;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -209,6 +254,29 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    struct PrefixCounters
+    {
+        std::atomic<uint64_t> nReads{0};
+        std::atomic<uint64_t> nReadHits{0};
+        std::atomic<uint64_t> nReadBytes{0};
+        std::atomic<uint64_t> nWrites{0};
+        std::atomic<uint64_t> nWriteBytes{0};
+        std::atomic<uint64_t> nErases{0};
+    };
+
+    //! usage counters, indexed by the first byte of the serialized key
+    mutable std::array<PrefixCounters, 256> prefixCounters;
+
+    void CountRead(const CDataStream& ssKey, bool fFound, size_t nValueSize) const
+    {
+        PrefixCounters& counters = prefixCounters[ssKey.empty() ? 0 : (unsigned char)ssKey[0]];
+        counters.nReads.fetch_add(1, std::memory_order_relaxed);
+        if (fFound) {
+            counters.nReadHits.fetch_add(1, std::memory_order_relaxed);
+            counters.nReadBytes.fetch_add(nValueSize, std::memory_order_relaxed);
+        }
+    }
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -219,6 +287,8 @@ public:
      *                        with a zero'd byte array.
      */
     CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    //! As above, with the tunables given separately
+    CDBWrapper(const fs::path& path, const DBOptions& dbOptionsIn, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -231,6 +301,7 @@ public:
 
         std::string strValue;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        CountRead(ssKey, status.ok(), strValue.size());
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -265,6 +336,7 @@ public:
 
         std::string strValue;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        CountRead(ssKey, status.ok(), strValue.size());
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -306,6 +378,20 @@ public:
      */
     bool IsEmpty();
 
+    const DBOptions& GetDBOptions() const { return dbOptions; }
+
+    //! A LevelDB property such as "leveldb.stats"; see leveldb/db.h
+    bool GetProperty(const std::string& strName, std::string& strValue) const;
+
+    //! Bytes held by the block cache
+    size_t GetBlockCacheUsage() const;
+
+    //! Approximate size on disk of the keys starting with chPrefix
+    uint64_t EstimatePrefixSize(unsigned char chPrefix) const;
+
+    //! Counters of the key prefixes that have been used since opening
+    std::map<unsigned char, DBPrefixStats> GetPrefixStats() const;
+
     template<typename K>
     size_t EstimateSize(const K& key_begin, const K& key_end) const
     {
@@ -43,7 +43,7 @@ void genesis_Scan_nNonce_nSolution(CBlock *pblock, unsigned int n, unsigned int
         std::function<bool(std::vector<unsigned char>) > validBlock =
                 [&pblock, &hashTarget, &cancelSolver](std::vector<unsigned char> solution) {
                     // Write the solution to the hash and compute the result.
-                    pblock->nSolution = solution;
+                    pblock->SetSolution(solution);
                     arith_uint256 hashAttained = UintToArith256(pblock->GetHashBeforeParamInitialization());
                     logBeforeInitialization() << "Checking solution: "  << Miscellaneous::toStringVectorHex(solution) << LoggerSession::endL;
                     logBeforeInitialization() << "hash: target, attained:" << LoggerSession::endL;
@@ -81,6 +81,6 @@ void genesis_Scan_nNonce_nSolution(CBlock *pblock, unsigned int n, unsigned int
             cancelSolver = false;
         }
         // Update nNonce
-        pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
+        pblock->SetNonce(ArithToUint256(UintToArith256(pblock->nNonce) + 1));
     }
 }
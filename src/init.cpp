@@ -11,9 +11,11 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockimport.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinsprefetch.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
 #include "fs.h"
@@ -118,6 +120,7 @@ static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
 
 std::atomic<bool> fRequestShutdown(false);
 std::atomic<bool> fDumpMempoolLater(false);
+static bool fDumpScriptCachesLater = false;
 
 void StartShutdown()
 {
@@ -207,7 +210,12 @@ void Shutdown()
     if (fDumpMempoolLater && gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
         DumpMempool();
     }
+    if (fDumpScriptCachesLater) {
+        DumpScriptCaches();
+    }
 
+    // The scheduler thread has been stopped; apply any further updates inline.
+    ::feeEstimator.SetScheduler(nullptr);
     if (fFeeEstimatesInitialized)
     {
         ::feeEstimator.FlushUnconfirmed(::mempool);
@@ -240,8 +248,12 @@ void Shutdown()
         if (pcoinsTip != nullptr) {
             FlushStateToDisk();
         }
+        delete pcoinsPrefetcher;
+        pcoinsPrefetcher = nullptr;
         delete pcoinsTip;
         pcoinsTip = nullptr;
+        delete pcoinsflusher;
+        pcoinsflusher = nullptr;
         delete pcoinscatcher;
         pcoinscatcher = nullptr;
         delete pcoinsdbview;
@@ -281,6 +293,7 @@ void Shutdown()
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    StopLogWriter();
 }
 
 /**
@@ -349,6 +362,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-compactundo", strprintf(_("Write the undo data of new blocks in a compact format, which older versions cannot read (default: %u)"), DEFAULT_COMPACT_UNDO));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), FABCOIN_CONF_FILENAME));
     if (mode == HMM_FABCOIND)
     {
@@ -359,21 +373,41 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     if (showDebug) {
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
+        strUsage += HelpMessageOpt("-dbbackgroundflush", strprintf("Write the coins cache to disk in the background, except when shutting down or pruning (default: %u)", DEFAULT_DB_BACKGROUND_FLUSH));
+        for (const std::string& strDB : {std::string("chainstatedb"), std::string("blockindexdb")}) {
+            strUsage += HelpMessageOpt("-" + strDB + "blockcache=<n>", strprintf("LevelDB block cache of the %s database in megabytes, taken out of -dbcache (default: half of its share of -dbcache)", strDB));
+            strUsage += HelpMessageOpt("-" + strDB + "writebuffer=<n>", strprintf("LevelDB write buffer of the %s database in megabytes; two may be in use at once, taken out of -dbcache (default: a quarter of its share of -dbcache)", strDB));
+            strUsage += HelpMessageOpt("-" + strDB + "bloombits=<n>", strprintf("Bloom filter bits per key in the tables of the %s database, 0 to disable (default: %u)", strDB, DBOptions(0).nBloomBits));
+        }
     }
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadtxoutset=<file>", _("Fill an empty chain state from a UTXO snapshot written by dumptxoutset, instead of connecting the blocks up to the snapshot. The block files up to its base block must already be present; combine with -reindex-chainstate to replace an existing chain state"));
+    strUsage += HelpMessageOpt("-loadtxoutsethash=<hex>", _("The hash_serialized_2 that gettxoutsetinfo true reports at the base block of the -loadtxoutset snapshot on a node you trust. Required with -loadtxoutset; a snapshot with a different hash is refused"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphansize=<n>", strprintf(_("Keep unconnectable transactions below <n> megabytes (default: %u)"), DEFAULT_MAX_ORPHAN_POOL_SIZE));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     if (showDebug) {
         strUsage += HelpMessageOpt("-minimumchainwork=<hex>", strprintf("Minimum work assumed to exist on a valid chain in hex (default: %s, testnet: %s)", defaultChainParams->GetConsensus().nMinimumChainWork.GetHex(), testnetChainParams->GetConsensus().nMinimumChainWork.GetHex()));
     }
     strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
+    strUsage += HelpMessageOpt("-persistscriptcache", strprintf(_("Whether to save the signature and script execution caches on shutdown and load them on restart (default: %u)"), DEFAULT_PERSIST_SCRIPT_CACHE));
+    if (showDebug) {
+        strUsage += HelpMessageOpt("-trustpersistedmempool", strprintf("Skip script verification when reloading a mempool this node saved on the same chain tip (default: %u)", DEFAULT_TRUST_PERSISTED_MEMPOOL));
+    }
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-batchverify", strprintf(_("Have the script verification threads verify the signatures in blocks in batches (default: %u)"), DEFAULT_BATCH_VERIFY));
+    strUsage += HelpMessageOpt("-importthreads=<n>", strprintf(_("Set the number of threads checking blocks during -reindex and -loadblock (0 to %d, 0 = auto, default: %d)"),
+        MAX_IMPORT_CHECK_THREADS, DEFAULT_IMPORT_CHECK_THREADS));
+    strUsage += HelpMessageOpt("-importreadahead=<n>", strprintf(_("Set the number of block files read at the same time during -reindex and -loadblock (1 to %d, default: %d)"),
+        MAX_IMPORT_READAHEAD_FILES, DEFAULT_IMPORT_READAHEAD_FILES));
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads looking up the inputs of blocks before they are connected (0 to %d, 0 = off, default: %d)"),
+        MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), FABCOIN_PID_FILENAME));
 #endif
@@ -484,6 +518,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), DEFAULT_LOGTIMESTAMPS));
     if (showDebug)
     {
+        strUsage += HelpMessageOpt("-asynclog", strprintf("Write debug.log from a thread of its own, dropping messages if it falls behind. Messages not written out yet are lost if the process aborts or crashes; use -asynclog=0 to debug those (default: %u)", DEFAULT_ASYNCLOG));
         strUsage += HelpMessageOpt("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS));
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
@@ -653,20 +688,23 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
     {
     CImportingNow imp;
 
+    // Blocks are read and checked ahead of being accepted, on these threads
+    int nImportCheckThreads = gArgs.GetArg("-importthreads", DEFAULT_IMPORT_CHECK_THREADS);
+    if (nImportCheckThreads <= 0)
+        nImportCheckThreads = GetNumCores() - 1; // the importing thread checks blocks too
+    nImportCheckThreads = std::max(0, std::min(nImportCheckThreads, MAX_IMPORT_CHECK_THREADS));
+    const int nImportReaders = std::max(1, std::min<int>(gArgs.GetArg("-importreadahead", DEFAULT_IMPORT_READAHEAD_FILES), MAX_IMPORT_READAHEAD_FILES));
+
     // -reindex
     if (fReindex) {
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos, "blk")))
+        std::vector<CBlockImportFile> vFiles;
+        for (int nFile = 0; ; nFile++) {
+            fs::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+            if (!fs::exists(path))
                 break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
+            vFiles.emplace_back(path, nFile);
         }
+        LoadExternalBlockFiles(chainparams, vFiles, nImportCheckThreads, nImportReaders);
         pblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
@@ -689,14 +727,11 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
     }
 
     // -loadblock=
-    for (const fs::path& path : vImportFiles) {
-        FILE *file = fsbridge::fopen(path, "rb");
-        if (file) {
-            LogPrintf("Importing blocks file %s...\n", path.string());
-            LoadExternalBlockFile(chainparams, file);
-        } else {
-            LogPrintf("Warning: Could not open blocks file %s\n", path.string());
-        }
+    if (!vImportFiles.empty()) {
+        std::vector<CBlockImportFile> vFiles;
+        for (const fs::path& path : vImportFiles)
+            vFiles.emplace_back(path, -1);
+        LoadExternalBlockFiles(chainparams, vFiles, nImportCheckThreads, nImportReaders);
     }
 
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
@@ -715,6 +750,7 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
         LoadMempool();
         fDumpMempoolLater = !fRequestShutdown;
     }
+    mempool.SetIsLoaded(!fRequestShutdown);
 }
 
 /** Sanity checks
@@ -1006,6 +1042,8 @@ bool AppInitParameterInteraction()
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fBatchVerify = gArgs.GetBoolArg("-batchverify", DEFAULT_BATCH_VERIFY);
+    fCompactUndo = gArgs.GetBoolArg("-compactundo", DEFAULT_COMPACT_UNDO);
 
     hashAssumeValid = uint256S(gArgs.GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
     if (!hashAssumeValid.IsNull())
@@ -1257,6 +1295,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     if (fPrintToDebugLog) {
         OpenDebugLog("debug.log", fileout, "a");
+        if (gArgs.GetBoolArg("-asynclog", DEFAULT_ASYNCLOG))
+            StartLogWriter();
     }
 
     if (!fLogTimestamps)
@@ -1268,11 +1308,17 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     InitSignatureCache();
     InitScriptExecutionCache();
+    if (gArgs.GetBoolArg("-persistscriptcache", DEFAULT_PERSIST_SCRIPT_CACHE)) {
+        LoadScriptCaches();
+        fDumpScriptCachesLater = true;
+    }
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadBlockTxCheck);
+        }
     }
 
     // Start the lightweight task scheduler thread
@@ -1280,6 +1326,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
     GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+    ::feeEstimator.SetScheduler(&scheduler);
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1417,6 +1464,18 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     fReindex = gArgs.GetBoolArg("-reindex", false);
     bool fReindexChainState = gArgs.GetBoolArg("-reindex-chainstate", false);
+    if (fReindex && gArgs.IsArgSet("-loadtxoutset"))
+        return InitError(_("-loadtxoutset needs the existing block index and cannot be combined with -reindex"));
+    uint256 hashSnapshotExpected;
+    if (gArgs.IsArgSet("-loadtxoutset")) {
+        // The snapshot's own checksum only shows that the file is intact, not
+        // that its coins are the real UTXO set, so the operator has to say
+        // which set to expect.
+        const std::string strSnapshotHash = gArgs.GetArg("-loadtxoutsethash", "");
+        if (strSnapshotHash.size() != 64 || !IsHex(strSnapshotHash))
+            return InitError(_("-loadtxoutset needs -loadtxoutsethash, the hash_serialized_2 of the expected UTXO set"));
+        hashSnapshotExpected = uint256S(strSnapshotHash);
+    }
 
     // cache size calculations
     int64_t nTotalCache = (gArgs.GetArg("-dbcache", nDefaultDbCache) << 20);
@@ -1428,11 +1487,21 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
+    // -<db>blockcache and -<db>writebuffer replace a database's share of
+    // -dbcache; the in-memory cache gets what they leave, or makes up for
+    // what they take beyond it.
+    const int64_t nBlockTreeDBUsage = DBOptions::FromArgs("blockindexdb", nBlockTreeDBCache).MemoryUsage();
+    const int64_t nCoinDBUsage = DBOptions::FromArgs("chainstatedb", nCoinDBCache).MemoryUsage();
+    nTotalCache -= (nBlockTreeDBUsage - nBlockTreeDBCache) + (nCoinDBUsage - nCoinDBCache);
+    if (nTotalCache < (nMinDbCache << 20)) {
+        InitWarning(_("The database cache options add up to more than -dbcache. The in-memory UTXO set is kept at its minimum size."));
+        nTotalCache = nMinDbCache << 20;
+    }
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
-    LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
-    LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBUsage * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBUsage * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
@@ -1446,7 +1515,9 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         do {
             try {
                 UnloadBlockIndex();
+                delete pcoinsPrefetcher;
                 delete pcoinsTip;
+                delete pcoinsflusher;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
@@ -1518,10 +1589,29 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                bool fLoadedSnapshot = false;
+                if (gArgs.IsArgSet("-loadtxoutset")) {
+                    if (pcoinsdbview->GetBestBlock().IsNull()) {
+                        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+                        const fs::path pathSnapshot = fs::absolute(gArgs.GetArg("-loadtxoutset", ""), GetDataDir());
+                        std::string strSnapshotError;
+                        if (!LoadUTXOSnapshot(chainparams, pathSnapshot, hashSnapshotExpected, pcoinsdbview, strSnapshotError)) {
+                            if (fRequestShutdown) break;
+                            return InitError(strprintf(_("Unable to load UTXO snapshot %s: %s"), pathSnapshot.string(), strSnapshotError));
+                        }
+                        fLoadedSnapshot = true;
+                    } else {
+                        LogPrintf("Chain state already initialized, ignoring -loadtxoutset\n");
+                    }
+                }
+
                 // The on-disk coinsdb is now in a good state, create the cache
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsflusher = new CCoinsViewBackgroundFlush(pcoinscatcher, pcoinsdbview);
+                pcoinsTip = new CCoinsViewCache(pcoinsflusher);
+                pcoinsPrefetcher = new CCoinsPrefetcher(pcoinsflusher);
+                pcoinsPrefetcher->Start(std::max(0, std::min<int>(gArgs.GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS)));
 
-                bool is_coinsview_empty = fReset || fReindexChainState || pcoinsTip->GetBestBlock().IsNull();
+                bool is_coinsview_empty = !fLoadedSnapshot && (fReset || fReindexChainState || pcoinsTip->GetBestBlock().IsNull());
                 if (!is_coinsview_empty) {
                     // LoadChainTip sets chainActive based on pcoinsTip's best block
                     if (!LoadChainTip(chainparams)) {
@@ -1531,6 +1621,11 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     assert(chainActive.Tip() != nullptr);
                 }
 
+                if (!InitCoinsTipDigest()) {
+                    strLoadError = _("Error initializing block database");
+                    break;
+                }
+
                 if (!fReset) {
                     // Note that RewindBlockIndex MUST run even if we're about to -reindex-chainstate.
                     // It both disconnects blocks based on chainActive, and drops block data in
@@ -1,4 +1,5 @@
 #include "logging.h"
 
 functionWithTwoStringInputs LoggerSession::timeStamper = 0;
+functionWithLoggerAndTwoStrings LoggerSession::asyncWriter = 0;
 std::string LoggerSession::baseFolderComputedRunTime = "";
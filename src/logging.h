@@ -2,6 +2,8 @@
 #define LOGGING_H_header
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 //The following include creates the need for a mind-boggling refactoring of the input file
 //needed to create the make file of fabcoind, so we circumvent including it with
 //pointers to functions.
@@ -10,6 +12,8 @@
 extern bool fLogTimestamps;
 
 typedef void (*functionWithTwoStringInputs) (const std::string& input, std::string& output);
+class LoggerSession;
+typedef bool (*functionWithLoggerAndTwoStrings) (LoggerSession* logger, const std::string& toFile, const std::string& toConsole);
 class LoggerSession
 {
 public:
@@ -32,45 +36,54 @@ public:
         return  "\e[92m";
     }
     std::fstream theFile;
+    std::mutex mutexLine;
+    //Text of the line being written, see Write().
+    std::string pendingFile;
+    std::string pendingConsole;
     std::string descriptionPrependToLogs;
     bool flagIncludeExtraDescriptionInNextLogMessage;
     bool flagDeallocated;
     bool flagHasColor;
     enum logModifiers{ endL, colorBlue, colorRed, colorYellow, colorGreen, colorNormal};
     friend LoggerSession& operator << (LoggerSession& inputLogger, logModifiers other) {
+        //Colors only go to the console.
+        std::string toConsole;
         if (other == LoggerSession::endL) {
-            std::cout << std::endl;
-            inputLogger.theFile << "\n";
-            inputLogger.flagIncludeExtraDescriptionInNextLogMessage = true;
+            toConsole = "\n";
             if (inputLogger.flagHasColor) {
-                std::cout << LoggerSession::consoleColorNormal();
+                toConsole += LoggerSession::consoleColorNormal();
                 inputLogger.flagHasColor = false;
             }
+            inputLogger.Write("\n", toConsole, true);
+            inputLogger.flagIncludeExtraDescriptionInNextLogMessage = true;
+            return inputLogger;
         }
         switch (other) {
         case LoggerSession::colorBlue:
-            std::cout << LoggerSession::consoleColorBlue();
+            toConsole = LoggerSession::consoleColorBlue();
             inputLogger.flagHasColor = true;
             break;
         case LoggerSession::colorGreen:
-            std::cout << LoggerSession::consoleColorGreen();
+            toConsole = LoggerSession::consoleColorGreen();
             inputLogger.flagHasColor = true;
             break;
         case LoggerSession::colorRed:
-            std::cout << LoggerSession::consoleColorRed();
+            toConsole = LoggerSession::consoleColorRed();
             inputLogger.flagHasColor = true;
             break;
         case LoggerSession::colorYellow:
-            std::cout << LoggerSession::consoleColorYellow();
+            toConsole = LoggerSession::consoleColorYellow();
             inputLogger.flagHasColor = true;
             break;
         case LoggerSession::colorNormal:
-            std::cout << LoggerSession::consoleColorNormal();
+            toConsole = LoggerSession::consoleColorNormal();
             inputLogger.flagHasColor = false;
             break;
         default:
             break;
         }
+        if (!toConsole.empty())
+            inputLogger.Write("", toConsole);
         return inputLogger;
     }
     template<typename any>
@@ -86,13 +99,44 @@ public:
                 inputLogger.timeStamper("", timeStamp);
                 inputLogger << timeStamp;
             }
-            std::cout << inputLogger.descriptionPrependToLogs;
+            inputLogger.Write("", inputLogger.descriptionPrependToLogs);
         }
-        inputLogger.theFile << other;
-        inputLogger.theFile.flush();
-        std::cout << other;
+        std::ostringstream out;
+        out << other;
+        inputLogger.Write(out.str(), out.str());
         return inputLogger;
     }
+    //Pointer to a function that takes text for a logger's file and for the console,
+    //and queues it for writing on a thread of its own, returning false if it is not running.
+    //Set by util.cpp, for the same reason as timeStamper.
+    static functionWithLoggerAndTwoStrings asyncWriter;
+    //Writes text, through asyncWriter if there is one; that one flushes the console itself.
+    //Text is held back until it ends a line, so that asyncWriter gets whole lines,
+    //and a line it has to drop is dropped as a whole.
+    void Write(const std::string& toFile, const std::string& toConsole, bool endsLine = false) {
+        std::string lineFile, lineConsole;
+        {
+            std::lock_guard<std::mutex> lock(this->mutexLine);
+            this->pendingFile += toFile;
+            this->pendingConsole += toConsole;
+            if (!endsLine && (this->pendingFile.empty() || this->pendingFile.back() != '\n'))
+                return;
+            lineFile.swap(this->pendingFile);
+            lineConsole.swap(this->pendingConsole);
+        }
+        if (asyncWriter == 0 || !asyncWriter(this, lineFile, lineConsole))
+            this->WriteNow(lineFile, lineConsole, true);
+    }
+    //Writes text right away, from the calling thread.
+    void WriteNow(const std::string& toFile, const std::string& toConsole, bool flushConsole = false) {
+        if (!toFile.empty()) {
+            this->theFile << toFile;
+            this->theFile.flush();
+        }
+        std::cout << toConsole;
+        if (flushConsole)
+            std::cout.flush();
+    }
     LoggerSession(const std::string& pathname, const std::string& inputDescriptionPrependToLogs) {
         this->theFile.open(pathname, std::fstream::out | std::fstream::trunc);
         this->flagIncludeExtraDescriptionInNextLogMessage = true;
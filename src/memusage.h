@@ -6,9 +6,12 @@
 #define FABCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "prevector.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
+#include <deque>
 #include <map>
 #include <set>
 #include <vector>
@@ -86,6 +89,16 @@ static inline size_t DynamicUsage(const std::vector<X>& v)
     return MallocUsage(v.capacity() * sizeof(X));
 }
 
+template<typename X>
+static inline size_t DynamicUsage(const std::deque<X>& v)
+{
+    // Elements are stored in blocks of 512 bytes (or one element per block
+    // if larger), plus a map with a pointer to every block.
+    const size_t nPerBlock = sizeof(X) < 512 ? 512 / sizeof(X) : 1;
+    const size_t nBlocks = v.size() / nPerBlock + 1;
+    return MallocUsage(nPerBlock * sizeof(X)) * nBlocks + MallocUsage((nBlocks + 2) * sizeof(void*));
+}
+
 template<unsigned int N, typename X, typename S, typename D>
 static inline size_t DynamicUsage(const prevector<N, X, S, D>& v)
 {
@@ -164,6 +177,17 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename P, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    // Nodes live in the pool's chunks, which are never handed back while the
+    // map exists, so count the chunks (and their std::list entries) rather
+    // than the nodes. The bucket array is too large for the pool.
+    const auto* pool = m.get_allocator().resource();
+    size_t usage_chunk = MallocUsage(pool->ChunkSizeBytes()) + MallocUsage(sizeof(void*) * 3);
+    return usage_chunk * pool->NumAllocatedChunks() + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 }
 
 #endif // FABCOIN_MEMUSAGE_H
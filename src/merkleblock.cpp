@@ -7,6 +7,7 @@
 
 #include "hash.h"
 #include "consensus/consensus.h"
+#include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
 CMerkleBlock::CMerkleBlock(const CBlock& block, CBloomFilter& filter)
@@ -65,17 +66,21 @@ uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::ve
     if (height == 0) {
         // hash at height 0 is the txids themself
         return vTxid[pos];
-    } else {
-        // calculate left hash
-        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
-        // calculate right hash if not beyond the end of the array - copy left hash otherwise
-        if (pos*2+1 < CalcTreeWidth(height-1))
-            right = CalcHash(height-1, pos*2+1, vTxid);
-        else
-            right = left;
-        // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
     }
+    // Hash the subtree level by level, so the pairs of each level are hashed
+    // in one go. A level of the subtree only has an odd number of nodes when
+    // it is cut short by the end of the tree, in which case the last node is
+    // paired with itself like in the rest of the tree.
+    const size_t nBegin = (size_t)pos << height;
+    const size_t nEnd = std::min((size_t)(pos + 1) << height, vTxid.size());
+    std::vector<uint256> vHash(vTxid.begin() + nBegin, vTxid.begin() + nEnd);
+    for (int h = 0; h < height; h++) {
+        if (vHash.size() & 1)
+            vHash.push_back(vHash.back());
+        SHA256D64(vHash[0].begin(), vHash[0].begin(), vHash.size() / 2);
+        vHash.resize(vHash.size() / 2);
+    }
+    return vHash[0];
 }
 
 void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch) {
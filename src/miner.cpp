@@ -70,11 +70,11 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     int64_t nNewTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
 
     if (nOldTime < nNewTime)
-        pblock->nTime = nNewTime;
+        pblock->SetTime(nNewTime);
 
     // Updating time can change work required on testnet:
     if (consensusParams.fPowAllowMinDifficultyBlocks)
-        pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, consensusParams);
+        pblock->SetBits(GetNextWorkRequired(pindexPrev, pblock, consensusParams));
 
     return nNewTime - nOldTime;
 }
@@ -147,13 +147,13 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     CBlockIndex* pindexPrev = chainActive.Tip();
     nHeight = pindexPrev->nHeight + 1;
 
-    pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
+    pblock->SetVersion(ComputeBlockVersion(pindexPrev, chainparams.GetConsensus()));
     // -regtest only: allow overriding block.nVersion with
     // -blockversion=N to test forking scenarios
     if (chainparams.MineBlocksOnDemand())
-        pblock->nVersion = gArgs.GetArg("-blockversion", pblock->nVersion);
+        pblock->SetVersion(gArgs.GetArg("-blockversion", pblock->nVersion));
 
-    pblock->nTime = GetAdjustedTime();
+    pblock->SetTime(GetAdjustedTime());
     const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
 
     nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
@@ -205,13 +205,13 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     }
 
     // Fill in header
-    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-    pblock->nHeight        = pindexPrev->nHeight + 1;
+    pblock->SetPrevBlock(pindexPrev->GetBlockHash());
+    pblock->SetHeight(pindexPrev->nHeight + 1);
     memset(pblock->nReserved, 0, sizeof(pblock->nReserved));
     UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
-    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-    pblock->nNonce         = ArithToUint256(nonce);
-    pblock->nSolution.clear();
+    pblock->SetBits(GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus()));
+    pblock->SetNonce(ArithToUint256(nonce));
+    pblock->SetSolution(std::vector<unsigned char>());
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
     CValidationState state;
@@ -491,7 +491,7 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    pblock->SetMerkleRoot(BlockMerkleRoot(*pblock));
 }
 
 #ifdef ENABLE_WALLET
@@ -675,7 +675,7 @@ void static FabcoinMiner(const CChainParams& chainparams, GPUConfig conf, int th
 
                     g_nSols[thr_id] ++ ;
 
-                    pblock->nSolution = soln;
+                    pblock->SetSolution(soln);
 
                     if (UintToArith256(pblock->GetHash()) > hashTarget) 
                     {
@@ -750,7 +750,7 @@ void static FabcoinMiner(const CChainParams& chainparams, GPUConfig conf, int th
 
                 //LogPrint(BCLog::POW, "solver... nNonce = %s -> Hash = %s \n", pblock->nNonce.ToString(), pblock->GetHash().GetHex());
                 // Update nNonce and nTime
-                pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
+                pblock->SetNonce(ArithToUint256(UintToArith256(pblock->nNonce) + 1));
                 ++nCounter;
 
                 // Update nTime every few seconds
@@ -815,7 +815,7 @@ static bool cb_validate(std::vector<unsigned char> sols, unsigned char *pblockda
     g_cs.lock();
     do 
     {
-        pblock->nSolution = sols;
+        pblock->SetSolution(sols);
         CChainParams chainparams = Params();
         arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
         if (UintToArith256(pblock->GetHash()) > hashTarget) 
@@ -974,7 +974,7 @@ void static FabcoinMinerCuda(const CChainParams& chainparams, GPUConfig conf, in
 
                 //LogPrint(BCLog::POW, "solver... nNonce = %s -> Hash = %s \n", pblock->nNonce.ToString(), pblock->GetHash().GetHex());
                 // Update nNonce and nTime
-                pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
+                pblock->SetNonce(ArithToUint256(UintToArith256(pblock->nNonce) + 1));
                 ++nCounter;
 
                 // Update nTime every few seconds
@@ -0,0 +1,104 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FABCOIN_MPSCQUEUE_H
+#define FABCOIN_MPSCQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+/**
+ * A bounded queue that any number of threads push to, and a single thread
+ * pops from, without taking a lock.
+ *
+ * The queue is a ring of cells, each with a sequence number saying whether it
+ * is free for the push at a given position or holds the value for the pop at
+ * it. A pusher claims a position with a compare-and-swap, and publishes its
+ * value by advancing the cell's sequence; the popper hands the cell back the
+ * same way. Pushing to a full queue fails rather than waiting.
+ */
+template <typename T>
+class CMPSCQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> nSequence;
+        T value;
+    };
+
+    const size_t nMask;
+    std::unique_ptr<Cell[]> cells;
+
+    //! Keep the pushers' and the popper's positions on separate cache lines
+    char padding0[64];
+    std::atomic<size_t> nPushPos;
+    char padding1[64];
+    size_t nPopPos;
+
+    static size_t RoundUp(size_t n)
+    {
+        size_t nPow2 = 2;
+        while (nPow2 < n)
+            nPow2 <<= 1;
+        return nPow2;
+    }
+
+public:
+    /** Create a queue holding at least nCapacity values, rounded up to a power of two */
+    explicit CMPSCQueue(size_t nCapacity) : nMask(RoundUp(nCapacity) - 1), cells(new Cell[nMask + 1]), nPushPos(0), nPopPos(0)
+    {
+        for (size_t i = 0; i <= nMask; i++)
+            cells[i].nSequence.store(i, std::memory_order_relaxed);
+    }
+
+    CMPSCQueue(const CMPSCQueue&) = delete;
+    CMPSCQueue& operator=(const CMPSCQueue&) = delete;
+
+    size_t Capacity() const { return nMask + 1; }
+
+    /** Push value, from any thread. Returns false, leaving value alone, if the queue is full. */
+    bool TryPush(T&& value)
+    {
+        size_t nPos = nPushPos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[nPos & nMask];
+            const intptr_t nDiff = (intptr_t)cell.nSequence.load(std::memory_order_acquire) - (intptr_t)nPos;
+            if (nDiff == 0) {
+                if (nPushPos.compare_exchange_weak(nPos, nPos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.nSequence.store(nPos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (nDiff < 0) {
+                // The popper has not freed this cell since the last round.
+                return false;
+            } else {
+                // Another pusher took the position.
+                nPos = nPushPos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Pop the oldest value, from the one popping thread. Returns false if the
+     * queue is empty, or its oldest value is still being pushed.
+     */
+    bool TryPop(T& value)
+    {
+        Cell& cell = cells[nPopPos & nMask];
+        if (cell.nSequence.load(std::memory_order_acquire) != nPopPos + 1)
+            return false;
+        value = std::move(cell.value);
+        cell.value = T();
+        cell.nSequence.store(nPopPos + nMask + 1, std::memory_order_release);
+        nPopPos++;
+        return true;
+    }
+};
+
+#endif // FABCOIN_MPSCQUEUE_H
@@ -39,23 +39,21 @@
 
 std::atomic<int64_t> nTimeBestReceived(0); // Used only to inform the wallet of when we last received a block
 
-struct IteratorComparator
-{
-    template<typename I>
-    bool operator()(const I& a, const I& b)
-    {
-        return &(*a) < &(*b);
-    }
-};
-
 struct COrphanTx {
     // When modifying, adapt the copy of this definition in tests/DoS_tests.
     CTransactionRef tx;
     NodeId fromPeer;
     int64_t nTimeExpire;
+    size_t nUsage;   //!< Memory charged to the orphan pool for this entry
+    size_t nListPos; //!< Position in vOrphanList
 };
-std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-std::map<COutPoint, std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+std::unordered_map<uint256, COrphanTx, SaltedTxidHasher> mapOrphanTransactions GUARDED_BY(cs_main);
+// Elements of an unordered_map keep their address when it rehashes, so the
+// indexes below can point straight at the entries.
+std::unordered_map<COutPoint, std::set<COrphanTx*>, SaltedOutpointHasher> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+std::vector<COrphanTx*> vOrphanList GUARDED_BY(cs_main); //!< All orphans, for random eviction
+size_t nOrphanPoolUsage GUARDED_BY(cs_main) = 0;
+std::map<NodeId, size_t> mapOrphanPoolUsageByPeer GUARDED_BY(cs_main);
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 static size_t vExtraTxnForCompactIt = 0;
@@ -105,6 +103,9 @@ namespace {
         uint256 hash;
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
+        int64_t nTimeRequested;                                  //!< When this block was requested (in microseconds).
+        size_t nBytesReceived;                                   //!< Bytes received so far towards this block, as a compact block.
+        bool fRoundTrip;                                         //!< Whether its delivery takes a round trip from nTimeRequested, so can be timed.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
@@ -118,6 +119,9 @@ namespace {
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** Sum of the in-flight block allowances of all peers, used to size the download window. Protected by cs_main. */
+    int nBlocksInFlightAllowanceTotal = 0;
+
     /** Number of outbound peers with m_chain_sync.m_protect. */
     int g_outbound_peers_with_protect_from_disconnect = 0;
 
@@ -131,6 +135,52 @@ namespace {
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
 } // namespace
 
+/** Weight of a new sample in the smoothed per-peer block download statistics. */
+static const double BLOCK_DOWNLOAD_STATS_ALPHA = 0.125;
+
+void CBlockDownloadStats::Update(int64_t nTimeRequested, bool fFirstInFlight, size_t nSize, int64_t nNow)
+{
+    // Blocks are pipelined, so the time this block took is measured from the delivery of the
+    // previous one (or from the request, if the connection was idle in between).
+    int64_t nServiceTime = std::max<int64_t>(nNow - std::max(nTimeRequested, nLastReceivedTime), 1);
+    double dRate = nSize * 1000000.0 / nServiceTime;
+    if (dBytesPerSecond == 0) {
+        dBytesPerSecond = dRate;
+        dAvgSize = nSize;
+    } else {
+        dBytesPerSecond += BLOCK_DOWNLOAD_STATS_ALPHA * (dRate - dBytesPerSecond);
+        dAvgSize += BLOCK_DOWNLOAD_STATS_ALPHA * (nSize - dAvgSize);
+    }
+    // Only a block requested while nothing else was being delivered measures the round trip
+    // without queueing delay.
+    if (fFirstInFlight && nTimeRequested >= nLastReceivedTime) {
+        int64_t nSample = std::max<int64_t>(nNow - nTimeRequested, 1);
+        if (nLatency == 0)
+            nLatency = nSample;
+        else
+            nLatency += (int64_t)(BLOCK_DOWNLOAD_STATS_ALPHA * (nSample - nLatency));
+    }
+    nLastReceivedTime = nNow;
+    nBytesReceived += nSize;
+}
+
+int CBlockDownloadStats::GetAllowance() const
+{
+    if (nLatency == 0 || dAvgSize == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    // Keep twice the bandwidth-delay product in flight so the pipe doesn't drain while requests are in transit.
+    double dBlocks = 2 * dBytesPerSecond * nLatency / 1000000.0 / dAvgSize;
+    return std::max<int>(MAX_BLOCKS_IN_TRANSIT_PER_PEER, std::min<double>(dBlocks, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+bool CBlockDownloadStats::ShouldReassignTo(const CBlockDownloadStats& other, int64_t nTimeRequested, int64_t nNow) const
+{
+    if (dBytesPerSecond == 0 || other.dBytesPerSecond <= dBytesPerSecond)
+        return false;
+    // Give the staller a few of its own round trips before giving up on it.
+    return nNow - nTimeRequested > std::max<int64_t>(BLOCK_REASSIGN_MIN_AGE, 4 * nLatency);
+}
+
 namespace {
 
 struct CBlockReject {
@@ -179,6 +229,10 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! How many blocks may be in flight from this peer, sized to its measured bandwidth-delay product.
+    int nBlocksInFlightAllowance;
+    //! How fast this peer delivers requested blocks.
+    CBlockDownloadStats blockDownload;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -231,6 +285,9 @@ struct CNodeState {
     //! Time of last new block announcement
     int64_t m_last_block_announcement;
 
+    //! Orphans whose parents this peer gave us, to be reconsidered on the next turns of the message handler.
+    std::set<uint256> setOrphanWork;
+
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
         nMisbehavior = 0;
@@ -246,6 +303,7 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlocksInFlightAllowance = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -302,11 +360,19 @@ void PushNodeVersion(CNode *pnode, CConnman* connman, int64_t nTime)
 
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
-// Also used if a block was /not/ received and timed out or started with another peer
-bool MarkBlockAsReceived(const uint256& hash) {
+// Also used if a block was /not/ received and timed out or started with another peer.
+// If nodeFrom delivered the block (of nBlockSize bytes) it requested, its download statistics are updated.
+bool MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1, size_t nBlockSize = 0) {
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (nBlockSize > 0 && itInFlight->second.first == nodeFrom) {
+            // Fold the delivery into the peer's estimates, and resize its allowance to them.
+            state->blockDownload.Update(itInFlight->second.second->nTimeRequested, state->vBlocksInFlight.begin() == itInFlight->second.second, nBlockSize, GetTimeMicros());
+            int nAllowance = state->blockDownload.GetAllowance();
+            nBlocksInFlightAllowanceTotal += nAllowance - state->nBlocksInFlightAllowance;
+            state->nBlocksInFlightAllowance = nAllowance;
+        }
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         if (state->nBlocksInFlightValidHeaders == 0 && itInFlight->second.second->fValidatedHeaders) {
             // Last validated block on the queue was received.
@@ -345,7 +411,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, GetTimeMicros(), 0, true, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -455,8 +521,20 @@ bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
     return false;
 }
 
+// Requires cs_main.
+// Whether the block hash, in flight from peer staller, should be requested from the peer with state instead.
+bool ShouldReassignBlock(const CNodeState* state, NodeId staller, const uint256& hash)
+{
+    const CNodeState* stallerState = State(staller);
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::const_iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (stallerState == nullptr || itInFlight == mapBlocksInFlight.end())
+        return false;
+    return stallerState->blockDownload.ShouldReassignTo(state->blockDownload, itInFlight->second.second->nTimeRequested, GetTimeMicros());
+}
+
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
+ *  at most count entries. If the window is blocked by a slow peer, vBlocks may receive the blocking
+ *  block even though it is in flight elsewhere. */
 void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
     if (count == 0)
         return;
@@ -488,12 +566,15 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
     std::vector<const CBlockIndex*> vToFetch;
     const CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than the download window + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
-    // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    // download that next block if the window were 1 larger. The window is widened beyond BLOCK_DOWNLOAD_WINDOW when
+    // the peers' combined in-flight allowances would otherwise not fit in it.
+    unsigned int nWindowSize = std::min<unsigned int>(std::max<unsigned int>(BLOCK_DOWNLOAD_WINDOW, 4 * nBlocksInFlightAllowanceTotal), MAX_BLOCK_DOWNLOAD_WINDOW);
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + nWindowSize;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaitingFor = nullptr;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -528,7 +609,15 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
                     // We reached the end of the window.
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
-                        nodeStaller = waitingfor;
+                        // If we are measurably faster than the peer holding up the window, take its block over
+                        // rather than waiting for the stalling timeout.
+                        if (pindexWaitingFor && ShouldReassignBlock(state, waitingfor, pindexWaitingFor->GetBlockHash())) {
+                            LogPrint(BCLog::NET, "Reassigning block %s (%d) from stalling peer=%d to peer=%d\n",
+                                pindexWaitingFor->GetBlockHash().ToString(), pindexWaitingFor->nHeight, waitingfor, nodeid);
+                            vBlocks.push_back(pindexWaitingFor);
+                        } else {
+                            nodeStaller = waitingfor;
+                        }
                     }
                     return;
                 }
@@ -539,6 +628,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -555,6 +645,22 @@ void UpdateLastBlockAnnounceTime(NodeId node, int64_t time_in_seconds)
     if (state) state->m_last_block_announcement = time_in_seconds;
 }
 
+// These functions are used for testing the handoff of orphan work on
+// disconnect, see DoS_tests.cpp
+void AddOrphanWork(NodeId node, const uint256& hash)
+{
+    LOCK(cs_main);
+    CNodeState *state = State(node);
+    if (state) state->setOrphanWork.insert(hash);
+}
+
+size_t GetOrphanWorkSize(NodeId node)
+{
+    LOCK(cs_main);
+    CNodeState *state = State(node);
+    return state ? state->setOrphanWork.size() : 0;
+}
+
 // Returns true for outbound peers, excluding manual connections, feelers, and
 // one-shots
 bool IsOutboundDisconnectionCandidate(const CNode *node)
@@ -569,6 +675,7 @@ void PeerLogicValidation::InitializeNode(CNode *pnode) {
     {
         LOCK(cs_main);
         mapNodeState.emplace_hint(mapNodeState.end(), std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, std::move(addrName)));
+        nBlocksInFlightAllowanceTotal += MAX_BLOCKS_IN_TRANSIT_PER_PEER;
     }
     if(!pnode->fInbound)
         PushNodeVersion(pnode, connman, GetTime());
@@ -591,9 +698,34 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
         mapBlocksInFlight.erase(entry.hash);
     }
     EraseOrphansFor(nodeid);
+    // Hand the orphans this peer was going to reconsider to the peers that
+    // sent them, or else to any other peer, rather than leaving them in the
+    // orphan pool until they expire.
+    CNodeState* fallback = nullptr;
+    for (const uint256& hash : state->setOrphanWork) {
+        auto it = mapOrphanTransactions.find(hash);
+        if (it == mapOrphanTransactions.end())
+            continue;
+        CNodeState* recipient = State(it->second.fromPeer);
+        if (recipient == nullptr) {
+            if (fallback == nullptr) {
+                for (auto& entry : mapNodeState) {
+                    if (entry.first != nodeid) {
+                        fallback = &entry.second;
+                        break;
+                    }
+                }
+                if (fallback == nullptr)
+                    break;
+            }
+            recipient = fallback;
+        }
+        recipient->setOrphanWork.insert(hash);
+    }
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
+    nBlocksInFlightAllowanceTotal -= state->nBlocksInFlightAllowance;
     g_outbound_peers_with_protect_from_disconnect -= state->m_chain_sync.m_protect;
     assert(g_outbound_peers_with_protect_from_disconnect >= 0);
 
@@ -604,6 +736,7 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
         assert(mapBlocksInFlight.empty());
         assert(nPreferredDownload == 0);
         assert(nPeersWithValidatedDownloads == 0);
+        assert(nBlocksInFlightAllowanceTotal == 0);
         assert(g_outbound_peers_with_protect_from_disconnect == 0);
     }
     LogPrint(BCLog::NET, "Cleared nodestate for peer=%d\n", nodeid);
@@ -621,6 +754,10 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksInFlightAllowance = state->nBlocksInFlightAllowance;
+    stats.nBlockBytesReceived = state->blockDownload.nBytesReceived;
+    stats.dBlockBytesPerSecond = state->blockDownload.dBytesPerSecond;
+    stats.dBlockLatency = state->blockDownload.nLatency * 0.000001;
     return true;
 }
 
@@ -640,6 +777,12 @@ void AddToCompactExtraTransactions(const CTransactionRef& tx)
     vExtraTxnForCompactIt = (vExtraTxnForCompactIt + 1) % max_extra_txn;
 }
 
+/** Memory budget of the orphan pool in bytes, from -maxorphansize */
+static size_t GetMaxOrphanPoolUsage()
+{
+    return std::max((int64_t)0, gArgs.GetArg("-maxorphansize", DEFAULT_MAX_ORPHAN_POOL_SIZE)) * 1000000;
+}
+
 bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     const uint256& hash = tx->GetHash();
@@ -651,8 +794,9 @@ bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRE
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 100 orphans, each of which is at most 99,999 bytes big is
-    // at most 10 megabytes of orphans and somewhat more byprev index (in the worst case):
+    // Beyond that the pool as a whole is bounded by -maxorphansize and
+    // -maxorphantx (see LimitOrphanTxSize), and no single peer may fill more
+    // than MAX_ORPHAN_POOL_PEER_PERCENT of the memory budget.
     unsigned int sz = GetTransactionWeight(*tx);
     if (sz >= MAX_STANDARD_TX_WEIGHT)
     {
@@ -660,33 +804,62 @@ bool AddOrphanTx(const CTransactionRef& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRE
         return false;
     }
 
-    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME});
+    size_t nUsage = RecursiveDynamicUsage(tx);
+    size_t& nPeerUsage = mapOrphanPoolUsageByPeer[peer];
+    if (nPeerUsage + nUsage > GetMaxOrphanPoolUsage() / 100 * MAX_ORPHAN_POOL_PEER_PERCENT)
+    {
+        LogPrint(BCLog::MEMPOOL, "ignoring orphan tx %s, peer=%d is over its orphan pool quota (%u bytes)\n", hash.ToString(), peer, nPeerUsage);
+        if (nPeerUsage == 0)
+            mapOrphanPoolUsageByPeer.erase(peer);
+        return false;
+    }
+
+    auto ret = mapOrphanTransactions.emplace(hash, COrphanTx{tx, peer, GetTime() + ORPHAN_TX_EXPIRE_TIME, nUsage, vOrphanList.size()});
     assert(ret.second);
+    COrphanTx* orphan = &ret.first->second;
+    vOrphanList.push_back(orphan);
     for (const CTxIn& txin : tx->vin) {
-        mapOrphanTransactionsByPrev[txin.prevout].insert(ret.first);
+        mapOrphanTransactionsByPrev[txin.prevout].insert(orphan);
     }
+    nOrphanPoolUsage += nUsage;
+    nPeerUsage += nUsage;
 
     AddToCompactExtraTransactions(tx);
 
-    LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u outsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u outsz %u usage %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanPoolUsage);
     return true;
 }
 
 int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
+    auto it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return 0;
-    for (const CTxIn& txin : it->second.tx->vin)
+    COrphanTx* orphan = &it->second;
+    for (const CTxIn& txin : orphan->tx->vin)
     {
         auto itPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
-        itPrev->second.erase(it);
+        itPrev->second.erase(orphan);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+
+    // Move the last entry of vOrphanList into the freed slot.
+    COrphanTx* last = vOrphanList.back();
+    vOrphanList[orphan->nListPos] = last;
+    last->nListPos = orphan->nListPos;
+    vOrphanList.pop_back();
+
+    nOrphanPoolUsage -= orphan->nUsage;
+    auto itPeer = mapOrphanPoolUsageByPeer.find(orphan->fromPeer);
+    assert(itPeer != mapOrphanPoolUsageByPeer.end() && itPeer->second >= orphan->nUsage);
+    itPeer->second -= orphan->nUsage;
+    if (itPeer->second == 0)
+        mapOrphanPoolUsageByPeer.erase(itPeer);
+
     mapOrphanTransactions.erase(it);
     return 1;
 }
@@ -694,10 +867,10 @@ int static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 void EraseOrphansFor(NodeId peer)
 {
     int nErased = 0;
-    std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
+    auto iter = mapOrphanTransactions.begin();
     while (iter != mapOrphanTransactions.end())
     {
-        std::map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
+        auto maybeErase = iter++; // increment to avoid iterator becoming invalid
         if (maybeErase->second.fromPeer == peer)
         {
             nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
@@ -707,7 +880,7 @@ void EraseOrphansFor(NodeId peer)
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphanUsage) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     unsigned int nEvicted = 0;
     static int64_t nNextSweep;
@@ -716,10 +889,10 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRE
         // Sweep out expired orphan pool entries:
         int nErased = 0;
         int64_t nMinExpTime = nNow + ORPHAN_TX_EXPIRE_TIME - ORPHAN_TX_EXPIRE_INTERVAL;
-        std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
+        auto iter = mapOrphanTransactions.begin();
         while (iter != mapOrphanTransactions.end())
         {
-            std::map<uint256, COrphanTx>::iterator maybeErase = iter++;
+            auto maybeErase = iter++;
             if (maybeErase->second.nTimeExpire <= nNow) {
                 nErased += EraseOrphanTx(maybeErase->second.tx->GetHash());
             } else {
@@ -730,14 +903,11 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRE
         nNextSweep = nMinExpTime + ORPHAN_TX_EXPIRE_INTERVAL;
         if (nErased > 0) LogPrint(BCLog::MEMPOOL, "Erased %d orphan tx due to expiration\n", nErased);
     }
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanPoolUsage > nMaxOrphanUsage)
     {
         // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        const COrphanTx* orphan = vOrphanList[GetRand(vOrphanList.size())];
+        EraseOrphanTx(orphan->tx->GetHash());
         ++nEvicted;
     }
     return nEvicted;
@@ -801,7 +971,7 @@ void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pb
             auto itByPrev = mapOrphanTransactionsByPrev.find(txin.prevout);
             if (itByPrev == mapOrphanTransactionsByPrev.end()) continue;
             for (auto mi = itByPrev->second.begin(); mi != itByPrev->second.end(); ++mi) {
-                const CTransaction& orphanTx = *(*mi)->second.tx;
+                const CTransaction& orphanTx = *(*mi)->tx;
                 const uint256& orphanHash = orphanTx.GetHash();
                 vOrphanErase.push_back(orphanHash);
             }
@@ -1461,6 +1631,89 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
     return true;
 }
 
+/** Queue the orphans that spend outputs of tx for reconsideration. */
+static void ScheduleOrphanWork(const CTransaction& tx, std::set<uint256>& setOrphanWork) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    const uint256& hash = tx.GetHash();
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        auto itByPrev = mapOrphanTransactionsByPrev.find(COutPoint(hash, i));
+        if (itByPrev == mapOrphanTransactionsByPrev.end())
+            continue;
+        for (const COrphanTx* orphan : itByPrev->second) {
+            setOrphanWork.insert(orphan->tx->GetHash());
+        }
+    }
+}
+
+/**
+ * Reconsider up to MAX_ORPHANS_PROCESSED_PER_TURN queued orphans, as one
+ * mempool batch. Children of the orphans that get accepted are queued in
+ * turn, so a long chain is worked off over several turns of the message
+ * handler rather than inside a single message.
+ */
+static void ProcessOrphanTx(CConnman* connman, std::set<uint256>& setOrphanWork) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    std::vector<CTransactionRef> vOrphans;
+    std::vector<NodeId> vOrphanPeers;
+    while (!setOrphanWork.empty() && vOrphans.size() < MAX_ORPHANS_PROCESSED_PER_TURN) {
+        auto it = mapOrphanTransactions.find(*setOrphanWork.begin());
+        setOrphanWork.erase(setOrphanWork.begin());
+        if (it == mapOrphanTransactions.end())
+            continue;
+        vOrphans.push_back(it->second.tx);
+        vOrphanPeers.push_back(it->second.fromPeer);
+    }
+    if (vOrphans.empty())
+        return;
+
+    // Use dummy CValidationStates so someone can't setup nodes to counter-DoS based on orphan
+    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+    // anyone relaying LegitTxX banned)
+    std::vector<CValidationState> vStateDummy;
+    std::vector<bool> vMissingInputs;
+    std::list<CTransactionRef> lRemovedTxn;
+    std::vector<bool> vAccepted = AcceptToMemoryPoolBatch(mempool, vOrphans, true, vStateDummy, vMissingInputs, &lRemovedTxn);
+
+    std::set<NodeId> setMisbehaving;
+    for (size_t j = 0; j < vOrphans.size(); j++) {
+        const CTransaction& orphanTx = *vOrphans[j];
+        const uint256& orphanHash = orphanTx.GetHash();
+        const CValidationState& stateDummy = vStateDummy[j];
+        if (vAccepted[j]) {
+            LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
+            RelayTransaction(orphanTx, connman);
+            ScheduleOrphanWork(orphanTx, setOrphanWork);
+            EraseOrphanTx(orphanHash);
+        }
+        else if (!vMissingInputs[j])
+        {
+            int nDos = 0;
+            if (stateDummy.IsInvalid(nDos) && nDos > 0 && setMisbehaving.insert(vOrphanPeers[j]).second)
+            {
+                // Punish peer that gave us an invalid orphan tx
+                Misbehaving(vOrphanPeers[j], nDos);
+                LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
+            }
+            // Has inputs but not accepted to mempool
+            // Probably non-standard or insufficient fee
+            LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
+            EraseOrphanTx(orphanHash);
+            if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
+                // Do not use rejection cache for witness transactions or
+                // witness-stripped transactions, as they can have been malleated.
+                // See https://github.com/blockchaingate/fabcoin/issues/8279 for details.
+                assert(recentRejects);
+                recentRejects->insert(orphanHash);
+            }
+        }
+    }
+    mempool.check(pcoinsTip);
+
+    for (const CTransactionRef& removedTx : lRemovedTxn)
+        AddToCompactExtraTransactions(removedTx);
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     FunctionProfile profileThis("ProcessMessage", 10, 100);
@@ -2080,8 +2333,6 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
-        std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
         const CTransaction& tx = *ptx;
@@ -2102,9 +2353,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, &lRemovedTxn)) {
             mempool.check(pcoinsTip);
             RelayTransaction(tx, connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
+            ScheduleOrphanWork(tx, State(pfrom->GetId())->setOrphanWork);
 
             pfrom->nLastTXTime = GetTime();
 
@@ -2112,67 +2361,6 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 pfrom->GetId(),
                 tx.GetHash().ToString(),
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
-                        LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint(BCLog::MEMPOOL, "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee
-                        LogPrint(BCLog::MEMPOOL, "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            // See https://github.com/blockchaingate/fabcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            for (uint256 hash : vEraseQueue)
-                EraseOrphanTx(hash);
         }
         else if (fMissingInputs)
         {
@@ -2194,7 +2382,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
                 // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
                 unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, gArgs.GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, GetMaxOrphanPoolUsage());
                 if (nEvicted > 0) {
                     LogPrint(BCLog::MEMPOOL, "mapOrphan overflow, removed %u tx\n", nEvicted);
                 }
@@ -2259,6 +2447,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlockHeaderAndShortTxIDs cmpctblock;
+        size_t nCmpctBlockSize = vRecv.size();
         vRecv >> cmpctblock;
 
         bool received_new_header = false;
@@ -2366,6 +2555,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                     }
                 }
 
+                (*queuedBlockIt)->nBytesReceived += nCmpctBlockSize;
+                // An announcement we did not ask for only takes a round trip if transactions are missing.
+                if (!fAlreadyInFlight)
+                    (*queuedBlockIt)->fRoundTrip = false;
                 PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
                 ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxnForCompact);
                 if (status == READ_STATUS_INVALID) {
@@ -2394,6 +2587,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                     fProcessBLOCKTXN = true;
                 } else {
                     req.blockhash = pindex->GetBlockHash();
+                    (*queuedBlockIt)->fRoundTrip = true;
                     connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
                 }
             } else {
@@ -2480,6 +2674,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         BlockTransactions resp;
+        size_t nBlockTxnSize = vRecv.size();
         vRecv >> resp;
 
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
@@ -2524,7 +2719,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // though the block was successfully read, and rely on the
                 // handling in ProcessNewBlock to ensure the block index is
                 // updated, reject messages go out, etc.
-                MarkBlockAsReceived(resp.blockhash); // it is now an empty pointer
+                // The compact block and the transactions filled in make up the delivery.
+                const QueuedBlock& queued = *it->second.second;
+                MarkBlockAsReceived(resp.blockhash, pfrom->GetId(), queued.fRoundTrip ? queued.nBytesReceived + nBlockTxnSize : 0); // it is now an empty pointer
                 fBlockRead = true;
                 // mapBlockSource is only used for sending reject messages and DoS scores,
                 // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -2591,6 +2788,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         vRecv.SetVersion(original_version | legacy_block_flag);
 
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        size_t nBlockSize = vRecv.size();
         vRecv >> *pblock;
         vRecv.SetVersion(original_version);
 
@@ -2602,7 +2800,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
-            forceProcessing |= MarkBlockAsReceived(hash);
+            forceProcessing |= MarkBlockAsReceived(hash, pfrom->GetId(), nBlockSize);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
             mapBlockSource.emplace(hash, std::make_pair(pfrom->GetId(), true));
@@ -2884,6 +3082,17 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return true;
 
+    {
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (state && !state->setOrphanWork.empty()) {
+            ProcessOrphanTx(connman, state->setOrphanWork);
+            // Finish this peer's orphans before looking at its next message.
+            if (!state->setOrphanWork.empty())
+                return true;
+        }
+    }
+
     // Don't bother if send buffer is too full to respond anyway
     if (pfrom->fPauseSend)
         return false;
@@ -3587,10 +3796,10 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nBlocksInFlightAllowance) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInFlightAllowance - state.nBlocksInFlight, vToDownload, staller, consensusParams);
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -11,7 +11,13 @@
 #include "consensus/params.h"
 
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
-static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 10000;
+/** Default for -maxorphansize, maximum memory used by orphan transactions in megabytes */
+static const unsigned int DEFAULT_MAX_ORPHAN_POOL_SIZE = 20;
+/** Share of the orphan pool memory budget a single peer may fill, in percent */
+static const unsigned int MAX_ORPHAN_POOL_PEER_PERCENT = 25;
+/** Maximum number of orphan transactions reconsidered per peer and message-handler turn */
+static const unsigned int MAX_ORPHANS_PROCESSED_PER_TURN = 100;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** Minimum time between orphan transactions expire time checks in seconds */
@@ -69,11 +75,52 @@ private:
     int64_t m_stale_tip_check_time; //! Next time to check for stale tip
 };
 
+/**
+ * How fast a peer delivers the blocks requested from it: smoothed throughput,
+ * block size and round-trip latency, from which the number of blocks it may
+ * have in flight is sized. Protected by cs_main.
+ */
+struct CBlockDownloadStats
+{
+    //! Total size of the requested blocks received
+    uint64_t nBytesReceived = 0;
+    //! Smoothed delivery rate in bytes per second, or 0 if not measured yet
+    double dBytesPerSecond = 0;
+    //! Smoothed size of the requested blocks
+    double dAvgSize = 0;
+    //! Smoothed delay (in microseconds) between requesting a block on an idle connection and receiving it, or 0
+    int64_t nLatency = 0;
+    //! When the last requested block was received (in microseconds), or 0
+    int64_t nLastReceivedTime = 0;
+
+    /**
+     * Fold in the delivery, at nNow, of nSize bytes for a block requested at
+     * nTimeRequested. fFirstInFlight says that no other block requested from
+     * the peer was pending ahead of it.
+     */
+    void Update(int64_t nTimeRequested, bool fFirstInFlight, size_t nSize, int64_t nNow);
+
+    /** Blocks that may be in flight: twice the bandwidth-delay product, within bounds */
+    int GetAllowance() const;
+
+    /**
+     * Whether a block requested from this peer at nTimeRequested, and holding
+     * up the download window, should be requested from a peer with stats
+     * other instead. Peers that were never measured are left to the stalling
+     * timeout.
+     */
+    bool ShouldReassignTo(const CBlockDownloadStats& other, int64_t nTimeRequested, int64_t nNow) const;
+};
+
 struct CNodeStateStats {
     int nMisbehavior;
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInFlightAllowance;
+    uint64_t nBlockBytesReceived;
+    double dBlockBytesPerSecond;
+    double dBlockLatency;
 };
 
 /** Get statistics from node state */
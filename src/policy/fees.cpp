@@ -10,6 +10,7 @@
 #include "clientversion.h"
 #include "primitives/transaction.h"
 #include "random.h"
+#include "scheduler.h"
 #include "streams.h"
 #include "txmempool.h"
 #include "util.h"
@@ -515,9 +516,9 @@ void TxConfirmStats::removeTx(unsigned int entryHeight, unsigned int nBestSeenHe
 // tracked. Txs that were part of a block have already been removed in
 // processBlockTx to ensure they are never double tracked, but it is
 // of no harm to try to remove them again.
-bool CBlockPolicyEstimator::removeTx(uint256 hash, bool inBlock)
+bool CBlockPolicyEstimator::removeTxInternal(const uint256& hash, bool inBlock)
 {
-    LOCK(cs_feeEstimator);
+    AssertLockHeld(cs_feeEstimator);
     std::map<uint256, TxStatsInfo>::iterator pos = mapMemPoolTxs.find(hash);
     if (pos != mapMemPoolTxs.end()) {
         feeStats->removeTx(pos->second.blockHeight, nBestSeenHeight, pos->second.bucketIndex, inBlock);
@@ -531,7 +532,8 @@ bool CBlockPolicyEstimator::removeTx(uint256 hash, bool inBlock)
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator()
-    : nBestSeenHeight(0), firstRecordedHeight(0), historicalFirst(0), historicalBest(0), trackedTxs(0), untrackedTxs(0)
+    : nBestSeenHeight(0), firstRecordedHeight(0), historicalFirst(0), historicalBest(0), trackedTxs(0), untrackedTxs(0),
+      scheduler(nullptr), fProcessScheduled(false), nVersion(0)
 {
     static_assert(MIN_BUCKET_FEERATE > 0, "Min feerate must be nonzero");
     size_t bucketIndex = 0;
@@ -555,11 +557,96 @@ CBlockPolicyEstimator::~CBlockPolicyEstimator()
     delete longStats;
 }
 
-void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, bool validFeeEstimate)
+void CBlockPolicyEstimator::SetScheduler(CScheduler* schedulerIn)
+{
+    LOCK(cs_queue);
+    scheduler = schedulerIn;
+    // A task scheduled on the old scheduler may never run.
+    fProcessScheduled = false;
+}
+
+void CBlockPolicyEstimator::QueueEvent(QueuedEvent&& event)
 {
+    {
+        LOCK(cs_queue);
+        queuedEvents.push_back(std::move(event));
+        if (scheduler) {
+            if (!fProcessScheduled) {
+                fProcessScheduled = true;
+                scheduler->schedule(std::bind(&CBlockPolicyEstimator::ProcessQueuedEvents, this));
+            }
+            return;
+        }
+    }
+    ProcessQueuedEvents();
+}
+
+void CBlockPolicyEstimator::ProcessQueuedEvents()
+{
+    // Hold cs_feeEstimator across taking and applying the events so
+    // concurrent callers apply them in the order they were queued.
     LOCK(cs_feeEstimator);
-    unsigned int txHeight = entry.GetHeight();
-    uint256 hash = entry.GetTx().GetHash();
+    std::deque<QueuedEvent> events;
+    {
+        LOCK(cs_queue);
+        events.swap(queuedEvents);
+        fProcessScheduled = false;
+    }
+    for (const QueuedEvent& event : events) {
+        switch (event.type) {
+        case QueuedEvent::NEW_TX:
+            processTransactionInternal(event.vTxs[0], event.fValidFeeEstimate);
+            break;
+        case QueuedEvent::REMOVE_TX:
+            removeTxInternal(event.vTxs[0].hash, false);
+            break;
+        case QueuedEvent::BLOCK:
+            processBlockInternal(event.nBlockHeight, event.vTxs);
+            break;
+        }
+    }
+    nVersion += events.size();
+}
+
+void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, bool validFeeEstimate)
+{
+    QueuedEvent event;
+    event.type = QueuedEvent::NEW_TX;
+    event.nBlockHeight = 0;
+    event.fValidFeeEstimate = validFeeEstimate;
+    event.vTxs.push_back(TxFeeInfo{entry.GetTx().GetHash(), entry.GetHeight(), entry.GetFee(), entry.GetTxSize()});
+    QueueEvent(std::move(event));
+}
+
+void CBlockPolicyEstimator::removeTx(const uint256& hash)
+{
+    QueuedEvent event;
+    event.type = QueuedEvent::REMOVE_TX;
+    event.nBlockHeight = 0;
+    event.fValidFeeEstimate = false;
+    event.vTxs.push_back(TxFeeInfo{hash, 0, 0, 0});
+    QueueEvent(std::move(event));
+}
+
+void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
+                                         std::vector<const CTxMemPoolEntry*>& entries)
+{
+    QueuedEvent event;
+    event.type = QueuedEvent::BLOCK;
+    event.nBlockHeight = nBlockHeight;
+    event.fValidFeeEstimate = false;
+    event.vTxs.reserve(entries.size());
+    for (const CTxMemPoolEntry* entry : entries) {
+        event.vTxs.push_back(TxFeeInfo{entry->GetTx().GetHash(), entry->GetHeight(), entry->GetFee(), entry->GetTxSize()});
+    }
+    QueueEvent(std::move(event));
+}
+
+void CBlockPolicyEstimator::processTransactionInternal(const TxFeeInfo& info, bool validFeeEstimate)
+{
+    AssertLockHeld(cs_feeEstimator);
+    unsigned int txHeight = info.height;
+    const uint256& hash = info.hash;
     if (mapMemPoolTxs.count(hash)) {
         LogPrint(BCLog::ESTIMATEFEE, "Blockpolicy error mempool tx %s already being tracked\n",
                  hash.ToString().c_str());
@@ -583,7 +670,7 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     trackedTxs++;
 
     // Feerates are stored and reported as FAB-per-kb:
-    CFeeRate feeRate(entry.GetFee(), entry.GetTxSize());
+    CFeeRate feeRate(info.fee, info.size);
 
     mapMemPoolTxs[hash].blockHeight = txHeight;
     unsigned int bucketIndex = feeStats->NewTx(txHeight, (double)feeRate.GetFeePerK());
@@ -594,9 +681,9 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     assert(bucketIndex == bucketIndex3);
 }
 
-bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry)
+bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const TxFeeInfo& info)
 {
-    if (!removeTx(entry->GetTx().GetHash(), true)) {
+    if (!removeTxInternal(info.hash, true)) {
         // This transaction wasn't being tracked for fee estimation
         return false;
     }
@@ -604,7 +691,7 @@ bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     // How many blocks did it take for miners to include this transaction?
     // blocksToConfirm is 1-based, so a transaction included in the earliest
     // possible block has confirmation count of 1
-    int blocksToConfirm = nBlockHeight - entry->GetHeight();
+    int blocksToConfirm = nBlockHeight - info.height;
     if (blocksToConfirm <= 0) {
         // This can't happen because we don't process transactions from a block with a height
         // lower than our greatest seen height
@@ -613,7 +700,7 @@ bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     }
 
     // Feerates are stored and reported as FAB-per-kb:
-    CFeeRate feeRate(entry->GetFee(), entry->GetTxSize());
+    CFeeRate feeRate(info.fee, info.size);
 
     feeStats->Record(blocksToConfirm, (double)feeRate.GetFeePerK());
     shortStats->Record(blocksToConfirm, (double)feeRate.GetFeePerK());
@@ -621,10 +708,9 @@ bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     return true;
 }
 
-void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
-                                         std::vector<const CTxMemPoolEntry*>& entries)
+void CBlockPolicyEstimator::processBlockInternal(unsigned int nBlockHeight, const std::vector<TxFeeInfo>& entries)
 {
-    LOCK(cs_feeEstimator);
+    AssertLockHeld(cs_feeEstimator);
     if (nBlockHeight <= nBestSeenHeight) {
         // Ignore side chains and re-orgs; assuming they are random
         // they don't affect the estimate.
@@ -651,7 +737,7 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
 
     unsigned int countedTxs = 0;
     // Update averages with data points from current block
-    for (const auto& entry : entries) {
+    for (const TxFeeInfo& entry : entries) {
         if (processBlockTx(nBlockHeight, entry))
             countedTxs++;
     }
@@ -833,6 +919,7 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, FeeCalculation
     if (feeCalc) {
         feeCalc->desiredTarget = confTarget;
         feeCalc->returnedTarget = confTarget;
+        feeCalc->version = nVersion;
     }
 
     double median = -1;
@@ -1020,9 +1107,10 @@ void CBlockPolicyEstimator::FlushUnconfirmed(CTxMemPool& pool) {
     int64_t startclear = GetTimeMicros();
     std::vector<uint256> txids;
     pool.queryHashes(txids);
+    ProcessQueuedEvents();
     LOCK(cs_feeEstimator);
     for (auto& txid : txids) {
-        removeTx(txid, false);
+        removeTxInternal(txid, false);
     }
     int64_t endclear = GetTimeMicros();
     LogPrint(BCLog::ESTIMATEFEE, "Recorded %u unconfirmed txs from mempool in %gs\n",txids.size(), (endclear - startclear)*0.000001);
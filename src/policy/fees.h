@@ -11,12 +11,15 @@
 #include "random.h"
 #include "sync.h"
 
+#include <atomic>
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
 
 class CAutoFile;
 class CFeeRate;
+class CScheduler;
 class CTxMemPoolEntry;
 class CTxMemPool;
 class TxConfirmStats;
@@ -127,6 +130,7 @@ struct FeeCalculation
     FeeReason reason = FeeReason::NONE;
     int desiredTarget = 0;
     int returnedTarget = 0;
+    uint64_t version = 0; //!< Estimator version (see CBlockPolicyEstimator::GetVersion) the result was computed from, reported by estimatesmartfee
 };
 
 /**
@@ -197,8 +201,25 @@ public:
     /** Process a transaction accepted to the mempool*/
     void processTransaction(const CTxMemPoolEntry& entry, bool validFeeEstimate);
 
-    /** Remove a transaction from the mempool tracking stats*/
-    bool removeTx(uint256 hash, bool inBlock);
+    /** Remove a transaction that left the mempool without being mined from the tracking stats */
+    void removeTx(const uint256& hash);
+
+    /**
+     * Apply the mempool and block events above from the given scheduler's
+     * thread instead of the caller's, which keeps the stats updates off the
+     * block-connect path. Pass nullptr to go back to applying them inline.
+     */
+    void SetScheduler(CScheduler* scheduler);
+
+    /** Apply all queued events now */
+    void ProcessQueuedEvents();
+
+    /**
+     * Number of events applied so far. Estimates always reflect a complete
+     * prefix of the events; two reads returning the same version saw the
+     * same state.
+     */
+    uint64_t GetVersion() const { return nVersion; }
 
     /** DEPRECATED. Return a feerate estimate */
     CFeeRate estimateFee(int confTarget) const;
@@ -257,8 +278,41 @@ private:
 
     mutable CCriticalSection cs_feeEstimator;
 
+    /** What the estimator needs to know about a mempool transaction */
+    struct TxFeeInfo
+    {
+        uint256 hash;
+        unsigned int height;
+        CAmount fee;
+        size_t size;
+    };
+
+    /** A mempool or block event waiting to be applied to the stats */
+    struct QueuedEvent
+    {
+        enum Type { NEW_TX, REMOVE_TX, BLOCK };
+        Type type;
+        unsigned int nBlockHeight;     //!< BLOCK only
+        bool fValidFeeEstimate;        //!< NEW_TX only
+        std::vector<TxFeeInfo> vTxs;   //!< The transaction, or the block's transactions
+    };
+
+    /** Guards the event queue. Taken after cs_feeEstimator, never before. */
+    CCriticalSection cs_queue;
+    std::deque<QueuedEvent> queuedEvents;
+    CScheduler* scheduler;
+    bool fProcessScheduled;
+    std::atomic<uint64_t> nVersion;
+
+    void QueueEvent(QueuedEvent&& event);
+
+    /** Apply a queued event; these are the old synchronous entry points */
+    void processTransactionInternal(const TxFeeInfo& info, bool validFeeEstimate);
+    bool removeTxInternal(const uint256& hash, bool inBlock);
+    void processBlockInternal(unsigned int nBlockHeight, const std::vector<TxFeeInfo>& txs);
+
     /** Process a transaction confirmed in a block*/
-    bool processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry);
+    bool processBlockTx(unsigned int nBlockHeight, const TxFeeInfo& info);
 
     /** Helper for estimateSmartFee */
     double estimateCombinedFee(unsigned int confTarget, double successThreshold, bool checkShorterHorizon, EstimationResult *result) const;
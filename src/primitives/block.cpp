@@ -12,6 +12,36 @@
 #include "consensus/params.h"
 #include "crypto/common.h"
 
+#include <assert.h>
+
+static std::atomic<uint64_t> nHeaderHashes{0};
+
+uint64_t GetBlockHeaderHashCount()
+{
+    return nHeaderHashes.load(std::memory_order_relaxed);
+}
+
+uint256 CBlockHeader::GetHashForVersion(int nSerVersion) const
+{
+    uint256 hash;
+    if (hashCache.Get(nSerVersion, hash)) {
+#ifdef DEBUG
+        // A field written to directly after the header was hashed leaves
+        // the cached hash stale.
+        CHashWriter check(SER_GETHASH, nSerVersion);
+        ::Serialize(check, *this);
+        assert(check.GetHash() == hash);
+#endif
+        return hash;
+    }
+    CHashWriter writer(SER_GETHASH, nSerVersion);
+    ::Serialize(writer, *this);
+    hash = writer.GetHash();
+    nHeaderHashes.fetch_add(1, std::memory_order_relaxed);
+    hashCache.Set(nSerVersion, hash);
+    return hash;
+}
+
 uint256 CBlockHeader::GetHash(const Consensus::Params& params) const
 {
     int version;
@@ -25,16 +55,11 @@ uint256 CBlockHeader::GetHash(const Consensus::Params& params) const
     } else {
         version = PROTOCOL_VERSION | SERIALIZE_BLOCK_LEGACY;
     }
-    CHashWriter writer(SER_GETHASH, version);
-    ::Serialize(writer, *this);
-    return writer.GetHash();
+    return GetHashForVersion(version);
 }
 
 uint256 CBlockHeader::GetHashBeforeParamInitialization() const {
-    int version = PROTOCOL_VERSION;
-    CHashWriter writer(SER_GETHASH, version);
-    ::Serialize(writer, *this);
-    return writer.GetHash();
+    return GetHashForVersion(PROTOCOL_VERSION);
 }
 
 uint256 CBlockHeader::GetHash() const
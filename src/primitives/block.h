@@ -11,6 +11,8 @@
 #include "serialize.h"
 #include "uint256.h"
 #include "version.h"
+
+#include <atomic>
 #include <string.h>
 
 namespace Consensus {
@@ -19,6 +21,58 @@ namespace Consensus {
 
 static const int SERIALIZE_BLOCK_LEGACY = 0x04000000;
 
+/**
+ * The hash of a block header, kept from the first time it is computed until
+ * a field of the header changes. Headers are hashed from several threads at
+ * once, so only the first of them to finish stores the hash; the others use
+ * their own until it is there. A copy of a header starts without the hash,
+ * since the usual reason to copy one is to change it.
+ */
+class CBlockHeaderHashCache
+{
+private:
+    enum { EMPTY, FILLING, FULL };
+
+    mutable std::atomic<int> nState;
+    mutable uint256 hash;
+    //! Serialization version the hash is of
+    mutable int nVersion;
+
+public:
+    CBlockHeaderHashCache() : nState(EMPTY), nVersion(0) {}
+    CBlockHeaderHashCache(const CBlockHeaderHashCache&) : nState(EMPTY), nVersion(0) {}
+
+    CBlockHeaderHashCache& operator=(const CBlockHeaderHashCache&)
+    {
+        nState = EMPTY;
+        return *this;
+    }
+
+    bool Get(int nVersionIn, uint256& hashOut) const
+    {
+        if (nState.load(std::memory_order_acquire) != FULL || nVersion != nVersionIn)
+            return false;
+        hashOut = hash;
+        return true;
+    }
+
+    void Set(int nVersionIn, const uint256& hashIn) const
+    {
+        int nExpected = EMPTY;
+        if (nState.compare_exchange_strong(nExpected, FILLING, std::memory_order_acquire)) {
+            hash = hashIn;
+            nVersion = nVersionIn;
+            nState.store(FULL, std::memory_order_release);
+        }
+    }
+
+    //! Only while no other thread uses the header, like the fields themselves
+    void Clear() { nState = EMPTY; }
+};
+
+/** Number of block header hashes computed, rather than taken from a header's cache, so far */
+uint64_t GetBlockHeaderHashCount();
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -41,6 +95,9 @@ public:
     uint256 nNonce;
     std::vector<unsigned char> nSolution;  // Equihash solution.
 
+    // memory only
+    CBlockHeaderHashCache hashCache;
+
     CBlockHeader()
     {
         SetNull();
@@ -51,6 +108,8 @@ public:
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
+        if (ser_action.ForRead())
+            hashCache.Clear();
         bool new_format = !(s.GetVersion() & SERIALIZE_BLOCK_LEGACY);
         READWRITE(this->nVersion);
         READWRITE(hashPrevBlock);
@@ -84,8 +143,25 @@ public:
         nBits = 0;
         nNonce.SetNull();
         nSolution.clear();
+        hashCache.Clear();
     }
 
+    /**
+     * Fields that change after the header may have been hashed, as they do
+     * while mining, have to be set through these, or the cached hash dropped
+     * with InvalidateHash(), for GetHash() to see the change. Builds with
+     * -DDEBUG check every hash taken from the cache against a new one.
+     */
+    void SetVersion(int32_t nVersionIn) { nVersion = nVersionIn; hashCache.Clear(); }
+    void SetPrevBlock(const uint256& hashPrevBlockIn) { hashPrevBlock = hashPrevBlockIn; hashCache.Clear(); }
+    void SetMerkleRoot(const uint256& hashMerkleRootIn) { hashMerkleRoot = hashMerkleRootIn; hashCache.Clear(); }
+    void SetHeight(uint32_t nHeightIn) { nHeight = nHeightIn; hashCache.Clear(); }
+    void SetTime(uint32_t nTimeIn) { nTime = nTimeIn; hashCache.Clear(); }
+    void SetBits(uint32_t nBitsIn) { nBits = nBitsIn; hashCache.Clear(); }
+    void SetNonce(const uint256& nNonceIn) { nNonce = nNonceIn; hashCache.Clear(); }
+    void SetSolution(const std::vector<unsigned char>& nSolutionIn) { nSolution = nSolutionIn; hashCache.Clear(); }
+    void InvalidateHash() { hashCache.Clear(); }
+
     bool IsNull() const
     {
         return (nBits == 0);
@@ -99,6 +175,9 @@ public:
     {
         return (int64_t)nTime;
     }
+
+private:
+    uint256 GetHashForVersion(int nSerVersion) const;
 };
 
 
@@ -139,16 +218,8 @@ public:
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nHeight        = nHeight;
-        memcpy(block.nReserved, nReserved, sizeof(block.nReserved));
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
+        // The copy keeps the cached hash
+        CBlockHeader block = *this;
         return block;
     }
 
@@ -181,6 +181,43 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
 }
 
+bool CPubKey::VerifyBatch(const std::vector<CDeferredSignature>& vSigs, std::vector<bool>* pvResult)
+{
+    // Parse what can be parsed; the others are simply invalid.
+    std::vector<secp256k1_pubkey> vPubkey(vSigs.size());
+    std::vector<secp256k1_ecdsa_signature> vSig(vSigs.size());
+    std::vector<const secp256k1_pubkey*> vpPubkey;
+    std::vector<const secp256k1_ecdsa_signature*> vpSig;
+    std::vector<const unsigned char*> vpHash;
+    std::vector<size_t> vIndex;
+    for (size_t i = 0; i < vSigs.size(); i++) {
+        const CDeferredSignature& sig = vSigs[i];
+        if (!sig.pubkey.IsValid() ||
+            !secp256k1_ec_pubkey_parse(secp256k1_context_verify, &vPubkey[i], sig.pubkey.begin(), sig.pubkey.size()) ||
+            !ecdsa_signature_parse_der_lax(secp256k1_context_verify, &vSig[i], sig.vchSig.data(), sig.vchSig.size())) {
+            continue;
+        }
+        // See Verify.
+        secp256k1_ecdsa_signature_normalize(secp256k1_context_verify, &vSig[i], &vSig[i]);
+        vpPubkey.push_back(&vPubkey[i]);
+        vpSig.push_back(&vSig[i]);
+        vpHash.push_back(sig.hash.begin());
+        vIndex.push_back(i);
+    }
+
+    std::vector<int> vValid(vIndex.size());
+    bool fAllValid = vIndex.size() == vSigs.size();
+    if (!vIndex.empty()) {
+        fAllValid &= secp256k1_ecdsa_verify_batch(secp256k1_context_verify, vValid.data(), vpSig.data(), vpHash.data(), vpPubkey.data(), vIndex.size()) == 1;
+    }
+    if (pvResult) {
+        pvResult->assign(vSigs.size(), false);
+        for (size_t j = 0; j < vIndex.size(); j++)
+            (*pvResult)[vIndex[j]] = vValid[j] != 0;
+    }
+    return fAllValid;
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
@@ -36,6 +36,8 @@ public:
 typedef uint256 ChainCode;
 
 /** An encapsulated public key. */
+struct CDeferredSignature;
+
 class CPubKey
 {
 private:
@@ -175,6 +177,13 @@ public:
      */
     bool Verify(const uint256& hash, const std::vector<unsigned char>& vchSig) const;
 
+    /**
+     * Verify a number of DER signatures, each with the same result Verify
+     * would give, but faster. If pvResult is given, it is set to the result
+     * of each one. Returns whether all of them are valid.
+     */
+    static bool VerifyBatch(const std::vector<CDeferredSignature>& vSigs, std::vector<bool>* pvResult = nullptr);
+
     /**
      * Check whether a signature is normalized (lower-S).
      */
@@ -190,6 +199,16 @@ public:
     bool Derive(CPubKey& pubkeyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 };
 
+/** A signature check put off, to be verified along with others by CPubKey::VerifyBatch() */
+struct CDeferredSignature
+{
+    CPubKey pubkey;
+    uint256 hash;
+    std::vector<unsigned char> vchSig;
+
+    CDeferredSignature(const CPubKey& pubkeyIn, const uint256& hashIn, const std::vector<unsigned char>& vchSigIn) : pubkey(pubkeyIn), hash(hashIn), vchSig(vchSigIn) {}
+};
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
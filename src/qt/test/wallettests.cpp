@@ -157,7 +157,11 @@ void TestSendCoins()
         wallet.SetAddressBook(test.coinbaseKey.GetPubKey().GetID(), "", "receive");
         wallet.AddKeyPubKey(test.coinbaseKey, test.coinbaseKey.GetPubKey());
     }
-    wallet.ScanForWalletTransactions(chainActive.Genesis(), true);
+    {
+        WalletRescanReserver reserver(&wallet);
+        reserver.Reserve();
+        wallet.ScanForWalletTransactions(chainActive.Genesis(), reserver, true);
+    }
     wallet.SetBroadcastTransactions(true);
 
     // Create widgets for sending coins and listing transactions.
@@ -409,27 +409,23 @@ std::string EntryDescriptionString()
            "       ... ]\n";
 }
 
-void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+void entryToJSON(UniValue &info, const CTxMemPoolSnapshotEntry &e)
 {
-    AssertLockHeld(mempool.cs);
-
-    info.push_back(Pair("size", (int)e.GetTxSize()));
-    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-    info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
-    info.push_back(Pair("time", e.GetTime()));
-    info.push_back(Pair("height", (int)e.GetHeight()));
-    info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
-    info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
-    info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
-    info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
-    info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
-    info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
-    const CTransaction& tx = e.GetTx();
+    info.push_back(Pair("size", (int)e.nTxSize));
+    info.push_back(Pair("fee", ValueFromAmount(e.nFee)));
+    info.push_back(Pair("modifiedfee", ValueFromAmount(e.nModifiedFee)));
+    info.push_back(Pair("time", e.nTime));
+    info.push_back(Pair("height", (int)e.nHeight));
+    info.push_back(Pair("descendantcount", e.nCountWithDescendants));
+    info.push_back(Pair("descendantsize", e.nSizeWithDescendants));
+    info.push_back(Pair("descendantfees", e.nModFeesWithDescendants));
+    info.push_back(Pair("ancestorcount", e.nCountWithAncestors));
+    info.push_back(Pair("ancestorsize", e.nSizeWithAncestors));
+    info.push_back(Pair("ancestorfees", e.nModFeesWithAncestors));
     std::set<std::string> setDepends;
-    for (const CTxIn& txin : tx.vin)
+    for (const uint256& parent : e.vParents)
     {
-        if (mempool.exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
+        setDepends.insert(parent.ToString());
     }
 
     UniValue depends(UniValue::VARR);
@@ -443,32 +439,67 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
 
 UniValue mempoolToJSON(bool fVerbose)
 {
+    // Work from a snapshot so that building the reply doesn't hold mempool.cs
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
     if (fVerbose)
     {
-        LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : mempool.mapTx)
+        for (const auto& e : snapshot->vEntries)
         {
-            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
-            o.push_back(Pair(hash.ToString(), info));
+            entryToJSON(info, *e);
+            o.push_back(Pair(e->GetHash().ToString(), info));
         }
         return o;
     }
     else
     {
-        std::vector<uint256> vtxid;
-        mempool.queryHashes(vtxid);
-
         UniValue a(UniValue::VARR);
-        for (const uint256& hash : vtxid)
-            a.push_back(hash.ToString());
+        for (const CTxMemPoolSnapshotEntry* e : snapshot->GetSortedDepthAndScore())
+            a.push_back(e->GetHash().ToString());
 
         return a;
     }
 }
 
+/** Collect the in-mempool ancestors (or descendants) of an entry, excluding the entry itself. */
+static std::set<uint256> CollectRelatives(const CTxMemPoolSnapshot& snapshot, const CTxMemPoolSnapshotEntry& entry, bool fAncestors)
+{
+    std::set<uint256> setRelatives;
+    std::vector<const CTxMemPoolSnapshotEntry*> vQueue{&entry};
+    while (!vQueue.empty()) {
+        const CTxMemPoolSnapshotEntry* e = vQueue.back();
+        vQueue.pop_back();
+        for (const uint256& hash : fAncestors ? e->vParents : e->vChildren) {
+            if (!setRelatives.insert(hash).second)
+                continue;
+            const CTxMemPoolSnapshotEntry* relative = snapshot.Find(hash);
+            assert(relative);
+            vQueue.push_back(relative);
+        }
+    }
+    return setRelatives;
+}
+
+static UniValue RelativesToJSON(const CTxMemPoolSnapshot& snapshot, const std::set<uint256>& setRelatives, bool fVerbose)
+{
+    if (!fVerbose) {
+        UniValue o(UniValue::VARR);
+        for (const uint256& hash : setRelatives) {
+            o.push_back(hash.ToString());
+        }
+        return o;
+    }
+
+    UniValue o(UniValue::VOBJ);
+    for (const uint256& hash : setRelatives) {
+        UniValue info(UniValue::VOBJ);
+        entryToJSON(info, *snapshot.Find(hash));
+        o.push_back(Pair(hash.ToString(), info));
+    }
+    return o;
+}
+
 UniValue getrawmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -533,36 +564,13 @@ UniValue getmempoolancestors(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
-
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
+    const CTxMemPoolSnapshotEntry* entry = snapshot->Find(hash);
+    if (!entry) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
     }
 
-    CTxMemPool::setEntries setAncestors;
-    uint64_t noLimit = std::numeric_limits<uint64_t>::max();
-    std::string dummy;
-    mempool.CalculateMemPoolAncestors(*it, setAncestors, noLimit, noLimit, noLimit, noLimit, dummy, false);
-
-    if (!fVerbose) {
-        UniValue o(UniValue::VARR);
-        for (CTxMemPool::txiter ancestorIt : setAncestors) {
-            o.push_back(ancestorIt->GetTx().GetHash().ToString());
-        }
-
-        return o;
-    } else {
-        UniValue o(UniValue::VOBJ);
-        for (CTxMemPool::txiter ancestorIt : setAncestors) {
-            const CTxMemPoolEntry &e = *ancestorIt;
-            const uint256& _hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
-            o.push_back(Pair(_hash.ToString(), info));
-        }
-        return o;
-    }
+    return RelativesToJSON(*snapshot, CollectRelatives(*snapshot, *entry, true), fVerbose);
 }
 
 UniValue getmempooldescendants(const JSONRPCRequest& request)
@@ -597,36 +605,13 @@ UniValue getmempooldescendants(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
-
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
+    const CTxMemPoolSnapshotEntry* entry = snapshot->Find(hash);
+    if (!entry) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
     }
 
-    CTxMemPool::setEntries setDescendants;
-    mempool.CalculateDescendants(it, setDescendants);
-    // CTxMemPool::CalculateDescendants will include the given tx
-    setDescendants.erase(it);
-
-    if (!fVerbose) {
-        UniValue o(UniValue::VARR);
-        for (CTxMemPool::txiter descendantIt : setDescendants) {
-            o.push_back(descendantIt->GetTx().GetHash().ToString());
-        }
-
-        return o;
-    } else {
-        UniValue o(UniValue::VOBJ);
-        for (CTxMemPool::txiter descendantIt : setDescendants) {
-            const CTxMemPoolEntry &e = *descendantIt;
-            const uint256& _hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
-            o.push_back(Pair(_hash.ToString(), info));
-        }
-        return o;
-    }
+    return RelativesToJSON(*snapshot, CollectRelatives(*snapshot, *entry, false), fVerbose);
 }
 
 UniValue getmempoolentry(const JSONRPCRequest& request)
@@ -649,19 +634,76 @@ UniValue getmempoolentry(const JSONRPCRequest& request)
 
     uint256 hash = ParseHashV(request.params[0], "parameter 1");
 
-    LOCK(mempool.cs);
-
-    CTxMemPool::txiter it = mempool.mapTx.find(hash);
-    if (it == mempool.mapTx.end()) {
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
+    const CTxMemPoolSnapshotEntry* entry = snapshot->Find(hash);
+    if (!entry) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not in mempool");
     }
 
-    const CTxMemPoolEntry &e = *it;
     UniValue info(UniValue::VOBJ);
-    entryToJSON(info, e);
+    entryToJSON(info, *entry);
     return info;
 }
 
+UniValue getmempooldelta(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "getmempooldelta sequence\n"
+            "\nReturns the transactions added to and removed from the mempool since the given sequence number.\n"
+            "Apply \"removed\" before \"added\": a transaction that was removed and then added again is in both.\n"
+            "If the changes since sequence are no longer known (or sequence is 0), \"reset\" is true and \"added\"\n"
+            "holds the whole mempool.\n"
+            "\nArguments:\n"
+            "1. sequence               (numeric, required) Sequence number returned by a previous call, or 0\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sequence\" : n,         (numeric) Current sequence number, to pass to the next call\n"
+            "  \"reset\" : true|false,   (boolean) Whether the caller must drop what it knows about the mempool\n"
+            "  \"added\" : [             (array) Transaction ids of transactions added to the mempool\n"
+            "    \"transactionid\", ...\n"
+            "  ],\n"
+            "  \"removed\" : [           (array) Transaction ids of transactions removed from the mempool\n"
+            "    \"transactionid\", ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempooldelta", "0")
+            + HelpExampleRpc("getmempooldelta", "0")
+        );
+    }
+
+    int64_t nSince = request.params[0].get_int64();
+    if (nSince < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative sequence number");
+    }
+
+    uint64_t nSequence = 0;
+    std::vector<uint256> vAdded, vRemoved;
+    bool fReset = nSince == 0 || !mempool.GetDelta(nSince, nSequence, vAdded, vRemoved);
+
+    UniValue added(UniValue::VARR);
+    UniValue removed(UniValue::VARR);
+    if (fReset) {
+        std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
+        nSequence = snapshot->nSequence;
+        for (const auto& e : snapshot->vEntries)
+            added.push_back(e->GetHash().ToString());
+    } else {
+        for (const uint256& hash : vAdded)
+            added.push_back(hash.ToString());
+        for (const uint256& hash : vRemoved)
+            removed.push_back(hash.ToString());
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("sequence", (int64_t)nSequence));
+    ret.push_back(Pair("reset", fReset));
+    ret.push_back(Pair("added", added));
+    ret.push_back(Pair("removed", removed));
+    return ret;
+}
+
 UniValue getblockhash(const JSONRPCRequest& request)
 {
     FunctionProfile profileThis("getblockhash", - 1, 10);
@@ -852,76 +894,6 @@ UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
-    stats.nTransactions++;
-    for (const auto output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue);
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -971,45 +943,144 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
     return uint64_t(height);
 }
 
+/**
+ * Finalizing a MuHash takes milliseconds, so remember the last result, keyed
+ * on the MuHash state itself: a scan of the same block can arrive at a
+ * different set (or a different representation of the same one).
+ */
+static std::mutex cs_muhashCache;
+static std::pair<uint256, uint256> muhashCache;
+
+static uint256 GetDigestHash(const CCoinsSetDigest& digest)
+{
+    const uint256 hashState = SerializeHash(digest.muhash);
+    {
+        std::lock_guard<std::mutex> lock(cs_muhashCache);
+        if (muhashCache.first == hashState)
+            return muhashCache.second;
+    }
+    uint256 hash = digest.GetHash();
+    std::lock_guard<std::mutex> lock(cs_muhashCache);
+    muhashCache = std::make_pair(hashState, hash);
+    return hash;
+}
+
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( verify )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "These come from a digest that is kept up to date as blocks are connected, so the call is cheap.\n"
+            "With verify, the whole set is scanned as well and checked against the digest; this may take some time.\n"
+            "\nArguments:\n"
+            "1. verify    (boolean, optional, default=false) Scan the whole UTXO set\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
+            "  \"muhash\": \"hash\",      (string) The order independent MuHash3072 of the set\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"total_amount\": x.xxx,  (numeric) The total amount\n"
+            "  \"transactions\": n,      (numeric) With verify: the number of transactions\n"
+            "  \"hash_serialized_2\": \"hash\", (string) With verify: the serialized hash\n"
+            "  \"verified\": true|false  (boolean) With verify: whether the scan matched the digest\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
-            + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "true")
+            + HelpExampleRpc("gettxoutsetinfo", "true")
         );
 
+    bool fVerify = !request.params[0].isNull() && request.params[0].get_bool();
+
     UniValue ret(UniValue::VOBJ);
 
+    CCoinsSetDigest digest;
+    int nHeight = 0;
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        digest = coinsTipDigest;
+        bool fHaveDigest = chainActive.Tip() && digest.hashBlock == chainActive.Tip()->GetBlockHash();
+        if (fHaveDigest)
+            nHeight = chainActive.Height();
+        if (fVerify || !fHaveDigest) {
+            // The cursor pins the set the digest describes.
+            FlushStateToDisk();
+            pcursor.reset(pcoinsdbview->Cursor());
+            if (!fHaveDigest)
+                digest = CCoinsSetDigest();
+        }
+    }
+
+    if (pcursor) {
+        CCoinsStats stats;
+        if (!GetUTXOStats(pcursor.get(), stats))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        if (fVerify) {
+            ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+            ret.push_back(Pair("verified", digest.hashBlock == stats.hashBlock &&
+                                           digest.nTransactionOutputs == stats.digest.nTransactionOutputs &&
+                                           digest.nBogoSize == stats.digest.nBogoSize &&
+                                           digest.nTotalAmount == stats.digest.nTotalAmount &&
+                                           GetDigestHash(digest) == GetDigestHash(stats.digest)));
+        }
+        // Report the scan whenever we have it
+        digest = stats.digest;
+        nHeight = stats.nHeight;
+    }
+
+    ret.push_back(Pair("height", (int64_t)nHeight));
+    ret.push_back(Pair("bestblock", digest.hashBlock.GetHex()));
+    ret.push_back(Pair("txouts", digest.nTransactionOutputs));
+    ret.push_back(Pair("bogosize", digest.nBogoSize));
+    ret.push_back(Pair("muhash", GetDigestHash(digest).GetHex()));
+    ret.push_back(Pair("disk_size", (uint64_t)pcoinsdbview->EstimateSize()));
+    ret.push_back(Pair("total_amount", ValueFromAmount(digest.nTotalAmount)));
+    return ret;
+}
+
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the current tip to a snapshot file,\n"
+            "which another node can bootstrap from with -loadtxoutset. That node also needs\n"
+            "-loadtxoutsethash, set to the hash_serialized_2 of the set as reported by a node it trusts.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write. Relative paths are taken relative to the data directory.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,           (numeric) The number of transaction outputs written\n"
+            "  \"base_hash\": \"hash\",          (string) The block the snapshot was taken at\n"
+            "  \"base_height\": n,             (numeric) The height of that block\n"
+            "  \"path\": \"path\",               (string) The absolute path of the snapshot\n"
+            "  \"hash_serialized_2\": \"hash\",  (string) The serialized hash of the set, as in gettxoutsetinfo\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview, stats)) {
-        ret.push_back(Pair("height", (int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
-        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
-        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
-        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
-        ret.push_back(Pair("disk_size", stats.nDiskSize));
-        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
-    } else {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+    std::string strError;
+    if (!DumpUTXOSnapshot(path, stats, strError)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
     }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("base_hash", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
     return ret;
 }
 
@@ -1093,6 +1164,99 @@ UniValue gettxout(const JSONRPCRequest& request)
     return ret;
 }
 
+static UniValue DBStatsToJSON(const CDBWrapper& db)
+{
+    UniValue ret(UniValue::VOBJ);
+
+    const DBOptions& dbOptions = db.GetDBOptions();
+    UniValue options(UniValue::VOBJ);
+    options.push_back(Pair("block_cache", (uint64_t)dbOptions.nBlockCacheSize));
+    options.push_back(Pair("write_buffer", (uint64_t)dbOptions.nWriteBufferSize));
+    options.push_back(Pair("bloom_bits", dbOptions.nBloomBits));
+    options.push_back(Pair("max_open_files", dbOptions.nMaxOpenFiles));
+    ret.push_back(Pair("options", options));
+
+    ret.push_back(Pair("block_cache_usage", (uint64_t)db.GetBlockCacheUsage()));
+    std::string strValue;
+    if (db.GetProperty("leveldb.approximate-memory-usage", strValue))
+        ret.push_back(Pair("memory_usage", atoi64(strValue)));
+    UniValue levels(UniValue::VARR);
+    for (int nLevel = 0; db.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strValue); nLevel++)
+        levels.push_back(atoi64(strValue));
+    ret.push_back(Pair("files_per_level", levels));
+
+    uint64_t nTotalSize = 0;
+    UniValue prefixes(UniValue::VOBJ);
+    for (const auto& entry : db.GetPrefixStats()) {
+        const DBPrefixStats& stats = entry.second;
+        const uint64_t nSize = db.EstimatePrefixSize(entry.first);
+        nTotalSize += nSize;
+        UniValue prefix(UniValue::VOBJ);
+        prefix.push_back(Pair("reads", stats.nReads));
+        prefix.push_back(Pair("read_hits", stats.nReadHits));
+        prefix.push_back(Pair("read_bytes", stats.nReadBytes));
+        prefix.push_back(Pair("writes", stats.nWrites));
+        prefix.push_back(Pair("write_bytes", stats.nWriteBytes));
+        prefix.push_back(Pair("erases", stats.nErases));
+        prefix.push_back(Pair("size", nSize));
+        const bool fPrintable = entry.first > ' ' && entry.first < 0x7f;
+        prefixes.push_back(Pair(fPrintable ? std::string(1, (char)entry.first) : strprintf("0x%02x", entry.first), prefix));
+    }
+    ret.push_back(Pair("prefixes", prefixes));
+    ret.push_back(Pair("prefixes_size", nTotalSize));
+
+    if (db.GetProperty("leveldb.stats", strValue))
+        ret.push_back(Pair("leveldb_stats", strValue));
+    return ret;
+}
+
+UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getdbstats\n"
+            "\nReturns the settings and usage statistics of the chain state and block index databases.\n"
+            "Counters are kept per key prefix (the first byte of a key; e.g. 'C' for coins) since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {             (json object) the chain state database\n"
+            "    \"options\": {              (json object) the LevelDB settings in use\n"
+            "      \"block_cache\": n,       (numeric) size of the block cache in bytes (-chainstatedbblockcache)\n"
+            "      \"write_buffer\": n,      (numeric) size of a write buffer in bytes (-chainstatedbwritebuffer)\n"
+            "      \"bloom_bits\": n,        (numeric) bloom filter bits per key (-chainstatedbbloombits)\n"
+            "      \"max_open_files\": n     (numeric) the number of table files kept open\n"
+            "    },\n"
+            "    \"block_cache_usage\": n,   (numeric) bytes held by the block cache\n"
+            "    \"memory_usage\": n,        (numeric) approximate memory used by LevelDB\n"
+            "    \"files_per_level\": [n,...], (json array) number of table files at each level\n"
+            "    \"prefixes\": {             (json object) per key prefix\n"
+            "      \"prefix\": {\n"
+            "        \"reads\": n,           (numeric) point lookups\n"
+            "        \"read_hits\": n,       (numeric) point lookups that found a value\n"
+            "        \"read_bytes\": n,      (numeric) value bytes read\n"
+            "        \"writes\": n,          (numeric) values written\n"
+            "        \"write_bytes\": n,     (numeric) key and value bytes written\n"
+            "        \"erases\": n,          (numeric) keys erased\n"
+            "        \"size\": n             (numeric) approximate size on disk\n"
+            "      }, ...\n"
+            "    },\n"
+            "    \"prefixes_size\": n,       (numeric) approximate size on disk of the prefixes above\n"
+            "    \"leveldb_stats\": \"...\"   (string) LevelDB's compaction statistics\n"
+            "  },\n"
+            "  \"blockindex\": {...}        (json object) the block index database, as above (-blockindexdb* options)\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB())));
+    ret.push_back(Pair("blockindex", DBStatsToJSON(*pblocktree)));
+    return ret;
+}
+
 UniValue verifychain(const JSONRPCRequest& request)
 {
     int nCheckLevel = gArgs.GetArg("-checklevel", DEFAULT_CHECKLEVEL);
@@ -1210,6 +1374,15 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored\n"
+            "  \"coinsflush\": {           (object) background writes of the UTXO cache to disk\n"
+            "     \"count\": xx,             (numeric) number of background flushes started\n"
+            "     \"failures\": xx,          (numeric) number of background flushes that failed\n"
+            "     \"in_progress\": xx,       (boolean) whether a flush is being written right now\n"
+            "     \"last_size\": xx,         (numeric) number of modified coins in the last flush\n"
+            "     \"last_stall_ms\": xx,     (numeric) time block validation was held up by the last flush\n"
+            "     \"total_stall_ms\": xx,    (numeric) time block validation was held up by all flushes\n"
+            "     \"last_write_ms\": xx      (numeric) duration of the last completed background write\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -1254,6 +1427,17 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
     obj.push_back(Pair("pruned",                fPruneMode));
 
+    CoinsFlushStats flushStats = pcoinsflusher->GetStats();
+    UniValue coinsflush(UniValue::VOBJ);
+    coinsflush.push_back(Pair("count",          flushStats.nFlushes));
+    coinsflush.push_back(Pair("failures",       flushStats.nFailures));
+    coinsflush.push_back(Pair("in_progress",    flushStats.fInProgress));
+    coinsflush.push_back(Pair("last_size",      (uint64_t)flushStats.nLastDirty));
+    coinsflush.push_back(Pair("last_stall_ms",  flushStats.nLastStallMicros * 0.001));
+    coinsflush.push_back(Pair("total_stall_ms", flushStats.nTotalStallMicros * 0.001));
+    coinsflush.push_back(Pair("last_write_ms",  flushStats.nLastWriteMicros * 0.001));
+    obj.push_back(Pair("coinsflush",            coinsflush));
+
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CBlockIndex* tip = chainActive.Tip();
     UniValue softforks(UniValue::VARR);
@@ -1398,6 +1582,7 @@ UniValue getchaintips(const JSONRPCRequest& request)
 UniValue mempoolInfoToJSON()
 {
     UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("loaded", mempool.IsLoaded()));
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
@@ -1416,6 +1601,7 @@ UniValue getmempoolinfo(const JSONRPCRequest& request)
             "\nReturns details on the active state of the TX memory pool.\n"
             "\nResult:\n"
             "{\n"
+            "  \"loaded\": true|false,        (boolean) Whether the mempool saved at shutdown has been fully loaded\n"
             "  \"size\": xxxxx,               (numeric) Current tx count\n"
             "  \"bytes\": xxxxx,              (numeric) Sum of all virtual transaction sizes as defined in BIP 141. Differs from actual serialized size because witness data is discounted\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
@@ -1623,10 +1809,13 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true,  {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
+    { "blockchain",         "getmempooldelta",        &getmempooldelta,        true,  {"sequence"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {"verify"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,  {"path"} },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,  {} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
 
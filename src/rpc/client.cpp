@@ -103,6 +103,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "fundrawtransaction", 1, "options" },
     { "gettxout", 1, "n" },
     { "gettxout", 2, "include_mempool" },
+    { "gettxoutsetinfo", 0, "verify" },
     { "gettxoutproof", 0, "txids" },
     { "lockunspent", 0, "unlock" },
     { "lockunspent", 1, "transactions" },
@@ -127,6 +128,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "setban", 3, "absolute" },
     { "setnetworkactive", 0, "state" },
     { "getmempoolancestors", 1, "verbose" },
+    { "getmempooldelta", 0, "sequence" },
     { "getmempooldescendants", 1, "verbose" },
     { "bumpfee", 1, "options" },
     { "logging", 0, "include" },
@@ -166,7 +166,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
             // Solve sha256d.
             while (nMaxTries > 0 && (int)pblock->nNonce.GetUint64(0) < nInnerLoopCount &&
                    !CheckProofOfWork(pblock->GetHash(), pblock->nBits, false, Params().GetConsensus())) {
-                pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
+                pblock->SetNonce(ArithToUint256(UintToArith256(pblock->nNonce) + 1));
                 --nMaxTries;
             }
         } else {
@@ -195,7 +195,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
 
                 // Yes, there is a chance every nonce could fail to satisfy the -regtest
                 // target -- 1 in 2^(2^256). That ain't gonna happen
-                pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
+                pblock->SetNonce(ArithToUint256(UintToArith256(pblock->nNonce) + 1));
                 ++nCounter;
 
                 if( conf.useGPU )
@@ -216,7 +216,7 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
                 std::function<bool(std::vector<unsigned char>)> validBlock =
                     [&pblock](std::vector<unsigned char> soln) 
                 {
-                    pblock->nSolution = soln;
+                    pblock->SetSolution(soln);
                     // TODO(h4x3rotab): Add metrics counter like Zcash? `solutionTargetChecks.increment();`
                     // TODO(h4x3rotab): Maybe switch to EhBasicSolve and better deal with `nMaxTries`?
                     return CheckProofOfWork(pblock->GetHash(), pblock->nBits, true, Params().GetConsensus());
@@ -657,8 +657,8 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
 
     // Update nTime
     UpdateTime(pblock, consensusParams, pindexPrev);
-    pblock->nNonce = uint256();
-    pblock->nSolution.clear();
+    pblock->SetNonce(uint256());
+    pblock->SetSolution(std::vector<unsigned char>());
 
     // NOTE: If at some point we support pre-segwit miners post-segwit-activation, this needs to take segwit support into consideration
     const bool fPreSegWit = !IsWitnessEnabled(pindexPrev, consensusParams);  
@@ -728,7 +728,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
                 break;
             case THRESHOLD_LOCKED_IN:
                 // Ensure bit is set in block version
-                pblock->nVersion |= VersionBitsMask(consensusParams, pos);
+                pblock->SetVersion(pblock->nVersion | VersionBitsMask(consensusParams, pos));
                 // FALL THROUGH to get vbavailable set...
             case THRESHOLD_STARTED:
             {
@@ -737,7 +737,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
                 if (setClientRules.find(vbinfo.name) == setClientRules.end()) {
                     if (!vbinfo.gbt_force) {
                         // If the client doesn't support this, don't indicate it in the [default] version
-                        pblock->nVersion &= ~VersionBitsMask(consensusParams, pos);
+                        pblock->SetVersion(pblock->nVersion & ~VersionBitsMask(consensusParams, pos));
                     }
                 }
                 break;
@@ -992,6 +992,8 @@ UniValue estimatesmartfee(const JSONRPCRequest& request)
             "  \"feerate\" : x.x,     (numeric, optional) estimate fee-per-kilobyte (in FAB)\n"
             "  \"errors\": [ str... ] (json array of strings, optional) Errors encountered during processing\n"
             "  \"blocks\" : n         (numeric) block number where estimate was found\n"
+            "  \"estimator_version\" : n (numeric) The number of updates the fee estimator had applied;\n"
+            "                       estimates with the same version were made from the same data\n"
             "}\n"
             "\n"
             "The request target will be clamped between 2 and the highest target\n"
@@ -1025,6 +1027,7 @@ UniValue estimatesmartfee(const JSONRPCRequest& request)
         result.push_back(Pair("errors", errors));
     }
     result.push_back(Pair("blocks", feeCalc.returnedTarget));
+    result.push_back(Pair("estimator_version", feeCalc.version));
     return result;
 }
 
@@ -102,6 +102,10 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"inflightallowance\": n,    (numeric) How many blocks we are willing to have in flight from this peer\n"
+            "    \"blockbytesrecv\": n,       (numeric) The total size of requested blocks received from this peer\n"
+            "    \"blockbytespersec\": n,     (numeric) Measured rate at which this peer delivers requested blocks (if any)\n"
+            "    \"blocklatency\": n,         (numeric) Measured delay in seconds between requesting a block and receiving it (if any)\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -168,6 +172,12 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflightallowance", statestats.nBlocksInFlightAllowance));
+            obj.push_back(Pair("blockbytesrecv", statestats.nBlockBytesReceived));
+            if (statestats.dBlockBytesPerSecond > 0.0)
+                obj.push_back(Pair("blockbytespersec", statestats.dBlockBytesPerSecond));
+            if (statestats.dBlockLatency > 0.0)
+                obj.push_back(Pair("blocklatency", statestats.dBlockLatency));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -1170,6 +1170,29 @@ bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript&
 
 namespace {
 
+/** Serialize scriptCode for a legacy signature hash, skipping OP_CODESEPARATORs */
+template<typename S>
+void SerializeScriptCode(S &s, const CScript& scriptCode) {
+    CScript::const_iterator it = scriptCode.begin();
+    CScript::const_iterator itBegin = it;
+    opcodetype opcode;
+    unsigned int nCodeSeparators = 0;
+    while (scriptCode.GetOp(it, opcode)) {
+        if (opcode == OP_CODESEPARATOR)
+            nCodeSeparators++;
+    }
+    ::WriteCompactSize(s, scriptCode.size() - nCodeSeparators);
+    it = itBegin;
+    while (scriptCode.GetOp(it, opcode)) {
+        if (opcode == OP_CODESEPARATOR) {
+            s.write((char*)&itBegin[0], it-itBegin-1);
+            itBegin = it;
+        }
+    }
+    if (itBegin != scriptCode.end())
+        s.write((char*)&itBegin[0], it-itBegin);
+}
+
 /**
  * Wrapper that serializes like CTransaction, but with the modifications
  *  required for the signature hash done in-place
@@ -1193,24 +1216,7 @@ public:
     /** Serialize the passed scriptCode, skipping OP_CODESEPARATORs */
     template<typename S>
     void SerializeScriptCode(S &s) const {
-        CScript::const_iterator it = scriptCode.begin();
-        CScript::const_iterator itBegin = it;
-        opcodetype opcode;
-        unsigned int nCodeSeparators = 0;
-        while (scriptCode.GetOp(it, opcode)) {
-            if (opcode == OP_CODESEPARATOR)
-                nCodeSeparators++;
-        }
-        ::WriteCompactSize(s, scriptCode.size() - nCodeSeparators);
-        it = itBegin;
-        while (scriptCode.GetOp(it, opcode)) {
-            if (opcode == OP_CODESEPARATOR) {
-                s.write((char*)&itBegin[0], it-itBegin-1);
-                itBegin = it;
-            }
-        }
-        if (itBegin != scriptCode.end())
-            s.write((char*)&itBegin[0], it-itBegin);
+        ::SerializeScriptCode(s, scriptCode);
     }
 
     /** Serialize an input of txTo */
@@ -1265,6 +1271,59 @@ public:
     }
 };
 
+/** Serializes like CHashWriter(SER_GETHASH, 0), into a byte vector */
+class CSighashVectorWriter {
+private:
+    std::vector<unsigned char>& vch;
+
+public:
+    explicit CSighashVectorWriter(std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+    int GetType() const { return SER_GETHASH; }
+    int GetVersion() const { return 0; }
+
+    void write(const char* pch, size_t size) {
+        vch.insert(vch.end(), (const unsigned char*)pch, (const unsigned char*)pch + size);
+    }
+
+    template<typename T>
+    CSighashVectorWriter& operator<<(const T& obj) {
+        ::Serialize(*this, obj);
+        return *this;
+    }
+};
+
+/** Hashes like CHashWriter(SER_GETHASH, 0), carrying on from a given SHA-256 state */
+class CSighashMidstateWriter {
+private:
+    CSHA256 sha;
+
+public:
+    explicit CSighashMidstateWriter(const CSHA256& shaIn) : sha(shaIn) {}
+    int GetType() const { return SER_GETHASH; }
+    int GetVersion() const { return 0; }
+
+    void write(const char* pch, size_t size) {
+        sha.Write((const unsigned char*)pch, size);
+    }
+
+    template<typename T>
+    CSighashMidstateWriter& operator<<(const T& obj) {
+        ::Serialize(*this, obj);
+        return *this;
+    }
+
+    uint256 GetHash() {
+        unsigned char buf[CSHA256::OUTPUT_SIZE];
+        sha.Finalize(buf);
+        uint256 result;
+        CSHA256().Write(buf, CSHA256::OUTPUT_SIZE).Finalize(result.begin());
+        return result;
+    }
+};
+
+/** Size of an input with its script blanked out: the prevout, an empty script and nSequence */
+static const size_t LEGACY_BLANKED_INPUT_SIZE = 32 + 4 + 1 + 4;
+
 uint256 GetPrevoutHash(const CTransaction& txTo) {
     CHashWriter ss(SER_GETHASH, 0);
     for (const auto& txin : txTo.vin) {
@@ -1296,6 +1355,28 @@ PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
     hashPrevouts = GetPrevoutHash(txTo);
     hashSequence = GetSequenceHash(txTo);
     hashOutputs = GetOutputsHash(txTo);
+
+    if (txTo.vin.size() >= LEGACY_SIGHASH_CACHE_MIN_INPUTS) {
+        CSighashVectorWriter blanked(vLegacyBlanked);
+        for (const auto& txin : txTo.vin)
+            blanked << txin.prevout << CScript() << txin.nSequence;
+        assert(vLegacyBlanked.size() == txTo.vin.size() * LEGACY_BLANKED_INPUT_SIZE);
+        blanked << txTo.vout << txTo.nLockTime;
+
+        // The prefix in front of input i is nVersion, the number of inputs
+        // and the first i blanked inputs.
+        std::vector<unsigned char> vHead;
+        CSighashVectorWriter head(vHead);
+        head << txTo.nVersion;
+        ::WriteCompactSize(head, txTo.vin.size());
+        CSHA256 sha;
+        sha.Write(vHead.data(), vHead.size());
+        vLegacyPrefix.reserve(txTo.vin.size());
+        for (size_t i = 0; i < txTo.vin.size(); i++) {
+            vLegacyPrefix.push_back(sha);
+            sha.Write(&vLegacyBlanked[i * LEGACY_BLANKED_INPUT_SIZE], LEGACY_BLANKED_INPUT_SIZE);
+        }
+    }
 }
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1359,6 +1440,21 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         }
     }
 
+    // With SIGHASH_ALL, every input hashes the same serialization but for its
+    // own scriptCode, so carry on from the state cached for the part in front
+    // of it, and hash what follows from the cached serialization.
+    if (cache && !cache->vLegacyPrefix.empty() && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        CSighashMidstateWriter ss(cache->vLegacyPrefix[nIn]);
+        ss << txTo.vin[nIn].prevout;
+        SerializeScriptCode(ss, scriptCode);
+        ss << txTo.vin[nIn].nSequence;
+        const size_t nRest = (nIn + 1) * LEGACY_BLANKED_INPUT_SIZE;
+        ss.write((const char*)cache->vLegacyBlanked.data() + nRest, cache->vLegacyBlanked.size() - nRest);
+        ss << nHashType;
+        return ss.GetHash();
+    }
+
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
@@ -7,6 +7,7 @@
 #define FABCOIN_SCRIPT_INTERPRETER_H
 
 #include "script_error.h"
+#include "crypto/sha256.h"
 #include "primitives/transaction.h"
 
 #include <vector>
@@ -110,10 +111,23 @@ enum
 
 bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
 
+/** Transactions with fewer inputs do not get their legacy signature hashes cached */
+static const size_t LEGACY_SIGHASH_CACHE_MIN_INPUTS = 8;
+
 struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
 
+    /**
+     * For legacy SIGHASH_ALL signatures. The serialization they hash is the
+     * same for every input but for the input's own scriptCode, so SHA-256
+     * states are kept for the prefix in front of each input, and the rest is
+     * kept serialized: each input with its script blanked out, then the
+     * outputs and nLockTime. Empty for transactions with few inputs.
+     */
+    std::vector<CSHA256> vLegacyPrefix;
+    std::vector<unsigned char> vLegacyBlanked;
+
     PrecomputedTransactionData(const CTransaction& tx);
 };
 
@@ -8,6 +8,7 @@
 #include "memusage.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/script.h"
 #include "uint256.h"
 #include "util.h"
 
@@ -57,6 +58,21 @@ public:
     {
         return setValid.setup_bytes(n);
     }
+
+    void GetEntries(uint256& nonceOut, std::vector<uint256>& entries)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonceOut = nonce;
+        setValid.get_live(entries);
+    }
+
+    void LoadEntries(const uint256& nonceIn, const std::vector<uint256>& entries)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        nonce = nonceIn;
+        for (const uint256& entry : entries)
+            setValid.insert(entry);
+    }
 };
 
 /* In previous versions of this code, signatureCache was a local static variable
@@ -80,6 +96,16 @@ void InitSignatureCache()
             (nElems*sizeof(uint256)) >>20, (nMaxCacheSize*2)>>20, nElems);
 }
 
+void GetSignatureCacheEntries(uint256& nonce, std::vector<uint256>& entries)
+{
+    signatureCache.GetEntries(nonce, entries);
+}
+
+void LoadSignatureCacheEntries(const uint256& nonce, const std::vector<uint256>& entries)
+{
+    signatureCache.LoadEntries(nonce, entries);
+}
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
     uint256 entry;
@@ -92,3 +118,27 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
         signatureCache.Set(entry);
     return true;
 }
+
+bool BatchingTransactionSignatureChecker::CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const
+{
+    fDefer = true;
+    CScript::const_iterator pc = scriptCode.begin();
+    opcodetype opcode;
+    while (fDefer && scriptCode.GetOp(pc, opcode)) {
+        if (opcode == OP_CHECKMULTISIG || opcode == OP_CHECKMULTISIGVERIFY)
+            fDefer = false;
+    }
+    return CachingTransactionSignatureChecker::CheckSig(scriptSig, vchPubKey, scriptCode, sigversion);
+}
+
+bool BatchingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    if (!fDefer)
+        return CachingTransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash);
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    if (signatureCache.Get(entry, true))
+        return true;
+    batch.emplace_back(pubkey, sighash, vchSig);
+    return true;
+}
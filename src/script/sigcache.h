@@ -6,6 +6,7 @@
 #ifndef FABCOIN_SCRIPT_SIGCACHE_H
 #define FABCOIN_SCRIPT_SIGCACHE_H
 
+#include "pubkey.h"
 #include "script/interpreter.h"
 
 #include <vector>
@@ -51,6 +52,39 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
 };
 
+/**
+ * A signature checker for block validation which, rather than verifying the
+ * signatures the signature cache has no entry for, takes them to be valid and
+ * adds them to batch, for CPubKey::VerifyBatch(). The script's result only
+ * holds if they all are; if one is not, or the script fails, it has to be run
+ * again with a CachingTransactionSignatureChecker to get the actual result.
+ *
+ * CHECKMULTISIG tries signatures against keys they are not expected to match,
+ * so signatures in scripts with one are verified right away.
+ */
+class BatchingTransactionSignatureChecker : public CachingTransactionSignatureChecker
+{
+private:
+    std::vector<CDeferredSignature>& batch;
+    mutable bool fDefer;
+
+public:
+    BatchingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, PrecomputedTransactionData& txdataIn, std::vector<CDeferredSignature>& batchIn) : CachingTransactionSignatureChecker(txToIn, nInIn, amountIn, false, txdataIn), batch(batchIn), fDefer(false) {}
+
+    bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const override;
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const override;
+};
+
 void InitSignatureCache();
 
+/** Get the salt and the live entries of the signature cache, to save them */
+void GetSignatureCacheEntries(uint256& nonce, std::vector<uint256>& entries);
+
+/**
+ * Switch the signature cache to a saved salt and insert the entries saved
+ * with it. Meant for startup: entries added before under the old salt are no
+ * longer found.
+ */
+void LoadSignatureCacheEntries(const uint256& nonce, const std::vector<uint256>& entries);
+
 #endif // FABCOIN_SCRIPT_SIGCACHE_H
@@ -381,6 +381,32 @@ SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_ecdsa_verify(
     const secp256k1_pubkey *pubkey
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4);
 
+/** Verify a number of ECDSA signatures.
+ *
+ *  Returns: 1: all signatures are correct
+ *           0: at least one signature is incorrect or unparseable
+ *  Args:    ctx:       a secp256k1 context object, initialized for verification.
+ *  Out:     results:   if not NULL, an array of n ints, set to 1 for each correct
+ *                      signature and 0 for every other one.
+ *  In:      sigs:      array of n pointers to signatures (cannot be NULL)
+ *           msg32s:    array of n pointers to 32-byte message hashes (cannot be NULL)
+ *           pubkeys:   array of n pointers to the public keys to verify with (cannot be NULL)
+ *           n:         the number of signatures
+ *
+ * Every signature gets the same result as from secp256k1_ecdsa_verify, so
+ * only lower-S signatures are accepted. It is faster than verifying them one
+ * by one because the modular inversions of the signatures' s values are
+ * shared, using Montgomery's trick.
+ */
+SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_ecdsa_verify_batch(
+    const secp256k1_context* ctx,
+    int *results,
+    const secp256k1_ecdsa_signature * const *sigs,
+    const unsigned char * const *msg32s,
+    const secp256k1_pubkey * const *pubkeys,
+    size_t n
+) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4) SECP256K1_ARG_NONNULL(5);
+
 /** Convert a signature to a normalized lower-S form.
  *
  *  Returns: 1 if sigin was not normalized, 0 if it already was.
@@ -307,6 +307,65 @@ int secp256k1_ecdsa_verify(const secp256k1_context* ctx, const secp256k1_ecdsa_s
             secp256k1_ecdsa_sig_verify(&ctx->ecmult_ctx, &r, &s, &q, &m));
 }
 
+/* Signatures whose s values secp256k1_ecdsa_verify_batch inverts at once */
+#define ECDSA_VERIFY_BATCH_SIZE 64
+
+int secp256k1_ecdsa_verify_batch(const secp256k1_context* ctx, int *results, const secp256k1_ecdsa_signature * const *sigs, const unsigned char * const *msg32s, const secp256k1_pubkey * const *pubkeys, size_t n) {
+    secp256k1_ge q[ECDSA_VERIFY_BATCH_SIZE];
+    secp256k1_scalar r[ECDSA_VERIFY_BATCH_SIZE], s[ECDSA_VERIFY_BATCH_SIZE], m[ECDSA_VERIFY_BATCH_SIZE];
+    /* prod[i] is the product of the usable s values up to and including i */
+    secp256k1_scalar prod[ECDSA_VERIFY_BATCH_SIZE];
+    secp256k1_scalar inv, sn;
+    int ok[ECDSA_VERIFY_BATCH_SIZE];
+    int all = 1;
+    size_t start, count, i;
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(sigs != NULL);
+    ARG_CHECK(msg32s != NULL);
+    ARG_CHECK(pubkeys != NULL);
+
+    for (start = 0; start < n; start += count) {
+        count = n - start < ECDSA_VERIFY_BATCH_SIZE ? n - start : ECDSA_VERIFY_BATCH_SIZE;
+        for (i = 0; i < count; i++) {
+            secp256k1_scalar_set_b32(&m[i], msg32s[start + i], NULL);
+            secp256k1_ecdsa_signature_load(ctx, &r[i], &s[i], sigs[start + i]);
+            ok[i] = !secp256k1_scalar_is_high(&s[i]) &&
+                    !secp256k1_scalar_is_zero(&s[i]) &&
+                    secp256k1_pubkey_load(ctx, &q[i], pubkeys[start + i]);
+            if (i == 0) {
+                secp256k1_scalar_set_int(&prod[i], 1);
+            } else {
+                prod[i] = prod[i - 1];
+            }
+            if (ok[i]) {
+                secp256k1_scalar_mul(&prod[i], &prod[i], &s[i]);
+            }
+        }
+        /* One inversion, then walk back peeling off one s value at a time. */
+        secp256k1_scalar_inverse_var(&inv, &prod[count - 1]);
+        for (i = count; i-- > 0;) {
+            if (!ok[i]) {
+                continue;
+            }
+            if (i == 0) {
+                sn = inv;
+            } else {
+                secp256k1_scalar_mul(&sn, &inv, &prod[i - 1]);
+                secp256k1_scalar_mul(&inv, &inv, &s[i]);
+            }
+            ok[i] = secp256k1_ecdsa_sig_verify_inv(&ctx->ecmult_ctx, &r[i], &sn, &q[i], &m[i]);
+        }
+        for (i = 0; i < count; i++) {
+            if (results != NULL) {
+                results[start + i] = ok[i];
+            }
+            all &= ok[i];
+        }
+    }
+    return all;
+}
+
 static int nonce_function_rfc6979(unsigned char *nonce32, const unsigned char *msg32, const unsigned char *key32, const unsigned char *algo16, void *data, unsigned int counter) {
    unsigned char keydata[112];
    int keylen = 64;
@@ -3641,6 +3641,70 @@ void run_ecdsa_end_to_end(void) {
     }
 }
 
+void test_ecdsa_verify_batch(void) {
+    /* More than a chunk of secp256k1_ecdsa_verify_batch, some of them bad. */
+    secp256k1_ecdsa_signature sigs[100];
+    unsigned char msgs[100][32];
+    secp256k1_pubkey pubkeys[100];
+    const secp256k1_ecdsa_signature *psigs[100];
+    const unsigned char *pmsgs[100];
+    const secp256k1_pubkey *ppubkeys[100];
+    int results[100];
+    int all = 1;
+    int n = 1 + secp256k1_rand_int(100);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        unsigned char privkey[32];
+        secp256k1_scalar msg, key, r, s;
+        random_scalar_order_test(&msg);
+        random_scalar_order_test(&key);
+        secp256k1_scalar_get_b32(privkey, &key);
+        secp256k1_scalar_get_b32(msgs[i], &msg);
+        CHECK(secp256k1_ec_pubkey_create(ctx, &pubkeys[i], privkey) == 1);
+        CHECK(secp256k1_ecdsa_sign(ctx, &sigs[i], msgs[i], privkey, NULL, NULL) == 1);
+        switch (secp256k1_rand_int(8)) {
+        case 0:
+            /* Wrong message */
+            msgs[i][secp256k1_rand_int(32)] ^= 1 + secp256k1_rand_int(255);
+            break;
+        case 1:
+            /* High S */
+            secp256k1_ecdsa_signature_load(ctx, &r, &s, &sigs[i]);
+            secp256k1_scalar_negate(&s, &s);
+            secp256k1_ecdsa_signature_save(&sigs[i], &r, &s);
+            break;
+        case 2:
+            /* Zero S */
+            secp256k1_ecdsa_signature_load(ctx, &r, &s, &sigs[i]);
+            secp256k1_scalar_clear(&s);
+            secp256k1_ecdsa_signature_save(&sigs[i], &r, &s);
+            break;
+        }
+    }
+    for (i = 0; i < 100; i++) {
+        psigs[i] = &sigs[i];
+        pmsgs[i] = msgs[i];
+        ppubkeys[i] = &pubkeys[i];
+    }
+    for (i = 0; i < n; i++) {
+        all &= secp256k1_ecdsa_verify(ctx, &sigs[i], msgs[i], &pubkeys[i]);
+    }
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, results, psigs, pmsgs, ppubkeys, n) == all);
+    for (i = 0; i < n; i++) {
+        CHECK(results[i] == secp256k1_ecdsa_verify(ctx, &sigs[i], msgs[i], &pubkeys[i]));
+    }
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, NULL, psigs, pmsgs, ppubkeys, n) == all);
+    CHECK(secp256k1_ecdsa_verify_batch(ctx, NULL, psigs, pmsgs, ppubkeys, 0) == 1);
+}
+
+void run_ecdsa_verify_batch(void) {
+    int i;
+    for (i = 0; i < count; i++) {
+        test_ecdsa_verify_batch();
+    }
+}
+
 int test_ecdsa_der_parse(const unsigned char *sig, size_t siglen, int certainly_der, int certainly_not_der) {
     static const unsigned char zeroes[32] = {0};
 #ifdef ENABLE_OPENSSL_TESTS
@@ -4515,6 +4579,7 @@ int main(int argc, char **argv) {
     run_ecdsa_der_parse();
     run_ecdsa_sign_verify();
     run_ecdsa_end_to_end();
+    run_ecdsa_verify_batch();
     run_ecdsa_edge_cases();
 #ifdef ENABLE_OPENSSL_TESTS
     run_ecdsa_openssl();
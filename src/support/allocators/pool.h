@@ -0,0 +1,197 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef FABCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define FABCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <list>
+#include <new>
+#include <type_traits>
+
+/**
+ * A memory resource for node based containers that allocate many objects of
+ * the same few sizes, like std::unordered_map.
+ *
+ * Memory is carved out of large chunks (DEFAULT_CHUNK_SIZE_BYTES unless told
+ * otherwise). Freed blocks are kept in a singly linked free list per size
+ * class (a multiple of ELEM_ALIGN_BYTES) and handed out again on the next
+ * allocation of that size, so an unordered_map node costs exactly its
+ * rounded-up size: no per-node malloc header, and nodes allocated one after
+ * another end up next to each other in memory. Requests larger than MAX_BLOCK_SIZE_BYTES, such as the
+ * bucket array, go to operator new.
+ *
+ * Chunks are only released when the resource is destroyed. The owner of a
+ * container that shrinks a lot (e.g. a flushed coins cache) should destroy
+ * the container and the resource together to give the memory back.
+ *
+ * Not thread safe; the resource shares the locking of its container.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+
+    /** In-place linked list of the free blocks of one size class */
+    struct ListNode {
+        ListNode* m_next;
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+    static_assert(std::is_trivially_destructible<ListNode>::value, "Make sure we don't need to manually call a destructor");
+
+    /** Granularity of the size classes; every block can hold a ListNode */
+    static const std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "Chunks come from operator new, which only guarantees max_align_t");
+    static_assert(sizeof(ListNode) <= ELEM_ALIGN_BYTES, "Units of size ELEM_ALIGN_BYTES need to be able to store a ListNode");
+    static_assert((MAX_BLOCK_SIZE_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "MAX_BLOCK_SIZE_BYTES needs to be a multiple of the alignment.");
+
+    const std::size_t m_chunk_size_bytes;
+    std::list<char*> m_allocated_chunks;
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists;
+    char* m_available_memory_it;
+    char* m_available_memory_end;
+
+    static std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    static void PlacementAddToList(void* p, ListNode*& node)
+    {
+        node = new (p) ListNode(node);
+    }
+
+    void AllocateChunk()
+    {
+        // Whatever is left of the current chunk is always a whole number of
+        // elements; keep it around in the matching free list.
+        const std::size_t remaining_available_bytes = m_available_memory_end - m_available_memory_it;
+        if (remaining_available_bytes != 0) {
+            PlacementAddToList(m_available_memory_it, m_free_lists[remaining_available_bytes / ELEM_ALIGN_BYTES]);
+        }
+
+        char* storage = static_cast<char*>(::operator new(m_chunk_size_bytes));
+        m_available_memory_it = storage;
+        m_available_memory_end = storage + m_chunk_size_bytes;
+        m_allocated_chunks.push_back(storage);
+    }
+
+public:
+    static const std::size_t DEFAULT_CHUNK_SIZE_BYTES = 262144;
+
+    explicit PoolResource(std::size_t chunk_size_bytes = DEFAULT_CHUNK_SIZE_BYTES)
+        : m_chunk_size_bytes(NumElemAlignBytes(chunk_size_bytes) * ELEM_ALIGN_BYTES),
+          m_available_memory_it(nullptr), m_available_memory_end(nullptr)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        m_free_lists.fill(nullptr);
+        AllocateChunk();
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (char* chunk : m_allocated_chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            assert(alignment <= alignof(std::max_align_t));
+            return ::operator new(bytes);
+        }
+        const std::size_t num_alignments = NumElemAlignBytes(bytes);
+        ListNode*& free_list = m_free_lists[num_alignments];
+        if (free_list != nullptr) {
+            ListNode* node = free_list;
+            free_list = node->m_next;
+            return node;
+        }
+        const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+        if (round_bytes > static_cast<std::size_t>(m_available_memory_end - m_available_memory_it)) {
+            AllocateChunk();
+        }
+        void* p = m_available_memory_it;
+        m_available_memory_it += round_bytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (!IsFreeListUsable(bytes, alignment)) {
+            ::operator delete(p);
+            return;
+        }
+        PlacementAddToList(p, m_free_lists[NumElemAlignBytes(bytes)]);
+    }
+
+    std::size_t NumAllocatedChunks() const { return m_allocated_chunks.size(); }
+
+    std::size_t ChunkSizeBytes() const { return m_chunk_size_bytes; }
+};
+
+/**
+ * Allocator handing out memory from a PoolResource, which must outlive every
+ * container using it.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    // Implicit, so a container can be constructed from a resource pointer.
+    PoolAllocator(ResourceType* resource) noexcept : m_resource(resource) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.resource()) {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return m_resource; }
+
+private:
+    ResourceType* m_resource;
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // FABCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -11,6 +11,7 @@
 #include "pow.h"
 #include "script/sign.h"
 #include "serialize.h"
+#include "txmempool.h"
 #include "util.h"
 #include "validation.h"
 
@@ -23,13 +24,17 @@
 // Tests these internal-to-net_processing.cpp methods:
 extern bool AddOrphanTx(const CTransactionRef& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxOrphanUsage);
 struct COrphanTx {
     CTransactionRef tx;
     NodeId fromPeer;
     int64_t nTimeExpire;
+    size_t nUsage;
+    size_t nListPos;
 };
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
+extern std::unordered_map<uint256, COrphanTx, SaltedTxidHasher> mapOrphanTransactions;
+extern size_t nOrphanPoolUsage;
+extern std::map<NodeId, size_t> mapOrphanPoolUsageByPeer;
 
 CService ip(uint32_t i)
 {
@@ -41,6 +46,8 @@ CService ip(uint32_t i)
 static NodeId id = 0;
 
 void UpdateLastBlockAnnounceTime(NodeId node, int64_t time_in_seconds);
+void AddOrphanWork(NodeId node, const uint256& hash);
+size_t GetOrphanWorkSize(NodeId node);
 
 BOOST_FIXTURE_TEST_SUITE(DoS_tests, TestingSetup)
 
@@ -265,10 +272,7 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
 
 CTransactionRef RandomOrphan()
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(InsecureRand256());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
+    auto it = std::next(mapOrphanTransactions.begin(), InsecureRandRange(mapOrphanTransactions.size()));
     return it->second.tx;
 }
 
@@ -343,12 +347,93 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
     }
 
+    // Memory accounting tracks what is left:
+    size_t nUsage = 0;
+    for (const auto& orphan : mapOrphanTransactions)
+        nUsage += orphan.second.nUsage;
+    BOOST_CHECK_EQUAL(nOrphanPoolUsage, nUsage);
+
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    LimitOrphanTxSize(10, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    LimitOrphanTxSize(std::numeric_limits<unsigned int>::max(), nOrphanPoolUsage / 2);
+    BOOST_CHECK(mapOrphanTransactions.size() < 10);
+    LimitOrphanTxSize(0, std::numeric_limits<size_t>::max());
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK_EQUAL(nOrphanPoolUsage, 0U);
+    BOOST_CHECK(mapOrphanPoolUsageByPeer.empty());
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphansPeerQuota)
+{
+    // A single peer can only fill its share of the orphan pool.
+    size_t nPeerLimit = DEFAULT_MAX_ORPHAN_POOL_SIZE * 1000000 / 100 * MAX_ORPHAN_POOL_PEER_PERCENT;
+    bool fRejected = false;
+    for (int i = 0; i < 100000 && !fRejected; i++)
+    {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = 0;
+        tx.vin[0].prevout.hash = InsecureRand256();
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(5000, 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1*CENT;
+        fRejected = !AddOrphanTx(MakeTransactionRef(tx), 0);
+    }
+    BOOST_CHECK(fRejected);
+    BOOST_CHECK(mapOrphanPoolUsageByPeer[0] <= nPeerLimit);
+
+    // ... while other peers can still add theirs.
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = InsecureRand256();
+    tx.vout.resize(1);
+    BOOST_CHECK(AddOrphanTx(MakeTransactionRef(tx), 1));
+
+    EraseOrphansFor(0);
+    EraseOrphansFor(1);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK_EQUAL(nOrphanPoolUsage, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(DoS_orphanWorkOnDisconnect)
+{
+    std::vector<std::unique_ptr<CNode>> vNodes;
+    for (int i = 0; i < 3; i++) {
+        CAddress addr(ip(0xa0b0c010 + i), NODE_NONE);
+        vNodes.emplace_back(new CNode(id++, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", true));
+        peerLogic->InitializeNode(vNodes.back().get());
+    }
+    const NodeId nodeA = vNodes[0]->GetId(), nodeB = vNodes[1]->GetId(), nodeC = vNodes[2]->GetId();
+    const NodeId nodeGone = id++;
+
+    // Orphans sent by B, by a peer that is gone already, and by A itself,
+    // all waiting to be reconsidered on A's turns.
+    std::vector<uint256> vOrphans;
+    for (NodeId from : {nodeB, nodeGone, nodeA}) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = InsecureRand256();
+        tx.vout.resize(1);
+        BOOST_CHECK(AddOrphanTx(MakeTransactionRef(tx), from));
+        vOrphans.push_back(tx.GetHash());
+        AddOrphanWork(nodeA, tx.GetHash());
+    }
+    BOOST_CHECK_EQUAL(GetOrphanWorkSize(nodeA), 3U);
+
+    // A's own orphan goes with it; B takes its orphan, and the first other
+    // peer (B again) the one whose sender is gone.
+    bool dummy;
+    peerLogic->FinalizeNode(nodeA, dummy);
+    BOOST_CHECK(!mapOrphanTransactions.count(vOrphans[2]));
+    BOOST_CHECK_EQUAL(GetOrphanWorkSize(nodeB), 2U);
+    BOOST_CHECK_EQUAL(GetOrphanWorkSize(nodeC), 0U);
+
+    peerLogic->FinalizeNode(nodeB, dummy);
+    peerLogic->FinalizeNode(nodeC, dummy);
+    EraseOrphansFor(nodeGone);
     BOOST_CHECK(mapOrphanTransactions.empty());
 }
 
@@ -4,6 +4,8 @@
 
 #include "util.h"
 
+#include "memusage.h"
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_fabcoin.h"
 
@@ -231,4 +233,43 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+
+    // Blocks of one size class are carved out back to back, and freed ones
+    // are handed out again.
+    char* a = static_cast<char*>(resource.Allocate(24, 8));
+    char* b = static_cast<char*>(resource.Allocate(24, 8));
+    BOOST_CHECK_EQUAL(b - a, 24);
+    resource.Deallocate(a, 24, 8);
+    BOOST_CHECK(resource.Allocate(20, 8) == a);
+
+    // Requests larger than the maximum block size bypass the pool.
+    void* big = resource.Allocate(1000, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    resource.Deallocate(big, 1000, 8);
+
+    // Running out of the chunk allocates another.
+    for (int i = 0; i < 20; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+
+    // A map keeps reusing the nodes it freed.
+    typedef PoolAllocator<std::pair<const int, int>, 64> Alloc;
+    Alloc::ResourceType mapResource;
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Alloc> map(0, std::hash<int>(), std::equal_to<int>(), &mapResource);
+    for (int i = 0; i < 100000; i++)
+        map.emplace(i, i);
+    size_t nChunks = mapResource.NumAllocatedChunks();
+    size_t nUsage = memusage::DynamicUsage(map);
+    BOOST_CHECK(nUsage >= nChunks * mapResource.ChunkSizeBytes());
+    map.clear();
+    for (int i = 0; i < 100000; i++)
+        map.emplace(-i, i);
+    BOOST_CHECK_EQUAL(mapResource.NumAllocatedChunks(), nChunks);
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nUsage);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
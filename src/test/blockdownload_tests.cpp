@@ -0,0 +1,75 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net_processing.h"
+#include "test/test_fabcoin.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockdownload_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(blockdownload_allowance)
+{
+    // An unmeasured peer gets the fixed allowance.
+    CBlockDownloadStats stats;
+    BOOST_CHECK_EQUAL(stats.GetAllowance(), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // A block requested on an idle connection measures rate and latency.
+    stats.Update(0, true, 100000, 1000000);
+    BOOST_CHECK_EQUAL(stats.nLatency, 1000000);
+    BOOST_CHECK_EQUAL(stats.dBytesPerSecond, 100000);
+    BOOST_CHECK_EQUAL(stats.dAvgSize, 100000);
+    BOOST_CHECK_EQUAL(stats.GetAllowance(), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Pipelined blocks, arriving every 10ms, raise the rate but leave the
+    // latency alone; the allowance grows up to its cap.
+    int64_t nNow = 1000000;
+    for (int i = 0; i < 100; i++) {
+        nNow += 10000;
+        stats.Update(0, false, 100000, nNow);
+    }
+    BOOST_CHECK_EQUAL(stats.nLatency, 1000000);
+    BOOST_CHECK(stats.dBytesPerSecond > 9000000);
+    BOOST_CHECK_EQUAL(stats.nBytesReceived, 101 * 100000U);
+    BOOST_CHECK_EQUAL(stats.GetAllowance(), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // A block requested before the last delivery does not measure latency,
+    // even if it is first in flight.
+    stats.Update(nNow - 1, true, 100000, nNow + 3000000);
+    BOOST_CHECK_EQUAL(stats.nLatency, 1000000);
+
+    // In between, the allowance is twice the bandwidth-delay product in blocks.
+    CBlockDownloadStats mid;
+    mid.dBytesPerSecond = 10000000;
+    mid.nLatency = 200000;
+    mid.dAvgSize = 100000;
+    BOOST_CHECK_EQUAL(mid.GetAllowance(), 40);
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_reassign)
+{
+    CBlockDownloadStats staller, fast, slow, unmeasured;
+    staller.dBytesPerSecond = 100000;
+    staller.nLatency = 500000;
+    staller.dAvgSize = 100000;
+    fast.dBytesPerSecond = 10000000;
+    slow.dBytesPerSecond = 50000;
+
+    // Only a faster peer takes a block over, after four of the staller's
+    // round trips.
+    BOOST_CHECK(!staller.ShouldReassignTo(fast, 0, 1500000));
+    BOOST_CHECK(staller.ShouldReassignTo(fast, 0, 2500000));
+    BOOST_CHECK(!staller.ShouldReassignTo(slow, 0, 2500000));
+
+    // With a short round trip, the block is still given BLOCK_REASSIGN_MIN_AGE.
+    staller.nLatency = 100000;
+    BOOST_CHECK(!staller.ShouldReassignTo(fast, 0, BLOCK_REASSIGN_MIN_AGE - 1));
+    BOOST_CHECK(staller.ShouldReassignTo(fast, 0, BLOCK_REASSIGN_MIN_AGE + 1));
+
+    // A peer that never delivered a block is left to the stalling timeout.
+    BOOST_CHECK(!unmeasured.ShouldReassignTo(fast, 0, 60 * BLOCK_REASSIGN_MIN_AGE));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -49,7 +49,7 @@ static CBlock BuildBlockTestCase() {
     assert(!mutated);
     while (!CheckProofOfWork(block.GetHash(), block.nBits, false, Params().GetConsensus())) 
     {
-        block.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+        block.SetNonce(ArithToUint256(UintToArith256(block.nNonce) + 1));
     }
     return block;
 }
@@ -294,7 +294,7 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     assert(!mutated);
     while (!CheckProofOfWork(block.GetHash(), block.nBits, false, Params().GetConsensus())) 
     {
-        block.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+        block.SetNonce(ArithToUint256(UintToArith256(block.nNonce) + 1));
     }
 
     // Test simple header round-trip with only coinbase
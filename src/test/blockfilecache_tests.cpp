@@ -0,0 +1,95 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilecache.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "test/test_fabcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilecache_tests, BasicTestingSetup)
+
+/** Append a record the way blocks and undo data are written, returning its position */
+static uint64_t AppendRecord(const fs::path& path, const std::vector<char>& vch)
+{
+    FILE* file = fsbridge::fopen(path, "ab");
+    BOOST_REQUIRE(file);
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    fileout << uint32_t{0xd9b4bef9} << (uint32_t)vch.size();
+    uint64_t nPos = ftell(fileout.Get());
+    fileout.write(vch.data(), vch.size());
+    return nPos;
+}
+
+static std::vector<char> RandomBytes(size_t nSize)
+{
+    std::vector<char> vch(nSize);
+    for (char& c : vch)
+        c = InsecureRandBits(8);
+    return vch;
+}
+
+static bool ReadsAs(CBlockFileCache& cache, const fs::path& path, uint64_t nPos, bool fFinal, const std::vector<char>& vch)
+{
+    CDiskRecord record;
+    if (!cache.ReadRecord(path, nPos, 0, fFinal, record))
+        return false;
+    return std::vector<char>(record.data(), record.data() + record.size()) == vch;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilecache_read)
+{
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+    const fs::path path = dir / "blk00000.dat";
+
+    std::vector<std::vector<char>> vRecords;
+    std::vector<uint64_t> vPos;
+    for (size_t nSize : {1, 100, 5000, 0, 70000}) {
+        vRecords.push_back(RandomBytes(nSize));
+        vPos.push_back(AppendRecord(path, vRecords.back()));
+    }
+
+    // Records come out the same whether read or mapped, and keep their bytes
+    // after the file is closed.
+    CBlockFileCache cache(2);
+    for (bool fFinal : {false, true})
+        for (size_t i = 0; i < vRecords.size(); i++)
+            BOOST_CHECK(ReadsAs(cache, path, vPos[i], fFinal, vRecords[i]));
+    CDiskRecord record;
+    BOOST_CHECK(cache.ReadRecord(path, vPos[2], 0, true, record));
+    cache.Forget(path);
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    BOOST_CHECK(std::vector<char>(record.data(), record.data() + record.size()) == vRecords[2]);
+
+    // A record appended after the file was mapped is found too.
+    BOOST_CHECK(ReadsAs(cache, path, vPos[0], true, vRecords[0]));
+    vRecords.push_back(RandomBytes(300));
+    vPos.push_back(AppendRecord(path, vRecords.back()));
+    BOOST_CHECK(ReadsAs(cache, path, vPos.back(), true, vRecords.back()));
+
+    // Trailing bytes are those of the next record.
+    BOOST_CHECK(cache.ReadRecord(path, vPos[1], 8 + vRecords[2].size(), false, record));
+    BOOST_CHECK(std::vector<char>(record.data() + record.size() - vRecords[2].size(), record.data() + record.size()) == vRecords[2]);
+
+    // Records past the end of the file, and missing files, are not read.
+    BOOST_CHECK(!cache.ReadRecord(path, vPos.back() + 1000, 0, true, record));
+    BOOST_CHECK(!cache.ReadRecord(path, vPos.back(), 1, false, record));
+    BOOST_CHECK(!cache.ReadRecord(dir / "blk00001.dat", 8, 0, true, record));
+
+    // At most two files stay open.
+    for (int i = 0; i < 4; i++) {
+        const fs::path pathOther = dir / strprintf("rev%05u.dat", i);
+        uint64_t nPos = AppendRecord(pathOther, vRecords[1]);
+        BOOST_CHECK(ReadsAs(cache, pathOther, nPos, i % 2, vRecords[1]));
+    }
+    BOOST_CHECK_EQUAL(cache.Size(), 2U);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
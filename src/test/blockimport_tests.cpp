@@ -0,0 +1,139 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "test/test_fabcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockimport_tests, BasicTestingSetup)
+
+/** Append a block file record, returning the position of its block data */
+static uint64_t AppendRecord(CDataStream& ss, const CBlock& block, int nTruncate = 0)
+{
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    ssBlock << block;
+    ss << FLATDATA(Params().MessageStart()) << (unsigned int)ssBlock.size();
+    uint64_t nPos = ss.size();
+    ss.write(ssBlock.data(), ssBlock.size() - nTruncate);
+    return nPos;
+}
+
+static void WriteFile(const fs::path& path, const CDataStream& ss)
+{
+    FILE* file = fsbridge::fopen(path, "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(ss.data(), 1, ss.size(), file), ss.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_order_and_checks)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    CBlock bad = genesis;
+    bad.SetMerkleRoot(uint256());
+
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+
+    // A block file with junk in front, a valid and an invalid block, and
+    // another one ending with a truncated record.
+    CDataStream ss0(SER_DISK, CLIENT_VERSION), ss1(SER_DISK, CLIENT_VERSION);
+    ss0 << std::string("junk");
+    uint64_t nPosGenesis0 = AppendRecord(ss0, genesis);
+    uint64_t nPosBad = AppendRecord(ss0, bad);
+    uint64_t nPosGenesis1 = AppendRecord(ss1, genesis);
+    uint64_t nPosTruncated = AppendRecord(ss1, genesis, 10);
+    WriteFile(dir / "blk00000.dat", ss0);
+    WriteFile(dir / "blk00001.dat", ss1);
+
+    std::vector<CBlockImportFile> vFiles;
+    vFiles.emplace_back(dir / "blk00000.dat", 0);
+    vFiles.emplace_back(dir / "blk00001.dat", 1);
+    vFiles.emplace_back(dir / "missing.dat", -1);
+
+    CBlockImporter importer(Params(), vFiles, 2, 2);
+    CBlockImporter::Item item;
+
+    BOOST_REQUIRE(importer.NextBlock(0, item));
+    BOOST_REQUIRE(item.pblock);
+    BOOST_CHECK(item.pblock->GetHash() == genesis.GetHash());
+    BOOST_CHECK(item.pblock->fChecked);
+    BOOST_CHECK(!item.NeedsRescan());
+    BOOST_CHECK_EQUAL(item.pos.nFile, 0);
+    BOOST_CHECK_EQUAL(item.pos.nPos, nPosGenesis0);
+
+    // Blocks failing CheckBlock are handed out unchecked, for AcceptBlock to
+    // reject.
+    BOOST_REQUIRE(importer.NextBlock(0, item));
+    BOOST_REQUIRE(item.pblock);
+    BOOST_CHECK(item.pblock->GetHash() == bad.GetHash());
+    BOOST_CHECK(!item.pblock->fChecked);
+    BOOST_CHECK_EQUAL(item.pos.nPos, nPosBad);
+    BOOST_CHECK(!importer.NextBlock(0, item));
+    BOOST_CHECK(!importer.OpenFailed(0));
+
+    BOOST_REQUIRE(importer.NextBlock(1, item));
+    BOOST_REQUIRE(item.pblock);
+    BOOST_CHECK(item.pblock->fChecked);
+    BOOST_CHECK_EQUAL(item.pos.nFile, 1);
+    BOOST_CHECK_EQUAL(item.pos.nPos, nPosGenesis1);
+
+    // The caller has to scan again from just after the truncated record's
+    // message start.
+    BOOST_REQUIRE(importer.NextBlock(1, item));
+    BOOST_CHECK(!item.pblock);
+    BOOST_CHECK(item.NeedsRescan());
+    BOOST_CHECK_EQUAL(item.GetResumePos(), nPosTruncated - 8 + 1);
+    BOOST_CHECK(!importer.NextBlock(1, item));
+
+    BOOST_CHECK(!importer.NextBlock(2, item));
+    BOOST_CHECK(importer.OpenFailed(2));
+
+    CBlockImportStats stats = importer.GetStats();
+    BOOST_CHECK_EQUAL(stats.nReadBlocks, 4U);
+    BOOST_CHECK_EQUAL(stats.nCheckedBlocks, 4U);
+    BOOST_CHECK_EQUAL(stats.nAcceptedBlocks, 4U);
+
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_skip_file)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    fs::path dir = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(dir);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    for (int i = 0; i < 100; i++)
+        AppendRecord(ss, genesis);
+    WriteFile(dir / "blk00000.dat", ss);
+    WriteFile(dir / "blk00001.dat", ss);
+
+    std::vector<CBlockImportFile> vFiles;
+    vFiles.emplace_back(dir / "blk00000.dat", 0);
+    vFiles.emplace_back(dir / "blk00001.dat", 1);
+
+    // No check threads: the caller checks every block itself.
+    CBlockImporter importer(Params(), vFiles, 0, 1);
+    CBlockImporter::Item item;
+    BOOST_REQUIRE(importer.NextBlock(0, item));
+    BOOST_CHECK(item.pblock->fChecked);
+    importer.SkipFile(0);
+
+    int nBlocks = 0;
+    while (importer.NextBlock(1, item)) {
+        BOOST_CHECK(item.pblock->fChecked);
+        nBlocks++;
+    }
+    BOOST_CHECK_EQUAL(nBlocks, 100);
+
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
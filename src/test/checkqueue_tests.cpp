@@ -210,6 +210,34 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Random)
 }
 
 
+/** Test that checks still complete when workers come and go between blocks,
+ * including when every worker is gone and the master does all the work.
+ */
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Workers_Come_And_Go)
+{
+    auto queue = std::unique_ptr<Correct_Queue>(new Correct_Queue {QUEUE_BATCH_SIZE});
+    for (size_t nWorkers : {3, 0, 1, 5}) {
+        boost::thread_group tg;
+        for (size_t x = 0; x < nWorkers; ++x) {
+            tg.create_thread([&]{queue->Thread();});
+        }
+        FakeCheckCheckCompletion::n_calls = 0;
+        size_t nExpected = 0;
+        {
+            CCheckQueueControl<FakeCheckCheckCompletion> control(queue.get());
+            for (size_t i = 0; i < 100; ++i) {
+                std::vector<FakeCheckCheckCompletion> vChecks(InsecureRandRange(20));
+                nExpected += vChecks.size();
+                control.Add(vChecks);
+            }
+            BOOST_REQUIRE(control.Wait());
+        }
+        BOOST_REQUIRE_EQUAL(FakeCheckCheckCompletion::n_calls, nExpected);
+        tg.interrupt_all();
+        tg.join_all();
+    }
+}
+
 /** Test that failing checks are caught */
 BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
 {
@@ -3,7 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "coinsprefetch.h"
+#include "primitives/block.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "undo.h"
 #include "utilstrencodings.h"
@@ -525,6 +528,57 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_AUTO_TEST_CASE(compact_undo_serialization)
+{
+    // Undo data of a block at a height well into the chain, spending coins
+    // of recent blocks and some old ones.
+    const unsigned int nHeight = 500000;
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(50);
+    for (CTxUndo& txundo : blockundo.vtxundo) {
+        txundo.vprevout.resize(1 + InsecureRandRange(4));
+        for (Coin& coin : txundo.vprevout) {
+            coin.nHeight = nHeight - (InsecureRandBool() ? InsecureRandRange(100) : InsecureRandRange(nHeight + 1));
+            coin.fCoinBase = InsecureRandRange(10) == 0;
+            coin.out.nValue = InsecureRandRange(100 * COIN);
+            const uint256 hash = InsecureRand256();
+            coin.out.scriptPubKey = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20))));
+        }
+    }
+
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION), ssCompact(SER_DISK, CLIENT_VERSION);
+    ssLegacy << blockundo;
+    ssCompact << BlockUndoCompactSerializer(&blockundo, nHeight);
+    BOOST_CHECK_EQUAL(ssCompact.size(), ::GetSerializeSize(BlockUndoCompactSerializer(&blockundo, nHeight), SER_DISK, CLIENT_VERSION));
+    BOOST_CHECK_LT(ssCompact.size(), ssLegacy.size());
+    BOOST_TEST_MESSAGE("undo data of " << ssLegacy.size() << " bytes, compact " << ssCompact.size());
+
+    // The compact format reads back the same coins.
+    CBlockUndo blockundoRead;
+    ssCompact >> REF(BlockUndoCompactDeserializer(&blockundoRead, nHeight));
+    BOOST_CHECK(ssCompact.empty());
+    BOOST_REQUIRE_EQUAL(blockundoRead.vtxundo.size(), blockundo.vtxundo.size());
+    for (size_t i = 0; i < blockundo.vtxundo.size(); i++) {
+        BOOST_REQUIRE_EQUAL(blockundoRead.vtxundo[i].vprevout.size(), blockundo.vtxundo[i].vprevout.size());
+        for (size_t j = 0; j < blockundo.vtxundo[i].vprevout.size(); j++) {
+            const Coin& coin = blockundo.vtxundo[i].vprevout[j];
+            const Coin& coinRead = blockundoRead.vtxundo[i].vprevout[j];
+            BOOST_CHECK_EQUAL(coinRead.nHeight, coin.nHeight);
+            BOOST_CHECK_EQUAL(coinRead.fCoinBase, coin.fCoinBase);
+            BOOST_CHECK(coinRead.out == coin.out);
+        }
+    }
+
+    // Unknown versions, and coins above the spending block, do not read.
+    CDataStream ssVersion(SER_DISK, CLIENT_VERSION);
+    ssVersion << BlockUndoCompactSerializer(&blockundo, nHeight);
+    ssVersion[0] = UNDO_COMPACT_VERSION + 1;
+    BOOST_CHECK_THROW(ssVersion >> REF(BlockUndoCompactDeserializer(&blockundoRead, nHeight)), std::ios_base::failure);
+    CDataStream ssHeight(SER_DISK, CLIENT_VERSION);
+    ssHeight << BlockUndoCompactSerializer(&blockundo, nHeight);
+    BOOST_CHECK_THROW(ssHeight >> REF(BlockUndoCompactDeserializer(&blockundoRead, 10)), std::ios_base::failure);
+}
+
 const static COutPoint OUTPOINT;
 const static CAmount PRUNED = -1;
 const static CAmount ABSENT = -2;
@@ -586,7 +640,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, CCoinsMap::hasher(), CCoinsMap::key_equal(), &resource);
     InsertCoinsMapEntry(map, value, flags);
     view.BatchWrite(map, {});
 }
@@ -855,4 +910,130 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_FIXTURE_TEST_CASE(ccoins_background_flush, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewBackgroundFlush flusher(&db, &db);
+    CCoinsViewCache cache(&flusher);
+
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 100; i++) {
+        outpoints.emplace_back(InsecureRand256(), 0);
+        Coin coin;
+        coin.out.nValue = InsecureRand32();
+        coin.out.scriptPubKey.assign(InsecureRandBits(6), 0);
+        coin.nHeight = 1;
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    uint256 hashBlock = InsecureRand256();
+    cache.SetBestBlock(hashBlock);
+
+    // The written coins stay cached, now clean.
+    BOOST_CHECK(flusher.FlushInBackground(cache, std::numeric_limits<size_t>::max()));
+    // Whether or not the write has committed yet, reads see the coins.
+    Coin coinRead;
+    BOOST_CHECK(flusher.GetCoin(outpoints[0], coinRead));
+    BOOST_CHECK(flusher.WaitForFlush());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size());
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(db.HaveCoin(outpoint));
+        BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    }
+    BOOST_CHECK_EQUAL(flusher.DynamicMemoryUsage(), 0U);
+
+    // Spends reach the database; spent entries leave the cache.
+    BOOST_CHECK(cache.SpendCoin(outpoints[0]));
+    hashBlock = InsecureRand256();
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(flusher.FlushInBackground(cache, std::numeric_limits<size_t>::max()));
+    BOOST_CHECK(!flusher.HaveCoin(outpoints[0]));
+    BOOST_CHECK(flusher.GetBestBlock() == hashBlock);
+    BOOST_CHECK(flusher.WaitForFlush());
+    BOOST_CHECK(!db.HaveCoin(outpoints[0]));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size() - 1);
+
+    // Without room for clean entries the cache ends up empty.
+    BOOST_CHECK(cache.SpendCoin(outpoints[1]));
+    BOOST_CHECK(flusher.FlushInBackground(cache, 0));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(flusher.WaitForFlush());
+    BOOST_CHECK(!db.HaveCoin(outpoints[1]));
+    BOOST_CHECK(cache.HaveCoin(outpoints[2]));
+
+    CoinsFlushStats stats = flusher.GetStats();
+    BOOST_CHECK_EQUAL(stats.nFlushes, 3U);
+    BOOST_CHECK_EQUAL(stats.nFailures, 0U);
+    BOOST_CHECK(!stats.fInProgress);
+    BOOST_CHECK_EQUAL(stats.nLastDirty, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewDB base(1 << 20, true);
+    std::vector<COutPoint> vOutPoints;
+    {
+        CCoinsViewCache cache(&base);
+        for (int i = 0; i < 100; i++) {
+            COutPoint outpoint(InsecureRand256(), 0);
+            cache.AddCoin(outpoint, Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false), false);
+            vOutPoints.push_back(outpoint);
+        }
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // A block spending all of them, an unknown coin, and an output of its own
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    CMutableTransaction tx;
+    for (const COutPoint& outpoint : vOutPoints)
+        tx.vin.emplace_back(outpoint);
+    const COutPoint missing(InsecureRand256(), 0);
+    tx.vin.emplace_back(missing);
+    tx.vout.resize(1);
+    CMutableTransaction child;
+    child.vin.emplace_back(COutPoint(tx.GetHash(), 0));
+    child.vout.resize(1);
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    pblock->vtx.push_back(MakeTransactionRef(coinbase));
+    pblock->vtx.push_back(MakeTransactionRef(tx));
+    pblock->vtx.push_back(MakeTransactionRef(child));
+
+    CCoinsPrefetcher prefetcher(&base);
+    prefetcher.Start(2);
+
+    CCoinsViewCache cache(&base);
+    prefetcher.Prefetch(pblock, cache);
+    BOOST_CHECK(prefetcher.GetPendingBlock(pblock->GetHash()) == pblock);
+    BOOST_CHECK_EQUAL(prefetcher.Warm(*pblock, cache), vOutPoints.size());
+    BOOST_CHECK(!prefetcher.GetPendingBlock(pblock->GetHash()));
+    for (const COutPoint& outpoint : vOutPoints)
+        BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK(!cache.HaveCoinInCache(missing));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), vOutPoints.size());
+
+    // Lookups queued before the cache wrote to its base are done again
+    CCoinsViewCache cache2(&base);
+    prefetcher.Prefetch(pblock, cache2);
+    BOOST_CHECK(cache2.SpendCoin(vOutPoints[0]));
+    cache2.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(cache2.Flush());
+    BOOST_CHECK_EQUAL(prefetcher.Warm(*pblock, cache2), vOutPoints.size() - 1);
+    BOOST_CHECK(!cache2.HaveCoinInCache(vOutPoints[0]));
+    BOOST_CHECK(cache2.HaveCoinInCache(vOutPoints[1]));
+
+    // Cached entries win over prefetched ones
+    CCoinsViewCache cache3(&base);
+    cache3.AddCoin(vOutPoints[1], Coin(CTxOut(12345, CScript() << OP_TRUE), 2, false), true);
+    prefetcher.Warm(*pblock, cache3);
+    BOOST_CHECK_EQUAL(cache3.AccessCoin(vOutPoints[1]).out.nValue, 12345);
+
+    // Without worker threads, Warm does the lookups itself
+    prefetcher.Stop();
+    CCoinsViewCache cache4(&base);
+    BOOST_CHECK_EQUAL(prefetcher.Warm(*pblock, cache4), vOutPoints.size() - 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
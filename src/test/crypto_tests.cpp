@@ -10,7 +10,10 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
+#include "hash.h"
 #include "random.h"
+#include "streams.h"
 #include "utilstrencodings.h"
 #include "test/test_fabcoin.h"
 
@@ -268,6 +271,26 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Counts that take each of the 8-way, 2-way and single paths, alone and mixed.
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = InsecureRandBits(8);
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+        // In place, as the Merkle tree code does it.
+        SHA256D64(in, in, i);
+        BOOST_CHECK(memcmp(out1, in, 32 * i) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -505,4 +528,70 @@ BOOST_AUTO_TEST_CASE(countbits_tests)
     }
 }
 
+static MuHash3072 FromInt(unsigned char i)
+{
+    unsigned char tmp[32] = {i, 0};
+    return MuHash3072().Insert(tmp, sizeof(tmp));
+}
+
+static uint256 FinalizeHash(MuHash3072 acc)
+{
+    uint256 out;
+    acc.Finalize(out.begin());
+    return out;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(1);
+    acc /= FromInt(2);
+    BOOST_CHECK_EQUAL(FinalizeHash(acc).GetHex(), "10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863");
+
+    // Removing before inserting, one at a time, gives the same hash
+    unsigned char tmp[32] = {0};
+    MuHash3072 acc2;
+    tmp[0] = 2;
+    acc2.Remove(tmp, sizeof(tmp));
+    tmp[0] = 1;
+    acc2.Insert(tmp, sizeof(tmp));
+    tmp[0] = 0;
+    acc2.Insert(tmp, sizeof(tmp));
+    BOOST_CHECK(FinalizeHash(acc2) == FinalizeHash(acc));
+
+    // The order of insertions and removals does not matter
+    std::vector<uint256> elems;
+    for (int i = 0; i < 10; ++i) {
+        elems.push_back(InsecureRand256());
+    }
+    MuHash3072 forward, backward;
+    for (int i = 0; i < 10; ++i) {
+        forward.Insert(elems[i].begin(), 32);
+        backward.Insert(elems[9 - i].begin(), 32);
+    }
+    BOOST_CHECK(FinalizeHash(forward) == FinalizeHash(backward));
+    for (int i = 0; i < 5; ++i) {
+        forward.Remove(elems[i].begin(), 32);
+    }
+    MuHash3072 rest;
+    for (int i = 5; i < 10; ++i) {
+        rest.Insert(elems[i].begin(), 32);
+    }
+    BOOST_CHECK(FinalizeHash(forward) == FinalizeHash(rest));
+    BOOST_CHECK(FinalizeHash(forward) != FinalizeHash(backward));
+
+    // Removing everything gives the hash of the empty set
+    for (int i = 5; i < 10; ++i) {
+        forward.Remove(elems[i].begin(), 32);
+    }
+    BOOST_CHECK(FinalizeHash(forward) == FinalizeHash(MuHash3072()));
+
+    // The state survives serialization
+    CDataStream ss(SER_DISK, 0);
+    ss << acc;
+    MuHash3072 acc3;
+    ss >> acc3;
+    BOOST_CHECK(FinalizeHash(acc3) == FinalizeHash(acc));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 #include "script/sigcache.h"
 #include "test/test_fabcoin.h"
 #include "random.h"
+#include <set>
 #include <thread>
 
 /** Test Suite for CuckooCache
@@ -377,4 +378,36 @@ BOOST_AUTO_TEST_CASE(cuckoocache_generations)
     test_cache_generations<CuckooCache::cache<uint256, SignatureCacheHasher>>();
 }
 
+/* Test that get_live returns exactly the elements not erased, and that
+ * inserting them into a new cache of the same size keeps all of them.
+ */
+BOOST_AUTO_TEST_CASE(cuckoocache_get_live)
+{
+    local_rand_ctx = FastRandomContext(true);
+    CuckooCache::cache<uint256, SignatureCacheHasher> set{};
+    size_t n = set.setup(1 << 12);
+    std::vector<uint256> hashes(n / 4);
+    for (uint256& h : hashes) {
+        insecure_GetRandHash(h);
+        set.insert(h);
+    }
+    // Erase every other one.
+    for (size_t i = 0; i < hashes.size(); i += 2)
+        BOOST_CHECK(set.contains(hashes[i], true));
+
+    std::vector<uint256> live;
+    set.get_live(live);
+    BOOST_CHECK_EQUAL(live.size(), hashes.size() / 2);
+    std::set<uint256> setLive(live.begin(), live.end());
+    for (size_t i = 1; i < hashes.size(); i += 2)
+        BOOST_CHECK(setLive.count(hashes[i]));
+
+    CuckooCache::cache<uint256, SignatureCacheHasher> set2{};
+    set2.setup(n);
+    for (const uint256& h : live)
+        set2.insert(h);
+    for (size_t i = 1; i < hashes.size(); i += 2)
+        BOOST_CHECK(set2.contains(hashes[i], false));
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -40,6 +40,49 @@ BOOST_AUTO_TEST_CASE(dbwrapper)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_options_and_stats)
+{
+    gArgs.ForceSetArg("-dbwrappertestbloombits", "5");
+    gArgs.ForceSetArg("-dbwrappertestwritebuffer", "2");
+    DBOptions dbOptions = DBOptions::FromArgs("dbwrappertest", 1 << 20);
+    BOOST_CHECK_EQUAL(dbOptions.nBlockCacheSize, 1U << 19);
+    BOOST_CHECK_EQUAL(dbOptions.nWriteBufferSize, 2U << 20);
+    BOOST_CHECK_EQUAL(dbOptions.nBloomBits, 5);
+    BOOST_CHECK_EQUAL(DBOptions::FromArgs("dbwrapperunset", 1 << 20).nBloomBits, 10);
+
+    fs::path ph = fs::temp_directory_path() / fs::unique_path();
+    CDBWrapper dbw(ph, dbOptions, true, false, false);
+    BOOST_CHECK_EQUAL(dbw.GetDBOptions().nBloomBits, 5);
+
+    uint256 in = InsecureRand256();
+    uint256 res;
+    BOOST_CHECK(dbw.Write('a', in));
+    BOOST_CHECK(dbw.Write('b', in));
+    BOOST_CHECK(dbw.Read('a', res));
+    BOOST_CHECK(!dbw.Read('c', res));
+    BOOST_CHECK(dbw.Exists('b'));
+    BOOST_CHECK(dbw.Erase('b'));
+
+    std::map<unsigned char, DBPrefixStats> mapStats = dbw.GetPrefixStats();
+    // Opening the database looked for the obfuscation key
+    BOOST_CHECK_EQUAL(mapStats.size(), 4U);
+    BOOST_CHECK_EQUAL(mapStats['a'].nReads, 1U);
+    BOOST_CHECK_EQUAL(mapStats['a'].nReadHits, 1U);
+    BOOST_CHECK_EQUAL(mapStats['a'].nReadBytes, 32U);
+    BOOST_CHECK_EQUAL(mapStats['a'].nWrites, 1U);
+    BOOST_CHECK_EQUAL(mapStats['a'].nWriteBytes, 33U);
+    BOOST_CHECK_EQUAL(mapStats['a'].nErases, 0U);
+    BOOST_CHECK_EQUAL(mapStats['b'].nReadHits, 1U);
+    BOOST_CHECK_EQUAL(mapStats['b'].nErases, 1U);
+    BOOST_CHECK_EQUAL(mapStats['c'].nReads, 1U);
+    BOOST_CHECK_EQUAL(mapStats['c'].nReadHits, 0U);
+    BOOST_CHECK_EQUAL(mapStats['c'].nWrites, 0U);
+
+    std::string strValue;
+    BOOST_CHECK(dbw.GetProperty("leveldb.stats", strValue));
+    BOOST_CHECK(!dbw.GetProperty("leveldb.nonsense", strValue));
+}
+
 // Test batch operations
 BOOST_AUTO_TEST_CASE(dbwrapper_batch)
 {
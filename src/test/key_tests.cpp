@@ -158,4 +158,46 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(key_verify_batch)
+{
+    std::vector<CDeferredSignature> vSigs;
+    std::vector<bool> vExpected;
+    for (int i = 0; i < 150; i++) {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        uint256 hash = InsecureRand256();
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        CPubKey pubkey = key.GetPubKey();
+        switch (i % 5) {
+        case 1:
+            // Wrong message
+            hash = InsecureRand256();
+            break;
+        case 2:
+            // Not DER at all
+            vchSig.assign(10, 0);
+            break;
+        case 3:
+            // Not a valid key
+            pubkey = CPubKey();
+            break;
+        }
+        vSigs.emplace_back(pubkey, hash, vchSig);
+        vExpected.push_back(pubkey.Verify(hash, vchSig));
+        BOOST_CHECK_EQUAL(vExpected.back(), i % 5 == 0 || i % 5 == 4);
+    }
+
+    std::vector<bool> vResult;
+    BOOST_CHECK(!CPubKey::VerifyBatch(vSigs, &vResult));
+    BOOST_CHECK(vResult == vExpected);
+
+    std::vector<CDeferredSignature> vValid;
+    for (size_t i = 0; i < vSigs.size(); i++)
+        if (vExpected[i])
+            vValid.push_back(vSigs[i]);
+    BOOST_CHECK(CPubKey::VerifyBatch(vValid));
+    BOOST_CHECK(CPubKey::VerifyBatch({}));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,88 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logging.h"
+#include "test/test_fabcoin.h"
+#include "util.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/test/unit_test.hpp>
+
+extern FILE* fileout;
+
+static std::vector<std::string> ReadLines(const fs::path& path)
+{
+    std::ifstream file(path.string());
+    std::vector<std::string> vLines;
+    std::string strLine;
+    while (std::getline(file, strLine))
+        vLines.push_back(strLine);
+    return vLines;
+}
+
+BOOST_FIXTURE_TEST_SUITE(logwriter_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(logwriter_queue_drain_and_drops)
+{
+    // debug.log can only be opened once per process, so everything that
+    // reads it back is in this one case.
+    BOOST_REQUIRE(fileout == nullptr);
+    OpenDebugLog("debug.log", fileout, "a");
+    BOOST_REQUIRE(fileout != nullptr);
+    const fs::path pathDebugLog = GetDataDir() / "debug.log";
+
+    // Session loggers echo to the console.
+    std::ostringstream console;
+    std::streambuf* pCoutBuf = std::cout.rdbuf(console.rdbuf());
+    fPrintToDebugLog = true;
+
+    // Messages are queued by LogPrintStr and all written out, in order, by
+    // the time StopLogWriter returns.
+    StartLogWriter(1024);
+    for (int i = 0; i < 100; i++)
+        LogPrintStr(strprintf("logwriter line %d\n", i));
+    StopLogWriter();
+    int nNext = 0;
+    for (const std::string& strLine : ReadLines(pathDebugLog)) {
+        if (nNext < 100 && boost::algorithm::ends_with(strLine, strprintf("logwriter line %d", nNext)))
+            nNext++;
+    }
+    BOOST_CHECK_EQUAL(nNext, 100);
+
+    // A writer that falls behind drops messages, counts them and says so in
+    // debug.log. A session line is queued once it is complete, so the lines
+    // that do make it are whole.
+    const uint64_t nDroppedBefore = GetLogMessagesDropped();
+    const fs::path pathSession = GetDataDir() / "logwriter_session.log";
+    {
+        LoggerSession session(pathSession.string(), "");
+        StartLogWriter(2);
+        for (int i = 0; i < 20000; i++)
+            session << "logwriter " << i << " in parts" << LoggerSession::endL;
+        StopLogWriter();
+    }
+    fPrintToDebugLog = false;
+    std::cout.rdbuf(pCoutBuf);
+
+    BOOST_CHECK(GetLogMessagesDropped() > nDroppedBefore);
+    std::vector<std::string> vLines = ReadLines(pathSession);
+    BOOST_CHECK(!vLines.empty());
+    BOOST_CHECK(vLines.size() < 20000U);
+    for (const std::string& strLine : vLines) {
+        BOOST_CHECK(strLine.find("logwriter ") != std::string::npos);
+        BOOST_CHECK(boost::algorithm::ends_with(strLine, " in parts"));
+    }
+    bool fReported = false;
+    for (const std::string& strLine : ReadLines(pathDebugLog))
+        fReported |= strLine.find("log messages dropped, the log writer fell behind") != std::string::npos;
+    BOOST_CHECK(fReported);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
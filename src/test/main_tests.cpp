@@ -3,13 +3,20 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
 #include "validation.h"
 #include "net.h"
+#include "streams.h"
 
 #include "test/test_fabcoin.h"
 
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include <functional>
+#include <set>
 
 BOOST_FIXTURE_TEST_SUITE(main_tests, TestingSetup)
 
@@ -86,4 +93,137 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+/** A block of nTxs transactions, with the ones at the given positions made invalid in different ways */
+static CBlock BlockWithBadTxs(size_t nTxs, const std::vector<size_t>& vBad)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    for (size_t i = 1; i < nTxs; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(COIN, CScript() << OP_TRUE);
+        for (size_t j = 0; j < vBad.size(); j++) {
+            if (vBad[j] != i)
+                continue;
+            if (j % 2 == 0)
+                tx.vout[0].nValue = -1;
+            else
+                tx.vout[0].nValue = MAX_MONEY + 1;
+        }
+        block.vtx.push_back(MakeTransactionRef(tx));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(checkblock_parallel_first_error)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    const int nScriptCheckThreadsOld = nScriptCheckThreads;
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(&ThreadBlockTxCheck);
+
+    const size_t nTxs = 3 * MIN_PARALLEL_BLOCK_CHECK_TXS;
+    const std::vector<std::vector<size_t>> vCases = {{}, {nTxs - 1}, {nTxs / 2, 7}, {5, nTxs / 2, nTxs - 2}};
+    for (const std::vector<size_t>& vBad : vCases) {
+        const CBlock block = BlockWithBadTxs(nTxs, vBad);
+
+        // The block's transactions on the check threads, and in order here.
+        CBlock blockParallel = block, blockSerial = block;
+        CValidationState stateParallel, stateSerial;
+        nScriptCheckThreads = 4;
+        const bool fParallel = CheckBlock(blockParallel, stateParallel, params, false, true);
+        nScriptCheckThreads = 0;
+        const bool fSerial = CheckBlock(blockSerial, stateSerial, params, false, true);
+
+        BOOST_CHECK_EQUAL(fParallel, vBad.empty());
+        BOOST_CHECK_EQUAL(fParallel, fSerial);
+        BOOST_CHECK_EQUAL(stateParallel.GetRejectReason(), stateSerial.GetRejectReason());
+        BOOST_CHECK_EQUAL(stateParallel.GetDebugMessage(), stateSerial.GetDebugMessage());
+        if (!vBad.empty()) {
+            const size_t nFirst = *std::min_element(vBad.begin(), vBad.end());
+            BOOST_CHECK(stateParallel.GetDebugMessage().find(block.vtx[nFirst]->GetHash().ToString()) != std::string::npos);
+        }
+    }
+
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+/** The hash of a header with the same fields that has never been hashed */
+static uint256 FreshHash(const CBlockHeader& header)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    CBlockHeader fresh;
+    ss >> fresh;
+    return fresh.GetHash();
+}
+
+BOOST_AUTO_TEST_CASE(block_header_hash_cache)
+{
+    CBlock block = BlockWithBadTxs(3, {});
+    block.nVersion = 4;
+    block.hashPrevBlock = InsecureRand256();
+    block.nHeight = 100;
+    block.nTime = 1500000000;
+    block.nBits = 0x207fffff;
+    block.nSolution.assign(1344, 0x5a);
+
+    // A header is hashed once.
+    const uint256 hash = block.GetHash();
+    const uint64_t nHashes = GetBlockHeaderHashCount();
+    BOOST_CHECK(block.GetHash() == hash);
+    BOOST_CHECK_EQUAL(GetBlockHeaderHashCount(), nHashes);
+    BOOST_CHECK(FreshHash(block) == hash);
+
+    // Copies start without the hash, so that one changed directly right
+    // after it was copied, like a block made invalid in a test, does not
+    // keep the hash of the original.
+    const CBlockHeader header = block.GetBlockHeader();
+    BOOST_CHECK(header.GetHash() == hash);
+    CBlock blockCopy = block;
+    blockCopy.hashMerkleRoot.SetNull();
+    BOOST_CHECK(blockCopy.GetHash() == FreshHash(blockCopy));
+    BOOST_CHECK(blockCopy.GetHash() != hash);
+    blockCopy = block;
+    BOOST_CHECK(blockCopy.GetHash() == hash);
+
+    // Every setter changes the hash.
+    std::set<uint256> setHashes = {hash};
+    const std::vector<std::function<void(CBlockHeader&)>> vSetters = {
+        [](CBlockHeader& h) { h.SetVersion(h.nVersion + 1); },
+        [](CBlockHeader& h) { h.SetPrevBlock(InsecureRand256()); },
+        [](CBlockHeader& h) { h.SetMerkleRoot(InsecureRand256()); },
+        [](CBlockHeader& h) { h.SetHeight(h.nHeight + 1); },
+        [](CBlockHeader& h) { h.SetTime(h.nTime + 1); },
+        [](CBlockHeader& h) { h.SetBits(h.nBits - 1); },
+        [](CBlockHeader& h) { h.SetNonce(ArithToUint256(UintToArith256(h.nNonce) + 1)); },
+        [](CBlockHeader& h) { h.SetSolution(std::vector<unsigned char>(1344, 0xa5)); },
+        [](CBlockHeader& h) { h.nReserved[3]++; h.InvalidateHash(); },
+    };
+    for (const auto& set : vSetters) {
+        set(blockCopy);
+        const uint256 hashNew = blockCopy.GetHash();
+        BOOST_CHECK(hashNew == FreshHash(blockCopy));
+        BOOST_CHECK(setHashes.insert(hashNew).second);
+    }
+    BOOST_CHECK(block.GetHash() == hash);
+
+    // Reading a header over a hashed one drops its hash.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << blockCopy;
+    ss >> block;
+    BOOST_CHECK(block.GetHash() == blockCopy.GetHash());
+    block.SetNull();
+    BOOST_CHECK(block.GetHash() == FreshHash(block));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
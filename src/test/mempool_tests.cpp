@@ -2,9 +2,15 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "consensus/validation.h"
+#include "key.h"
+#include "keystore.h"
 #include "policy/policy.h"
+#include "script/sign.h"
+#include "script/standard.h"
 #include "txmempool.h"
 #include "util.h"
+#include "validation.h"
 
 #include "test/test_fabcoin.h"
 
@@ -539,11 +545,15 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     BOOST_CHECK(pool.exists(tx6.GetHash()));
     BOOST_CHECK(!pool.exists(tx7.GetHash()));
 
-    if (!pool.exists(tx5.GetHash()))
-        pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5));
+    // The history kept for GetDelta() isn't freed by trimming, so aim at the
+    // usage without 5/7, give or take a block of that history.
+    if (pool.exists(tx5.GetHash()))
+        pool.removeRecursive(tx5);
+    size_t nUsageWithout57 = pool.DynamicMemoryUsage();
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/7
+    pool.TrimToSize(nUsageWithout57 + 600); // should maximize mempool size by only removing 5/7
     BOOST_CHECK(pool.exists(tx4.GetHash()));
     BOOST_CHECK(!pool.exists(tx5.GetHash()));
     BOOST_CHECK(pool.exists(tx6.GetHash()));
@@ -581,4 +591,339 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+
+BOOST_AUTO_TEST_CASE(MempoolTraversalTest)
+{
+    // Diamond: A is spent by B and C, which are both spent by D.
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool;
+
+    CMutableTransaction txA;
+    txA.vin.resize(1);
+    txA.vin[0].scriptSig = CScript() << OP_11;
+    txA.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txA.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txA.vout[i].nValue = 10 * COIN;
+    }
+    CMutableTransaction txMid[2];
+    for (int i = 0; i < 2; i++) {
+        txMid[i].vin.resize(1);
+        txMid[i].vin[0].scriptSig = CScript() << OP_11;
+        txMid[i].vin[0].prevout = COutPoint(txA.GetHash(), i);
+        txMid[i].vout.resize(1);
+        txMid[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txMid[i].vout[0].nValue = 9 * COIN;
+    }
+    CMutableTransaction txD;
+    txD.vin.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txD.vin[i].scriptSig = CScript() << OP_11;
+        txD.vin[i].prevout = COutPoint(txMid[i].GetHash(), 0);
+    }
+    txD.vout.resize(1);
+    txD.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txD.vout[0].nValue = 17 * COIN;
+
+    pool.addUnchecked(txA.GetHash(), entry.Fee(1000LL).FromTx(txA));
+    pool.addUnchecked(txMid[0].GetHash(), entry.Fee(1000LL).FromTx(txMid[0]));
+    pool.addUnchecked(txMid[1].GetHash(), entry.Fee(1000LL).FromTx(txMid[1]));
+    pool.addUnchecked(txD.GetHash(), entry.Fee(1000LL).FromTx(txD));
+
+    // A is reachable through both B and C but must be reported once.
+    LOCK(pool.cs);
+    CTxMemPool::txiter itD = pool.mapTx.find(txD.GetHash());
+    CTxMemPool::vecEntries vAncestors;
+    std::string dummy;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itD, vAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK_EQUAL(vAncestors.size(), 3U);
+    BOOST_CHECK_EQUAL(CTxMemPool::setEntries(vAncestors.begin(), vAncestors.end()).size(), 3U);
+    BOOST_CHECK_EQUAL(itD->GetCountWithAncestors(), 4U);
+
+    CTxMemPool::txiter itA = pool.mapTx.find(txA.GetHash());
+    CTxMemPool::vecEntries vDescendants;
+    {
+        CTxMemPool::EpochGuard epoch(pool);
+        pool.CalculateDescendants(itA, vDescendants);
+        // A second walk under the same guard adds nothing new.
+        pool.CalculateDescendants(pool.mapTx.find(txMid[0].GetHash()), vDescendants);
+    }
+    BOOST_CHECK_EQUAL(vDescendants.size(), 4U);
+    BOOST_CHECK(vDescendants[0] == itA);
+    BOOST_CHECK_EQUAL(itA->GetCountWithDescendants(), 4U);
+
+    // A nested walk sees nothing of the outer one and leaves it intact.
+    {
+        CTxMemPool::EpochGuard epoch(pool);
+        BOOST_CHECK(!pool.Visited(itA));
+        {
+            CTxMemPool::EpochGuard nested(pool);
+            BOOST_CHECK(!pool.Visited(itA));
+            BOOST_CHECK(!pool.Visited(itD));
+            BOOST_CHECK(pool.Visited(itD));
+        }
+        BOOST_CHECK(pool.Visited(itA));
+        BOOST_CHECK(!pool.Visited(itD));
+    }
+
+    // Limits are enforced on the deduplicated ancestor count.
+    vAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(*itD, vAncestors, 3, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    vAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itD, vAncestors, 4, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+
+    // Confirming A updates the ancestor state of everything below it.
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(txA));
+    pool.removeForBlock(vtx, 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txD.GetHash())->GetCountWithAncestors(), 3U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txMid[0].GetHash())->GetCountWithAncestors(), 1U);
+
+    // Removing B recursively takes D with it, once.
+    pool.removeRecursive(txMid[0]);
+    BOOST_CHECK_EQUAL(pool.size(), 1U);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txMid[1].GetHash())->GetCountWithDescendants(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+
+    CMutableTransaction txOther = txParent;
+    txOther.vout[0].nValue = 5 * COIN;
+
+    uint64_t nStart = pool.GetSequence();
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(2000LL).FromTx(txChild));
+
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->nSequence, pool.GetSequence());
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 2U);
+    // Unchanged mempool: the same snapshot is handed out again.
+    BOOST_CHECK(pool.GetSnapshot() == snapshot);
+
+    const CTxMemPoolSnapshotEntry* child = snapshot->Find(txChild.GetHash());
+    BOOST_CHECK(child);
+    BOOST_CHECK_EQUAL(child->nFee, 2000LL);
+    BOOST_CHECK_EQUAL(child->nCountWithAncestors, 2U);
+    BOOST_CHECK(child->vParents == std::vector<uint256>{txParent.GetHash()});
+    BOOST_CHECK(snapshot->Find(txParent.GetHash())->vChildren == std::vector<uint256>{txChild.GetHash()});
+    BOOST_CHECK(!snapshot->Find(txOther.GetHash()));
+
+    // Non-verbose getrawmempool order: parents first.
+    std::vector<uint256> vHashes;
+    pool.queryHashes(vHashes);
+    std::vector<const CTxMemPoolSnapshotEntry*> vSorted = snapshot->GetSortedDepthAndScore();
+    BOOST_CHECK_EQUAL(vSorted.size(), vHashes.size());
+    for (size_t i = 0; i < vSorted.size(); i++)
+        BOOST_CHECK(vSorted[i]->GetHash() == vHashes[i]);
+    BOOST_CHECK(vHashes[0] == txParent.GetHash());
+
+    // Changes publish a new snapshot; the old one stays intact for its readers.
+    uint64_t nMiddle = pool.GetSequence();
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(1000LL).FromTx(txOther));
+    pool.removeRecursive(txParent);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot2 = pool.GetSnapshot();
+    BOOST_CHECK(snapshot2 != snapshot);
+    BOOST_CHECK_EQUAL(snapshot2->vEntries.size(), 1U);
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 2U);
+
+    uint64_t nSequence;
+    std::vector<uint256> vAdded, vRemoved;
+    BOOST_CHECK(pool.GetDelta(nMiddle, nSequence, vAdded, vRemoved));
+    BOOST_CHECK_EQUAL(nSequence, pool.GetSequence());
+    BOOST_CHECK(vAdded == std::vector<uint256>{txOther.GetHash()});
+    BOOST_CHECK_EQUAL(vRemoved.size(), 2U);
+
+    // Parent and child came and went since the start.
+    BOOST_CHECK(pool.GetDelta(nStart, nSequence, vAdded, vRemoved));
+    BOOST_CHECK(vAdded == std::vector<uint256>{txOther.GetHash()});
+    BOOST_CHECK(vRemoved.empty());
+
+    BOOST_CHECK(pool.GetDelta(nSequence, nSequence, vAdded, vRemoved));
+    BOOST_CHECK(vAdded.empty() && vRemoved.empty());
+    BOOST_CHECK(!pool.GetDelta(nSequence + 1, nSequence, vAdded, vRemoved));
+
+    // Only entries that changed are copied into the next snapshot.
+    CMutableTransaction txUnrelated = txOther;
+    txUnrelated.vout[0].nValue = 4 * COIN;
+    pool.addUnchecked(txUnrelated.GetHash(), entry.Fee(1000LL).FromTx(txUnrelated));
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot3 = pool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot3->vEntries.size(), 2U);
+    BOOST_CHECK(snapshot3->Find(txOther.GetHash()) == snapshot2->Find(txOther.GetHash()));
+    pool.PrioritiseTransaction(txOther.GetHash(), 500LL);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot4 = pool.GetSnapshot();
+    BOOST_CHECK(snapshot4->Find(txUnrelated.GetHash()) == snapshot3->Find(txUnrelated.GetHash()));
+    BOOST_CHECK_EQUAL(snapshot4->Find(txOther.GetHash())->nModifiedFee, 1500LL);
+    BOOST_CHECK_EQUAL(snapshot3->Find(txOther.GetHash())->nModifiedFee, 1000LL);
+
+    // clear() forgets the history.
+    pool.clear();
+    BOOST_CHECK(!pool.GetDelta(nMiddle, nSequence, vAdded, vRemoved));
+    BOOST_CHECK(pool.GetSnapshot()->vEntries.empty());
+
+    // The history kept for GetDelta() counts towards the mempool's memory usage.
+    size_t nUsage = pool.DynamicMemoryUsage();
+    for (int i = 0; i < 1000; i++) {
+        pool.addUnchecked(txOther.GetHash(), entry.Fee(1000LL).FromTx(txOther));
+        pool.removeRecursive(txOther);
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    BOOST_CHECK(pool.DynamicMemoryUsage() > nUsage);
+}
+
+/** A standard transaction spending vPrevout, all paying to scriptPubKey, signed with keystore. */
+static CMutableTransaction SignedSpend(const CBasicKeyStore& keystore, const CScript& scriptPubKey, const std::vector<COutPoint>& vPrevout, CAmount nValueIn)
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = 1;
+    for (const COutPoint& prevout : vPrevout)
+        mtx.vin.push_back(CTxIn(prevout));
+    mtx.vout.push_back(CTxOut(nValueIn * vPrevout.size() - 100000, scriptPubKey));
+    for (unsigned int i = 0; i < mtx.vin.size(); i++)
+        BOOST_CHECK(SignSignature(keystore, scriptPubKey, mtx, i, nValueIn, SIGHASH_ALL));
+    return mtx;
+}
+
+/** Add a confirmed coin paying to scriptPubKey to the chain state. */
+static COutPoint AddTestCoin(const CScript& scriptPubKey, CAmount nValue)
+{
+    COutPoint outpoint(InsecureRand256(), 0);
+    pcoinsTip->AddCoin(outpoint, Coin(CTxOut(nValue, scriptPubKey), chainActive.Height(), false), false);
+    return outpoint;
+}
+
+/** Break the signature in the scriptSig of input nIn, leaving it well-formed. */
+static void BreakSignature(CMutableTransaction& mtx, unsigned int nIn)
+{
+    mtx.vin[nIn].scriptSig[10] ^= 1;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAcceptBatchTest)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    const CAmount nValue = 1 * COIN;
+
+    LOCK(cs_main);
+    // Independent, accepted.
+    CMutableTransaction tx1 = SignedSpend(keystore, scriptPubKey, {AddTestCoin(scriptPubKey, nValue)}, nValue);
+    // Spends another member, so it is accepted after the staged ones.
+    CMutableTransaction tx2 = SignedSpend(keystore, scriptPubKey, {COutPoint(tx1.GetHash(), 0)}, tx1.vout[0].nValue);
+    // Two members spending the same coin: the first one wins.
+    const COutPoint prevoutShared = AddTestCoin(scriptPubKey, nValue);
+    CMutableTransaction tx3 = SignedSpend(keystore, scriptPubKey, {prevoutShared}, nValue);
+    CMutableTransaction tx3b = tx3;
+    tx3b.vout[0].nValue -= 1000;
+    BOOST_CHECK(SignSignature(keystore, scriptPubKey, tx3b, 0, nValue, SIGHASH_ALL));
+    // Independent, fails its script check. That makes the batched check fail,
+    // which must not take the other staged members down with it.
+    CMutableTransaction tx4 = SignedSpend(keystore, scriptPubKey, {AddTestCoin(scriptPubKey, nValue)}, nValue);
+    BreakSignature(tx4, 0);
+    // Independent, accepted.
+    CMutableTransaction tx5 = SignedSpend(keystore, scriptPubKey, {AddTestCoin(scriptPubKey, nValue)}, nValue);
+    // Spends a coin nobody has.
+    CMutableTransaction tx6 = SignedSpend(keystore, scriptPubKey, {AddTestCoin(scriptPubKey, nValue)}, nValue);
+    tx6.vin[0].prevout = COutPoint(InsecureRand256(), 0);
+
+    std::vector<CTransactionRef> vtx = {MakeTransactionRef(tx1), MakeTransactionRef(tx2), MakeTransactionRef(tx3),
+        MakeTransactionRef(tx3b), MakeTransactionRef(tx4), MakeTransactionRef(tx5), MakeTransactionRef(tx6)};
+    std::vector<CValidationState> vState;
+    std::vector<bool> vMissingInputs;
+    std::vector<bool> vAccepted = AcceptToMemoryPoolBatch(mempool, vtx, true, vState, vMissingInputs);
+    BOOST_REQUIRE_EQUAL(vAccepted.size(), vtx.size());
+    BOOST_REQUIRE_EQUAL(vState.size(), vtx.size());
+    BOOST_REQUIRE_EQUAL(vMissingInputs.size(), vtx.size());
+
+    BOOST_CHECK(vAccepted[0] && vState[0].IsValid());
+    BOOST_CHECK(vAccepted[1] && vState[1].IsValid());
+    BOOST_CHECK(vAccepted[2] && vState[2].IsValid());
+    BOOST_CHECK(!vAccepted[3]);
+    BOOST_CHECK_EQUAL(vState[3].GetRejectReason(), "txn-mempool-conflict");
+    BOOST_CHECK(!vAccepted[4]);
+    BOOST_CHECK(vState[4].IsInvalid());
+    BOOST_CHECK(vState[4].GetRejectReason().find("script-verify-flag-failed") != std::string::npos);
+    BOOST_CHECK(vAccepted[5] && vState[5].IsValid());
+    BOOST_CHECK(!vAccepted[6]);
+    BOOST_CHECK(vMissingInputs[6]);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(mempool.exists(vtx[i]->GetHash()), vAccepted[i]);
+        if (i != 6)
+            BOOST_CHECK(!vMissingInputs[i]);
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 4U);
+
+    // A batch agrees with the same transactions accepted one at a time.
+    mempool.clear();
+    for (size_t i = 0; i < vtx.size(); i++) {
+        CValidationState state;
+        bool fMissingInputs = false;
+        BOOST_CHECK_EQUAL(AcceptToMemoryPool(mempool, state, vtx[i], true, &fMissingInputs), vAccepted[i]);
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), vState[i].GetRejectReason());
+        BOOST_CHECK_EQUAL(fMissingInputs, vMissingInputs[i]);
+    }
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(MempoolParallelInputsRejectReasonTest)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    const CAmount nValue = 1 * COIN;
+
+    LOCK(cs_main);
+    std::vector<COutPoint> vPrevout;
+    for (unsigned int i = 0; i < MIN_PARALLEL_MEMPOOL_SCRIPT_INPUTS; i++)
+        vPrevout.push_back(AddTestCoin(scriptPubKey, nValue));
+    CMutableTransaction mtx = SignedSpend(keystore, scriptPubKey, vPrevout, nValue);
+    // Two inputs fail for different reasons; the reject reason has to be
+    // the one of the first, as a serial check reports it, whichever of them
+    // the script-check threads happened to run into.
+    BreakSignature(mtx, 2);
+    mtx.vin[MIN_PARALLEL_MEMPOOL_SCRIPT_INPUTS - 1].scriptSig = CScript() << OP_1;
+    const CTransactionRef ptx = MakeTransactionRef(mtx);
+
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+    CValidationState stateParallel;
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, stateParallel, ptx, true, nullptr));
+
+    const int nScriptCheckThreadsBefore = nScriptCheckThreads;
+    nScriptCheckThreads = 0;
+    CValidationState stateSerial;
+    BOOST_CHECK(!AcceptToMemoryPool(mempool, stateSerial, ptx, true, nullptr));
+    nScriptCheckThreads = nScriptCheckThreadsBefore;
+
+    BOOST_CHECK(stateSerial.IsInvalid());
+    BOOST_CHECK(stateSerial.GetRejectReason().find("script-verify-flag-failed") != std::string::npos);
+    BOOST_CHECK_EQUAL(stateParallel.GetRejectReason(), stateSerial.GetRejectReason());
+    BOOST_CHECK_EQUAL(stateParallel.GetDebugMessage(), stateSerial.GetDebugMessage());
+    BOOST_CHECK_EQUAL(stateParallel.GetRejectCode(), stateSerial.GetRejectCode());
+    BOOST_CHECK(stateSerial.GetRejectReason().find("OP_EQUALVERIFY") == std::string::npos);
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -231,8 +231,8 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
         CBlock *pblock = &pblocktemplate->block; // pointer for convenience
         {
             LOCK(cs_main);
-            pblock->nVersion = 1;
-            pblock->nTime = chainActive.Tip()->GetMedianTimePast()+1;
+            pblock->SetVersion(1);
+            pblock->SetTime(chainActive.Tip()->GetMedianTimePast()+1);
             CMutableTransaction txCoinbase(*pblock->vtx[0]);
             txCoinbase.nVersion = 1;
             txCoinbase.vin[0].scriptSig = CScript();
@@ -245,13 +245,13 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
                 baseheight = chainActive.Height();
             if (txFirst.size() < 4)
                 txFirst.push_back(pblock->vtx[0]);
-            pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
-            pblock->nNonce = ArithToUint256(arith_uint256(blockinfo[i].nonce));
+            pblock->SetMerkleRoot(BlockMerkleRoot(*pblock));
+            pblock->SetNonce(ArithToUint256(arith_uint256(blockinfo[i].nonce)));
         }
         std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
         ProcessNewBlock(chainparams, shared_pblock, true, nullptr) ;
         //BOOST_CHECK( ProcessNewBlock(chainparams, shared_pblock, true, nullptr) );
-        pblock->hashPrevBlock = pblock->GetHash();
+        pblock->SetPrevBlock(pblock->GetHash());
     }
 
     LOCK(cs_main);
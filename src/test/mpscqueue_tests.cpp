@@ -0,0 +1,78 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mpscqueue.h"
+#include "test/test_fabcoin.h"
+#include "util.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mpscqueue_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(mpscqueue_fill)
+{
+    CMPSCQueue<std::string> queue(5);
+    BOOST_CHECK_EQUAL(queue.Capacity(), 8U);
+
+    // Values come out in order, and a full queue takes no more.
+    std::string str;
+    BOOST_CHECK(!queue.TryPop(str));
+    for (int nRound = 0; nRound < 3; nRound++) {
+        for (int i = 0; i < 8; i++) {
+            str = strprintf("value %d", i);
+            BOOST_CHECK(queue.TryPush(std::move(str)));
+        }
+        str = "one too many";
+        BOOST_CHECK(!queue.TryPush(std::move(str)));
+        BOOST_CHECK_EQUAL(str, "one too many");
+        for (int i = 0; i < 8; i++) {
+            BOOST_CHECK(queue.TryPop(str));
+            BOOST_CHECK_EQUAL(str, strprintf("value %d", i));
+        }
+        BOOST_CHECK(!queue.TryPop(str));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mpscqueue_threads)
+{
+    const int nThreads = 4;
+    const int nPerThread = 20000;
+    CMPSCQueue<std::pair<int, int>> queue(64);
+
+    // Every value pushed comes out once, and each thread's in the order it
+    // pushed them, however the pushes interleave.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; t++) {
+        threads.emplace_back([&queue, t, nPerThread] {
+            for (int i = 0; i < nPerThread; i++) {
+                while (!queue.TryPush(std::make_pair(t, i)))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    std::vector<int> vNext(nThreads, 0);
+    int nPopped = 0;
+    bool fInOrder = true;
+    std::pair<int, int> value;
+    while (nPopped < nThreads * nPerThread) {
+        if (!queue.TryPop(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        fInOrder &= value.second == vNext[value.first]++;
+        nPopped++;
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    BOOST_CHECK(fInOrder);
+    BOOST_CHECK(!queue.TryPop(value));
+    for (int t = 0; t < nThreads; t++)
+        BOOST_CHECK_EQUAL(vNext[t], nPerThread);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "policy/policy.h"
 #include "policy/fees.h"
+#include "scheduler.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
@@ -179,4 +180,55 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesQueued)
+{
+    // Nothing services this scheduler, so queued events are only applied
+    // when the test asks for it.
+    CScheduler scheduler;
+    CBlockPolicyEstimator feeEst;
+    CBlockPolicyEstimator feeEstQueued;
+    feeEstQueued.SetScheduler(&scheduler);
+    CTxMemPool mpool(&feeEst);
+    CTxMemPool mpoolQueued(&feeEstQueued);
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 0LL;
+
+    std::vector<CTransactionRef> block;
+    int blocknum = 0;
+    while (blocknum < 50) {
+        for (int j = 0; j < 10; j++) {
+            tx.vin[0].prevout.n = 10000*blocknum+j;
+            uint256 hash = tx.GetHash();
+            mpool.addUnchecked(hash, entry.Fee(1000 * (j+1)).Time(GetTime()).Height(blocknum).FromTx(tx));
+            mpoolQueued.addUnchecked(hash, entry.Fee(1000 * (j+1)).Time(GetTime()).Height(blocknum).FromTx(tx));
+            if (j % 2 == 0)
+                block.push_back(mpool.get(hash));
+        }
+        mpool.removeForBlock(block, ++blocknum);
+        mpoolQueued.removeForBlock(block, blocknum);
+        block.clear();
+    }
+
+    // Nothing has been applied yet.
+    BOOST_CHECK_EQUAL(feeEstQueued.GetVersion(), 0U);
+    BOOST_CHECK(feeEst.GetVersion() > 0);
+    FeeCalculation feeCalc;
+    feeEstQueued.estimateSmartFee(2, &feeCalc, true);
+    BOOST_CHECK_EQUAL(feeCalc.version, 0U);
+
+    // Once applied, both estimators have seen the same history.
+    feeEstQueued.ProcessQueuedEvents();
+    BOOST_CHECK_EQUAL(feeEstQueued.GetVersion(), feeEst.GetVersion());
+    for (int i = 1; i < 12; i++) {
+        BOOST_CHECK(feeEstQueued.estimateFee(i) == feeEst.estimateFee(i));
+        BOOST_CHECK(feeEstQueued.estimateSmartFee(i, &feeCalc, false) == feeEst.estimateSmartFee(i, nullptr, false));
+        BOOST_CHECK_EQUAL(feeCalc.version, feeEst.GetVersion());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
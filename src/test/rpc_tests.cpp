@@ -8,6 +8,7 @@
 #include "base58.h"
 #include "core_io.h"
 #include "netbase.h"
+#include "validation.h"
 
 #include "test/test_fabcoin.h"
 
@@ -343,4 +344,32 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_gettxoutsetinfo_verify)
+{
+    UniValue r = CallRPC("gettxoutsetinfo true");
+    BOOST_CHECK(find_value(r.get_obj(), "verified").get_bool());
+    const std::string strMuHash = find_value(r.get_obj(), "muhash").get_str();
+    BOOST_CHECK_EQUAL(find_value(CallRPC("gettxoutsetinfo").get_obj(), "muhash").get_str(), strMuHash);
+
+    // A digest whose MuHash disagrees with the set, for the same block and
+    // with the same totals, fails verification; the scan is what's reported.
+    CCoinsSetDigest digestSaved;
+    {
+        LOCK(cs_main);
+        digestSaved = coinsTipDigest;
+        const unsigned char data[] = {0x01};
+        coinsTipDigest.muhash.Insert(data, sizeof(data));
+    }
+    BOOST_CHECK(find_value(CallRPC("gettxoutsetinfo").get_obj(), "muhash").get_str() != strMuHash);
+    r = CallRPC("gettxoutsetinfo true");
+    BOOST_CHECK(!find_value(r.get_obj(), "verified").get_bool());
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "muhash").get_str(), strMuHash);
+
+    {
+        LOCK(cs_main);
+        coinsTipDigest = digestSaved;
+    }
+    BOOST_CHECK(find_value(CallRPC("gettxoutsetinfo true").get_obj(), "verified").get_bool());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
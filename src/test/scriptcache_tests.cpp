@@ -0,0 +1,84 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "random.h"
+#include "script/sigcache.h"
+#include "util.h"
+#include "validation.h"
+#include "test/test_fabcoin.h"
+
+#include <algorithm>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(scriptcache_tests, TestingSetup)
+
+static bool HasEntry(const std::vector<uint256>& entries, const uint256& entry)
+{
+    return std::find(entries.begin(), entries.end(), entry) != entries.end();
+}
+
+static void FlipScriptCacheBit(const fs::path& path, long nOffset)
+{
+    FILE* file = fsbridge::fopen(path, "r+b");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fseek(file, nOffset, SEEK_SET), 0);
+    int c = fgetc(file);
+    BOOST_REQUIRE_EQUAL(fseek(file, nOffset, SEEK_SET), 0);
+    fputc(c ^ 1, file);
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(scriptcache_persist)
+{
+    uint256 nonce, nonceLoaded;
+    std::vector<uint256> entries;
+    GetSignatureCacheEntries(nonce, entries);
+    const uint256 entry1 = GetRandHash(), entry2 = GetRandHash();
+    LoadSignatureCacheEntries(nonce, {entry1, entry2});
+
+    DumpScriptCaches();
+    const fs::path path = GetDataDir() / "scriptcache.dat";
+    BOOST_REQUIRE(fs::exists(path));
+
+    // A fresh salt, as after a restart, is replaced by the saved one.
+    LoadSignatureCacheEntries(GetRandHash(), {});
+    BOOST_CHECK(LoadScriptCaches());
+    entries.clear();
+    GetSignatureCacheEntries(nonceLoaded, entries);
+    BOOST_CHECK(nonceLoaded == nonce);
+    BOOST_CHECK(HasEntry(entries, entry1));
+    BOOST_CHECK(HasEntry(entries, entry2));
+
+    // A damaged file is not loaded; this flips a bit of the saved salt,
+    // past the version, client version and script verification flags.
+    const uint256 nonceOther = GetRandHash();
+    LoadSignatureCacheEntries(nonceOther, {});
+    FlipScriptCacheBit(path, 8 + 4 + 4 + 5);
+    BOOST_CHECK(!LoadScriptCaches());
+    GetSignatureCacheEntries(nonceLoaded, entries);
+    BOOST_CHECK(nonceLoaded == nonceOther);
+
+    // Nor is one written by another client version.
+    LoadSignatureCacheEntries(nonce, {});
+    DumpScriptCaches();
+    LoadSignatureCacheEntries(nonceOther, {});
+    FlipScriptCacheBit(path, 8);
+    BOOST_CHECK(!LoadScriptCaches());
+    GetSignatureCacheEntries(nonceLoaded, entries);
+    BOOST_CHECK(nonceLoaded == nonceOther);
+
+    // Nor is one written by another node, whose secret we do not have.
+    LoadSignatureCacheEntries(nonce, {});
+    DumpScriptCaches();
+    fs::remove(GetDataDir() / "mempool.key");
+    LoadSignatureCacheEntries(nonceOther, {});
+    BOOST_CHECK(!LoadScriptCaches());
+    GetSignatureCacheEntries(nonceLoaded, entries);
+    BOOST_CHECK(nonceLoaded == nonceOther);
+
+    LoadSignatureCacheEntries(nonce, {});
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -92,12 +92,12 @@ void static RandomScript(CScript &script) {
         script << oplist[InsecureRandRange(sizeof(oplist)/sizeof(oplist[0]))];
 }
 
-void static RandomTransaction(CMutableTransaction &tx, bool fSingle) {
+void static RandomTransaction(CMutableTransaction &tx, bool fSingle, int nInputs = 0) {
     tx.nVersion = InsecureRand32();
     tx.vin.clear();
     tx.vout.clear();
     tx.nLockTime = (InsecureRandBool()) ? InsecureRand32() : 0;
-    int ins = (InsecureRandBits(2)) + 1;
+    int ins = nInputs ? nInputs : (InsecureRandBits(2)) + 1;
     int outs = fSingle ? ins : (InsecureRandBits(2)) + 1;
     for (int in = 0; in < ins; in++) {
         tx.vin.push_back(CTxIn());
@@ -163,6 +163,39 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// Goal: check that the legacy signature hashes precomputed for transactions
+// with many inputs match the ones computed from scratch
+BOOST_AUTO_TEST_CASE(sighash_precomputed)
+{
+    SeedInsecureRand(false);
+
+    for (int i = 0; i < 200; i++) {
+        int nHashType = InsecureRand32();
+        if (InsecureRandBool())
+            nHashType = SIGHASH_ALL;
+        CMutableTransaction txTo;
+        RandomTransaction(txTo, (nHashType & 0x1f) == SIGHASH_SINGLE, LEGACY_SIGHASH_CACHE_MIN_INPUTS + InsecureRandRange(32));
+        const CTransaction tx(txTo);
+        PrecomputedTransactionData txdata(tx);
+        BOOST_CHECK_EQUAL(txdata.vLegacyPrefix.size(), tx.vin.size());
+
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++) {
+            CScript scriptCode;
+            RandomScript(scriptCode);
+            uint256 sh = SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE, &txdata);
+            BOOST_CHECK(sh == SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE));
+            BOOST_CHECK(sh == SignatureHashOld(scriptCode, tx, nIn, nHashType));
+        }
+    }
+
+    // Below the threshold, nothing is cached.
+    CMutableTransaction txTo;
+    RandomTransaction(txTo, false, LEGACY_SIGHASH_CACHE_MIN_INPUTS - 1);
+    PrecomputedTransactionData txdata(txTo);
+    BOOST_CHECK(txdata.vLegacyPrefix.empty());
+    BOOST_CHECK(txdata.vLegacyBlanked.empty());
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -82,7 +82,9 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         mempool.setSanityCheck(1.0);
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
-        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        pcoinsflusher = new CCoinsViewBackgroundFlush(pcoinsdbview, pcoinsdbview);
+        pcoinsTip = new CCoinsViewCache(pcoinsflusher);
+        InitCoinsTipDigest();
         if (!LoadGenesisBlock(chainparams)) {
             throw std::runtime_error("LoadGenesisBlock failed.");
         }
@@ -110,6 +112,7 @@ TestingSetup::~TestingSetup()
         peerLogic.reset();
         UnloadBlockIndex();
         delete pcoinsTip;
+        delete pcoinsflusher;
         delete pcoinsdbview;
         delete pblocktree;
         fs::remove_all(pathTemp);
@@ -148,7 +151,7 @@ TestChain800Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
     IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
 
     while (!CheckProofOfWork(block.GetHash(), block.nBits, false, chainparams.GetConsensus())) 
-        block.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+        block.SetNonce(ArithToUint256(UintToArith256(block.nNonce) + 1));
 
     std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
     ProcessNewBlock(chainparams, shared_pblock, true, nullptr);
@@ -196,7 +199,7 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
     IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
 
     while (!CheckProofOfWork(block.GetHash(), block.nBits, false, chainparams.GetConsensus())) 
-        block.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+        block.SetNonce(ArithToUint256(UintToArith256(block.nNonce) + 1));
 
     std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
     ProcessNewBlock(chainparams, shared_pblock, true, nullptr);
@@ -494,6 +494,67 @@ BOOST_AUTO_TEST_CASE(test_big_witness_transaction) {
     threadGroup.join_all();
 }
 
+BOOST_AUTO_TEST_CASE(test_batch_script_checks)
+{
+    CKey key1, key2, key3;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    key3.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key1);
+    keystore.AddKey(key2);
+    keystore.AddKey(key3);
+
+    // Spends of a P2PKH, a P2WPKH and a 2-of-3 multisig output whose first key
+    // does not sign, and of an output which takes a bad signature.
+    std::vector<CPubKey> vMultisigKeys = {key1.GetPubKey(), key2.GetPubKey(), key3.GetPubKey()};
+    std::vector<CScript> vScriptPubKey = {
+        GetScriptForDestination(key1.GetPubKey().GetID()),
+        GetScriptForWitness(GetScriptForDestination(key2.GetPubKey().GetID())),
+        GetScriptForMultisig(2, vMultisigKeys),
+        CScript() << ToByteVector(key3.GetPubKey()) << OP_CHECKSIG << OP_NOT,
+    };
+    CMutableTransaction mtx;
+    mtx.nVersion = 1;
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    mtx.vout[0].scriptPubKey = CScript() << OP_1;
+    for (size_t i = 0; i < vScriptPubKey.size(); i++)
+        mtx.vin.emplace_back(COutPoint(uint256S("0100"), i));
+    for (size_t i = 0; i < 2; i++)
+        BOOST_REQUIRE(SignSignature(keystore, vScriptPubKey[i], mtx, i, 1000, SIGHASH_ALL));
+    {
+        CBasicKeyStore keystoreMultisig;
+        keystoreMultisig.AddKey(key2);
+        keystoreMultisig.AddKey(key3);
+        BOOST_REQUIRE(SignSignature(keystoreMultisig, vScriptPubKey[2], mtx, 2, 1000, SIGHASH_ALL));
+    }
+    std::vector<unsigned char> vchBadSig;
+    BOOST_REQUIRE(key3.Sign(uint256S("01"), vchBadSig));
+    vchBadSig.push_back(SIGHASH_ALL);
+    mtx.vin[3].scriptSig = CScript() << vchBadSig;
+
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_WITNESS;
+    for (int nBad = -1; nBad < 2; nBad++) {
+        CMutableTransaction mtxBad = mtx;
+        if (nBad == 0)
+            mtxBad.vin[0].scriptSig = CScript() << vchBadSig << ToByteVector(key1.GetPubKey());
+        if (nBad == 1)
+            mtxBad.vin[1].scriptWitness.stack[0] = vchBadSig;
+        const CTransaction tx(mtxBad);
+        PrecomputedTransactionData txdata(tx);
+        for (bool fBatch : {false, true}) {
+            std::vector<CScriptCheck> vChecks;
+            for (size_t i = 0; i < vScriptPubKey.size(); i++)
+                vChecks.emplace_back(vScriptPubKey[i], 1000, tx, i, flags, false, &txdata);
+            BOOST_CHECK_EQUAL(VerifyScriptChecksBatched(vChecks, fBatch), nBad < 0);
+            // The failing input gets the error.
+            if (nBad >= 0)
+                BOOST_CHECK_EQUAL(vChecks[nBad].GetScriptError(), SCRIPT_ERR_EVAL_FALSE);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(test_witness)
 {
     CBasicKeyStore keystore, keystore2;
@@ -27,6 +27,7 @@ static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
+static const char DB_COINS_DIGEST = 'D';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
@@ -55,7 +56,7 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", DBOptions::FromArgs("chainstatedb", nCacheSize), fMemory, fWipe, true)
 {
 }
 
@@ -83,6 +84,12 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool ret = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -107,7 +114,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -117,8 +124,6 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -136,6 +141,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     // In the last batch, mark the database as consistent with hashBlock again.
     batch.Erase(DB_HEAD_BLOCKS);
     batch.Write(DB_BEST_BLOCK, hashBlock);
+    WritePendingDigest(batch, hashBlock);
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
@@ -143,12 +149,60 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+bool CCoinsViewDB::WriteSnapshotCoins(const std::vector<std::pair<COutPoint, Coin> > &coins, const uint256 &hashBlock, bool fFinal) {
+    CDBBatch batch(db);
+    assert(!hashBlock.IsNull());
+
+    // Until the final batch the coins written so far are not known to be a
+    // valid set, so there is nothing ReplayBlocks could recover from: a
+    // single head makes it refuse, and the user has to -reindex-chainstate.
+    batch.Erase(DB_BEST_BLOCK);
+    batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock});
+
+    // Snapshots are written in database key order, so consecutive batches
+    // append to the key space and rarely need compacting.
+    for (const auto& coin : coins) {
+        batch.Write(CoinEntry(&coin.first), coin.second);
+    }
+
+    if (fFinal) {
+        batch.Erase(DB_HEAD_BLOCKS);
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+        WritePendingDigest(batch, hashBlock);
+    }
+
+    LogPrint(BCLog::COINDB, "Writing %s snapshot batch of %.2f MiB (%u coins)\n", fFinal ? "final" : "partial",
+        batch.SizeEstimate() * (1.0 / 1048576.0), (unsigned int)coins.size());
+    return db.WriteBatch(batch, fFinal);
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+void CCoinsViewDB::SetPendingDigest(const CCoinsSetDigest& digest)
+{
+    LOCK(cs_digest);
+    mapPendingDigests[digest.hashBlock] = digest;
+}
+
+void CCoinsViewDB::WritePendingDigest(CDBBatch& batch, const uint256& hashBlock)
+{
+    LOCK(cs_digest);
+    std::map<uint256, CCoinsSetDigest>::iterator it = mapPendingDigests.find(hashBlock);
+    if (it != mapPendingDigests.end()) {
+        batch.Write(DB_COINS_DIGEST, it->second);
+        mapPendingDigests.erase(it);
+    }
+}
+
+bool CCoinsViewDB::ReadDigest(CCoinsSetDigest& digest) const
+{
+    return db.Read(DB_COINS_DIGEST, digest);
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", DBOptions::FromArgs("blockindexdb", nCacheSize), fMemory, fWipe) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -225,6 +279,159 @@ void CCoinsViewDBCursor::Next()
     }
 }
 
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsView* baseIn, CCoinsViewDB* dbIn) : CCoinsViewBacked(baseIn), db(dbIn), fWriteFailed(false)
+{
+}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    WaitForFlush();
+}
+
+bool CCoinsViewBackgroundFlush::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    {
+        LOCK(cs);
+        if (frozen) {
+            CCoinsMap::const_iterator it = frozen->mapCoins.find(outpoint);
+            if (it != frozen->mapCoins.end()) {
+                coin = it->second.coin;
+                return !coin.IsSpent();
+            }
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoin(const COutPoint &outpoint) const
+{
+    {
+        LOCK(cs);
+        if (frozen) {
+            CCoinsMap::const_iterator it = frozen->mapCoins.find(outpoint);
+            if (it != frozen->mapCoins.end())
+                return !it->second.coin.IsSpent();
+        }
+    }
+    return base->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const
+{
+    {
+        LOCK(cs);
+        if (frozen)
+            return frozen->hashBlock;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    if (!WaitForFlush())
+        return false;
+    return base->BatchWrite(mapCoins, hashBlock);
+}
+
+CCoinsViewCursor *CCoinsViewBackgroundFlush::Cursor() const
+{
+    WaitForFlush();
+    return base->Cursor();
+}
+
+bool CCoinsViewBackgroundFlush::WaitForFlush() const
+{
+    {
+        std::lock_guard<std::mutex> lock(mutexWriter);
+        if (threadWriter.joinable())
+            threadWriter.join();
+    }
+    LOCK(cs);
+    return !fWriteFailed;
+}
+
+bool CCoinsViewBackgroundFlush::FlushInBackground(CCoinsViewCache& cache, size_t nMaxCleanUsage)
+{
+    std::lock_guard<std::mutex> lock(mutexWriter);
+    int64_t nStart = GetTimeMicros();
+    if (threadWriter.joinable())
+        threadWriter.join();
+    int64_t nWaited = GetTimeMicros();
+    {
+        LOCK(cs);
+        if (fWriteFailed)
+            return false;
+    }
+
+    std::unique_ptr<FrozenGeneration> generation(new FrozenGeneration());
+    generation->hashBlock = cache.ExtractDirty(generation->mapCoins, nMaxCleanUsage);
+    generation->nUsage = memusage::DynamicUsage(generation->mapCoins);
+    for (const auto& entry : generation->mapCoins)
+        generation->nUsage += entry.second.coin.DynamicMemoryUsage();
+    size_t nDirty = generation->mapCoins.size();
+
+    int64_t nStall = GetTimeMicros() - nStart;
+    {
+        LOCK(cs);
+        frozen = std::move(generation);
+        stats.nFlushes++;
+        stats.fInProgress = true;
+        stats.nLastDirty = nDirty;
+        stats.nLastStallMicros = nStall;
+        stats.nTotalStallMicros += nStall;
+    }
+    threadWriter = std::thread(&CCoinsViewBackgroundFlush::ThreadWrite, this);
+
+    LogPrintf("Flushing %u coins in the background, validation stalled %.2fms (%.2fms waiting for the previous flush), %u coins (%.1fMiB) stay cached\n",
+        nDirty, nStall * 0.001, (nWaited - nStart) * 0.001, cache.GetCacheSize(), cache.DynamicMemoryUsage() * (1.0 / (1 << 20)));
+    return true;
+}
+
+void CCoinsViewBackgroundFlush::ThreadWrite()
+{
+    RenameThread("fabcoin-coinsflush");
+    int64_t nStart = GetTimeMicros();
+    bool fOk = false;
+    // Nobody else modifies or replaces the frozen generation while it is
+    // being written, so it can be read without holding cs.
+    const FrozenGeneration& generation = *frozen;
+    try {
+        fOk = db->WriteCoins(generation.mapCoins, generation.hashBlock);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    int64_t nWrite = GetTimeMicros() - nStart;
+    LogPrint(BCLog::COINDB, "Background flush of %u coins %s after %.2fs\n", generation.mapCoins.size(), fOk ? "committed" : "failed", nWrite * 0.000001);
+
+    std::unique_ptr<FrozenGeneration> done;
+    {
+        LOCK(cs);
+        stats.fInProgress = false;
+        stats.nLastWriteMicros = nWrite;
+        if (fOk) {
+            done = std::move(frozen);
+        } else {
+            // Keep answering lookups from the generation; the database does
+            // not have it. The next flush reports the failure.
+            fWriteFailed = true;
+            stats.nFailures++;
+        }
+    }
+    // done is freed here, outside of cs.
+}
+
+size_t CCoinsViewBackgroundFlush::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return frozen ? frozen->nUsage : 0;
+}
+
+CoinsFlushStats CCoinsViewBackgroundFlush::GetStats() const
+{
+    LOCK(cs);
+    return stats;
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -9,9 +9,13 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "sync.h"
 
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -25,6 +29,8 @@ static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 static const int64_t nDefaultDbCache = 450;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -dbbackgroundflush default
+static const bool DEFAULT_DB_BACKGROUND_FLUSH = true;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -78,9 +84,103 @@ public:
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! Like BatchWrite, but leaves mapCoins untouched so others can keep reading it meanwhile
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    //! Write coins straight to the database, without going through a cache.
+    //! Used to fill an empty database from a UTXO snapshot: until the last
+    //! call (fFinal) the database is marked as holding an incomplete load.
+    bool WriteSnapshotCoins(const std::vector<std::pair<COutPoint, Coin> > &coins, const uint256 &hashBlock, bool fFinal);
+
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    //! The underlying database, for statistics
+    const CDBWrapper& GetDB() const { return db; }
+
+    //! Store digest with the coins once its block is written as the best block
+    void SetPendingDigest(const CCoinsSetDigest& digest);
+    //! Read the digest stored with the coins. It may be older than the best block.
+    bool ReadDigest(CCoinsSetDigest& digest) const;
+
+private:
+    void WritePendingDigest(CDBBatch& batch, const uint256& hashBlock);
+
+    CCriticalSection cs_digest;
+    std::map<uint256, CCoinsSetDigest> mapPendingDigests;
+};
+
+/** Counters describing the background flushes of a CCoinsViewBackgroundFlush */
+struct CoinsFlushStats
+{
+    uint64_t nFlushes = 0;           //!< Background flushes started
+    uint64_t nFailures = 0;          //!< Background writes that failed
+    bool fInProgress = false;        //!< Whether a generation is being written right now
+    size_t nLastDirty = 0;           //!< Entries in the last generation
+    int64_t nLastStallMicros = 0;    //!< Time the caller was held up by the last flush
+    int64_t nTotalStallMicros = 0;
+    int64_t nLastWriteMicros = 0;    //!< Duration of the last completed background write
+};
+
+/**
+ * Sits between the coins tip cache and the database and writes the tip's
+ * modified entries to the database on a background thread.
+ *
+ * FlushInBackground() freezes the tip's dirty entries into a separate
+ * generation and returns as soon as that is done; validation then continues
+ * on the tip while the frozen generation is written out. Until the write has
+ * committed, lookups that miss the tip are answered from the frozen
+ * generation first. Only one generation is written at a time: starting a new
+ * flush, a regular BatchWrite and Cursor() all wait for the previous one.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsViewBacked
+{
+public:
+    //! Reads go through base; frozen generations are written to db, which must be (below) base
+    CCoinsViewBackgroundFlush(CCoinsView* base, CCoinsViewDB* db);
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    CCoinsViewCursor *Cursor() const override;
+
+    /**
+     * Hand the dirty entries of cache to the writer thread, keeping the
+     * clean ones cached as long as the cache stays below nMaxCleanUsage.
+     * Returns false if the previous background write failed.
+     */
+    bool FlushInBackground(CCoinsViewCache& cache, size_t nMaxCleanUsage);
+
+    //! Wait for the write in progress, if any. Returns false if it failed.
+    bool WaitForFlush() const;
+
+    //! Memory held by the frozen generation
+    size_t DynamicMemoryUsage() const;
+
+    CoinsFlushStats GetStats() const;
+
+private:
+    struct FrozenGeneration
+    {
+        CCoinsMapMemoryResource resource;
+        CCoinsMap mapCoins;
+        uint256 hashBlock;
+        size_t nUsage;
+        FrozenGeneration() : mapCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource), nUsage(0) {}
+    };
+
+    CCoinsViewDB* db;
+    mutable CCriticalSection cs;
+    std::unique_ptr<FrozenGeneration> frozen; //!< Generation being written, or whose write failed; guarded by cs
+    bool fWriteFailed;                        //!< Guarded by cs
+    CoinsFlushStats stats;                    //!< Guarded by cs
+    mutable std::mutex mutexWriter;
+    mutable std::thread threadWriter;         //!< Guarded by mutexWriter
+
+    void ThreadWrite();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -37,6 +37,8 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+
+    nEpoch = 0;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -66,13 +68,17 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    const EpochGuard epoch(*this);
+    vecEntries vStageEntries, vAllDescendants;
+    for (const txiter childEntry : GetMemPoolChildren(updateIt)) {
+        Visited(childEntry);
+        vStageEntries.push_back(childEntry);
+    }
 
-    while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
-        setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
+    while (!vStageEntries.empty()) {
+        const txiter cit = vStageEntries.back();
+        vStageEntries.pop_back();
+        vAllDescendants.push_back(cit);
         const setEntries &setChildren = GetMemPoolChildren(cit);
         for (const txiter childEntry : setChildren) {
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
@@ -80,30 +86,34 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
                 // We've already calculated this one, just add the entries for this set
                 // but don't traverse again.
                 for (const txiter cacheEntry : cacheIt->second) {
-                    setAllDescendants.insert(cacheEntry);
+                    if (!Visited(cacheEntry)) {
+                        vAllDescendants.push_back(cacheEntry);
+                    }
                 }
-            } else if (!setAllDescendants.count(childEntry)) {
+            } else if (!Visited(childEntry)) {
                 // Schedule for later processing
-                stageEntries.insert(childEntry);
+                vStageEntries.push_back(childEntry);
             }
         }
     }
-    // setAllDescendants now contains all in-mempool descendants of updateIt.
+    // vAllDescendants now contains all in-mempool descendants of updateIt, once each.
     // Update and add to cached descendant map
     int64_t modifySize = 0;
     CAmount modifyFee = 0;
     int64_t modifyCount = 0;
-    for (txiter cit : setAllDescendants) {
+    for (txiter cit : vAllDescendants) {
         if (!setExclude.count(cit->GetTx().GetHash())) {
             modifySize += cit->GetTxSize();
             modifyFee += cit->GetModifiedFee();
             modifyCount++;
-            cachedDescendants[updateIt].insert(cit);
+            cachedDescendants[updateIt].push_back(cit);
             // Update ancestor state for each descendant
             mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
+            MarkSnapshotStale(cit->GetTx().GetHash());
         }
     }
     mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
+    MarkSnapshotStale(updateIt->GetTx().GetHash());
 }
 
 // vHashesToUpdate is the set of transaction hashes from a disconnected block
@@ -118,6 +128,8 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
     // in-vHashesToUpdate transactions, so that we don't have to recalculate
     // descendants when we come across a previously seen entry.
     cacheMap mapMemPoolDescendantsToUpdate;
+    // Descendant state changes below, so outstanding snapshots are stale.
+    ++nSequence;
 
     // Use a set for lookups into vHashesToUpdate (these entries are already
     // accounted for in the state of their ancestors)
@@ -155,10 +167,19 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 }
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
+{
+    vecEntries vAncestors;
+    bool fResult = CalculateMemPoolAncestors(entry, vAncestors, limitAncestorCount, limitAncestorSize, limitDescendantCount, limitDescendantSize, errString, fSearchForParents);
+    setAncestors.insert(vAncestors.begin(), vAncestors.end());
+    return fResult;
+}
+
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, vecEntries &vAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
 {
     LOCK(cs);
+    assert(vAncestors.empty());
+    const EpochGuard epoch(*this);
 
-    setEntries parentHashes;
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -167,9 +188,9 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
-                if (parentHashes.size() + 1 > limitAncestorCount) {
+            if (piter != mapTx.end() && !Visited(piter)) {
+                vAncestors.push_back(piter);
+                if (vAncestors.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
                 }
@@ -179,16 +200,19 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        for (const txiter &piter : GetMemPoolParents(it)) {
+            Visited(piter);
+            vAncestors.push_back(piter);
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
-    while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
+    // vAncestors doubles as the work queue: the entries from nPos on have not
+    // had their own parents walked yet.
+    for (size_t nPos = 0; nPos < vAncestors.size(); nPos++) {
+        txiter stageit = vAncestors[nPos];
 
-        setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -205,10 +229,10 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
         for (const txiter &phash : setMemPoolParents) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (!Visited(phash)) {
+                vAncestors.push_back(phash);
             }
-            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+            if (vAncestors.size() + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
                 return false;
             }
@@ -218,9 +242,10 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
     return true;
 }
 
-void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
+template <typename Entries>
+void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, const Entries &ancestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    const setEntries &parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
     for (txiter piter : parentIters) {
         UpdateChild(piter, it, add);
@@ -228,8 +253,9 @@ void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors
     const int64_t updateCount = (add ? 1 : -1);
     const int64_t updateSize = updateCount * it->GetTxSize();
     const CAmount updateFee = updateCount * it->GetModifiedFee();
-    for (txiter ancestorIt : setAncestors) {
+    for (txiter ancestorIt : ancestors) {
         mapTx.modify(ancestorIt, update_descendant_state(updateSize, updateFee, updateCount));
+        MarkSnapshotStale(ancestorIt->GetTx().GetHash());
     }
 }
 
@@ -245,6 +271,7 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
         updateSigOpsCost += ancestorIt->GetSigOpCost();
     }
     mapTx.modify(it, update_ancestor_state(updateSize, updateFee, updateCount, updateSigOpsCost));
+    MarkSnapshotStale(it->GetTx().GetHash());
 }
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
@@ -267,20 +294,26 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // Here we only update statistics and not data in mapLinks (which
         // we need to preserve until we're finished with all operations that
         // need to traverse the mempool).
+        vecEntries vDescendants;
         for (txiter removeIt : entriesToRemove) {
-            setEntries setDescendants;
-            CalculateDescendants(removeIt, setDescendants);
-            setDescendants.erase(removeIt); // don't update state for self
+            vDescendants.clear();
+            {
+                const EpochGuard epoch(*this);
+                CalculateDescendants(removeIt, vDescendants);
+            }
             int64_t modifySize = -((int64_t)removeIt->GetTxSize());
             CAmount modifyFee = -removeIt->GetModifiedFee();
             int modifySigOps = -removeIt->GetSigOpCost();
-            for (txiter dit : setDescendants) {
-                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+            // vDescendants starts with removeIt itself; don't update state for self
+            for (size_t i = 1; i < vDescendants.size(); i++) {
+                mapTx.modify(vDescendants[i], update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+                MarkSnapshotStale(vDescendants[i]->GetTx().GetHash());
             }
         }
     }
+    vecEntries vAncestors;
     for (txiter removeIt : entriesToRemove) {
-        setEntries setAncestors;
+        vAncestors.clear();
         const CTxMemPoolEntry &entry = *removeIt;
         std::string dummy;
         // Since this is a tx that is already in the mempool, we can call CMPA
@@ -300,10 +333,10 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // differ from the set of mempool parents we'd calculate by searching,
         // and it's important that we use the mapLinks[] notion of ancestor
         // transactions as the set of things to update for removal.
-        CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        CalculateMemPoolAncestors(entry, vAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
         // Note that UpdateAncestorsOf severs the child links that point to
         // removeIt in the entries for the parents of removeIt.
-        UpdateAncestorsOf(false, removeIt, setAncestors);
+        UpdateAncestorsOf(false, removeIt, vAncestors);
     }
     // After updating all the ancestor sizes, we can now sever the link between each
     // transaction being removed and any mempool children (ie, update setMemPoolParents
@@ -334,7 +367,8 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
-    nTransactionsUpdated(0), minerPolicyEstimator(estimator)
+    nTransactionsUpdated(0), minerPolicyEstimator(estimator), nEpoch(0), nEpochLast(0), nEpochGuardDepth(0),
+    nSequence(0), nDeltaLogFloor(0), fSnapshotStaleAll(true), fLoaded(false)
 {
     _clear(); //lock free clear
 
@@ -412,6 +446,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     UpdateEntryForAncestors(newit, setAncestors);
 
     nTransactionsUpdated++;
+    RecordDelta(hash, true);
     totalTxSize += entry.GetTxSize();
     if (minerPolicyEstimator) {minerPolicyEstimator->processTransaction(entry, validFeeEstimate);}
 
@@ -443,7 +478,8 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     mapLinks.erase(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
-    if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash, false);}
+    RecordDelta(hash, false);
+    if (minerPolicyEstimator) {minerPolicyEstimator->removeTx(hash);}
 }
 
 // Calculates descendants of entry that are not already in setDescendants, and adds to
@@ -454,22 +490,41 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 // can save time by not iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants)
 {
-    setEntries stage;
-    if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
+    if (setDescendants.count(entryit)) {
+        return;
     }
+    const EpochGuard epoch(*this);
+    vecEntries vDescendants;
+    Visited(entryit);
+    vDescendants.push_back(entryit);
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have either
     // already been walked, or will be walked in this iteration).
-    while (!stage.empty()) {
-        txiter it = *stage.begin();
-        setDescendants.insert(it);
-        stage.erase(it);
+    for (size_t nPos = 0; nPos < vDescendants.size(); nPos++) {
+        const setEntries &setChildren = GetMemPoolChildren(vDescendants[nPos]);
+        for (const txiter &childiter : setChildren) {
+            if (!Visited(childiter) && !setDescendants.count(childiter)) {
+                vDescendants.push_back(childiter);
+            }
+        }
+    }
+    setDescendants.insert(vDescendants.begin(), vDescendants.end());
+}
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
+void CTxMemPool::CalculateDescendants(txiter entryit, vecEntries &vDescendants) const
+{
+    if (Visited(entryit)) {
+        return;
+    }
+    size_t nPos = vDescendants.size();
+    vDescendants.push_back(entryit);
+    // vDescendants doubles as the work queue: the entries from nPos on still
+    // need their children walked.
+    for (; nPos < vDescendants.size(); nPos++) {
+        const setEntries &setChildren = GetMemPoolChildren(vDescendants[nPos]);
         for (const txiter &childiter : setChildren) {
-            if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+            if (!Visited(childiter)) {
+                vDescendants.push_back(childiter);
             }
         }
     }
@@ -480,10 +535,10 @@ void CTxMemPool::removeRecursive(const CTransaction &origTx, MemPoolRemovalReaso
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        setEntries txToRemove;
+        vecEntries vTxToRemove;
         txiter origit = mapTx.find(origTx.GetHash());
         if (origit != mapTx.end()) {
-            txToRemove.insert(origit);
+            vTxToRemove.push_back(origit);
         } else {
             // When recursively removing but origTx isn't in the mempool
             // be sure to remove any children that are in the pool. This can
@@ -495,12 +550,17 @@ void CTxMemPool::removeRecursive(const CTransaction &origTx, MemPoolRemovalReaso
                     continue;
                 txiter nextit = mapTx.find(it->second->GetHash());
                 assert(nextit != mapTx.end());
-                txToRemove.insert(nextit);
+                vTxToRemove.push_back(nextit);
             }
         }
         setEntries setAllRemoves;
-        for (txiter it : txToRemove) {
-            CalculateDescendants(it, setAllRemoves);
+        {
+            const EpochGuard epoch(*this);
+            vecEntries vAllRemoves;
+            for (txiter it : vTxToRemove) {
+                CalculateDescendants(it, vAllRemoves);
+            }
+            setAllRemoves.insert(vAllRemoves.begin(), vAllRemoves.end());
         }
 
         RemoveStaged(setAllRemoves, false, reason);
@@ -609,6 +669,11 @@ void CTxMemPool::_clear()
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
+    // Removals aren't recorded, so no earlier sequence number can be answered.
+    deltaLog.clear();
+    nDeltaLogFloor = ++nSequence;
+    setSnapshotStale.clear();
+    fSnapshotStaleAll = true;
 }
 
 void CTxMemPool::clear()
@@ -822,6 +887,176 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     return ret;
 }
 
+void CTxMemPool::RecordDelta(const uint256& hash, bool fAdded)
+{
+    AssertLockHeld(cs);
+    deltaLog.emplace_back(++nSequence, hash, fAdded);
+    while (deltaLog.size() > MEMPOOL_DELTA_LOG_SIZE) {
+        nDeltaLogFloor = std::get<0>(deltaLog.front());
+        deltaLog.pop_front();
+    }
+    MarkSnapshotStale(hash);
+}
+
+void CTxMemPool::MarkSnapshotStale(const uint256& hash)
+{
+    AssertLockHeld(cs);
+    // Nothing to track until a snapshot is published, nor once most of it
+    // has to be copied anyway.
+    if (fSnapshotStaleAll)
+        return;
+    setSnapshotStale.insert(hash);
+    if (setSnapshotStale.size() > mapTx.size() / 2) {
+        setSnapshotStale.clear();
+        fSnapshotStaleAll = true;
+    }
+}
+
+CTxMemPoolSnapshot::CTxMemPoolSnapshot(uint64_t nSequenceIn, std::vector<std::shared_ptr<const CTxMemPoolSnapshotEntry>>&& vEntriesIn) :
+    nSequence(nSequenceIn), vEntries(std::move(vEntriesIn))
+{
+}
+
+const CTxMemPoolSnapshotEntry* CTxMemPoolSnapshot::Find(const uint256& hash) const
+{
+    auto it = std::lower_bound(vEntries.begin(), vEntries.end(), hash,
+        [](const std::shared_ptr<const CTxMemPoolSnapshotEntry>& entry, const uint256& h) { return entry->GetHash() < h; });
+    if (it == vEntries.end() || (*it)->GetHash() != hash)
+        return nullptr;
+    return it->get();
+}
+
+std::vector<const CTxMemPoolSnapshotEntry*> CTxMemPoolSnapshot::GetSortedDepthAndScore() const
+{
+    std::vector<const CTxMemPoolSnapshotEntry*> vSorted;
+    vSorted.reserve(vEntries.size());
+    for (const auto& entry : vEntries)
+        vSorted.push_back(entry.get());
+    // Same order as DepthAndScoreComparator.
+    std::sort(vSorted.begin(), vSorted.end(), [](const CTxMemPoolSnapshotEntry* a, const CTxMemPoolSnapshotEntry* b) {
+        if (a->nCountWithAncestors != b->nCountWithAncestors)
+            return a->nCountWithAncestors < b->nCountWithAncestors;
+        double f1 = (double)a->nModifiedFee * b->nTxSize;
+        double f2 = (double)b->nModifiedFee * a->nTxSize;
+        if (f1 == f2)
+            return b->GetHash() < a->GetHash();
+        return f1 > f2;
+    });
+    return vSorted;
+}
+
+std::shared_ptr<const CTxMemPoolSnapshotEntry> CTxMemPool::MakeSnapshotEntry(txiter it) const
+{
+    AssertLockHeld(cs);
+    std::shared_ptr<CTxMemPoolSnapshotEntry> entry = std::make_shared<CTxMemPoolSnapshotEntry>();
+    entry->tx = it->GetSharedTx();
+    entry->nFee = it->GetFee();
+    entry->nModifiedFee = it->GetModifiedFee();
+    entry->nTime = it->GetTime();
+    entry->nHeight = it->GetHeight();
+    entry->nTxSize = it->GetTxSize();
+    entry->nCountWithDescendants = it->GetCountWithDescendants();
+    entry->nSizeWithDescendants = it->GetSizeWithDescendants();
+    entry->nModFeesWithDescendants = it->GetModFeesWithDescendants();
+    entry->nCountWithAncestors = it->GetCountWithAncestors();
+    entry->nSizeWithAncestors = it->GetSizeWithAncestors();
+    entry->nModFeesWithAncestors = it->GetModFeesWithAncestors();
+    const TxLinks& links = mapLinks.find(it)->second;
+    entry->vParents.reserve(links.parents.size());
+    for (txiter parentIt : links.parents)
+        entry->vParents.push_back(parentIt->GetTx().GetHash());
+    entry->vChildren.reserve(links.children.size());
+    for (txiter childIt : links.children)
+        entry->vChildren.push_back(childIt->GetTx().GetHash());
+    return entry;
+}
+
+std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPool::GetSnapshot() const
+{
+    std::shared_ptr<const CTxMemPoolSnapshot> current = std::atomic_load(&snapshot);
+    if (current && current->nSequence == nSequence)
+        return current;
+
+    LOCK(cs);
+    // Someone else may have published a fresh one while we waited.
+    current = std::atomic_load(&snapshot);
+    if (current && current->nSequence == nSequence)
+        return current;
+
+    std::vector<std::shared_ptr<const CTxMemPoolSnapshotEntry>> vEntries;
+    vEntries.reserve(mapTx.size());
+    if (current && !fSnapshotStaleAll) {
+        // Both are sorted by txid: take the unchanged entries from the last
+        // snapshot and fresh copies of the others, if still in the mempool.
+        auto itStale = setSnapshotStale.begin();
+        auto addStale = [&]() {
+            txiter it = mapTx.find(*itStale++);
+            if (it != mapTx.end())
+                vEntries.push_back(MakeSnapshotEntry(it));
+        };
+        for (const auto& entry : current->vEntries) {
+            while (itStale != setSnapshotStale.end() && *itStale < entry->GetHash())
+                addStale();
+            if (itStale != setSnapshotStale.end() && *itStale == entry->GetHash()) {
+                addStale();
+            } else {
+                vEntries.push_back(entry);
+            }
+        }
+        while (itStale != setSnapshotStale.end())
+            addStale();
+    } else {
+        for (txiter it = mapTx.begin(); it != mapTx.end(); ++it)
+            vEntries.push_back(MakeSnapshotEntry(it));
+        std::sort(vEntries.begin(), vEntries.end(),
+            [](const std::shared_ptr<const CTxMemPoolSnapshotEntry>& a, const std::shared_ptr<const CTxMemPoolSnapshotEntry>& b) { return a->GetHash() < b->GetHash(); });
+    }
+    setSnapshotStale.clear();
+    fSnapshotStaleAll = false;
+
+    current = std::make_shared<const CTxMemPoolSnapshot>(nSequence, std::move(vEntries));
+    std::atomic_store(&snapshot, current);
+    return current;
+}
+
+bool CTxMemPool::GetDelta(uint64_t nSince, uint64_t& nSequenceOut, std::vector<uint256>& vAdded, std::vector<uint256>& vRemoved) const
+{
+    LOCK(cs);
+    nSequenceOut = nSequence;
+    if (nSince < nDeltaLogFloor || nSince > nSequenceOut)
+        return false;
+
+    // First and last change per transaction, in order of first change.
+    std::map<uint256, std::pair<bool, bool>> mapChanges;
+    std::vector<uint256> vOrder;
+    auto it = std::upper_bound(deltaLog.begin(), deltaLog.end(), nSince,
+        [](uint64_t n, const std::tuple<uint64_t, uint256, bool>& change) { return n < std::get<0>(change); });
+    for (; it != deltaLog.end(); ++it) {
+        const uint256& hash = std::get<1>(*it);
+        const bool fAdded = std::get<2>(*it);
+        auto inserted = mapChanges.emplace(hash, std::make_pair(fAdded, fAdded));
+        if (inserted.second) {
+            vOrder.push_back(hash);
+        } else {
+            inserted.first->second.second = fAdded;
+        }
+    }
+
+    vAdded.clear();
+    vRemoved.clear();
+    for (const uint256& hash : vOrder) {
+        const std::pair<bool, bool>& change = mapChanges[hash];
+        // Came and went in between: nothing to report.
+        if (change.first && !change.second)
+            continue;
+        if (!change.first)
+            vRemoved.push_back(hash);
+        if (change.second)
+            vAdded.push_back(hash);
+    }
+    return true;
+}
+
 CTransactionRef CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -849,6 +1084,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(delta));
+            MarkSnapshotStale(hash);
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -856,6 +1092,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
             CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
             for (txiter ancestorIt : setAncestors) {
                 mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
+                MarkSnapshotStale(ancestorIt->GetTx().GetHash());
             }
             // Now update all descendants' modified fees with ancestors
             setEntries setDescendants;
@@ -863,8 +1100,10 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
             setDescendants.erase(it);
             for (txiter descendantIt : setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
+                MarkSnapshotStale(descendantIt->GetTx().GetHash());
             }
             ++nTransactionsUpdated;
+            ++nSequence;
         }
     }
     LogPrintf("PrioritiseTransaction: %s feerate += %s\n", hash.ToString(), FormatMoney(nFeeDelta));
@@ -915,7 +1154,7 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + memusage::DynamicUsage(deltaLog) + memusage::DynamicUsage(setSnapshotStale) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -935,8 +1174,13 @@ int CTxMemPool::Expire(int64_t time) {
         it++;
     }
     setEntries stage;
-    for (txiter removeit : toremove) {
-        CalculateDescendants(removeit, stage);
+    {
+        const EpochGuard epoch(*this);
+        vecEntries vStage;
+        for (txiter removeit : toremove) {
+            CalculateDescendants(removeit, vStage);
+        }
+        stage.insert(vStage.begin(), vStage.end());
     }
     RemoveStaged(stage, false, MemPoolRemovalReason::EXPIRY);
     return stage.size();
@@ -955,6 +1199,7 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
     setEntries s;
+    MarkSnapshotStale(entry->GetTx().GetHash());
     if (add && mapLinks[entry].children.insert(child).second) {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
     } else if (!add && mapLinks[entry].children.erase(child)) {
@@ -965,6 +1210,7 @@ void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
     setEntries s;
+    MarkSnapshotStale(entry->GetTx().GetHash());
     if (add && mapLinks[entry].parents.insert(parent).second) {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
     } else if (!add && mapLinks[entry].parents.erase(parent)) {
@@ -972,6 +1218,25 @@ void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
     }
 }
 
+CTxMemPool::EpochGuard::EpochGuard(const CTxMemPool& poolIn) :
+    pool(poolIn), nEpochOuter(poolIn.nEpoch), nUndoSize(poolIn.vEpochUndo.size())
+{
+    AssertLockHeld(pool.cs);
+    pool.nEpoch = ++pool.nEpochLast;
+    pool.nEpochGuardDepth++;
+}
+
+CTxMemPool::EpochGuard::~EpochGuard()
+{
+    // Put back the marks of the outer walk, if any, that this one overwrote.
+    while (pool.vEpochUndo.size() > nUndoSize) {
+        pool.vEpochUndo.back().first->nEpoch = pool.vEpochUndo.back().second;
+        pool.vEpochUndo.pop_back();
+    }
+    pool.nEpoch = nEpochOuter;
+    pool.nEpochGuardDepth--;
+}
+
 const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
@@ -6,12 +6,15 @@
 #ifndef FABCOIN_TXMEMPOOL_H
 #define FABCOIN_TXMEMPOOL_H
 
+#include <atomic>
+#include <deque>
 #include <memory>
 #include <set>
 #include <map>
 #include <vector>
 #include <utility>
 #include <string>
+#include <tuple>
 
 #include "amount.h"
 #include "coins.h"
@@ -30,6 +33,9 @@
 
 class CBlockIndex;
 
+/** Number of mempool additions and removals kept for CTxMemPool::GetDelta() */
+static const size_t MEMPOOL_DELTA_LOG_SIZE = 100000;
+
 /** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const uint32_t MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
@@ -131,6 +137,7 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t nEpoch; //!< Last traversal epoch in which this entry was visited, see CTxMemPool::EpochGuard
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -313,6 +320,54 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * A mempool entry as seen by a CTxMemPoolSnapshot: the transaction and a
+ * copy of the entry's fee and package state, with its in-mempool parents
+ * and children by txid.
+ */
+struct CTxMemPoolSnapshotEntry
+{
+    CTransactionRef tx;
+    CAmount nFee;
+    CAmount nModifiedFee;
+    int64_t nTime;
+    unsigned int nHeight;
+    size_t nTxSize;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    std::vector<uint256> vParents;
+    std::vector<uint256> vChildren;
+
+    const uint256& GetHash() const { return tx->GetHash(); }
+};
+
+/**
+ * Immutable copy of the mempool at a given sequence number, sorted by txid.
+ * Snapshots are shared between readers and can be used without holding
+ * CTxMemPool::cs; see CTxMemPool::GetSnapshot(). Entries that didn't change
+ * are shared with the previous snapshot.
+ */
+class CTxMemPoolSnapshot
+{
+public:
+    CTxMemPoolSnapshot(uint64_t nSequenceIn, std::vector<std::shared_ptr<const CTxMemPoolSnapshotEntry>>&& vEntriesIn);
+
+    /** The mempool sequence number this snapshot was taken at */
+    const uint64_t nSequence;
+    /** All entries, sorted by txid */
+    const std::vector<std::shared_ptr<const CTxMemPoolSnapshotEntry>> vEntries;
+
+    /** Return the entry for the given txid, or nullptr if it wasn't in the mempool */
+    const CTxMemPoolSnapshotEntry* Find(const uint256& hash) const;
+
+    /** Return all entries in the order of CTxMemPool::queryHashes() */
+    std::vector<const CTxMemPoolSnapshotEntry*> GetSortedDepthAndScore() const;
+};
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -426,6 +481,25 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    mutable uint64_t nEpoch;          //!< Current traversal epoch, or 0 outside an EpochGuard
+    mutable uint64_t nEpochLast;      //!< Last epoch handed out, see EpochGuard
+    mutable int nEpochGuardDepth;     //!< Number of EpochGuards in scope
+
+    std::atomic<uint64_t> nSequence;  //!< Bumped on every change to the entries, see GetSnapshot()
+    /** (sequence, txid, added) for recent additions and removals, see GetDelta() */
+    std::deque<std::tuple<uint64_t, uint256, bool>> deltaLog;
+    uint64_t nDeltaLogFloor;          //!< Oldest sequence number GetDelta() can answer from
+    mutable std::shared_ptr<const CTxMemPoolSnapshot> snapshot; //!< Only accessed through std::atomic_load/store
+    mutable std::set<uint256> setSnapshotStale; //!< Entries added, removed or changed since snapshot was published
+    mutable bool fSnapshotStaleAll;   //!< Whether the next snapshot has to copy every entry
+
+    std::atomic<bool> fLoaded;        //!< Whether the startup reload from mempool.dat has finished
+
+    /** Record a change to the mempool's entries, see GetDelta(). */
+    void RecordDelta(const uint256& hash, bool fAdded);
+    /** Note that the entry for hash differs from the one in the published snapshot, see GetSnapshot(). */
+    void MarkSnapshotStale(const uint256& hash);
+
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
@@ -476,11 +550,43 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    typedef std::vector<txiter> vecEntries;
 
     const setEntries & GetMemPoolParents(txiter entry) const;
     const setEntries & GetMemPoolChildren(txiter entry) const;
+
+    /**
+     * Scope of a walk over the transaction graph. Starting one advances the
+     * pool's epoch, which implicitly marks every entry as unvisited, so walks
+     * can track visited entries in the entries themselves instead of building
+     * a std::set. A guard opened inside another starts a walk of its own,
+     * and hands the entries it visited back to the outer walk as they were.
+     * Requires cs.
+     */
+    class EpochGuard {
+    public:
+        explicit EpochGuard(const CTxMemPool& poolIn);
+        ~EpochGuard();
+    private:
+        const CTxMemPool& pool;
+        const uint64_t nEpochOuter;
+        const size_t nUndoSize;
+    };
+
+    /** Return whether it was already visited in the current epoch, and mark it visited. */
+    bool Visited(txiter it) const
+    {
+        assert(nEpochGuardDepth > 0);
+        bool fVisited = it->nEpoch == nEpoch;
+        if (!fVisited) {
+            if (nEpochGuardDepth > 1)
+                vEpochUndo.emplace_back(it, it->nEpoch);
+            it->nEpoch = nEpoch;
+        }
+        return fVisited;
+    }
 private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+    typedef std::map<txiter, vecEntries, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
         setEntries parents;
@@ -490,10 +596,15 @@ private:
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
     txlinksMap mapLinks;
 
+    //! Entries visited under a nested EpochGuard, with the epochs they had before
+    mutable std::vector<std::pair<txiter, uint64_t>> vEpochUndo;
+
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
+    /** Copy an entry for GetSnapshot(). Requires cs. */
+    std::shared_ptr<const CTxMemPoolSnapshotEntry> MakeSnapshotEntry(txiter it) const;
 
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx;
@@ -574,11 +685,18 @@ public:
      *    look up parents from mapLinks. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
+    /** As above, but append the ancestors to vAncestors (which must be empty) in
+     *  the order they are found, without building a set. */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, vecEntries &vAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
      *  already in it.  */
     void CalculateDescendants(txiter it, setEntries &setDescendants);
+    /** Append to vDescendants it and all its in-mempool descendants that have not
+     *  been visited yet in the current epoch. Requires an active EpochGuard, so
+     *  several calls under the same guard accumulate a duplicate-free union. */
+    void CalculateDescendants(txiter it, vecEntries &vDescendants) const;
 
     /** The minimum fee to get into the mempool, which may itself not be enough
       *  for larger-sized transactions.
@@ -624,6 +742,32 @@ public:
 
     size_t DynamicMemoryUsage() const;
 
+    /** Whether the mempool saved at shutdown has been reloaded (or there was nothing to reload). */
+    bool IsLoaded() const { return fLoaded; }
+    void SetIsLoaded(bool loaded) { fLoaded = loaded; }
+
+    /** Current sequence number; it changes whenever an entry is added, removed or reprioritised. */
+    uint64_t GetSequence() const { return nSequence; }
+
+    /**
+     * Return an immutable snapshot of the current mempool contents. If
+     * nothing changed since the last snapshot was published it is returned
+     * without taking cs; otherwise a new one is built under cs from the last
+     * one, copying only the entries that changed since, and published.
+     */
+    std::shared_ptr<const CTxMemPoolSnapshot> GetSnapshot() const;
+
+    /**
+     * Return the txids added to and removed from the mempool since sequence
+     * number nSince, net of transactions that came and went in between, and
+     * set nSequenceOut to the current sequence number. A transaction that was
+     * removed and then added again appears in both lists. Returns false if
+     * nSince is older than the retained history (or newer than the current
+     * sequence number), in which case the caller has to start over from a
+     * snapshot.
+     */
+    bool GetDelta(uint64_t nSince, uint64_t& nSequenceOut, std::vector<uint256>& vAdded, std::vector<uint256>& vRemoved) const;
+
     boost::signals2::signal<void (CTransactionRef)> NotifyEntryAdded;
     boost::signals2::signal<void (CTransactionRef, MemPoolRemovalReason)> NotifyEntryRemoved;
 
@@ -645,7 +789,8 @@ private:
             cacheMap &cachedDescendants,
             const std::set<uint256> &setExclude);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
-    void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
+    template <typename Entries>
+    void UpdateAncestorsOf(bool add, txiter hash, const Entries &ancestors);
     /** Set ancestor state for an entry */
     void UpdateEntryForAncestors(txiter it, const setEntries &setAncestors);
     /** For each transaction being removed, update ancestors and any direct children.
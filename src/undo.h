@@ -60,6 +60,49 @@ public:
     TxInUndoDeserializer(Coin* coin) : txout(coin) {}
 };
 
+/** Undo information for a CTxIn in the compact undo format
+ *
+ *  As TxInUndoSerializer, but without the dummy, and with the height of the
+ *  coin as its distance below the height of the block spending it, which is
+ *  usually a lot smaller.
+ */
+class TxInUndoCompactSerializer
+{
+    const Coin* txout;
+    unsigned int nSpendHeight;
+
+public:
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        assert(txout->nHeight <= nSpendHeight);
+        ::Serialize(s, VARINT((nSpendHeight - txout->nHeight) * 2 + (txout->fCoinBase ? 1 : 0)));
+        ::Serialize(s, CTxOutCompressor(REF(txout->out)));
+    }
+
+    TxInUndoCompactSerializer(const Coin* coin, unsigned int nSpendHeightIn) : txout(coin), nSpendHeight(nSpendHeightIn) {}
+};
+
+class TxInUndoCompactDeserializer
+{
+    Coin* txout;
+    unsigned int nSpendHeight;
+
+public:
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        unsigned int nCode = 0;
+        ::Unserialize(s, VARINT(nCode));
+        if (nCode / 2 > nSpendHeight) {
+            throw std::ios_base::failure("Undo record height out of range");
+        }
+        txout->nHeight = nSpendHeight - nCode / 2;
+        txout->fCoinBase = nCode & 1;
+        ::Unserialize(s, REF(CTxOutCompressor(REF(txout->out))));
+    }
+
+    TxInUndoCompactDeserializer(Coin* coin, unsigned int nSpendHeightIn) : txout(coin), nSpendHeight(nSpendHeightIn) {}
+};
+
 static const size_t MIN_TRANSACTION_INPUT_WEIGHT = WITNESS_SCALE_FACTOR * ::GetSerializeSize(CTxIn(), SER_NETWORK, PROTOCOL_VERSION);
 static const size_t MAX_INPUTS_PER_BLOCK = MAX_BLOCK_WEIGHT / MIN_TRANSACTION_INPUT_WEIGHT;
 
@@ -109,4 +152,66 @@ public:
     }
 };
 
+/** Version of the compact undo format, which its records start with */
+static const unsigned char UNDO_COMPACT_VERSION = 1;
+
+/** A CBlockUndo in the compact undo format, for the block at height nHeight */
+class BlockUndoCompactSerializer
+{
+    const CBlockUndo* blockundo;
+    unsigned int nHeight;
+
+public:
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ::Serialize(s, UNDO_COMPACT_VERSION);
+        uint64_t nTxs = blockundo->vtxundo.size();
+        ::Serialize(s, COMPACTSIZE(nTxs));
+        for (const auto& txundo : blockundo->vtxundo) {
+            uint64_t count = txundo.vprevout.size();
+            ::Serialize(s, COMPACTSIZE(count));
+            for (const auto& prevout : txundo.vprevout) {
+                ::Serialize(s, REF(TxInUndoCompactSerializer(&prevout, nHeight)));
+            }
+        }
+    }
+
+    BlockUndoCompactSerializer(const CBlockUndo* blockundoIn, unsigned int nHeightIn) : blockundo(blockundoIn), nHeight(nHeightIn) {}
+};
+
+class BlockUndoCompactDeserializer
+{
+    CBlockUndo* blockundo;
+    unsigned int nHeight;
+
+public:
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        unsigned char nVersion = 0;
+        ::Unserialize(s, nVersion);
+        if (nVersion != UNDO_COMPACT_VERSION) {
+            throw std::ios_base::failure("Unknown undo format version");
+        }
+        uint64_t nTxs = 0;
+        ::Unserialize(s, COMPACTSIZE(nTxs));
+        if (nTxs > MAX_INPUTS_PER_BLOCK) {
+            throw std::ios_base::failure("Too many transaction undo records");
+        }
+        blockundo->vtxundo.resize(nTxs);
+        for (auto& txundo : blockundo->vtxundo) {
+            uint64_t count = 0;
+            ::Unserialize(s, COMPACTSIZE(count));
+            if (count > MAX_INPUTS_PER_BLOCK) {
+                throw std::ios_base::failure("Too many input undo records");
+            }
+            txundo.vprevout.resize(count);
+            for (auto& prevout : txundo.vprevout) {
+                ::Unserialize(s, REF(TxInUndoCompactDeserializer(&prevout, nHeight)));
+            }
+        }
+    }
+
+    BlockUndoCompactDeserializer(CBlockUndo* blockundoIn, unsigned int nHeightIn) : blockundo(blockundoIn), nHeight(nHeightIn) {}
+};
+
 #endif // FABCOIN_UNDO_H
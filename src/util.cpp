@@ -16,9 +16,16 @@
 #include "utilstrencodings.h"
 #include "utiltime.h"
 #include "logging.h"
+#include "mpscqueue.h"
 
 #include <stdarg.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
 #if (defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__DragonFly__))
 #include <pthread.h>
 #include <pthread_np.h>
@@ -297,42 +304,21 @@ std::vector<CLogCategoryActive> ListActiveLogCategories()
     return ret;
 }
 
-void LogTimestampStrDoStamp(const std::string& input, std::string& output)
+/** Format a timestamp for a log message written at nTimeMicros */
+static std::string FormatLogTimestamp(int64_t nTimeMicros, int64_t nMockTime)
 {
-    int64_t nTimeMicros = GetTimeMicros();
-    output = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTimeMicros/1000000);
+    std::string strStamp = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTimeMicros/1000000);
     if (fLogTimeMicros)
-        output += strprintf(".%06d", nTimeMicros%1000000);
-    int64_t mocktime = GetMockTime();
-    if (mocktime) {
-        output += " (mocktime: " + DateTimeStrFormat("%Y-%m-%d %H:%M:%S", mocktime) + ")";
+        strStamp += strprintf(".%06d", nTimeMicros%1000000);
+    if (nMockTime) {
+        strStamp += " (mocktime: " + DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nMockTime) + ")";
     }
-    output += ' ' + input;
+    return strStamp;
 }
 
-/**
- * fStartedNewLine is a state variable held by the calling context that will
- * suppress printing of the timestamp when multiple calls are made that don't
- * end in a newline. Initialize it to true, and hold it, in the calling context.
- */
-static std::string LogTimestampStr(const std::string &str, std::atomic_bool *fStartedNewLine)
+void LogTimestampStrDoStamp(const std::string& input, std::string& output)
 {
-    std::string strStamped;
-
-    if (!fLogTimestamps)
-        return str;
-
-    if (*fStartedNewLine)
-        LogTimestampStrDoStamp(str, strStamped);
-    else
-        strStamped = str;
-
-    if (!str.empty() && str[str.size()-1] == '\n')
-        *fStartedNewLine = true;
-    else
-        *fStartedNewLine = false;
-
-    return strStamped;
+    output = FormatLogTimestamp(GetTimeMicros(), GetMockTime()) + ' ' + input;
 }
 
 LoggerSession& logMain()
@@ -373,12 +359,196 @@ void LogPrintSessionStr(const std::string &str)
     logMain() << str;
 }
 
+/** A message for the log writer thread */
+struct CLogEntry
+{
+    //! Logger to write to, or nullptr for debug.log and the session log
+    LoggerSession* psession = nullptr;
+    //! Whether to timestamp the message, with the time it was logged at
+    bool fTimestamp = false;
+    int64_t nTimeMicros = 0;
+    int64_t nMockTime = 0;
+    std::string str;
+    //! What a logger shows on the console
+    std::string strConsole;
+};
+
+/**
+ * While the log writer thread runs, threads that log only push their message
+ * onto plogQueue, and the writer thread formats and writes them out in
+ * batches. Like mutexDebugLog, the queue is leaked on exit.
+ */
+static CMPSCQueue<CLogEntry>* plogQueue = nullptr;
+static std::thread* plogWriterThread = nullptr;
+static std::atomic<bool> fLogWriterRunning(false);
+static std::atomic<bool> fLogWriterStop(false);
+static std::atomic<bool> fLogWriterSleeping(false);
+//! Threads pushing onto plogQueue, which the writer has to wait for when it stops
+static std::atomic<int> nLogPushing(0);
+static std::atomic<uint64_t> nLogDropped(0);
+static std::mutex csLogWriter;
+static std::condition_variable condLogWriter;
+
+/** Hand entry to the log writer. Returns false if it is not running. */
+static bool PushLogEntry(CLogEntry&& entry)
+{
+    bool fQueued = false;
+    nLogPushing++;
+    if (fLogWriterRunning) {
+        fQueued = true;
+        if (!plogQueue->TryPush(std::move(entry)))
+            nLogDropped++;
+        else if (fLogWriterSleeping)
+            condLogWriter.notify_one();
+    }
+    nLogPushing--;
+    return fQueued;
+}
+
+static bool PushSessionLog(LoggerSession* psession, const std::string& strFile, const std::string& strConsole)
+{
+    CLogEntry entry;
+    entry.psession = psession;
+    entry.str = strFile;
+    entry.strConsole = strConsole;
+    return PushLogEntry(std::move(entry));
+}
+
+/** Write timestamped messages to debug.log and the session log */
+static int WriteDebugLog(const std::string& str, bool fSessionNow)
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    // buffer if we haven't opened the log yet
+    if (fileout == nullptr) {
+        assert(vMsgsBeforeOpenLog);
+        vMsgsBeforeOpenLog->push_back(str);
+        return str.length();
+    }
+
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        fs::path pathDebug = GetDataDir() / "debug.log";
+        if (fsbridge::freopen(pathDebug, "a", fileout) != nullptr)
+            setbuf(fileout, nullptr); // unbuffered
+    }
+
+    int ret = FileWriteStr(str, fileout);
+    if (fSessionNow)
+        logMain().WriteNow(str, str);
+    else
+        LogPrintSessionStr(str);
+    return ret;
+}
+
+static void LogWriterThread()
+{
+    RenameThread("fabcoin-logger");
+    uint64_t nDroppedReported = 0;
+    CLogEntry entry;
+    while (true) {
+        // Read before looking at the queue, so that all messages pushed
+        // before the writer was told to stop are seen.
+        const bool fStop = fLogWriterStop;
+        std::string strBatch;
+        int nPopped = 0;
+        while (nPopped < LOG_WRITER_BATCH && plogQueue->TryPop(entry)) {
+            nPopped++;
+            if (entry.psession) {
+                if (!strBatch.empty())
+                    WriteDebugLog(strBatch, true);
+                strBatch.clear();
+                entry.psession->WriteNow(entry.str, entry.strConsole);
+                continue;
+            }
+            if (entry.fTimestamp)
+                strBatch += FormatLogTimestamp(entry.nTimeMicros, entry.nMockTime) + ' ';
+            strBatch += entry.str;
+        }
+        const uint64_t nDropped = GetLogMessagesDropped();
+        if (nDropped != nDroppedReported) {
+            strBatch += strprintf("%s %u log messages dropped, the log writer fell behind\n", FormatLogTimestamp(GetTimeMicros(), GetMockTime()), nDropped - nDroppedReported);
+            nDroppedReported = nDropped;
+        }
+        if (!strBatch.empty())
+            WriteDebugLog(strBatch, true);
+        if (nPopped > 0) {
+            std::cout.flush();
+            continue;
+        }
+        if (fStop)
+            return;
+
+        // Pushers wake the writer up, but one that misses it waits no
+        // longer than the timeout.
+        std::unique_lock<std::mutex> lock(csLogWriter);
+        fLogWriterSleeping = true;
+        if (!fLogWriterStop)
+            condLogWriter.wait_for(lock, std::chrono::milliseconds(100));
+        fLogWriterSleeping = false;
+    }
+}
+
+void StartLogWriter(size_t nQueueSize)
+{
+    if (plogWriterThread)
+        return;
+    // Nothing pushes while the writer is stopped, and it left the queue empty.
+    delete plogQueue;
+    plogQueue = new CMPSCQueue<CLogEntry>(nQueueSize);
+    fLogWriterStop = false;
+    LoggerSession::asyncWriter = &PushSessionLog;
+    plogWriterThread = new std::thread(&LogWriterThread);
+    fLogWriterRunning = true;
+}
+
+void StopLogWriter()
+{
+    if (!plogWriterThread)
+        return;
+    // Log from the calling thread again, once no thread is in the middle of
+    // pushing a message the writer would miss.
+    fLogWriterRunning = false;
+    while (nLogPushing > 0)
+        std::this_thread::yield();
+    {
+        std::lock_guard<std::mutex> lock(csLogWriter);
+        fLogWriterStop = true;
+        condLogWriter.notify_one();
+    }
+    plogWriterThread->join();
+    delete plogWriterThread;
+    plogWriterThread = nullptr;
+}
+
+uint64_t GetLogMessagesDropped()
+{
+    return nLogDropped;
+}
+
 int LogPrintStr(const std::string &str)
 {
     int ret = 0; // Returns total number of characters written
     static std::atomic_bool fStartedNewLine(true);
 
-    std::string strTimestamped = LogTimestampStr(str, &fStartedNewLine);
+    // Timestamps are of when the message was logged, not written out, and
+    // are left out of messages that continue a line.
+    const bool fNewLine = fStartedNewLine.exchange(!str.empty() && str[str.size()-1] == '\n');
+    const bool fTimestamp = fLogTimestamps && fNewLine;
+    const int64_t nTimeMicros = fTimestamp ? GetTimeMicros() : 0;
+
+    if (fPrintToDebugLog && !fPrintToConsole && fLogWriterRunning) {
+        CLogEntry entry;
+        entry.fTimestamp = fTimestamp;
+        entry.nTimeMicros = nTimeMicros;
+        entry.nMockTime = fTimestamp ? GetMockTime() : 0;
+        entry.str = str;
+        if (PushLogEntry(std::move(entry)))
+            return str.size();
+    }
+
+    std::string strTimestamped = fTimestamp ? FormatLogTimestamp(nTimeMicros, GetMockTime()) + ' ' + str : str;
 
     if (fPrintToConsole)
     {
@@ -387,28 +557,8 @@ int LogPrintStr(const std::string &str)
         fflush(stdout);
     }
     else if (fPrintToDebugLog)
-    {   boost::call_once(&DebugPrintInit, debugPrintInitFlag);
-        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-        //std::cout << "DEBUG Got to here in logprintstr" << std::endl;
-        // buffer if we haven't opened the log yet
-        if (fileout == nullptr) {
-            assert(vMsgsBeforeOpenLog);
-            ret = strTimestamped.length();
-            vMsgsBeforeOpenLog->push_back(strTimestamped);
-        }
-        else
-        {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                fs::path pathDebug = GetDataDir() / "debug.log";
-                if (fsbridge::freopen(pathDebug, "a", fileout) != nullptr)
-                    setbuf(fileout, nullptr); // unbuffered
-            }
-
-            ret = FileWriteStr(strTimestamped, fileout);
-            LogPrintSessionStr(strTimestamped);
-        }
+    {
+        ret = WriteDebugLog(strTimestamped, false);
     }
     return ret;
 }
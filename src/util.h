@@ -36,6 +36,11 @@ int64_t GetStartupTime();
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const bool DEFAULT_ASYNCLOG       = true;
+/** Messages the log writer thread may fall behind by before further ones are dropped */
+static const size_t DEFAULT_LOG_QUEUE_SIZE = 8192;
+/** Most messages the log writer thread writes out at once */
+static const int LOG_WRITER_BATCH = 256;
 
 /** Signals for translation. */
 class CTranslationInterface
@@ -130,6 +135,18 @@ int LogPrintStr(const std::string &str);
 /** Send a string to the session output */
 void LogPrintSessionStr(const std::string &str);
 
+/**
+ * Write debug.log and the LoggerSession logs from a thread of their own, so
+ * that logging threads only queue their messages, with the time they logged
+ * them at. Messages logged while nQueueSize are waiting are dropped, and
+ * counted.
+ */
+void StartLogWriter(size_t nQueueSize = DEFAULT_LOG_QUEUE_SIZE);
+/** Write out what is queued, stop the log writer, and log from the calling threads again */
+void StopLogWriter();
+/** Number of log messages dropped because the log writer fell behind, as it also reports in the log */
+uint64_t GetLogMessagesDropped();
+
 /** Get format string from VA_ARGS for error reporting */
 template<typename... Args> std::string FormatStringFromLogArgs(const char *fmt, const Args&... args) { return fmt; }
 
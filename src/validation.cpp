@@ -6,10 +6,13 @@
 #include "validation.h"
 
 #include "arith_uint256.h"
+#include "blockfilecache.h"
+#include "blockimport.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
@@ -43,6 +46,8 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <functional>
+#include <mutex>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -75,6 +80,8 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fBatchVerify = DEFAULT_BATCH_VERIFY;
+bool fCompactUndo = DEFAULT_COMPACT_UNDO;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -136,6 +143,8 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** Open blk/rev files for reading; files before nLastBlockFile are mapped */
+    CBlockFileCache blockFileCache;
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -200,7 +209,10 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewDB *pcoinsdbview = nullptr;
+CCoinsViewBackgroundFlush *pcoinsflusher = nullptr;
 CCoinsViewCache *pcoinsTip = nullptr;
+CCoinsPrefetcher *pcoinsPrefetcher = nullptr;
+CCoinsSetDigest coinsTipDigest;
 CBlockTreeDB *pblocktree = nullptr;
 
 enum FlushStateMode {
@@ -216,6 +228,8 @@ static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPr
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+static bool RunScriptChecks(std::vector<CScriptCheck>& vChecks);
+static bool CheckInputsParallel(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
 {
@@ -476,13 +490,73 @@ static bool CheckInputsFromMempoolAndCache(const CTransaction& tx, CValidationSt
     return CheckInputs(tx, state, view, true, flags, cacheSigStore, true, txdata);
 }
 
-static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
-                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+namespace {
+
+/**
+ * State of one transaction on its way into the mempool. The pre-checks fill
+ * it in, the script checks only read it, and the commit stage turns it into
+ * a mempool entry. Script checks keep pointers into it, so it must not move
+ * while they are outstanding.
+ *
+ * All stages run under cs_main and pool.cs, held from the pre-checks to the
+ * commit, so acceptance of one transaction never overlaps another and the
+ * commit needs no second look at the inputs. Peer transactions arrive on
+ * the single message handler thread anyway. The stages are split so that
+ * the script checks can be handed to the script-check threads: the inputs
+ * of one transaction with many of them (CheckInputsParallel), and those of
+ * all members of a batch (AcceptToMemoryPoolBatch).
+ */
+struct MemPoolAcceptWorkspace
 {
-    FunctionProfile profileThis("AcceptToMemoryPoolWorker", 100, 300);
-    const CTransaction& tx = *ptx;
-    const uint256 hash = tx.GetHash();
+    explicit MemPoolAcceptWorkspace(const CTransactionRef& ptxIn) :
+        ptx(ptxIn), hash(ptxIn->GetHash()), view(&dummy), nModifiedFees(0), nConflictingFees(0),
+        nConflictingSize(0), nSize(0), fReplacementTransaction(false), scriptVerifyFlags(0) {}
+
+    const CTransactionRef ptx;
+    const uint256 hash;
+    CCoinsView dummy;
+    CCoinsViewCache view;
+    std::unique_ptr<PrecomputedTransactionData> txdata;
+    std::unique_ptr<CTxMemPoolEntry> entry;
+    std::set<uint256> setConflicts;
+    CTxMemPool::setEntries setAncestors;
+    CTxMemPool::setEntries allConflicting;
+    CAmount nModifiedFees;
+    CAmount nConflictingFees;
+    size_t nConflictingSize;
+    unsigned int nSize;
+    bool fReplacementTransaction;
+    unsigned int scriptVerifyFlags;
+};
+
+} // namespace
+
+// Calculate in-mempool ancestors, up to the configured chain limits.
+static bool MemPoolCheckChainLimits(CTxMemPool& pool, CValidationState& state, MemPoolAcceptWorkspace& ws)
+{
+    AssertLockHeld(pool.cs);
+    size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", Params().DefaultDescendantLimit());
+    size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantcount", Params().DefaultDescendantSizeLimit());
+    std::string errString;
+    ws.setAncestors.clear();
+    if (!pool.CalculateMemPoolAncestors(*ws.entry, ws.setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+    }
+    return true;
+}
+
+/**
+ * Everything except script validation: standardness, conflicts, input
+ * availability, fees, chain limits and the replacement rules.
+ */
+static bool MemPoolPreChecks(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, MemPoolAcceptWorkspace& ws,
+                             bool fLimitFree, bool* pfMissingInputs, int64_t nAcceptTime, const CAmount& nAbsurdFee,
+                             std::vector<COutPoint>& coins_to_uncache)
+{
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = ws.hash;
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
         *pfMissingInputs = false;
@@ -517,7 +591,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     }
 
     // Check for conflicts with in-memory transactions
-    std::set<uint256> setConflicts;
+    std::set<uint256>& setConflicts = ws.setConflicts;
     {
     LOCK(pool.cs); // protect pool.mapNextTx
     for (const CTxIn &txin : tx.vin)
@@ -562,353 +636,405 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
     }
     }
 
+    CCoinsViewCache& view = ws.view;
+    CAmount nValueIn = 0;
+    LockPoints lp;
     {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
-
-        CAmount nValueIn = 0;
-        LockPoints lp;
-        {
-        LOCK(pool.cs);
-        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
-        view.SetBackend(viewMemPool);
+    LOCK(pool.cs);
+    CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+    view.SetBackend(viewMemPool);
 
-        // do all inputs exist?
-        for (const CTxIn txin : tx.vin) {
-            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
-                coins_to_uncache.push_back(txin.prevout);
-            }
-            if (!view.HaveCoin(txin.prevout)) {
-                // Are inputs missing because we already have the tx?
-                for (size_t out = 0; out < tx.vout.size(); out++) {
-                    // Optimistically just do efficient check of cache for outputs
-                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
-                        return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
-                    }
-                }
-                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
-                if (pfMissingInputs) {
-                    *pfMissingInputs = true;
+    // do all inputs exist?
+    for (const CTxIn txin : tx.vin) {
+        if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+            coins_to_uncache.push_back(txin.prevout);
+        }
+        if (!view.HaveCoin(txin.prevout)) {
+            // Are inputs missing because we already have the tx?
+            for (size_t out = 0; out < tx.vout.size(); out++) {
+                // Optimistically just do efficient check of cache for outputs
+                if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                    return state.Invalid(false, REJECT_DUPLICATE, "txn-already-known");
                 }
-                return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
+            // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
+            if (pfMissingInputs) {
+                *pfMissingInputs = true;
+            }
+            return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
         }
+    }
 
-        // Bring the best block into scope
-        view.GetBestBlock();
+    // Bring the best block into scope
+    view.GetBestBlock();
 
-        nValueIn = view.GetValueIn(tx);
+    nValueIn = view.GetValueIn(tx);
 
-        // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
-        view.SetBackend(dummy);
+    // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
+    view.SetBackend(ws.dummy);
 
-        // Only accept BIP68 sequence locked transactions that can be mined in the next
-        // block; we don't want our mempool filled up with transactions that can't
-        // be mined yet.
-        // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
-        // CoinsViewCache instead of create its own
-        if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
+    // Only accept BIP68 sequence locked transactions that can be mined in the next
+    // block; we don't want our mempool filled up with transactions that can't
+    // be mined yet.
+    // Must keep pool.cs for this unless we change CheckSequenceLocks to take a
+    // CoinsViewCache instead of create its own
+    if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "non-BIP68-final");
+    }
+
+    // Check for non-standard pay-to-script-hash in inputs
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
+
+    // Check for non-standard witness in P2WSH
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
+
+    int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+
+    CAmount nValueOut = tx.GetValueOut();
+    CAmount nFees = nValueIn-nValueOut;
+    // nModifiedFees includes any fee deltas from PrioritiseTransaction
+    CAmount& nModifiedFees = ws.nModifiedFees;
+    nModifiedFees = nFees;
+    pool.ApplyDelta(hash, nModifiedFees);
+
+    // Keep track of transactions that spend a coinbase, which we re-scan
+    // during reorgs to ensure COINBASE_MATURITY is still met.
+    bool fSpendsCoinbase = false;
+    for (const CTxIn &txin : tx.vin) {
+        const Coin &coin = view.AccessCoin(txin.prevout);
+        if (coin.IsCoinBase()) {
+            fSpendsCoinbase = true;
+            break;
         }
+    }
 
-        // Check for non-standard pay-to-script-hash in inputs
-        if (fRequireStandard && !AreInputsStandard(tx, view))
-            return state.Invalid(false, REJECT_NONSTANDARD, "bad-txns-nonstandard-inputs");
-
-        // Check for non-standard witness in P2WSH
-        if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-witness-nonstandard", true);
-
-        int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
-
-        CAmount nValueOut = tx.GetValueOut();
-        CAmount nFees = nValueIn-nValueOut;
-        // nModifiedFees includes any fee deltas from PrioritiseTransaction
-        CAmount nModifiedFees = nFees;
-        pool.ApplyDelta(hash, nModifiedFees);
-
-        // Keep track of transactions that spend a coinbase, which we re-scan
-        // during reorgs to ensure COINBASE_MATURITY is still met.
-        bool fSpendsCoinbase = false;
-        for (const CTxIn &txin : tx.vin) {
-            const Coin &coin = view.AccessCoin(txin.prevout);
-            if (coin.IsCoinBase()) {
-                fSpendsCoinbase = true;
-                break;
-            }
-        }
+    ws.entry.reset(new CTxMemPoolEntry(ws.ptx, nFees, nAcceptTime, chainActive.Height(),
+                                       fSpendsCoinbase, nSigOpsCost, lp));
+    unsigned int nSize = ws.nSize = ws.entry->GetTxSize();
 
-        CTxMemPoolEntry entry(ptx, nFees, nAcceptTime, chainActive.Height(),
-                              fSpendsCoinbase, nSigOpsCost, lp);
-        unsigned int nSize = entry.GetTxSize();
+    // Check that the transaction doesn't have an excessive number of
+    // sigops, making it impossible to mine. Since the coinbase transaction
+    // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
+    // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
+    // merely non-standard transaction.
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
+            strprintf("%d", nSigOpsCost));
 
-        // Check that the transaction doesn't have an excessive number of
-        // sigops, making it impossible to mine. Since the coinbase transaction
-        // itself can contain sigops MAX_STANDARD_TX_SIGOPS is less than
-        // MAX_BLOCK_SIGOPS; we still consider this an invalid rather than
-        // merely non-standard transaction.
-        if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
-            return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
-                strprintf("%d", nSigOpsCost));
+    CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+    if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    }
 
-        CAmount mempoolRejectFee = pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
-            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
+    // No transactions are allowed below minRelayTxFee except from disconnected blocks
+    if (fLimitFree) {
+        CAmount expectedFee = ::minRelayTxFee.GetFee(nSize);
+        if (nModifiedFees < expectedFee) {
+            std::stringstream out;
+            out << "Min relay fee of " << expectedFee << " not met by submitted fee: " << nModifiedFees;
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, out.str());
         }
+    }
 
-        // No transactions are allowed below minRelayTxFee except from disconnected blocks
-        if (fLimitFree) {
-            CAmount expectedFee = ::minRelayTxFee.GetFee(nSize);
-            if (nModifiedFees < expectedFee) {
-                std::stringstream out;
-                out << "Min relay fee of " << expectedFee << " not met by submitted fee: " << nModifiedFees;
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, out.str());
-            }
-        }
+    if (nAbsurdFee && nFees > nAbsurdFee)
+        return state.Invalid(false,
+            REJECT_HIGHFEE, "absurdly-high-fee",
+            strprintf("%d > %d", nFees, nAbsurdFee));
 
-        if (nAbsurdFee && nFees > nAbsurdFee)
-            return state.Invalid(false,
-                REJECT_HIGHFEE, "absurdly-high-fee",
-                strprintf("%d > %d", nFees, nAbsurdFee));
+    // If we don't hold the lock allConflicting might be incomplete; the
+    // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
+    // mempool consistency for us, so the caller keeps holding pool.cs until
+    // the transaction is committed.
+    LOCK(pool.cs);
 
-        // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
-        size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
-        size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
-        size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", Params().DefaultDescendantLimit());
-        size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantcount", Params().DefaultDescendantSizeLimit());
-        std::string errString;
-        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
-            return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
-        }
+    if (!MemPoolCheckChainLimits(pool, state, ws))
+        return false;
 
-        // A transaction that spends outputs that would be replaced by it is invalid. Now
-        // that we have the set of all ancestors we can detect this
-        // pathological case by making sure setConflicts and setAncestors don't
-        // intersect.
-        for (CTxMemPool::txiter ancestorIt : setAncestors)
+    // A transaction that spends outputs that would be replaced by it is invalid. Now
+    // that we have the set of all ancestors we can detect this
+    // pathological case by making sure setConflicts and setAncestors don't
+    // intersect.
+    for (CTxMemPool::txiter ancestorIt : ws.setAncestors)
+    {
+        const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
+        if (setConflicts.count(hashAncestor))
         {
-            const uint256 &hashAncestor = ancestorIt->GetTx().GetHash();
-            if (setConflicts.count(hashAncestor))
-            {
-                return state.DoS(10, false,
-                                 REJECT_INVALID, "bad-txns-spends-conflicting-tx", false,
-                                 strprintf("%s spends conflicting transaction %s",
-                                           hash.ToString(),
-                                           hashAncestor.ToString()));
-            }
+            return state.DoS(10, false,
+                             REJECT_INVALID, "bad-txns-spends-conflicting-tx", false,
+                             strprintf("%s spends conflicting transaction %s",
+                                       hash.ToString(),
+                                       hashAncestor.ToString()));
         }
+    }
 
-        // Check if it's economically rational to mine this transaction rather
-        // than the ones it replaces.
-        CAmount nConflictingFees = 0;
-        size_t nConflictingSize = 0;
-        uint64_t nConflictingCount = 0;
-        CTxMemPool::setEntries allConflicting;
+    // Check if it's economically rational to mine this transaction rather
+    // than the ones it replaces.
+    CAmount& nConflictingFees = ws.nConflictingFees;
+    size_t& nConflictingSize = ws.nConflictingSize;
+    uint64_t nConflictingCount = 0;
+    CTxMemPool::setEntries& allConflicting = ws.allConflicting;
 
-        // If we don't hold the lock allConflicting might be incomplete; the
-        // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
-        // mempool consistency for us.
-        LOCK(pool.cs);
-        const bool fReplacementTransaction = setConflicts.size();
-        if (fReplacementTransaction)
+    ws.fReplacementTransaction = setConflicts.size();
+    if (ws.fReplacementTransaction)
+    {
+        CFeeRate newFeeRate(nModifiedFees, nSize);
+        std::set<uint256> setConflictsParents;
+        const int maxDescendantsToVisit = 100;
+        CTxMemPool::setEntries setIterConflicting;
+        for (const uint256 &hashConflicting : setConflicts)
         {
-            CFeeRate newFeeRate(nModifiedFees, nSize);
-            std::set<uint256> setConflictsParents;
-            const int maxDescendantsToVisit = 100;
-            CTxMemPool::setEntries setIterConflicting;
-            for (const uint256 &hashConflicting : setConflicts)
-            {
-                CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
-                if (mi == pool.mapTx.end())
-                    continue;
-
-                // Save these to avoid repeated lookups
-                setIterConflicting.insert(mi);
-
-                // Don't allow the replacement to reduce the feerate of the
-                // mempool.
-                //
-                // We usually don't want to accept replacements with lower
-                // feerates than what they replaced as that would lower the
-                // feerate of the next block. Requiring that the feerate always
-                // be increased is also an easy-to-reason about way to prevent
-                // DoS attacks via replacements.
-                //
-                // The mining code doesn't (currently) take children into
-                // account (CPFP) so we only consider the feerates of
-                // transactions being directly replaced, not their indirect
-                // descendants. While that does mean high feerate children are
-                // ignored when deciding whether or not to replace, we do
-                // require the replacement to pay more overall fees too,
-                // mitigating most cases.
-                CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
-                if (newFeeRate <= oldFeeRate)
-                {
-                    return state.DoS(0, false,
-                            REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                            strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
-                                  hash.ToString(),
-                                  newFeeRate.ToString(),
-                                  oldFeeRate.ToString()));
-                }
-
-                for (const CTxIn &txin : mi->GetTx().vin)
-                {
-                    setConflictsParents.insert(txin.prevout.hash);
-                }
+            CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
+            if (mi == pool.mapTx.end())
+                continue;
 
-                nConflictingCount += mi->GetCountWithDescendants();
-            }
-            // This potentially overestimates the number of actual descendants
-            // but we just want to be conservative to avoid doing too much
-            // work.
-            if (nConflictingCount <= maxDescendantsToVisit) {
-                // If not too many to replace, then calculate the set of
-                // transactions that would have to be evicted
-                for (CTxMemPool::txiter it : setIterConflicting) {
-                    pool.CalculateDescendants(it, allConflicting);
-                }
-                for (CTxMemPool::txiter it : allConflicting) {
-                    nConflictingFees += it->GetModifiedFee();
-                    nConflictingSize += it->GetTxSize();
-                }
-            } else {
+            // Save these to avoid repeated lookups
+            setIterConflicting.insert(mi);
+
+            // Don't allow the replacement to reduce the feerate of the
+            // mempool.
+            //
+            // We usually don't want to accept replacements with lower
+            // feerates than what they replaced as that would lower the
+            // feerate of the next block. Requiring that the feerate always
+            // be increased is also an easy-to-reason about way to prevent
+            // DoS attacks via replacements.
+            //
+            // The mining code doesn't (currently) take children into
+            // account (CPFP) so we only consider the feerates of
+            // transactions being directly replaced, not their indirect
+            // descendants. While that does mean high feerate children are
+            // ignored when deciding whether or not to replace, we do
+            // require the replacement to pay more overall fees too,
+            // mitigating most cases.
+            CFeeRate oldFeeRate(mi->GetModifiedFee(), mi->GetTxSize());
+            if (newFeeRate <= oldFeeRate)
+            {
                 return state.DoS(0, false,
-                        REJECT_NONSTANDARD, "too many potential replacements", false,
-                        strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
-                            hash.ToString(),
-                            nConflictingCount,
-                            maxDescendantsToVisit));
+                        REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                        strprintf("rejecting replacement %s; new feerate %s <= old feerate %s",
+                              hash.ToString(),
+                              newFeeRate.ToString(),
+                              oldFeeRate.ToString()));
             }
 
-            for (unsigned int j = 0; j < tx.vin.size(); j++)
+            for (const CTxIn &txin : mi->GetTx().vin)
             {
-                // We don't want to accept replacements that require low
-                // feerate junk to be mined first. Ideally we'd keep track of
-                // the ancestor feerates and make the decision based on that,
-                // but for now requiring all new inputs to be confirmed works.
-                if (!setConflictsParents.count(tx.vin[j].prevout.hash))
-                {
-                    // Rather than check the UTXO set - potentially expensive -
-                    // it's cheaper to just check if the new input refers to a
-                    // tx that's in the mempool.
-                    if (pool.mapTx.find(tx.vin[j].prevout.hash) != pool.mapTx.end())
-                        return state.DoS(0, false,
-                                         REJECT_NONSTANDARD, "replacement-adds-unconfirmed", false,
-                                         strprintf("replacement %s adds unconfirmed input, idx %d",
-                                                  hash.ToString(), j));
-                }
+                setConflictsParents.insert(txin.prevout.hash);
             }
 
-            // The replacement must pay greater fees than the transactions it
-            // replaces - if we did the bandwidth used by those conflicting
-            // transactions would not be paid for.
-            if (nModifiedFees < nConflictingFees)
-            {
-                return state.DoS(0, false,
-                                 REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                                 strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
-                                          hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
+            nConflictingCount += mi->GetCountWithDescendants();
+        }
+        // This potentially overestimates the number of actual descendants
+        // but we just want to be conservative to avoid doing too much
+        // work.
+        if (nConflictingCount <= maxDescendantsToVisit) {
+            // If not too many to replace, then calculate the set of
+            // transactions that would have to be evicted
+            for (CTxMemPool::txiter it : setIterConflicting) {
+                pool.CalculateDescendants(it, allConflicting);
+            }
+            for (CTxMemPool::txiter it : allConflicting) {
+                nConflictingFees += it->GetModifiedFee();
+                nConflictingSize += it->GetTxSize();
             }
+        } else {
+            return state.DoS(0, false,
+                    REJECT_NONSTANDARD, "too many potential replacements", false,
+                    strprintf("rejecting replacement %s; too many potential replacements (%d > %d)\n",
+                        hash.ToString(),
+                        nConflictingCount,
+                        maxDescendantsToVisit));
+        }
 
-            // Finally in addition to paying more fees than the conflicts the
-            // new transaction must pay for its own bandwidth.
-            CAmount nDeltaFees = nModifiedFees - nConflictingFees;
-            if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+        {
+            // We don't want to accept replacements that require low
+            // feerate junk to be mined first. Ideally we'd keep track of
+            // the ancestor feerates and make the decision based on that,
+            // but for now requiring all new inputs to be confirmed works.
+            if (!setConflictsParents.count(tx.vin[j].prevout.hash))
             {
-                return state.DoS(0, false,
-                        REJECT_INSUFFICIENTFEE, "insufficient fee", false,
-                        strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
-                              hash.ToString(),
-                              FormatMoney(nDeltaFees),
-                              FormatMoney(::incrementalRelayFee.GetFee(nSize))));
+                // Rather than check the UTXO set - potentially expensive -
+                // it's cheaper to just check if the new input refers to a
+                // tx that's in the mempool.
+                if (pool.mapTx.find(tx.vin[j].prevout.hash) != pool.mapTx.end())
+                    return state.DoS(0, false,
+                                     REJECT_NONSTANDARD, "replacement-adds-unconfirmed", false,
+                                     strprintf("replacement %s adds unconfirmed input, idx %d",
+                                              hash.ToString(), j));
             }
         }
 
-        unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-        if (!chainparams.RequireStandard()) {
-            scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+        // The replacement must pay greater fees than the transactions it
+        // replaces - if we did the bandwidth used by those conflicting
+        // transactions would not be paid for.
+        if (nModifiedFees < nConflictingFees)
+        {
+            return state.DoS(0, false,
+                             REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                             strprintf("rejecting replacement %s, less fees than conflicting txs; %s < %s",
+                                      hash.ToString(), FormatMoney(nModifiedFees), FormatMoney(nConflictingFees)));
         }
 
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, false, txdata)) {
-            // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
-            // need to turn both off, and compare against just turning off CLEANSTACK
-            // to see if the failure is specifically due to witness validation.
-            CValidationState stateDummy; // Want reported failures to be from first CheckInputs
-            if (!tx.HasWitness() && CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
-                !CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
-                // Only the witness is missing, so the transaction itself may be fine.
-                state.SetCorruptionPossible();
-            }
-            return false; // state filled in by CheckInputs
-        }
-
-        // Check again against the current block tip's script verification
-        // flags to cache our script execution flags. This is, of course,
-        // useless if the next block has different script flags from the
-        // previous one, but because the cache tracks script flags for us it
-        // will auto-invalidate and we'll just have a few blocks of extra
-        // misses on soft-fork activation.
-        //
-        // This is also useful in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks (using TestBlockValidity), however allowing such
-        // transactions into the mempool can be exploited as a DoS attack.
-        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
-        if (!CheckInputsFromMempoolAndCache(tx, state, view, pool, currentBlockScriptVerifyFlags, true, txdata))
+        // Finally in addition to paying more fees than the conflicts the
+        // new transaction must pay for its own bandwidth.
+        CAmount nDeltaFees = nModifiedFees - nConflictingFees;
+        if (nDeltaFees < ::incrementalRelayFee.GetFee(nSize))
         {
-            // If we're using promiscuousmempoolflags, we may hit this normally
-            // Check if current block has some flags that scriptVerifyFlags
-            // does not before printing an ominous warning
-            if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
-                return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+            return state.DoS(0, false,
+                    REJECT_INSUFFICIENTFEE, "insufficient fee", false,
+                    strprintf("rejecting replacement %s, not enough additional fees to relay; %s < %s",
+                          hash.ToString(),
+                          FormatMoney(nDeltaFees),
+                          FormatMoney(::incrementalRelayFee.GetFee(nSize))));
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Check the transaction's scripts against the standard (policy) flags. If
+ * pvChecks is given, the script checks are appended to it instead of being
+ * run, and only the non-script input checks can fail here; the caller must
+ * come back without pvChecks to get the reject reason if a queued check fails.
+ */
+static bool MemPoolPolicyScriptChecks(const CChainParams& chainparams, CValidationState& state, MemPoolAcceptWorkspace& ws,
+                                      std::vector<CScriptCheck>* pvChecks = nullptr)
+{
+    const CTransaction& tx = *ws.ptx;
+    ws.scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!chainparams.RequireStandard()) {
+        ws.scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", ws.scriptVerifyFlags);
+    }
+    unsigned int scriptVerifyFlags = ws.scriptVerifyFlags;
+
+    if (!ws.txdata)
+        ws.txdata.reset(new PrecomputedTransactionData(tx));
+    PrecomputedTransactionData& txdata = *ws.txdata;
+
+    if (pvChecks)
+        return CheckInputs(tx, state, ws.view, true, scriptVerifyFlags, true, false, txdata, pvChecks);
+
+    // Check against previous transactions
+    // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+    if (!CheckInputsParallel(tx, state, ws.view, scriptVerifyFlags, true, txdata)) {
+        // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
+        // need to turn both off, and compare against just turning off CLEANSTACK
+        // to see if the failure is specifically due to witness validation.
+        CValidationState stateDummy; // Want reported failures to be from first CheckInputs
+        if (!tx.HasWitness() && CheckInputs(tx, stateDummy, ws.view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, false, txdata) &&
+            !CheckInputs(tx, stateDummy, ws.view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, false, txdata)) {
+            // Only the witness is missing, so the transaction itself may be fine.
+            state.SetCorruptionPossible();
+        }
+        return false; // state filled in by CheckInputs
+    }
+    return true;
+}
+
+static bool MemPoolConsensusScriptChecks(CTxMemPool& pool, CValidationState& state, MemPoolAcceptWorkspace& ws)
+{
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = ws.hash;
+    unsigned int scriptVerifyFlags = ws.scriptVerifyFlags;
+
+    // Check again against the current block tip's script verification
+    // flags to cache our script execution flags. This is, of course,
+    // useless if the next block has different script flags from the
+    // previous one, but because the cache tracks script flags for us it
+    // will auto-invalidate and we'll just have a few blocks of extra
+    // misses on soft-fork activation.
+    //
+    // This is also useful in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain
+    // CHECKSIG NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks (using TestBlockValidity), however allowing such
+    // transactions into the mempool can be exploited as a DoS attack.
+    unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
+    if (!CheckInputsFromMempoolAndCache(tx, state, ws.view, pool, currentBlockScriptVerifyFlags, true, *ws.txdata))
+    {
+        // If we're using promiscuousmempoolflags, we may hit this normally
+        // Check if current block has some flags that scriptVerifyFlags
+        // does not before printing an ominous warning
+        if (!(~scriptVerifyFlags & currentBlockScriptVerifyFlags)) {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against latest-block but not STANDARD flags %s, %s",
+                __func__, hash.ToString(), FormatStateMessage(state));
+        } else {
+            if (!CheckInputs(tx, state, ws.view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, *ws.txdata)) {
+                return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
                     __func__, hash.ToString(), FormatStateMessage(state));
             } else {
-                if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, false, txdata)) {
-                    return error("%s: ConnectInputs failed against MANDATORY but not STANDARD flags due to promiscuous mempool %s, %s",
-                        __func__, hash.ToString(), FormatStateMessage(state));
-                } else {
-                    LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
-                }
+                LogPrintf("Warning: -promiscuousmempool flags set to not include currently enforced soft forks, this may break mining or otherwise cause instability!\n");
             }
         }
+    }
+    return true;
+}
 
-        // Remove conflicting transactions from the mempool
-        for (const CTxMemPool::txiter it : allConflicting)
-        {
-            LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s FAB additional fees, %d delta bytes\n",
-                    it->GetTx().GetHash().ToString(),
-                    hash.ToString(),
-                    FormatMoney(nModifiedFees - nConflictingFees),
-                    (int)nSize - (int)nConflictingSize);
-            if (plTxnReplaced)
-                plTxnReplaced->push_back(it->GetSharedTx());
-        }
-        pool.RemoveStaged(allConflicting, false, MemPoolRemovalReason::REPLACED);
-
-        // This transaction should only count for fee estimation if it isn't a
-        // BIP 125 replacement transaction (may not be widely supported), the
-        // node is not behind, and the transaction is not dependent on any other
-        // transactions in the mempool.
-        bool validForFeeEstimation = !fReplacementTransaction && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
-
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry, setAncestors, validForFeeEstimation);
-
-        // trim mempool and check if tx was trimmed
-        if (!fOverrideMempoolLimit) {
-            LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
-            if (!pool.exists(hash))
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
-        }
+/** Evict the conflicts and add the transaction to the mempool. */
+static bool MemPoolFinalize(CTxMemPool& pool, CValidationState& state, MemPoolAcceptWorkspace& ws,
+                            std::list<CTransactionRef>* plTxnReplaced, bool fOverrideMempoolLimit)
+{
+    AssertLockHeld(pool.cs);
+    const CTransaction& tx = *ws.ptx;
+    const uint256& hash = ws.hash;
+
+    // Remove conflicting transactions from the mempool
+    for (const CTxMemPool::txiter it : ws.allConflicting)
+    {
+        LogPrint(BCLog::MEMPOOL, "replacing tx %s with %s for %s FAB additional fees, %d delta bytes\n",
+                it->GetTx().GetHash().ToString(),
+                hash.ToString(),
+                FormatMoney(ws.nModifiedFees - ws.nConflictingFees),
+                (int)ws.nSize - (int)ws.nConflictingSize);
+        if (plTxnReplaced)
+            plTxnReplaced->push_back(it->GetSharedTx());
+    }
+    pool.RemoveStaged(ws.allConflicting, false, MemPoolRemovalReason::REPLACED);
+
+    // This transaction should only count for fee estimation if it isn't a
+    // BIP 125 replacement transaction (may not be widely supported), the
+    // node is not behind, and the transaction is not dependent on any other
+    // transactions in the mempool.
+    bool validForFeeEstimation = !ws.fReplacementTransaction && IsCurrentForFeeEstimation() && pool.HasNoInputsOf(tx);
+
+    // Store transaction in memory
+    pool.addUnchecked(hash, *ws.entry, ws.setAncestors, validForFeeEstimation);
+
+    // trim mempool and check if tx was trimmed
+    if (!fOverrideMempoolLimit) {
+        LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+    }
+    return true;
+}
+
+static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
+                              bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
+{
+    FunctionProfile profileThis("AcceptToMemoryPoolWorker", 100, 300);
+    AssertLockHeld(cs_main);
+    MemPoolAcceptWorkspace ws(ptx);
+    {
+        // The mempool must not change between the pre-checks and the commit,
+        // so it stays locked while the scripts are checked.
+        LOCK(pool.cs);
+        if (!MemPoolPreChecks(chainparams, pool, state, ws, fLimitFree, pfMissingInputs, nAcceptTime, nAbsurdFee, coins_to_uncache))
+            return false;
+        if (!MemPoolPolicyScriptChecks(chainparams, state, ws))
+            return false;
+        if (!MemPoolConsensusScriptChecks(pool, state, ws))
+            return false;
+        if (!MemPoolFinalize(pool, state, ws, plTxnReplaced, fOverrideMempoolLimit))
+            return false;
     }
 
     GetMainSignals().TransactionAddedToMempool(ptx);
@@ -947,6 +1073,146 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee);
 }
 
+/**
+ * See AcceptToMemoryPoolBatch. vAcceptTime holds the acceptance time of each
+ * member. With fSkipScriptChecks the independent members only get their
+ * inputs checked, not their scripts; this is for reloading transactions we
+ * validated ourselves against the same chain tip.
+ */
+static std::vector<bool> AcceptToMemoryPoolBatchWorker(const CChainParams& chainparams, CTxMemPool& pool, const std::vector<CTransactionRef>& vtx,
+                                                       const std::vector<int64_t>& vAcceptTime, bool fLimitFree, bool fSkipScriptChecks,
+                                                       std::vector<CValidationState>& vState, std::vector<bool>& vMissingInputs,
+                                                       std::list<CTransactionRef>* plTxnReplaced)
+{
+    FunctionProfile profileThis("AcceptToMemoryPoolBatch", -1, 100);
+    AssertLockHeld(cs_main);
+    const size_t nTx = vtx.size();
+    assert(vAcceptTime.size() == nTx);
+    std::vector<bool> vAccepted(nTx, false);
+    vState.assign(nTx, CValidationState());
+    vMissingInputs.assign(nTx, false);
+
+    std::vector<std::unique_ptr<MemPoolAcceptWorkspace>> vWorkspace(nTx);
+    std::vector<std::vector<COutPoint>> vCoinsToUncache(nTx);
+    std::vector<size_t> vDeferred;
+    {
+        LOCK(pool.cs);
+
+        // Pre-check the members that neither spend nor double-spend another
+        // member and don't replace anything in the mempool; the others are
+        // left to AcceptToMemoryPool below, in their original order.
+        std::set<uint256> setBatchTxids;
+        std::set<COutPoint> setBatchSpent;
+        std::vector<size_t> vStaged;
+        for (size_t i = 0; i < nTx; i++) {
+            const CTransaction& tx = *vtx[i];
+            bool fIndependent = setBatchTxids.insert(tx.GetHash()).second;
+            for (const CTxIn& txin : tx.vin) {
+                if (setBatchTxids.count(txin.prevout.hash) || !setBatchSpent.insert(txin.prevout).second)
+                    fIndependent = false;
+            }
+            if (!fIndependent) {
+                vDeferred.push_back(i);
+                continue;
+            }
+            vWorkspace[i].reset(new MemPoolAcceptWorkspace(vtx[i]));
+            bool fMissingInputs = false;
+            if (!MemPoolPreChecks(chainparams, pool, vState[i], *vWorkspace[i], fLimitFree, &fMissingInputs, vAcceptTime[i], 0, vCoinsToUncache[i])) {
+                vMissingInputs[i] = fMissingInputs;
+                vWorkspace[i].reset();
+                continue;
+            }
+            if (vWorkspace[i]->fReplacementTransaction) {
+                vWorkspace[i].reset();
+                vDeferred.push_back(i);
+                continue;
+            }
+            vStaged.push_back(i);
+        }
+
+        // Verify the scripts of all staged transactions in one go. If any
+        // check fails, redo them one transaction at a time (mostly hitting
+        // the signature cache) to attribute the failure.
+        std::vector<CScriptCheck> vChecks;
+        std::vector<size_t> vVerified;
+        for (size_t i : vStaged) {
+            MemPoolAcceptWorkspace& ws = *vWorkspace[i];
+            if (fSkipScriptChecks) {
+                ws.txdata.reset(new PrecomputedTransactionData(*ws.ptx));
+                if (CheckInputs(*ws.ptx, vState[i], ws.view, false, 0, false, false, *ws.txdata))
+                    vVerified.push_back(i);
+            } else if (MemPoolPolicyScriptChecks(chainparams, vState[i], ws, &vChecks)) {
+                vVerified.push_back(i);
+            }
+        }
+        if (!RunScriptChecks(vChecks)) {
+            std::vector<size_t> vPassed;
+            for (size_t i : vVerified) {
+                if (MemPoolPolicyScriptChecks(chainparams, vState[i], *vWorkspace[i]))
+                    vPassed.push_back(i);
+            }
+            vVerified.swap(vPassed);
+        }
+
+        // Commit in order. The chain limits are evaluated again, as earlier
+        // members may have been added below the same in-mempool ancestors.
+        bool fAnyAccepted = false;
+        for (size_t i : vVerified) {
+            MemPoolAcceptWorkspace& ws = *vWorkspace[i];
+            if (!fSkipScriptChecks && !MemPoolConsensusScriptChecks(pool, vState[i], ws))
+                continue;
+            if (!MemPoolCheckChainLimits(pool, vState[i], ws))
+                continue;
+            if (!MemPoolFinalize(pool, vState[i], ws, plTxnReplaced, true))
+                continue;
+            vAccepted[i] = fAnyAccepted = true;
+        }
+
+        // Trim once for the whole batch.
+        if (fAnyAccepted) {
+            LimitMempoolSize(pool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            for (size_t i : vVerified) {
+                if (vAccepted[i] && !pool.exists(vtx[i]->GetHash())) {
+                    vAccepted[i] = false;
+                    vState[i].DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < nTx; i++) {
+        if (!vAccepted[i])
+            continue;
+        GetMainSignals().TransactionAddedToMempool(vtx[i]);
+        if (Profiling::fAllowTxIdReceiveTimeLogging)
+            Profiling::theProfiler().RegisterReceivedTxId(vtx[i]->GetHash().ToString());
+    }
+
+    for (size_t i : vDeferred) {
+        bool fMissingInputs = false;
+        vAccepted[i] = AcceptToMemoryPoolWithTime(chainparams, pool, vState[i], vtx[i], fLimitFree, &fMissingInputs, vAcceptTime[i], plTxnReplaced, false, 0);
+        vMissingInputs[i] = fMissingInputs;
+    }
+
+    for (size_t i = 0; i < nTx; i++) {
+        if (vAccepted[i])
+            continue;
+        for (const COutPoint& outpoint : vCoinsToUncache[i])
+            pcoinsTip->Uncache(outpoint);
+    }
+    CValidationState stateDummy;
+    FlushStateToDisk(chainparams, stateDummy, FLUSH_STATE_PERIODIC);
+    return vAccepted;
+}
+
+std::vector<bool> AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, bool fLimitFree,
+                                          std::vector<CValidationState>& vState, std::vector<bool>& vMissingInputs,
+                                          std::list<CTransactionRef>* plTxnReplaced)
+{
+    std::vector<int64_t> vAcceptTime(vtx.size(), GetTime());
+    return AcceptToMemoryPoolBatchWorker(Params(), pool, vtx, vAcceptTime, fLimitFree, false, vState, vMissingInputs, plTxnReplaced);
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1034,23 +1300,51 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+/** Read the record at pos of a blk or rev file, and nTrailing bytes after it, through blockFileCache */
+static bool ReadDiskRecord(const CDiskBlockPos& pos, const char* prefix, size_t nTrailing, CDiskRecord& record)
 {
-    block.SetNull();
+    bool fFinal;
+    {
+        LOCK(cs_LastBlockFile);
+        fFinal = pos.nFile < nLastBlockFile;
+    }
+    return blockFileCache.ReadRecord(GetBlockPosFilename(pos, prefix), pos.nPos, nTrailing, fFinal, record);
+}
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW)
+{
+    block.SetNull();
 
-    // Read block
-    try {
-        filein >> block;
+    // Read block, from the file cache if possible
+    CDiskRecord record;
+    bool fRead = false;
+    if (ReadDiskRecord(pos, "blk", 0, record)) {
+        try {
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, record.data(), record.size());
+            reader >> block;
+            fRead = true;
+        }
+        catch (const std::exception&) {
+            // Try the file itself below, which reports the error.
+            block.SetNull();
+        }
     }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    if (!fRead) {
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
+    if (!fCheckPOW)
+        return true;
+
     // Check Equihash solution
     bool postfork = block.nHeight >= (uint32_t)consensusParams.FABHeight;
     if (postfork && !CheckEquihashSolution(&block, Params())) {
@@ -1066,9 +1360,9 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams, fCheckPOW))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1274,6 +1568,51 @@ bool CScriptCheck::checkScript(std::stringstream *extraErrorStream) {
     return VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata), &this->error, extraErrorStream);
 }
 
+bool CScriptCheck::RunDeferred(std::vector<CDeferredSignature>& batch)
+{
+    // Signatures to be cached have to be verified on their own.
+    if (cacheStore)
+        return false;
+    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
+    const CScriptWitness *witness = &ptxTo->vin[nIn].scriptWitness;
+    return VerifyScript(scriptSig, scriptPubKey, witness, nFlags, BatchingTransactionSignatureChecker(ptxTo, nIn, amount, *txdata, batch), &error);
+}
+
+bool VerifyScriptChecksBatched(std::vector<CScriptCheck>& vChecks, bool fBatch)
+{
+    if (!fBatch) {
+        for (CScriptCheck& check : vChecks)
+            if (!check())
+                return false;
+        return true;
+    }
+
+    std::vector<CDeferredSignature> batch;
+    std::vector<size_t> vEnd(vChecks.size());
+    std::vector<bool> vRerun(vChecks.size());
+    for (size_t i = 0; i < vChecks.size(); i++) {
+        vRerun[i] = !vChecks[i].RunDeferred(batch);
+        vEnd[i] = batch.size();
+    }
+    std::vector<bool> vValid;
+    if (!CPubKey::VerifyBatch(batch, &vValid)) {
+        // Run the checks with a bad signature again, so that the script
+        // decides what that means, and a failure is reported for the right
+        // input.
+        size_t nStart = 0;
+        for (size_t i = 0; i < vChecks.size(); i++) {
+            for (size_t j = nStart; j < vEnd[i]; j++)
+                if (!vValid[j])
+                    vRerun[i] = true;
+            nStart = vEnd[i];
+        }
+    }
+    for (size_t i = 0; i < vChecks.size(); i++)
+        if (vRerun[i] && !vChecks[i]())
+            return false;
+    return true;
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -1405,7 +1744,33 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+/** Write undo data in the format fCompact selects: legacy, or the compact one for the block at nHeight */
+template<typename Stream>
+void SerializeUndo(Stream& s, const CBlockUndo& blockundo, bool fCompact, int nHeight)
+{
+    if (fCompact)
+        s << BlockUndoCompactSerializer(&blockundo, nHeight);
+    else
+        s << blockundo;
+}
+
+template<typename Stream>
+void UnserializeUndo(Stream& s, CBlockUndo& blockundo, bool fCompact, int nHeight)
+{
+    if (fCompact)
+        s >> REF(BlockUndoCompactDeserializer(&blockundo, nHeight));
+    else
+        s >> blockundo;
+}
+
+unsigned int GetUndoSize(const CBlockUndo& blockundo, bool fCompact, int nHeight)
+{
+    if (fCompact)
+        return ::GetSerializeSize(BlockUndoCompactSerializer(&blockundo, nHeight), SER_DISK, CLIENT_VERSION);
+    return ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION);
+}
+
+bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, bool fCompact, int nHeight, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
@@ -1413,7 +1778,7 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
         return error("%s: OpenUndoFile failed", __func__);
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
+    unsigned int nSize = GetUndoSize(blockundo, fCompact, nHeight);
     fileout << FLATDATA(messageStart) << nSize;
 
     // Write undo data
@@ -1421,30 +1786,53 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     if (fileOutPos < 0)
         return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    SerializeUndo(fileout, blockundo, fCompact, nHeight);
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
-    hasher << blockundo;
+    SerializeUndo(hasher, blockundo, fCompact, nHeight);
     fileout << hasher.GetHash();
 
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
+/** Read and verify the undo data of the block at pindex, in the format its status says */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
 {
+    const CDiskBlockPos pos = pindex->GetUndoPos();
+    const uint256 hashBlock = pindex->pprev->GetBlockHash();
+    const bool fCompact = pindex->nStatus & BLOCK_UNDO_COMPACT;
+
+    // Read from the file cache if possible
+    uint256 hashChecksum;
+    CDiskRecord record;
+    if (ReadDiskRecord(pos, "rev", sizeof(hashChecksum), record)) {
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, record.data(), record.size());
+        CHashVerifier<CSpanReader> verifier(&reader);
+        try {
+            verifier << hashBlock;
+            UnserializeUndo(verifier, blockundo, fCompact, pindex->nHeight);
+            reader >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+        if (hashChecksum != verifier.GetHash())
+            return error("%s: Checksum mismatch", __func__);
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("%s: OpenUndoFile failed", __func__);
 
     // Read block
-    uint256 hashChecksum;
     CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
     try {
         verifier << hashBlock;
-        verifier >> blockundo;
+        UnserializeUndo(verifier, blockundo, fCompact, pindex->nHeight);
         filein >> hashChecksum;
     }
     catch (const std::exception& e) {
@@ -1520,18 +1908,18 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 }
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
+ *  If pdigest is given, the changes made to the set are added to it.
  *  When FAILED is returned, view is left in an indeterminate state. */
-static DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+static DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, CCoinsSetDigest* pdigest = nullptr)
 {
     bool fClean = true;
 
     CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull()) {
+    if (pindex->GetUndoPos().IsNull()) {
         error("DisconnectBlock(): no undo data available");
         return DISCONNECT_FAILED;
     }
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash())) {
+    if (!UndoReadFromDisk(blockUndo, pindex)) {
         error("DisconnectBlock(): failure reading undo data");
         return DISCONNECT_FAILED;
     }
@@ -1557,6 +1945,9 @@ static DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex*
                 if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || is_coinbase != coin.fCoinBase) {
                     fClean = false; // transaction output mismatch
                 }
+                if (is_spent && pdigest) {
+                    pdigest->Remove(out, coin);
+                }
             }
         }
 
@@ -1572,6 +1963,9 @@ static DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex*
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
+                if (pdigest) {
+                    pdigest->Insert(out, view.AccessCoin(out));
+                }
             }
             // At this point, all of txundo.vprevout should have been moved out.
         }
@@ -1589,6 +1983,11 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
+    if (fFinalize) {
+        blockFileCache.Forget(GetBlockPosFilename(posOld, "blk"));
+        blockFileCache.Forget(GetBlockPosFilename(posOld, "rev"));
+    }
+
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
@@ -1608,20 +2007,57 @@ void static FlushBlockFile(bool fFinalize = false)
 
 static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128, [](std::vector<CScriptCheck>& vChecks) { return VerifyScriptChecksBatched(vChecks, fBatchVerify); });
 
 void ThreadScriptCheck() {
     RenameThread("fabcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
-// Protected by cs_main
-VersionBitsCache versionbitscache;
+/** Run script checks on the script-check threads if there are any, and in this thread otherwise. */
+static bool RunScriptChecks(std::vector<CScriptCheck>& vChecks)
+{
+    if (vChecks.empty())
+        return true;
+    if (nScriptCheckThreads) {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        return control.Wait();
+    }
+    for (CScriptCheck& check : vChecks) {
+        if (!check())
+            return false;
+    }
+    return true;
+}
 
-int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
+/**
+ * CheckInputs for a loose transaction, spreading the script checks of
+ * transactions with many inputs over the script-check threads. The script
+ * execution cache is never written. On failure the inputs are checked again
+ * serially, so that state reports the first failing input just like a plain
+ * CheckInputs call would.
+ */
+static bool CheckInputsParallel(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, unsigned int flags, bool cacheSigStore, PrecomputedTransactionData& txdata)
 {
-    LOCK(cs_main);
-    int32_t nVersion = VERSIONBITS_TOP_BITS;
+    if (!nScriptCheckThreads || tx.vin.size() < MIN_PARALLEL_MEMPOOL_SCRIPT_INPUTS)
+        return CheckInputs(tx, state, inputs, true, flags, cacheSigStore, false, txdata);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, inputs, true, flags, cacheSigStore, false, txdata, &vChecks))
+        return false;
+    if (RunScriptChecks(vChecks))
+        return true;
+    return CheckInputs(tx, state, inputs, true, flags, cacheSigStore, false, txdata);
+}
+
+// Protected by cs_main
+VersionBitsCache versionbitscache;
+
+int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
+{
+    LOCK(cs_main);
+    int32_t nVersion = VERSIONBITS_TOP_BITS;
 
     for (int i = 0; i < (int)Consensus::MAX_VERSION_BITS_DEPLOYMENTS; i++) {
         ThresholdState state = VersionBitsState(pindexPrev, params, (Consensus::DeploymentPos)i, versionbitscache);
@@ -1705,9 +2141,11 @@ static int64_t nTimeTotal = 0;
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  If pdigest is given, the changes made to the set are added to it. */
 static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false,
+                  CCoinsSetDigest* pdigest = nullptr)
 {
     AssertLockHeld(cs_main);
     assert(pindex);
@@ -1904,14 +2342,18 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     {
         if (pindex->GetUndoPos().IsNull()) {
             CDiskBlockPos _pos;
-            if (!FindUndoPos(state, pindex->nFile, _pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+            if (!FindUndoPos(state, pindex->nFile, _pos, GetUndoSize(blockundo, fCompactUndo, pindex->nHeight) + 40))
                 return error("ConnectBlock(): FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+            if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), fCompactUndo, pindex->nHeight, chainparams.MessageStart()))
                 return AbortNode(state, "Failed to write undo data");
 
             // update nUndoPos in block index
             pindex->nUndoPos = _pos.nPos;
             pindex->nStatus |= BLOCK_HAVE_UNDO;
+            if (fCompactUndo)
+                pindex->nStatus |= BLOCK_UNDO_COMPACT;
+            else
+                pindex->nStatus &= ~BLOCK_UNDO_COMPACT;
         }
 
         pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
@@ -1922,6 +2364,24 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (pdigest) {
+        // The undo data holds exactly the coins this block spent.
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *(block.vtx[i]);
+            if (i > 0) {
+                const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+                for (size_t j = 0; j < tx.vin.size(); j++) {
+                    pdigest->Remove(tx.vin[j].prevout, txundo.vprevout[j]);
+                }
+            }
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                    pdigest->Insert(COutPoint(tx.GetHash(), o), Coin(tx.vout[o], pindex->nHeight, i == 0));
+                }
+            }
+        }
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -1980,7 +2440,7 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             nLastSetChain = nNow;
         }
         int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
-        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+        int64_t cacheSize = pcoinsTip->DynamicMemoryUsage() + pcoinsflusher->DynamicMemoryUsage();
         int64_t nTotalSpace = nCoinCacheUsage + std::max<int64_t>(nMempoolSizeMax - nMempoolUsage, 0);
         // The cache is large and we're within 10% and 10 MiB of the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize > std::max((9 * nTotalSpace) / 10, nTotalSpace - MAX_BLOCK_COINSDB_USAGE * 1024 * 1024);
@@ -2031,9 +2491,23 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
+            // The UTXO set digest goes out with the coins it describes.
+            if (coinsTipDigest.hashBlock == pcoinsTip->GetBestBlock())
+                pcoinsdbview->SetPendingDigest(coinsTipDigest);
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
-                return AbortNode(state, "Failed to write to coin database");
+            // Unless the caller needs it on disk now, or just pruned blocks
+            // the chainstate on disk may still need for a replay, let
+            // validation carry on while it is written.
+            int64_t nStart = GetTimeMicros();
+            if (mode != FLUSH_STATE_ALWAYS && !fFlushForPrune && gArgs.GetBoolArg("-dbbackgroundflush", DEFAULT_DB_BACKGROUND_FLUSH)) {
+                // Clean entries stay cached while they fit in half the budget.
+                if (!pcoinsflusher->FlushInBackground(*pcoinsTip, fCacheCritical ? 0 : nTotalSpace / 2))
+                    return AbortNode(state, "Failed to write to coin database");
+            } else {
+                if (!pcoinsTip->Flush())
+                    return AbortNode(state, "Failed to write to coin database");
+                LogPrintf("Flushed coins cache to disk, validation stalled %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+            }
             nLastFlush = nNow;
         }
     }
@@ -2126,6 +2600,20 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
 
 }
 
+/**
+ * Move coinsTipDigest from hashFrom to hashTo by applying the changes a block
+ * made. A digest that does not describe hashFrom is left alone; it is only
+ * ever stored with the block it describes.
+ */
+static void UpdateCoinsTipDigest(const CCoinsSetDigest& delta, const uint256& hashFrom, const uint256& hashTo)
+{
+    AssertLockHeld(cs_main);
+    if (coinsTipDigest.hashBlock != hashFrom)
+        return;
+    coinsTipDigest.Apply(delta);
+    coinsTipDigest.hashBlock = hashTo;
+}
+
 /** Disconnect chainActive's tip.
   * After calling, the mempool will be in an inconsistent state, with
   * transactions from disconnected blocks being added to disconnectpool.  You
@@ -2150,10 +2638,12 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     {
         CCoinsViewCache view(pcoinsTip);
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        CCoinsSetDigest digestDelta;
+        if (DisconnectBlock(block, pindexDelete, view, &digestDelta) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
+        UpdateCoinsTipDigest(digestDelta, pindexDelete->GetBlockHash(), pindexDelete->pprev->GetBlockHash());
     }
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
@@ -2182,6 +2672,7 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2265,10 +2756,15 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime1 = GetTimeMicros();
     std::shared_ptr<const CBlock> pthisBlock;
     if (!pblock) {
-        std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
-        if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
-            return AbortNode(state, "Failed to read block");
-        pthisBlock = pblockNew;
+        // The prefetcher may have read it already.
+        if (pcoinsPrefetcher)
+            pthisBlock = pcoinsPrefetcher->GetPendingBlock(pindexNew->GetBlockHash());
+        if (!pthisBlock) {
+            std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblockNew, pindexNew, chainparams.GetConsensus()))
+                return AbortNode(state, "Failed to read block");
+            pthisBlock = pblockNew;
+        }
     } else {
         pthisBlock = pblock;
     }
@@ -2277,9 +2773,16 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    if (pcoinsPrefetcher) {
+        size_t nPrefetched = pcoinsPrefetcher->Warm(blockConnecting, *pcoinsTip);
+        int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+        LogPrint(BCLog::BENCH, "  - Prefetch inputs: %.2fms (%u coins) [%.2fs]\n", (nTimePrefetched - nTime2) * 0.001, nPrefetched, nTimePrefetch * 0.000001);
+        nTime2 = nTimePrefetched;
+    }
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        CCoinsSetDigest digestDelta;
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, &digestDelta);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2290,6 +2793,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         bool flushed = view.Flush();
         assert(flushed);
+        UpdateCoinsTipDigest(digestDelta, pindexNew->pprev ? pindexNew->pprev->GetBlockHash() : uint256(), pindexNew->GetBlockHash());
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -2386,6 +2890,33 @@ static void PruneBlockIndexCandidates() {
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either nullptr or a pointer to a CBlock corresponding to pindexMostWork.
  */
+/**
+ * Hand the blocks that follow the one about to be connected on the way to
+ * pindexMostWork to the prefetcher, so their inputs get looked up while
+ * earlier blocks are being connected.
+ */
+static void PrefetchBlocksAhead(const CChainParams& chainparams, const CBlockIndex* pindexMostWork)
+{
+    AssertLockHeld(cs_main);
+    if (!pcoinsPrefetcher || !chainActive.Tip())
+        return;
+    const int nTipHeight = chainActive.Height();
+    if (pindexMostWork->GetAncestor(nTipHeight) != chainActive.Tip())
+        return;
+    const int nLastHeight = std::min(nTipHeight + 1 + PREFETCH_BLOCKS_AHEAD, pindexMostWork->nHeight);
+    for (int nHeight = nTipHeight + 2; nHeight <= nLastHeight; nHeight++) {
+        const CBlockIndex* pindex = pindexMostWork->GetAncestor(nHeight);
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
+        if (pcoinsPrefetcher->GetPendingBlock(pindex->GetBlockHash()))
+            continue;
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblock, pindex, chainparams.GetConsensus()))
+            break; // ConnectTip will complain
+        pcoinsPrefetcher->Prefetch(pblock, *pcoinsTip);
+    }
+}
+
 static bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace)
 {
     AssertLockHeld(cs_main);
@@ -2424,6 +2955,7 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
+            PrefetchBlocksAhead(chainparams, pindexMostWork);
             if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
@@ -2877,6 +3409,54 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     return true;
 }
 
+/**
+ * The context-free checks of a transaction in a block, for the block
+ * transaction check threads. The result only tells whether it passes; the
+ * reason for a failure comes from checking again in order, so that it is
+ * always that of the first bad transaction.
+ */
+class CBlockTxCheck
+{
+private:
+    const CTransaction* ptx;
+    unsigned int* pnSigOps;
+
+public:
+    CBlockTxCheck() : ptx(nullptr), pnSigOps(nullptr) {}
+    CBlockTxCheck(const CTransaction& tx, unsigned int& nSigOps) : ptx(&tx), pnSigOps(&nSigOps) {}
+
+    bool operator()()
+    {
+        CValidationState state;
+        if (!CheckTransaction(*ptx, state, false))
+            return false;
+        *pnSigOps = GetLegacySigOpCount(*ptx);
+        return true;
+    }
+
+    void swap(CBlockTxCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        std::swap(pnSigOps, check.pnSigOps);
+    }
+};
+
+/**
+ * Not scriptcheckqueue: CheckBlock runs on the message handler thread without
+ * cs_main, while ConnectBlock may hold the script check threads for seconds
+ * at a time, and a block waiting behind that to be checked in parallel would
+ * be slower than checking it serially. The workers sleep unless a large block
+ * is being checked.
+ */
+static CCheckQueue<CBlockTxCheck> blocktxcheckqueue(16);
+//! Taken by CheckBlock while it uses blocktxcheckqueue, which others then do not wait for
+static std::mutex csBlockTxCheckQueue;
+
+void ThreadBlockTxCheck() {
+    RenameThread("fabcoin-blocktxch");
+    blocktxcheckqueue.Thread();
+}
+
 bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -2889,6 +3469,21 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
         return false;
 
+    // The transactions of large blocks are checked on the block transaction
+    // check threads while this one computes the merkle root, unless another
+    // block is using them already.
+    std::vector<unsigned int> vSigOps(block.vtx.size());
+    std::unique_lock<std::mutex> lockQueue(csBlockTxCheckQueue, std::defer_lock);
+    const bool fParallel = nScriptCheckThreads && block.vtx.size() >= MIN_PARALLEL_BLOCK_CHECK_TXS && lockQueue.try_lock();
+    CCheckQueueControl<CBlockTxCheck> control(fParallel ? &blocktxcheckqueue : nullptr);
+    if (fParallel) {
+        std::vector<CBlockTxCheck> vChecks;
+        vChecks.reserve(block.vtx.size());
+        for (size_t i = 0; i < block.vtx.size(); i++)
+            vChecks.emplace_back(*block.vtx[i], vSigOps[i]);
+        control.Add(vChecks);
+    }
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
@@ -2924,17 +3519,21 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
         if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
-    // Check transactions
-    for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, false))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+    // Check transactions. If one failed on the check threads, this finds the
+    // first one that does.
+    if (!fParallel || !control.Wait()) {
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *block.vtx[i];
+            if (!CheckTransaction(tx, state, false))
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx.GetHash().ToString(), state.GetDebugMessage()));
+            vSigOps[i] = GetLegacySigOpCount(tx);
+        }
+    }
 
     unsigned int nSigOps = 0;
-    for (const auto& tx : block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(*tx);
-    }
+    for (unsigned int nTxSigOps : vSigOps)
+        nSigOps += nTxSigOps;
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
 
@@ -3135,7 +3734,8 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+/** fChecked tells that CheckBlockHeader already passed, as part of CheckBlock */
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fChecked = false)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3154,7 +3754,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!fChecked && !CheckBlockHeader(block, state, chainparams.GetConsensus()))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3226,7 +3826,8 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     CBlockIndex *pindexDummy = nullptr;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    // Spare the Equihash verification of a block that passed CheckBlock
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, block.fChecked))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3303,6 +3904,8 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
 
 bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<const CBlock> pblock, bool fForceProcessing, bool *fNewBlock)
 {
+    // Header hashes computed anywhere meanwhile, which is mostly for this block
+    const uint64_t nHeaderHashesStart = GetBlockHeaderHashCount();
     {
         CBlockIndex *pindex = nullptr;
         if (fNewBlock) *fNewBlock = false;
@@ -3322,6 +3925,10 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
             GetMainSignals().BlockChecked(*pblock, state);
             return error("%s: AcceptBlock FAILED", __func__);
         }
+        // Blocks that may get connected soon, like those arriving out of
+        // order during initial download, have their inputs looked up now.
+        if (pcoinsPrefetcher && pindex && chainActive.Tip() && pindex->nChainWork > chainActive.Tip()->nChainWork)
+            pcoinsPrefetcher->Prefetch(pblock, *pcoinsTip);
     }
 
     NotifyHeaderTip();
@@ -3330,6 +3937,7 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
     if (!ActivateBestChain(state, chainparams, pblock))
         return error("%s: ActivateBestChain failed", __func__);
 
+    LogPrint(BCLog::BENCH, "- Header hashes for block %s: %u\n", pblock->GetHash().ToString(), GetBlockHeaderHashCount() - nHeaderHashesStart);
     return true;
 }
 
@@ -3377,7 +3985,7 @@ void PruneOneBlockFile(const int fileNumber)
         CBlockIndex* pindex = it->second;
         if (pindex->nFile == fileNumber) {
             pindex->nStatus &= ~BLOCK_HAVE_DATA;
-            pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+            pindex->nStatus &= ~(BLOCK_HAVE_UNDO | BLOCK_UNDO_COMPACT);
             pindex->nFile = 0;
             pindex->nDataPos = 0;
             pindex->nUndoPos = 0;
@@ -3407,6 +4015,8 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileCache.Forget(GetBlockPosFilename(pos, "blk"));
+        blockFileCache.Forget(GetBlockPosFilename(pos, "rev"));
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3759,9 +4369,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         // check level 2: verify undo validity
         if (nCheckLevel >= 2 && pindex) {
             CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
+            if (!pindex->GetUndoPos().IsNull()) {
+                if (!UndoReadFromDisk(undo, pindex))
                     return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
             }
         }
@@ -3836,6 +4445,7 @@ bool ReplayBlocks(const CChainParams& params, CCoinsView* view)
 
     std::vector<uint256> hashHeads = view->GetHeadBlocks();
     if (hashHeads.empty()) return true; // We're already in a consistent state.
+    if (hashHeads.size() == 1) return error("ReplayBlocks(): loading a UTXO snapshot was interrupted");
     if (hashHeads.size() != 2) return error("ReplayBlocks(): unknown inconsistent state");
 
     uiInterface.ShowProgress(_("Replaying blocks..."), 0);
@@ -3942,7 +4552,7 @@ bool RewindBlockIndex(const CChainParams& params)
             // Reduce validity
             pindexIter->nStatus = std::min<unsigned int>(pindexIter->nStatus & BLOCK_VALID_MASK, BLOCK_VALID_TREE) | (pindexIter->nStatus & ~BLOCK_VALID_MASK);
             // Remove have-data flags.
-            pindexIter->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO);
+            pindexIter->nStatus &= ~(BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO | BLOCK_UNDO_COMPACT);
             // Remove storage location.
             pindexIter->nFile = 0;
             pindexIter->nDataPos = 0;
@@ -4000,6 +4610,7 @@ void UnloadBlockIndex()
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
+    blockFileCache.Clear();
     nBlockSequenceId = 1;
     setDirtyBlockIndex.clear();
     g_failed_blocks.clear();
@@ -4072,14 +4683,88 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Accept a block read from an external or block file, along with any children
+ * of it that were encountered earlier. Returns false if the rest of the file
+ * should be given up on.
+ */
+static bool ImportBlock(const CChainParams& chainparams, const std::shared_ptr<CBlock>& pblock, CDiskBlockPos* dbp, int& nLoaded)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    const CBlock& block = *pblock;
 
-    int nLoaded = 0;
+    // detect out of order blocks, and store them for later
+    uint256 hash = block.GetHash();
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        LOCK(cs_main);
+        CValidationState state;
+        if (AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+            if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
+            {
+                LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                {
+                    nLoaded++;
+                    queue.push_back(pblockrecursive->GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
+/** Scan fileIn for blocks from nStartPos on, and import them */
+static void LoadBlockFileFrom(const CChainParams& chainparams, FILE* fileIn, uint64_t nStartPos, CDiskBlockPos *dbp, int& nLoaded)
+{
     try {
+        if (nStartPos && fseek(fileIn, nStartPos, SEEK_SET)) {
+            fclose(fileIn);
+            throw std::runtime_error(strprintf("%s: failed to seek to %u", __func__, nStartPos));
+        }
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
@@ -4110,73 +4795,15 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 // read block
                 uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
-                    dbp->nPos = nBlockPos;
+                    dbp->nPos = nStartPos + nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
+                blkdat >> *pblock;
                 nRewind = blkdat.GetPos();
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
-
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
-
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
-                }
+                if (!ImportBlock(chainparams, pblock, dbp, nLoaded))
+                    break;
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
@@ -4184,11 +4811,75 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
+}
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    LoadBlockFileFrom(chainparams, fileIn, 0, dbp, nLoaded);
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
+int LoadExternalBlockFiles(const CChainParams& chainparams, const std::vector<CBlockImportFile>& vFiles, int nCheckThreads, int nReaders)
+{
+    CBlockImporter importer(chainparams, vFiles, nCheckThreads, nReaders);
+    int nTotal = 0;
+    for (size_t i = 0; i < vFiles.size(); i++) {
+        const CBlockImportFile& file = vFiles[i];
+        const bool fBlockFile = file.nFile >= 0;
+        if (fBlockFile)
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)file.nFile);
+        else
+            LogPrintf("Importing blocks file %s...\n", file.path.string());
+        int64_t nStart = GetTimeMillis();
+
+        int nLoaded = 0;
+        CBlockImporter::Item item;
+        while (importer.NextBlock(i, item)) {
+            boost::this_thread::interruption_point();
+
+            CDiskBlockPos pos = item.pos;
+            try {
+                if (item.pblock && !ImportBlock(chainparams, item.pblock, fBlockFile ? &pos : nullptr, nLoaded)) {
+                    importer.SkipFile(i);
+                    break;
+                }
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+            if (item.NeedsRescan()) {
+                // The record was not the size it claimed to be, so the records
+                // the readers found after it may be off. Go over the rest of
+                // the file one block at a time instead.
+                LogPrint(BCLog::REINDEX, "%s: Bad record at %u in %s, scanning the rest of the file again\n", __func__,
+                        item.nMagicPos, file.path.string());
+                importer.SkipFile(i);
+                FILE* fileIn = fsbridge::fopen(file.path, "rb");
+                if (fileIn)
+                    LoadBlockFileFrom(chainparams, fileIn, item.GetResumePos(), fBlockFile ? &pos : nullptr, nLoaded);
+                break;
+            }
+        }
+        if (importer.OpenFailed(i)) {
+            if (fBlockFile) {
+                LogPrintf("Unable to open file %s\n", file.path.string());
+                break;
+            }
+            LogPrintf("Warning: Could not open blocks file %s\n", file.path.string());
+        }
+
+        if (nLoaded > 0)
+            LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+        nTotal += nLoaded;
+    }
+    importer.LogStats(true);
+    return nTotal;
+}
+
 void static CheckBlockIndex(const Consensus::Params& consensusParams)
 {
     if (!fCheckBlockIndex) {
@@ -4401,7 +5092,44 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Version of mempool.dat written by DumpMempool */
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+/** Earlier format without chain tip and checksum, still read by LoadMempool */
+static const uint64_t MEMPOOL_DUMP_VERSION_NO_CHECKSUM = 1;
+/** Maximum number of transactions LoadMempool hands to the mempool at once */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 1000;
+
+/**
+ * Read the node-local secret that keys the mempool.dat and scriptcache.dat
+ * checksums, creating it if fCreate is set. Only a dump written by this node
+ * can carry a matching checksum, which is what makes -trustpersistedmempool
+ * and -persistscriptcache safe to use.
+ */
+static bool GetDumpKey(uint256& key, bool fCreate)
+{
+    const fs::path path = GetDataDir() / "mempool.key";
+    {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (!file.IsNull()) {
+            try {
+                file >> key;
+                return true;
+            } catch (const std::exception&) {
+                // Rewrite it below
+            }
+        }
+    }
+    if (!fCreate)
+        return false;
+
+    GetStrongRandBytes(key.begin(), key.size());
+    CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return false;
+    file << key;
+    FileCommit(file.Get());
+    return true;
+}
 
 bool LoadMempool(void)
 {
@@ -4419,36 +5147,42 @@ bool LoadMempool(void)
     int64_t skipped = 0;
     int64_t failed = 0;
     int64_t nNow = GetTime();
+    int64_t nStartTime = GetTimeMillis();
 
+    std::vector<CTransactionRef> vtx;
+    std::vector<int64_t> vTime;
+    uint256 hashBestBlock;
+    bool fTrusted = false;
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
+        if (version != MEMPOOL_DUMP_VERSION && version != MEMPOOL_DUMP_VERSION_NO_CHECKSUM) {
             return false;
         }
+        CHashVerifier<CAutoFile> verifier(&file);
+        uint256 key;
+        bool fHaveKey = version == MEMPOOL_DUMP_VERSION && GetDumpKey(key, false);
+        verifier << key;
+        if (version == MEMPOOL_DUMP_VERSION) {
+            verifier >> hashBestBlock;
+        }
         uint64_t num;
-        file >> num;
+        verifier >> num;
         while (num--) {
             CTransactionRef tx;
             int64_t nTime;
             int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
+            verifier >> tx;
+            verifier >> nTime;
+            verifier >> nFeeDelta;
 
             CAmount amountdelta = nFeeDelta;
             if (amountdelta) {
                 mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
             }
-            CValidationState state;
             if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, true, nullptr, nTime, nullptr, false, 0);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    ++failed;
-                }
+                vtx.push_back(tx);
+                vTime.push_back(nTime);
             } else {
                 ++skipped;
             }
@@ -4456,17 +5190,70 @@ bool LoadMempool(void)
                 return false;
         }
         std::map<uint256, CAmount> mapDeltas;
-        file >> mapDeltas;
+        verifier >> mapDeltas;
 
         for (const auto& i : mapDeltas) {
             mempool.PrioritiseTransaction(i.first, i.second);
         }
+
+        if (version == MEMPOOL_DUMP_VERSION) {
+            uint256 checksum = verifier.GetHash();
+            uint256 checksumOnDisk;
+            file >> checksumOnDisk;
+            fTrusted = fHaveKey && checksum == checksumOnDisk && gArgs.GetBoolArg("-trustpersistedmempool", DEFAULT_TRUST_PERSISTED_MEMPOOL);
+        }
     } catch (const std::exception& e) {
         LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
         return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    // The dump is in topological order, so cutting it wherever a transaction
+    // spends one already in the current batch leaves batches whose members
+    // are independent of each other, and can be script-checked together.
+    size_t nStart = 0;
+    while (nStart < vtx.size()) {
+        std::set<uint256> setBatch;
+        size_t nEnd = nStart;
+        while (nEnd < vtx.size() && nEnd - nStart < MEMPOOL_LOAD_BATCH_SIZE) {
+            bool fDependent = false;
+            for (const CTxIn& txin : vtx[nEnd]->vin) {
+                if (setBatch.count(txin.prevout.hash)) {
+                    fDependent = true;
+                    break;
+                }
+            }
+            if (fDependent)
+                break;
+            setBatch.insert(vtx[nEnd]->GetHash());
+            ++nEnd;
+        }
+        std::vector<CTransactionRef> vBatch(vtx.begin() + nStart, vtx.begin() + nEnd);
+        std::vector<int64_t> vBatchTime(vTime.begin() + nStart, vTime.begin() + nEnd);
+        nStart = nEnd;
+
+        std::vector<CValidationState> vState;
+        std::vector<bool> vMissingInputs;
+        std::vector<bool> vAccepted;
+        {
+            LOCK(cs_main);
+            // Scripts were checked when the dump was written; that still holds
+            // as long as we are on the same tip.
+            bool fSkipScriptChecks = fTrusted && chainActive.Tip() && chainActive.Tip()->GetBlockHash() == hashBestBlock;
+            vAccepted = AcceptToMemoryPoolBatchWorker(chainparams, mempool, vBatch, vBatchTime, true, fSkipScriptChecks, vState, vMissingInputs, nullptr);
+        }
+        for (bool fAccepted : vAccepted) {
+            if (fAccepted) {
+                ++count;
+            } else {
+                ++failed;
+            }
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired (%s, %dms)\n",
+        count, failed, skipped, fTrusted ? "trusted" : "verified", GetTimeMillis() - nStartTime);
     return true;
 }
 
@@ -4476,13 +5263,17 @@ void DumpMempool(void)
 
     std::map<uint256, CAmount> mapDeltas;
     std::vector<TxMempoolInfo> vinfo;
+    uint256 hashBestBlock;
 
     {
-        LOCK(mempool.cs);
+        LOCK2(cs_main, mempool.cs);
         for (const auto &i : mempool.mapDeltas) {
             mapDeltas[i.first] = i.second;
         }
+        // Sorted by depth, so parents always precede their children.
         vinfo = mempool.infoAll();
+        if (chainActive.Tip())
+            hashBestBlock = chainActive.Tip()->GetBlockHash();
     }
 
     int64_t mid = GetTimeMicros();
@@ -4498,15 +5289,30 @@ void DumpMempool(void)
         uint64_t version = MEMPOOL_DUMP_VERSION;
         file << version;
 
+        // Everything after the version is covered by a checksum keyed with
+        // our own secret; without one the dump is simply never trusted.
+        uint256 key;
+        GetDumpKey(key, true);
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        hasher << key;
+
+        file << hashBestBlock;
+        hasher << hashBestBlock;
         file << (uint64_t)vinfo.size();
+        hasher << (uint64_t)vinfo.size();
         for (const auto& i : vinfo) {
             file << *(i.tx);
+            hasher << *(i.tx);
             file << (int64_t)i.nTime;
+            hasher << (int64_t)i.nTime;
             file << (int64_t)i.nFeeDelta;
+            hasher << (int64_t)i.nFeeDelta;
             mapDeltas.erase(i.tx->GetHash());
         }
 
         file << mapDeltas;
+        hasher << mapDeltas;
+        file << hasher.GetHash();
         FileCommit(file.Get());
         file.fclose();
         RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
@@ -4517,6 +5323,433 @@ void DumpMempool(void)
     }
 }
 
+/** Version of scriptcache.dat written by DumpScriptCaches */
+static const uint64_t SCRIPT_CACHE_DUMP_VERSION = 2;
+
+bool LoadScriptCaches()
+{
+    int64_t nStart = GetTimeMillis();
+    CAutoFile file(fsbridge::fopen(GetDataDir() / "scriptcache.dat", "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open script cache file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    uint256 nonceSig, nonceScript;
+    std::vector<uint256> vSig, vScript;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != SCRIPT_CACHE_DUMP_VERSION) {
+            return false;
+        }
+        // Entries only vouch for the checks of the software and the script
+        // verification flags that made them.
+        int nClientVersion;
+        unsigned int nScriptVerifyFlags;
+        file >> nClientVersion >> nScriptVerifyFlags;
+        if (nClientVersion != CLIENT_VERSION || nScriptVerifyFlags != STANDARD_SCRIPT_VERIFY_FLAGS) {
+            LogPrintf("Script cache file was written by another version or with other script verification flags. Continuing anyway.\n");
+            return false;
+        }
+        // An entry tells us to skip a check, so unlike a mempool dump, one we
+        // cannot authenticate is of no use at all.
+        uint256 key;
+        if (!GetDumpKey(key, false)) {
+            LogPrintf("No key to verify the script cache file with. Continuing anyway.\n");
+            return false;
+        }
+        CHashVerifier<CAutoFile> verifier(&file);
+        verifier << key << std::string("scriptcache") << nClientVersion << nScriptVerifyFlags;
+        verifier >> nonceSig >> vSig >> nonceScript >> vScript;
+        uint256 checksumOnDisk;
+        file >> checksumOnDisk;
+        if (checksumOnDisk != verifier.GetHash()) {
+            LogPrintf("Script cache file has a bad checksum. Continuing anyway.\n");
+            return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize script cache data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LoadSignatureCacheEntries(nonceSig, vSig);
+    {
+        LOCK(cs_main);
+        scriptExecutionCacheNonce = nonceScript;
+        for (const uint256& entry : vScript)
+            scriptExecutionCache.insert(entry);
+    }
+    LogPrintf("Imported %u signature cache and %u script execution cache entries from disk (%dms)\n",
+        vSig.size(), vScript.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+void DumpScriptCaches()
+{
+    int64_t nStart = GetTimeMillis();
+
+    uint256 nonceSig, nonceScript;
+    std::vector<uint256> vSig, vScript;
+    GetSignatureCacheEntries(nonceSig, vSig);
+    {
+        LOCK(cs_main);
+        nonceScript = scriptExecutionCacheNonce;
+        scriptExecutionCache.get_live(vScript);
+    }
+
+    uint256 key;
+    if (!GetDumpKey(key, true)) {
+        LogPrintf("Failed to dump script caches: no key to protect them with. Continuing anyway.\n");
+        return;
+    }
+
+    try {
+        FILE* filestr = fsbridge::fopen(GetDataDir() / "scriptcache.dat.new", "wb");
+        if (!filestr) {
+            return;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        file << SCRIPT_CACHE_DUMP_VERSION;
+        file << CLIENT_VERSION << STANDARD_SCRIPT_VERIFY_FLAGS;
+
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        hasher << key << std::string("scriptcache") << CLIENT_VERSION << STANDARD_SCRIPT_VERIFY_FLAGS;
+
+        file << nonceSig << vSig << nonceScript << vScript;
+        hasher << nonceSig << vSig << nonceScript << vScript;
+        file << hasher.GetHash();
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "scriptcache.dat.new", GetDataDir() / "scriptcache.dat");
+        LogPrintf("Dumped %u signature cache and %u script execution cache entries (%dms)\n",
+            vSig.size(), vScript.size(), GetTimeMillis() - nStart);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump script caches: %s. Continuing anyway.\n", e.what());
+    }
+}
+
+/** Version of the UTXO snapshot files written by DumpUTXOSnapshot */
+static const uint64_t UTXO_SNAPSHOT_VERSION = 1;
+
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
+    stats.nTransactions++;
+    for (const auto output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out.scriptPubKey;
+        ss << VARINT(output.second.out.nValue);
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += output.second.out.nValue;
+        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        stats.digest.Insert(COutPoint(hash, output.first), output.second);
+    }
+    ss << VARINT(0);
+}
+
+/**
+ * Walk the coins under pcursor one transaction at a time, accumulating
+ * stats as of hashBlock. fnGroup, if given, also sees every transaction.
+ */
+static bool ScanUTXOSet(CCoinsViewCursor* pcursor, const uint256& hashBlock, CCoinsStats& stats,
+                        const std::function<void(const uint256&, const std::map<uint32_t, Coin>&)>& fnGroup)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    stats.hashBlock = hashBlock;
+    stats.digest.hashBlock = hashBlock;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+        if (it == mapBlockIndex.end())
+            return error("%s: unknown best block %s", __func__, stats.hashBlock.ToString());
+        stats.nHeight = it->second->nHeight;
+    }
+    ss << stats.hashBlock;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                if (fnGroup) fnGroup(prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+        if (fnGroup) fnGroup(prevkey, outputs);
+    }
+    stats.hashSerialized = ss.GetHash();
+    return true;
+}
+
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+{
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    if (!GetUTXOStats(pcursor.get(), stats))
+        return false;
+    stats.nDiskSize = view->EstimateSize();
+    return true;
+}
+
+bool GetUTXOStats(CCoinsViewCursor *pcursor, CCoinsStats &stats)
+{
+    return ScanUTXOSet(pcursor, pcursor->GetBestBlock(), stats, nullptr);
+}
+
+bool InitCoinsTipDigest()
+{
+    LOCK(cs_main);
+    const uint256 hashBestBlock = pcoinsTip->GetBestBlock();
+    coinsTipDigest = CCoinsSetDigest();
+    if (hashBestBlock.IsNull())
+        return true;
+    if (pcoinsdbview->ReadDigest(coinsTipDigest) && coinsTipDigest.hashBlock == hashBestBlock)
+        return true;
+
+    // Nothing stored for this block, e.g. after a replay or on a database
+    // from an older version: scan it once. pcoinsTip is still unmodified.
+    LogPrintf("Computing the UTXO set digest at %s...\n", hashBestBlock.ToString());
+    int64_t nStart = GetTimeMillis();
+    CCoinsStats stats;
+    if (!GetUTXOStats(pcoinsdbview, stats) || stats.hashBlock != hashBestBlock) {
+        coinsTipDigest = CCoinsSetDigest();
+        return error("%s: unable to scan the coins database", __func__);
+    }
+    coinsTipDigest = stats.digest;
+    LogPrintf("Computed the UTXO set digest in %dms\n", GetTimeMillis() - nStart);
+    return true;
+}
+
+/*
+ * Snapshot file layout:
+ *   uint64 version, network magic, uint256 base block hash
+ *   per transaction: VARINT(number of outputs), txid, then VARINT(n) and
+ *     the Coin for each output
+ *   VARINT(0)
+ *   uint64 transactions, uint64 outputs, uint256 hash_serialized_2
+ * Transactions appear in coins database key order.
+ */
+bool DumpUTXOSnapshot(const fs::path& path, CCoinsStats& stats, std::string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    if (fs::exists(path)) {
+        strError = path.string() + " already exists";
+        return false;
+    }
+    const fs::path pathTmp = path.string() + ".incomplete";
+    FILE* filestr = fsbridge::fopen(pathTmp, "wb");
+    if (!filestr) {
+        strError = "Unable to open " + pathTmp.string() + " for writing";
+        return false;
+    }
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    {
+        LOCK(cs_main);
+        // The database iterator is a point-in-time view, so once the tip is
+        // on disk new blocks can come in while we write.
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+    }
+
+    try {
+        file << UTXO_SNAPSHOT_VERSION;
+        file.write((const char*)Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE);
+        file << pcursor->GetBestBlock();
+        bool fScanned = ScanUTXOSet(pcursor.get(), pcursor->GetBestBlock(), stats,
+            [&file](const uint256& hash, const std::map<uint32_t, Coin>& outputs) {
+                uint64_t nOutputs = outputs.size();
+                file << VARINT(nOutputs);
+                file << hash;
+                for (const auto& output : outputs) {
+                    file << VARINT(output.first);
+                    file << output.second;
+                }
+            });
+        if (!fScanned) {
+            strError = "Unable to read UTXO set";
+        } else {
+            uint64_t nEnd = 0;
+            file << VARINT(nEnd);
+            file << stats.nTransactions;
+            file << stats.nTransactionOutputs;
+            file << stats.hashSerialized;
+            FileCommit(file.Get());
+            file.fclose();
+            if (RenameOver(pathTmp, path)) {
+                LogPrintf("Dumped UTXO snapshot of %u coins at %s to %s (%dms)\n", stats.nTransactionOutputs,
+                    stats.hashBlock.ToString(), path.string(), GetTimeMillis() - nStart);
+                return true;
+            }
+            strError = "Unable to rename " + pathTmp.string() + " to " + path.string();
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Unable to write UTXO snapshot: %s", e.what());
+    }
+    file.fclose();
+    fs::remove(pathTmp);
+    return false;
+}
+
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, const uint256& hashExpected, CCoinsViewDB* view, std::string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    {
+        std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+        if (!view->GetBestBlock().IsNull() || pcursor->Valid()) {
+            strError = "the chainstate database is not empty";
+            return false;
+        }
+    }
+
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = "unable to open " + path.string();
+        return false;
+    }
+
+    const size_t nBatchSize = (size_t)gArgs.GetArg("-dbbatchsize", nDefaultDbBatchSize);
+    CCoinsStats stats;
+    uint256 hashBase;
+    try {
+        // The hash the snapshot ends with is checked against its contents
+        // below; refuse one for another set before writing any coins.
+        uint256 hashSerializedClaimed;
+        if (fseek(file.Get(), -(long)hashSerializedClaimed.size(), SEEK_END) != 0) {
+            strError = "the snapshot is truncated";
+            return false;
+        }
+        file >> hashSerializedClaimed;
+        if (hashSerializedClaimed != hashExpected) {
+            strError = strprintf("the snapshot's hash %s is not the expected %s", hashSerializedClaimed.ToString(), hashExpected.ToString());
+            return false;
+        }
+        if (fseek(file.Get(), 0, SEEK_SET) != 0) {
+            strError = "unable to read " + path.string();
+            return false;
+        }
+
+        uint64_t version;
+        file >> version;
+        if (version != UTXO_SNAPSHOT_VERSION) {
+            strError = strprintf("unsupported snapshot version %u", version);
+            return false;
+        }
+        unsigned char pchMessageStart[CMessageHeader::MESSAGE_START_SIZE];
+        file.read((char*)pchMessageStart, sizeof(pchMessageStart));
+        if (memcmp(pchMessageStart, chainparams.MessageStart(), sizeof(pchMessageStart)) != 0) {
+            strError = "the snapshot is for a different network";
+            return false;
+        }
+        file >> hashBase;
+        {
+            LOCK(cs_main);
+            BlockMap::const_iterator it = mapBlockIndex.find(hashBase);
+            if (it == mapBlockIndex.end() || it->second->nChainTx == 0) {
+                strError = strprintf("the block data up to the snapshot's base block %s is not available", hashBase.ToString());
+                return false;
+            }
+            stats.nHeight = it->second->nHeight;
+        }
+        LogPrintf("Loading UTXO snapshot at %s (height %d)\n", hashBase.ToString(), stats.nHeight);
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << hashBase;
+        std::vector<std::pair<COutPoint, Coin> > vCoins;
+        size_t nBatchBytes = 0;
+        while (true) {
+            uint64_t nOutputs;
+            file >> VARINT(nOutputs);
+            if (nOutputs == 0)
+                break;
+            uint256 hash;
+            file >> hash;
+            std::map<uint32_t, Coin> outputs;
+            while (outputs.size() < nOutputs) {
+                uint32_t n;
+                Coin coin;
+                file >> VARINT(n);
+                file >> coin;
+                if (!outputs.emplace(n, std::move(coin)).second) {
+                    strError = strprintf("duplicate output %s:%u in snapshot", hash.ToString(), n);
+                    return false;
+                }
+            }
+            ApplyStats(stats, ss, hash, outputs);
+            for (auto& output : outputs) {
+                nBatchBytes += 48 + output.second.out.scriptPubKey.size();
+                vCoins.emplace_back(COutPoint(hash, output.first), std::move(output.second));
+            }
+            if (nBatchBytes >= nBatchSize) {
+                if (!view->WriteSnapshotCoins(vCoins, hashBase, false)) {
+                    strError = "failed to write to the chainstate database";
+                    return false;
+                }
+                vCoins.clear();
+                nBatchBytes = 0;
+                if (ShutdownRequested()) {
+                    strError = "interrupted";
+                    return false;
+                }
+            }
+        }
+        if (!view->WriteSnapshotCoins(vCoins, hashBase, false)) {
+            strError = "failed to write to the chainstate database";
+            return false;
+        }
+
+        uint64_t nTransactions, nTransactionOutputs;
+        uint256 hashSerialized;
+        file >> nTransactions;
+        file >> nTransactionOutputs;
+        file >> hashSerialized;
+        stats.hashSerialized = ss.GetHash();
+        if (stats.nTransactions != nTransactions || stats.nTransactionOutputs != nTransactionOutputs || stats.hashSerialized != hashSerialized || hashSerialized != hashExpected) {
+            strError = "the snapshot contents do not match its checksum";
+            return false;
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("failed to read the snapshot: %s", e.what());
+        return false;
+    }
+
+    // Check what actually ended up in the database before declaring it
+    // consistent with the base block.
+    CCoinsStats statsLoaded;
+    {
+        std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+        if (!ScanUTXOSet(pcursor.get(), hashBase, statsLoaded, nullptr) || statsLoaded.hashSerialized != stats.hashSerialized) {
+            strError = "the loaded UTXO set does not match the snapshot";
+            return false;
+        }
+    }
+    view->SetPendingDigest(statsLoaded.digest);
+    if (!view->WriteSnapshotCoins(std::vector<std::pair<COutPoint, Coin> >(), hashBase, true)) {
+        strError = "failed to write to the chainstate database";
+        return false;
+    }
+
+    LogPrintf("Loaded UTXO snapshot: %u coins, hash %s (%dms)\n", stats.nTransactionOutputs,
+        stats.hashSerialized.ToString(), GetTimeMillis() - nStart);
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, CBlockIndex *pindex) {
     if (pindex == nullptr)
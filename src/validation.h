@@ -32,10 +32,14 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+struct CBlockImportFile;
 class CChainParams;
+class CCoinsPrefetcher;
+class CCoinsViewBackgroundFlush;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
+struct CDeferredSignature;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
@@ -77,11 +81,20 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 64;
+/** Loose transactions with at least this many inputs have their scripts checked on the script-check threads */
+static const unsigned int MIN_PARALLEL_MEMPOOL_SCRIPT_INPUTS = 8;
+/** Blocks with at least this many transactions have them checked on the block transaction check threads */
+static const size_t MIN_PARALLEL_BLOCK_CHECK_TXS = 64;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Upper bound for the per-peer in-flight allowance, which grows above MAX_BLOCKS_IN_TRANSIT_PER_PEER
+ *  to cover the measured bandwidth-delay product of fast peers. */
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 128;
+/** Minimum time (in microseconds) a block must be in flight before it may be reassigned from a stalling peer to a faster one. */
+static const int64_t BLOCK_REASSIGN_MIN_AGE = 1000000;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -97,6 +110,8 @@ static const int MAX_BLOCKTXN_DEPTH = 10;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Upper bound for the download window when it is widened to keep all in-flight allowances busy. */
+static const unsigned int MAX_BLOCK_DOWNLOAD_WINDOW = 8192;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -131,8 +146,16 @@ static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
+/** Default for -batchverify */
+static const bool DEFAULT_BATCH_VERIFY = false;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -persistscriptcache */
+static const bool DEFAULT_PERSIST_SCRIPT_CACHE = true;
+/** Default for -compactundo */
+static const bool DEFAULT_COMPACT_UNDO = false;
+/** Default for -trustpersistedmempool */
+static const bool DEFAULT_TRUST_PERSISTED_MEMPOOL = false;
 /** Default for -mempoolreplacement */
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
@@ -173,6 +196,10 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Whether block script checks verify their signatures in batches, see VerifyScriptChecksBatched */
+extern bool fBatchVerify;
+/** Whether to write undo data in the compact format */
+extern bool fCompactUndo;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -259,6 +286,8 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/** Import blocks from several files in order, reading and checking them ahead on other threads. Returns the number of blocks loaded. */
+int LoadExternalBlockFiles(const CChainParams& chainparams, const std::vector<CBlockImportFile>& vFiles, int nCheckThreads, int nReaders);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -270,6 +299,8 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread checking the transactions of large blocks in CheckBlock */
+void ThreadBlockTxCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -306,6 +337,20 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced = nullptr,
                         bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/** (try to) add a batch of transactions to memory pool
+ * Transactions that don't depend on, conflict with or replace anything else
+ * are pre-checked one at a time, have their scripts verified together on the
+ * script-check threads and are then added in order; the remaining ones go
+ * through AcceptToMemoryPool afterwards. vState and vMissingInputs receive
+ * the per-transaction results; the returned vector tells which were accepted.
+ * The mempool is trimmed once after the batch rather than after every member.
+ * cs_main must be held; the mempool stays locked for the staged members from
+ * their pre-checks to their commit, so the batch is accepted as a whole.
+ * plTxnReplaced will be appended to with all transactions replaced from mempool **/
+std::vector<bool> AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, bool fLimitFree,
+                                          std::vector<CValidationState>& vState, std::vector<bool>& vMissingInputs,
+                                          std::list<CTransactionRef>* plTxnReplaced = nullptr);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -376,6 +421,14 @@ public:
     bool operator()();
     bool checkScript(std::stringstream* extraErrorStream);
 
+    /**
+     * Run the script, adding the signature checks the signature cache cannot
+     * answer to batch rather than verifying them (see
+     * BatchingTransactionSignatureChecker). Returns false if the check has to
+     * be run again to tell its result.
+     */
+    bool RunDeferred(std::vector<CDeferredSignature>& batch);
+
     void swap(CScriptCheck &check) {
         scriptPubKey.swap(check.scriptPubKey);
         std::swap(ptxTo, check.ptxTo);
@@ -390,13 +443,24 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Run a batch of script checks, returning whether they all pass. With fBatch,
+ * the signatures of all of them are verified together, and only checks whose
+ * result that leaves open are run again one by one.
+ */
+bool VerifyScriptChecksBatched(std::vector<CScriptCheck>& vChecks, bool fBatch);
+
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
 
-/** Functions for disk access for blocks */
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Functions for disk access for blocks. Without fCheckPOW, the Equihash
+ * solution and proof of work of the block read are not checked again, for
+ * readers that only trust it because the block index does.
+ */
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW = true);
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fCheckPOW = true);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -447,9 +511,21 @@ extern CChain chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern CCoinsViewDB *pcoinsdbview;
 
+/** Global variable that points to the view writing pcoinsTip to pcoinsdbview (protected by cs_main) */
+extern CCoinsViewBackgroundFlush *pcoinsflusher;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Looks up block inputs for pcoinsTip ahead of ConnectBlock, if enabled (protected by cs_main) */
+extern CCoinsPrefetcher *pcoinsPrefetcher;
+
+/** Rolling digest of the UTXO set, kept up to date as blocks are (dis)connected (protected by cs_main) */
+extern CCoinsSetDigest coinsTipDigest;
+
+/** Set coinsTipDigest for pcoinsTip's best block, from disk or by scanning the coins database. */
+bool InitCoinsTipDigest();
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -484,4 +560,46 @@ void DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Save the signature and script execution caches, with their salts, to disk. */
+void DumpScriptCaches();
+
+/** Load the signature and script execution caches from disk, if this node saved them. */
+bool LoadScriptCaches();
+
+/** Statistics about the unspent transaction output set */
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+    CCoinsSetDigest digest;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
+};
+
+/** Calculate statistics about the unspent transaction output set */
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats);
+/** Same for the coins under a cursor, which pins the point in time; leaves nDiskSize alone */
+bool GetUTXOStats(CCoinsViewCursor *pcursor, CCoinsStats &stats);
+
+/**
+ * Write the UTXO set at the current tip to a snapshot file. Fills in stats
+ * with what was written; hashSerialized matches gettxoutsetinfo.
+ */
+bool DumpUTXOSnapshot(const fs::path& path, CCoinsStats& stats, std::string& strError);
+
+/**
+ * Fill an empty coins database from a snapshot written by DumpUTXOSnapshot.
+ * The snapshot's base block must be in the block index with its data, and
+ * the loaded set must hash to hashExpected, as well as to what the snapshot
+ * says, or nothing is committed. A snapshot that says it hashes to anything
+ * else is refused before it is read.
+ */
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, const uint256& hashExpected, CCoinsViewDB* view, std::string& strError);
+
 #endif // FABCOIN_VALIDATION_H
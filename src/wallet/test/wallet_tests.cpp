@@ -6,11 +6,14 @@
 
 #include <set>
 #include <stdint.h>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "chainparams.h"
 #include "consensus/validation.h"
 #include "rpc/server.h"
+#include "script/sign.h"
 #include "test/test_fabcoin.h"
 #include "validation.h"
 #include "wallet/coincontrol.h"
@@ -24,6 +27,7 @@ extern CWallet* pwalletMain;
 extern UniValue importmulti(const JSONRPCRequest& request);
 extern UniValue dumpwallet(const JSONRPCRequest& request);
 extern UniValue importwallet(const JSONRPCRequest& request);
+extern UniValue importpubkey(const JSONRPCRequest& request);
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -386,7 +390,9 @@ BOOST_FIXTURE_TEST_CASE(rescan, TestChain800Setup)
     {
         CWallet wallet;
         AddKey(wallet, coinbaseKey);
-        BOOST_CHECK_EQUAL(nullBlock, wallet.ScanForWalletTransactions(oldTip));
+        WalletRescanReserver reserver(&wallet);
+        reserver.Reserve();
+        BOOST_CHECK_EQUAL(nullBlock, wallet.ScanForWalletTransactions(oldTip, reserver));
         BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), 50 * COIN);
     }
 
@@ -399,7 +405,9 @@ BOOST_FIXTURE_TEST_CASE(rescan, TestChain800Setup)
     {
         CWallet wallet;
         AddKey(wallet, coinbaseKey);
-        BOOST_CHECK_EQUAL(oldTip, wallet.ScanForWalletTransactions(oldTip));
+        WalletRescanReserver reserver(&wallet);
+        reserver.Reserve();
+        BOOST_CHECK_EQUAL(oldTip, wallet.ScanForWalletTransactions(oldTip, reserver));
         BOOST_CHECK_EQUAL(wallet.GetImmatureBalance(), 25 * COIN);
     }
 
@@ -502,6 +510,88 @@ BOOST_FIXTURE_TEST_CASE(importwallet_rescan, TestChain800Setup)
     vpwallets.erase(vpwallets.begin());
 }
 
+// Verify that only one of several imports racing to rescan the wallet gets
+// to, and that an import fails, rather than leave its keys unscanned, while
+// another rescan holds the wallet.
+BOOST_AUTO_TEST_CASE(rescan_concurrent_import)
+{
+    CWallet wallet;
+
+    const int nThreads = 8;
+    std::atomic<int> nTried(0);
+    std::atomic<int> nReserved(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back([&] {
+            WalletRescanReserver reserver(&wallet);
+            if (reserver.Reserve())
+                nReserved++;
+            // Hold on to the reservation until every thread has tried.
+            nTried++;
+            while (nTried < nThreads)
+                std::this_thread::yield();
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    BOOST_CHECK_EQUAL(nReserved, 1);
+    BOOST_CHECK(!wallet.IsScanning());
+
+    WalletRescanReserver reserver(&wallet);
+    BOOST_REQUIRE(reserver.Reserve());
+    vpwallets.insert(vpwallets.begin(), &wallet);
+    CKey key;
+    key.MakeNewKey(true);
+    JSONRPCRequest request;
+    request.params.setArray();
+    request.params.push_back(HexStr(key.GetPubKey()));
+    BOOST_CHECK_THROW(::importpubkey(request), UniValue);
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK(!wallet.HaveWatchOnly(GetScriptForRawPubKey(key.GetPubKey())));
+    }
+    vpwallets.erase(vpwallets.begin());
+}
+
+// Verify that a rescan that finds a block it read ahead disconnected skips
+// it, goes on along the active chain from where it forked off, and does not
+// report the block as one it failed to scan.
+BOOST_FIXTURE_TEST_CASE(rescan_reorg, TestChain800Setup)
+{
+    LOCK(cs_main);
+
+    CBlockIndex* const nullBlock = nullptr;
+    CBlockIndex* const pindexStale = chainActive[2];
+    uint256 hashNewCoinbase;
+    bool fReorged = false;
+
+    CWallet wallet;
+    AddKey(wallet, coinbaseKey);
+    // Block 1 pays to the wallet first. While the wallet is updated with it,
+    // disconnect block 2, which has been read already, and mine another
+    // block, paying to the same key differently, in its place.
+    wallet.NotifyTransactionChanged.connect([&](CWallet*, const uint256&, ChangeType) {
+        if (fReorged)
+            return;
+        fReorged = true;
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), pindexStale));
+        hashNewCoinbase = CreateAndProcessBlock({}, GetScriptForDestination(coinbaseKey.GetPubKey().GetID())).vtx[0]->GetHash();
+    });
+
+    WalletRescanReserver reserver(&wallet);
+    reserver.Reserve();
+    BOOST_CHECK_EQUAL(nullBlock, wallet.ScanForWalletTransactions(chainActive.Genesis(), reserver));
+    BOOST_CHECK(fReorged);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 2);
+
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 2U);
+    BOOST_CHECK(wallet.GetWalletTx(coinbaseTxns[0].GetHash()));
+    BOOST_CHECK(wallet.GetWalletTx(hashNewCoinbase));
+    BOOST_CHECK(!wallet.GetWalletTx(coinbaseTxns[1].GetHash()));
+}
+
 // Check that GetImmatureCredit() returns a newly calculated value instead of
 // the cached value after a MarkDirty() call.
 //
@@ -604,7 +694,9 @@ public:
         bool firstRun;
         wallet->LoadWallet(firstRun);
         AddKey(*wallet, coinbaseKey);
-        wallet->ScanForWalletTransactions(chainActive.Genesis());
+        WalletRescanReserver reserver(wallet.get());
+        reserver.Reserve();
+        wallet->ScanForWalletTransactions(chainActive.Genesis(), reserver);
     }
 
     ~ListCoinsTestingSetup()
@@ -680,4 +772,127 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2);
 }
 
+BOOST_FIXTURE_TEST_CASE(wallet_utxo_index, ListCoinsTestingSetup)
+{
+    LOCK2(cs_main, wallet->cs_wallet);
+
+    // Paying a key the wallet does not have leaves the change as its only
+    // coin, with the spent coinbase output gone.
+    CKey key;
+    key.MakeNewKey(true);
+    AddTx(CRecipient{GetScriptForRawPubKey(key.GetPubKey()), 1 * COIN, false /* subtract fee */});
+    std::vector<COutput> available;
+    wallet->AvailableCoins(available);
+    BOOST_CHECK_EQUAL(available.size(), 1);
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), wallet->GetAvailableBalance());
+
+    // Once the key is added, the output to it is a coin as well, without a
+    // rescan.
+    AddKey(*wallet, key);
+    wallet->AvailableCoins(available);
+    BOOST_CHECK_EQUAL(available.size(), 2);
+}
+
+// Check that the index of unspent outputs, which is kept up to date as
+// transactions change state, is what building it from scratch gives.
+BOOST_FIXTURE_TEST_CASE(wallet_utxo_index_updates, ListCoinsTestingSetup)
+{
+    LOCK2(cs_main, wallet->cs_wallet);
+    BOOST_CHECK(wallet->CheckWalletUtxos());
+
+    CKey key;
+    key.MakeNewKey(true);
+    auto CommitTx = [&]() {
+        CWalletTx wtx;
+        CReserveKey reservekey(wallet.get());
+        CAmount fee;
+        int changePos = -1;
+        std::string error;
+        CCoinControl dummy;
+        BOOST_CHECK(wallet->CreateTransaction({CRecipient{GetScriptForRawPubKey(key.GetPubKey()), 1 * COIN, false /* subtract fee */}}, wtx, reservekey, fee, changePos, error, dummy));
+        CValidationState state;
+        BOOST_CHECK(wallet->CommitTransaction(wtx, reservekey, nullptr, state));
+        return wtx.GetHash();
+    };
+
+    // A spend that is in neither a block nor the mempool, abandoned.
+    const uint256 hashAbandoned = CommitTx();
+    BOOST_CHECK(wallet->CheckWalletUtxos());
+    BOOST_CHECK(wallet->AbandonTransaction(hashAbandoned));
+    BOOST_CHECK(wallet->CheckWalletUtxos());
+    BOOST_CHECK_EQUAL(wallet->GetAvailableBalance(), 25 * COIN);
+
+    // A spend that a block conflicts with.
+    const CWalletTx& wtxSpend = wallet->mapWallet.at(CommitTx());
+    const COutPoint& prevout = wtxSpend.tx->vin[0].prevout;
+    CMutableTransaction txConflict;
+    txConflict.vin.emplace_back(prevout);
+    txConflict.vout.emplace_back(24 * COIN, GetScriptForRawPubKey(key.GetPubKey()));
+    BOOST_CHECK(SignSignature(*wallet, *wallet->mapWallet.at(prevout.hash).tx, txConflict, 0, SIGHASH_ALL));
+    CBlock block = CreateAndProcessBlock({txConflict}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    wallet->BlockConnected(std::make_shared<const CBlock>(block), chainActive.Tip(), {});
+    BOOST_CHECK(wallet->GetWalletTx(txConflict.GetHash()));
+    BOOST_CHECK(wtxSpend.GetDepthInMainChain() < 0);
+    BOOST_CHECK(wallet->CheckWalletUtxos());
+
+    // The block disconnected again.
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+    wallet->BlockDisconnected(std::make_shared<const CBlock>(block));
+    BOOST_CHECK(wallet->CheckWalletUtxos());
+
+    // The conflicting spend zapped.
+    std::vector<uint256> vHashIn{txConflict.GetHash()};
+    std::vector<uint256> vHashOut;
+    BOOST_CHECK_EQUAL(wallet->ZapSelectTx(vHashIn, vHashOut), DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(vHashOut.size(), 1U);
+    BOOST_CHECK(wallet->CheckWalletUtxos());
+}
+
+
+// Check that outputs of transactions the wallet already has become coins
+// when a rescan derives the keys they pay to, as it does for a restored HD
+// wallet.
+BOOST_FIXTURE_TEST_CASE(wallet_utxo_index_derived_keys, ListCoinsTestingSetup)
+{
+    LOCK2(cs_main, wallet->cs_wallet);
+    BOOST_CHECK(wallet->SetHDMasterKey(wallet->GenerateNewHDMasterKey()));
+    wallet->TopUpKeyPool();
+
+    // The external key a few places past the ones derived so far, at
+    // m/0'/0'/<n>' like CWallet::DeriveNewChildKey.
+    const uint32_t nHardened = 0x80000000;
+    CKey masterSeed;
+    BOOST_CHECK(wallet->GetKey(wallet->GetHDChain().masterKeyID, masterSeed));
+    CExtKey masterKey, accountKey, chainKey, futureKey;
+    masterKey.SetMaster(masterSeed.begin(), masterSeed.size());
+    masterKey.Derive(accountKey, nHardened);
+    accountKey.Derive(chainKey, nHardened);
+    chainKey.Derive(futureKey, (wallet->GetHDChain().nExternalChainCounter + 10) | nHardened);
+    const CPubKey futurePubKey = futureKey.key.GetPubKey();
+    BOOST_CHECK(!wallet->HaveKey(futurePubKey.GetID()));
+
+    // Pay it; the wallet has the transaction, as it spent a coin of its own,
+    // but not the key yet.
+    const CWalletTx& wtx = AddTx(CRecipient{GetScriptForDestination(futurePubKey.GetID()), 1 * COIN, false /* subtract fee */});
+    std::vector<COutput> available;
+    wallet->AvailableCoins(available);
+    BOOST_CHECK_EQUAL(available.size(), 1);
+
+    // A rescan tops up the keypool far enough to derive the key.
+    {
+        WalletRescanReserver reserver(wallet.get());
+        BOOST_CHECK(reserver.Reserve());
+        wallet->TopUpKeyPool(wallet->GetKeyPoolSize() + 20);
+    }
+    BOOST_CHECK(wallet->HaveKey(futurePubKey.GetID()));
+    BOOST_CHECK(wallet->CheckWalletUtxos());
+    wallet->AvailableCoins(available);
+    BOOST_CHECK_EQUAL(available.size(), 2);
+    bool fFound = false;
+    for (const COutput& out : available)
+        fFound |= out.tx == &wtx && wtx.tx->vout[out.i].scriptPubKey == GetScriptForDestination(futurePubKey.GetID());
+    BOOST_CHECK(fFound);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -36,6 +36,12 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/thread.hpp>
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 std::vector<CWalletRef> vpwallets;
 /** Transaction fee set by the user */
 CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
@@ -219,6 +225,7 @@ bool CWallet::AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& secret, const
         return false;
     }
     if (needsDB) pwalletdbEncryption = nullptr;
+    nKeystoreChanges++;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -242,7 +249,9 @@ bool CWallet::AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& secret, const
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 {
     CWalletDB walletdb(*dbw);
-    return CWallet::AddKeyPubKeyWithDB(walletdb, secret, pubkey);
+    const bool fAdded = CWallet::AddKeyPubKeyWithDB(walletdb, secret, pubkey);
+    MarkWalletUtxosStale();
+    return fAdded;
 }
 
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
@@ -250,6 +259,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    nKeystoreChanges++;
     {
         LOCK(cs_wallet);
         if (pwalletdbEncryption)
@@ -296,6 +306,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    nKeystoreChanges++;
+    MarkWalletUtxosStale();
     return CWalletDB(*dbw).WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
@@ -319,6 +331,8 @@ bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    nKeystoreChanges++;
+    MarkWalletUtxosStale();
     const CKeyMetadata& meta = mapKeyMetadata[CScriptID(dest)];
     UpdateTimeFirstKey(meta.nCreateTime);
     NotifyWatchonlyChanged(true);
@@ -611,6 +625,88 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+bool CWallet::IsWalletUtxo(const CWalletTx& wtx, unsigned int n) const
+{
+    if (IsMine(wtx.tx->vout[n]) == ISMINE_NO)
+        return false;
+    std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(COutPoint(wtx.GetHash(), n));
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+    {
+        // A spend that is in a block, or is in none and not abandoned, has a
+        // depth of at least 0 wherever the chain goes.
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && !mit->second.isAbandoned() && (mit->second.hashBlock.IsNull() || mit->second.nIndex >= 0))
+            return false;
+    }
+    return true;
+}
+
+void CWallet::UpdateWalletUtxo(const COutPoint& outpoint)
+{
+    std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(outpoint.hash);
+    if (mit == mapWallet.end() || outpoint.n >= mit->second.tx->vout.size())
+        return;
+    if (IsWalletUtxo(mit->second, outpoint.n)) {
+        mapWalletUtxos[outpoint.hash].insert(outpoint.n);
+    } else {
+        auto it = mapWalletUtxos.find(outpoint.hash);
+        if (it != mapWalletUtxos.end()) {
+            it->second.erase(outpoint.n);
+            if (it->second.empty())
+                mapWalletUtxos.erase(it);
+        }
+    }
+}
+
+void CWallet::UpdateWalletUtxos(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    // A stale index is built from scratch on its next use anyway.
+    if (fWalletUtxosStale)
+        return;
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++)
+        UpdateWalletUtxo(COutPoint(hash, i));
+    for (const CTxIn& txin : wtx.tx->vin)
+        UpdateWalletUtxo(txin.prevout);
+}
+
+void CWallet::MarkWalletUtxosStale()
+{
+    LOCK(cs_wallet);
+    fWalletUtxosStale = true;
+}
+
+void CWallet::BuildWalletUtxos(std::map<uint256, std::set<unsigned int>>& mapUtxos) const
+{
+    mapUtxos.clear();
+    for (const std::pair<const uint256, CWalletTx>& item : mapWallet) {
+        for (unsigned int i = 0; i < item.second.tx->vout.size(); i++) {
+            if (IsWalletUtxo(item.second, i))
+                mapUtxos[item.first].insert(i);
+        }
+    }
+}
+
+const std::map<uint256, std::set<unsigned int>>& CWallet::GetWalletUtxos() const
+{
+    AssertLockHeld(cs_wallet);
+    if (fWalletUtxosStale) {
+        BuildWalletUtxos(mapWalletUtxos);
+        fWalletUtxosStale = false;
+    }
+    return mapWalletUtxos;
+}
+
+bool CWallet::CheckWalletUtxos() const
+{
+    AssertLockHeld(cs_wallet);
+    std::map<uint256, std::set<unsigned int>> mapUtxos;
+    BuildWalletUtxos(mapUtxos);
+    return GetWalletUtxos() == mapUtxos;
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
@@ -990,6 +1086,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    UpdateWalletUtxos(wtx);
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -1015,6 +1112,7 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     wtx.BindWallet(this);
     wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
     AddToSpends(hash);
+    UpdateWalletUtxos(wtx);
     for (const CTxIn& txin : wtx.tx->vin) {
         if (mapWallet.count(txin.prevout.hash)) {
             CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -1083,6 +1181,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransactionRef& ptx, const CBlockI
                         if (!TopUpKeyPool()) {
                             LogPrintf("%s: Topping up keypool failed (locked wallet)\n", __func__);
                         }
+                        // A restored HD wallet is catching up: the keys just
+                        // derived may be paid by transactions it already has.
+                        MarkWalletUtxosStale();
                     }
                 }
             }
@@ -1157,6 +1258,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
             }
+            UpdateWalletUtxos(wtx);
         }
     }
 
@@ -1218,6 +1320,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
             }
+            UpdateWalletUtxos(wtx);
         }
     }
 }
@@ -1583,19 +1686,20 @@ void CWalletTx::GetAmounts(std::list<COutputEntry>& listReceived,
  * @return Earliest timestamp that could be successfully scanned from. Timestamp
  * returned will be higher than startTime if relevant blocks could not be read.
  */
-int64_t CWallet::RescanFromTime(int64_t startTime, bool update)
+int64_t CWallet::RescanFromTime(int64_t startTime, const WalletRescanReserver& reserver, bool update)
 {
-    AssertLockHeld(cs_main);
-    AssertLockHeld(cs_wallet);
-
     // Find starting block. May be null if nCreateTime is greater than the
     // highest blockchain timestamp, in which case there is nothing that needs
     // to be scanned.
-    CBlockIndex* const startBlock = chainActive.FindEarliestAtLeast(startTime - TIMESTAMP_WINDOW);
-    LogPrintf("%s: Rescanning last %i blocks\n", __func__, startBlock ? chainActive.Height() - startBlock->nHeight + 1 : 0);
+    CBlockIndex* startBlock;
+    {
+        LOCK(cs_main);
+        startBlock = chainActive.FindEarliestAtLeast(startTime - TIMESTAMP_WINDOW);
+        LogPrintf("%s: Rescanning last %i blocks\n", __func__, startBlock ? chainActive.Height() - startBlock->nHeight + 1 : 0);
+    }
 
     if (startBlock) {
-        const CBlockIndex* const failedBlock = ScanForWalletTransactions(startBlock, update);
+        const CBlockIndex* const failedBlock = ScanForWalletTransactions(startBlock, reserver, update);
         if (failedBlock) {
             return failedBlock->GetBlockTimeMax() + TIMESTAMP_WINDOW + 1;
         }
@@ -1603,56 +1707,264 @@ int64_t CWallet::RescanFromTime(int64_t startTime, bool update)
     return startTime;
 }
 
+namespace {
+
+/** A block of a rescan, read and matched against the wallet's keys ahead of time */
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    CBlock block;
+    bool fRead = false;
+    //! Whether each transaction pays to the wallet
+    std::vector<bool> vPaysToMe;
+    //! The wallet's nKeystoreChanges when vPaysToMe was filled in
+    uint64_t nKeystoreChanges = 0;
+    bool fDone = false;
+
+    explicit CRescanBlock(CBlockIndex* pindexIn) : pindex(pindexIn) {}
+};
+
+/**
+ * Threads that read the blocks of a rescan from disk, and look for outputs
+ * to the wallet in them, while the wallet is updated with earlier blocks.
+ */
+class CRescanReaders
+{
+private:
+    const CWallet& wallet;
+    const std::atomic<uint64_t>& nKeystoreChanges;
+    std::mutex mutex;
+    std::condition_variable condWork;
+    std::condition_variable condDone;
+    std::deque<std::shared_ptr<CRescanBlock>> queue;
+    bool fStop = false;
+    std::vector<std::thread> threads;
+
+    void Read(CRescanBlock& rblock)
+    {
+        // The block index vouches for the block, so its Equihash solution
+        // is not checked again.
+        rblock.fRead = ReadBlockFromDisk(rblock.block, rblock.pindex, Params().GetConsensus(), false);
+        if (!rblock.fRead)
+            return;
+        rblock.nKeystoreChanges = nKeystoreChanges;
+        rblock.vPaysToMe.resize(rblock.block.vtx.size());
+        for (size_t i = 0; i < rblock.block.vtx.size(); i++)
+            rblock.vPaysToMe[i] = wallet.IsMine(*rblock.block.vtx[i]);
+    }
+
+    void Thread()
+    {
+        RenameThread("fabcoin-rescan");
+        while (true) {
+            std::shared_ptr<CRescanBlock> prblock;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condWork.wait(lock, [this] { return fStop || !queue.empty(); });
+                if (fStop)
+                    return;
+                prblock = queue.front();
+                queue.pop_front();
+            }
+            Read(*prblock);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                prblock->fDone = true;
+            }
+            condDone.notify_all();
+        }
+    }
+
+public:
+    CRescanReaders(const CWallet& walletIn, const std::atomic<uint64_t>& nKeystoreChangesIn, int nThreads) :
+        wallet(walletIn), nKeystoreChanges(nKeystoreChangesIn)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threads.emplace_back(&CRescanReaders::Thread, this);
+    }
+
+    ~CRescanReaders()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+    void Add(const std::shared_ptr<CRescanBlock>& prblock)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(prblock);
+        }
+        condWork.notify_one();
+    }
+
+    void Wait(const CRescanBlock& rblock)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condDone.wait(lock, [&rblock] { return rblock.fDone; });
+    }
+};
+
+} // namespace
+
+bool CWallet::MayBeInvolvingMe(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()))
+        return true;
+    for (const CTxIn& txin : tx.vin) {
+        if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout))
+            return true;
+    }
+    return false;
+}
+
+void CWallet::UpdateRescanBlock(const CBlockIndex* pindexStart, const CBlockIndex* pindexScanned)
+{
+    LOCK(cs_main);
+    CWalletDB walletdb(*dbw);
+    // A mark left by an earlier scan that this one does not reach back to
+    // stays, so that the blocks in between are not skipped.
+    CBlockLocator locator;
+    if (walletdb.ReadRescanBlock(locator)) {
+        const CBlockIndex* pindexMark = FindForkInGlobalIndex(chainActive, locator);
+        if (pindexMark && pindexMark->nHeight < pindexStart->nHeight - 1)
+            return;
+    }
+    if (pindexScanned)
+        walletdb.WriteRescanBlock(chainActive.GetLocator(pindexScanned));
+    else
+        walletdb.EraseRescanBlock();
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  *
+ * Blocks are read, and matched against the wallet's keys, on -rescanthreads
+ * threads ahead of the block the wallet is updated with, and cs_main and
+ * cs_wallet are only held while it is. A scan that is aborted or cut short
+ * by a shutdown leaves where it got to in the wallet, for the next start to
+ * go on from. A block that is disconnected before the wallet is updated with
+ * it is skipped, and the scan goes on from where the chain forked off.
+ *
+ * The caller must have reserved the wallet with reserver.
+ *
  * Returns null if scan was successful. Otherwise, if a complete rescan was not
  * possible (due to pruning or corruption), returns pointer to the most recent
  * block that could not be scanned.
  */
-CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
+CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, const WalletRescanReserver& reserver, bool fUpdate)
 {
+    assert(reserver.IsReserved());
+
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
     CBlockIndex* ret = nullptr;
+    fAbortRescan = false;
+    nRescanStartTime = GetTimeMillis();
+    dRescanProgress = 0;
+    nRescanHeight = -1;
+
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    double dProgressStart, dProgressTip;
     {
-        LOCK2(cs_main, cs_wallet);
-        fAbortRescan = false;
-        fScanningWallet = true;
+        LOCK(cs_main);
+        dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
+        dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
+    }
+
+    int nThreads = gArgs.GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores();
+    nThreads = std::max(1, std::min(nThreads, MAX_RESCAN_THREADS));
+
+    bool fInterrupted = false;
+    {
+        CRescanReaders readers(*this, nKeystoreChanges, nThreads);
+        std::deque<std::shared_ptr<CRescanBlock>> window;
+        CBlockIndex* pindexQueued = nullptr;
+        CBlockIndex* pindexScanned = nullptr;
+        while (true) {
+            if (fAbortRescan || ShutdownRequested()) {
+                fInterrupted = true;
+                break;
+            }
+            {
+                // Keep the readers ahead, following the tip as it moves on.
+                LOCK(cs_main);
+                while (window.size() < (size_t)RESCAN_READ_AHEAD) {
+                    CBlockIndex* pindexNext = pindexQueued ? chainActive.Next(pindexQueued) : pindexStart;
+                    if (!pindexNext)
+                        break;
+                    window.push_back(std::make_shared<CRescanBlock>(pindexNext));
+                    readers.Add(window.back());
+                    pindexQueued = pindexNext;
+                }
+            }
+            if (window.empty()) {
+                pindex = nullptr;
+                break;
+            }
+
+            const std::shared_ptr<CRescanBlock> prblock = window.front();
+            window.pop_front();
+            pindex = prblock->pindex;
+            readers.Wait(*prblock);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = GuessVerificationProgress(chainParams.TxData(), pindex);
-        double dProgressTip = GuessVerificationProgress(chainParams.TxData(), chainActive.Tip());
-        while (pindex && !fAbortRescan)
-        {
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
+                // Leave a mark to go on from, in case the node stops.
+                if (pindexScanned)
+                    UpdateRescanBlock(pindexStart, pindexScanned);
             }
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+            if (prblock->fRead) {
+                LOCK2(cs_main, cs_wallet);
+                if (!chainActive.Contains(pindex)) {
+                    // The block was disconnected, so its transactions must
+                    // not be marked as being in it. Go on from where the
+                    // active chain forked off instead; the blocks queued
+                    // after this one are off it as well.
+                    window.clear();
+                    pindexQueued = chainActive[chainActive.FindFork(pindex)->nHeight];
+                    continue;
+                }
+                const CBlock& block = prblock->block;
                 for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+                    // Transactions that neither pay to the wallet, nor
+                    // touch its transactions, are left alone, unless keys
+                    // were added since they were matched.
+                    if (prblock->vPaysToMe[posInBlock] || prblock->nKeystoreChanges != nKeystoreChanges || MayBeInvolvingMe(*block.vtx[posInBlock]))
+                        AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
                 }
             } else {
                 ret = pindex;
             }
-            pindex = chainActive.Next(pindex);
+            pindexScanned = pindex;
+            nRescanHeight = pindex->nHeight;
+            if (dProgressTip - dProgressStart > 0.0)
+                dRescanProgress = std::max(0.0, std::min(1.0, (GuessVerificationProgress(chainParams.TxData(), pindex) - dProgressStart) / (dProgressTip - dProgressStart)));
         }
-        if (pindex && fAbortRescan) {
+
+        if (fInterrupted && pindex) {
             LogPrintf("Rescan aborted at block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
-
-        fScanningWallet = false;
+        UpdateRescanBlock(pindexStart, fInterrupted ? pindexScanned : nullptr);
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
     return ret;
 }
 
@@ -1993,9 +2305,9 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const auto& entry : GetWalletUtxos())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.at(entry.first);
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2009,9 +2321,9 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const auto& entry : GetWalletUtxos())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.at(entry.first);
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -2038,9 +2350,9 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const auto& entry : GetWalletUtxos())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.at(entry.first);
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -2054,9 +2366,9 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const auto& entry : GetWalletUtxos())
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.at(entry.first);
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -2145,10 +2457,11 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
 
         CAmount nTotal = 0;
 
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        // Transactions without outputs in the index have no coins to offer.
+        for (const auto& entry : GetWalletUtxos())
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256& wtxid = entry.first;
+            const CWalletTx* pcoin = &mapWallet.at(wtxid);
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -2205,14 +2518,14 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
             if (nDepth < nMinDepth || nDepth > nMaxDepth)
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
+            for (unsigned int i : entry.second) {
                 if (pcoin->tx->vout[i].nValue < nMinimumAmount || pcoin->tx->vout[i].nValue > nMaximumAmount)
                     continue;
 
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint((*it).first, i)))
+                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint(wtxid, i)))
                     continue;
 
-                if (IsLockedCoin((*it).first, i))
+                if (IsLockedCoin(wtxid, i))
                     continue;
 
                 if (IsSpent(wtxid, i))
@@ -3143,6 +3456,7 @@ DBErrors CWallet::ZapSelectTx(std::vector<uint256>& vHashIn, std::vector<uint256
     DBErrors nZapSelectTxRet = CWalletDB(*dbw,"cr+").ZapSelectTx(vHashIn, vHashOut);
     for (uint256 hash : vHashOut)
         mapWallet.erase(hash);
+    fWalletUtxosStale = true;
 
     if (nZapSelectTxRet == DB_NEED_REWRITE)
     {
@@ -3357,6 +3671,10 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         }
         if (missingInternal + missingExternal > 0) {
             LogPrintf("keypool added %d keys (%d internal), size=%u (%u internal)\n", missingInternal + missingExternal, missingInternal, setInternalKeyPool.size() + setExternalKeyPool.size(), setInternalKeyPool.size());
+            // During a rescan, transactions found so far may pay to keys
+            // derived only now.
+            if (fScanningWallet)
+                MarkWalletUtxosStale();
         }
     }
     return true;
@@ -3931,6 +4249,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", DEFAULT_WALLET_PRIVDB));
+        strUsage += HelpMessageOpt("-rescanthreads=<n>", strprintf("Number of threads reading and matching blocks during a rescan (0 = number of cores, up to %d, default: %d)", MAX_RESCAN_THREADS, DEFAULT_RESCAN_THREADS));
         strUsage += HelpMessageOpt("-walletrejectlongchains", strprintf(_("Wallet will not create transactions that violate mempool chain limits (default: %u)"), DEFAULT_WALLET_REJECT_LONG_CHAINS));
     }
 
@@ -4060,6 +4379,14 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
         CBlockLocator locator;
         if (walletdb.ReadBestBlock(locator))
             pindexRescan = FindForkInGlobalIndex(chainActive, locator);
+        // Go on with a rescan that did not finish before the node stopped.
+        if (walletdb.ReadRescanBlock(locator)) {
+            CBlockIndex* pindexResume = FindForkInGlobalIndex(chainActive, locator);
+            if (pindexResume && (!pindexRescan || pindexResume->nHeight < pindexRescan->nHeight)) {
+                LogPrintf("Resuming rescan from block %i\n", pindexResume->nHeight);
+                pindexRescan = pindexResume;
+            }
+        }
     }
     if (chainActive.Tip() && chainActive.Tip() != pindexRescan)
     {
@@ -4088,7 +4415,14 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
         }
 
         nStart = GetTimeMillis();
-        walletInstance->ScanForWalletTransactions(pindexRescan, true);
+        {
+            WalletRescanReserver reserver(walletInstance);
+            if (!reserver.Reserve()) {
+                InitError(_("Failed to rescan the wallet during initialization"));
+                return nullptr;
+            }
+            walletInstance->ScanForWalletTransactions(pindexRescan, reserver, true);
+        }
         LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
         walletInstance->SetBestChain(chainActive.GetLocator());
         walletInstance->dbw->IncrementUpdateCounter();
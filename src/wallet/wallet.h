@@ -12,6 +12,7 @@
 #include "tinyformat.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 #include "validationinterface.h"
 #include "script/ismine.h"
 #include "script/sign.h"
@@ -67,6 +68,11 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
 //! if set, all keys will be derived by using BIP32
 static const bool DEFAULT_USE_HD_WALLET = true;
+//! -rescanthreads default, for as many threads as there are cores
+static const int DEFAULT_RESCAN_THREADS = 0;
+static const int MAX_RESCAN_THREADS = 16;
+//! Blocks the rescan threads read ahead of the one the wallet is updated with
+static const int RESCAN_READ_AHEAD = 32;
 
 extern const char * DEFAULT_WALLET_DAT;
 
@@ -81,6 +87,7 @@ class CScheduler;
 class CTxMemPool;
 class CBlockPolicyEstimator;
 class CWalletTx;
+class WalletRescanReserver;
 struct FeeCalculation;
 enum class FeeEstimateMode;
 
@@ -655,9 +662,27 @@ private:
 class CWallet : public CCryptoKeyStore, public CValidationInterface
 {
 private:
+    friend class WalletRescanReserver;
     static std::atomic<bool> fFlushScheduled;
     std::atomic<bool> fAbortRescan;
     std::atomic<bool> fScanningWallet;
+    //! When the running rescan started, in milliseconds, how far it got, and its last block
+    std::atomic<int64_t> nRescanStartTime;
+    std::atomic<double> dRescanProgress;
+    std::atomic<int> nRescanHeight;
+    /**
+     * Counts the keys, scripts and watch-only scripts added, so that a rescan
+     * can tell whether transactions it matched against the keystore ahead of
+     * time have to be matched again.
+     */
+    std::atomic<uint64_t> nKeystoreChanges;
+
+    /**
+     * Mark pindexScanned as the last block of an unfinished rescan from
+     * pindexStart in the wallet, or clear the mark if it is null, unless an
+     * earlier rescan left a mark before pindexStart.
+     */
+    void UpdateRescanBlock(const CBlockIndex* pindexStart, const CBlockIndex* pindexScanned);
 
     /**
      * Select a set of coins such that nValueRet >= nTargetValue and at least
@@ -688,6 +713,35 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * The outputs of wallet transactions that pay to the wallet, and that no
+     * wallet transaction spends but abandoned or conflicted ones, by
+     * transaction. Balances and coin selection look at these instead of all
+     * of mapWallet. The spends of abandoned and conflicted transactions can
+     * count again as the chain moves, so IsSpent still has the last word.
+     * Built on first use, and again after keys or scripts are imported,
+     * keys are derived during a rescan or transactions are removed; kept up
+     * to date as transactions are added and change state.
+     */
+    mutable std::map<uint256, std::set<unsigned int>> mapWalletUtxos;
+    mutable bool fWalletUtxosStale;
+    /**
+     * Build mapWalletUtxos again on its next use, since outputs of wallet
+     * transactions may pay to an imported key or script. Keys generated for
+     * the keypool are normally new, so they are not imports. But when a
+     * transaction uses a keypool key, or a rescan tops up the keypool, the
+     * wallet may be a restored HD wallet whose transactions pay to keys it
+     * derives only then.
+     */
+    void MarkWalletUtxosStale();
+    bool IsWalletUtxo(const CWalletTx& wtx, unsigned int n) const;
+    void UpdateWalletUtxo(const COutPoint& outpoint);
+    /** Update mapWalletUtxos for the outputs of wtx, and the outputs it spends */
+    void UpdateWalletUtxos(const CWalletTx& wtx);
+    void BuildWalletUtxos(std::map<uint256, std::set<unsigned int>>& mapUtxos) const;
+    /** mapWalletUtxos, built first if it is stale */
+    const std::map<uint256, std::set<unsigned int>>& GetWalletUtxos() const;
+
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
@@ -793,6 +847,11 @@ public:
         nRelockTime = 0;
         fAbortRescan = false;
         fScanningWallet = false;
+        nRescanStartTime = 0;
+        dRescanProgress = 0;
+        nRescanHeight = -1;
+        nKeystoreChanges = 0;
+        fWalletUtxosStale = true;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -841,6 +900,8 @@ public:
     bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
+    /** Whether the index of unspent outputs is what building it from scratch gives */
+    bool CheckWalletUtxos() const;
 
     bool IsLockedCoin(uint256 hash, unsigned int n) const;
     void LockCoin(const COutPoint& output);
@@ -854,6 +915,12 @@ public:
     void AbortRescan() { fAbortRescan = true; }
     bool IsAbortingRescan() { return fAbortRescan; }
     bool IsScanning() { return fScanningWallet; }
+    //! Milliseconds the running rescan has taken so far
+    int64_t ScanningDuration() const { return fScanningWallet ? GetTimeMillis() - nRescanStartTime : 0; }
+    //! Estimated fraction of the running rescan done
+    double ScanningProgress() const { return fScanningWallet ? dRescanProgress.load() : 0; }
+    //! Height of the last block the running rescan is done with, or -1
+    int ScanningHeight() const { return fScanningWallet ? nRescanHeight.load() : -1; }
 
     /**
      * keystore implementation
@@ -921,8 +988,10 @@ public:
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex, const std::vector<CTransactionRef>& vtxConflicted) override;
     void BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) override;
     bool AddToWalletIfInvolvingMe(const CTransactionRef& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
-    int64_t RescanFromTime(int64_t startTime, bool update);
-    CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    /** Whether tx is, or spends, a wallet transaction, or spends an output the wallet tracks spends of */
+    bool MayBeInvolvingMe(const CTransaction& tx) const;
+    int64_t RescanFromTime(int64_t startTime, const WalletRescanReserver& reserver, bool update);
+    CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, const WalletRescanReserver& reserver, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
     // ResendWalletTransactionsBefore may only be called if fBroadcastTransactions!
@@ -1171,6 +1240,41 @@ public:
     void KeepScript() override { KeepKey(); }
 };
 
+/**
+ * Reserves the wallet for a rescan, for as long as it lives. Callers reserve
+ * before they change the keystore, so that keys they add are not left
+ * unscanned because another rescan got in first.
+ */
+class WalletRescanReserver
+{
+private:
+    CWalletRef pwallet;
+    bool fReserved;
+public:
+    explicit WalletRescanReserver(CWalletRef pwalletIn) : pwallet(pwalletIn), fReserved(false) {}
+
+    WalletRescanReserver(const WalletRescanReserver&) = delete;
+    WalletRescanReserver& operator=(const WalletRescanReserver&) = delete;
+
+    //! Returns false if another rescan holds the wallet
+    bool Reserve()
+    {
+        assert(!fReserved);
+        if (pwallet->fScanningWallet.exchange(true))
+            return false;
+        fReserved = true;
+        return true;
+    }
+
+    bool IsReserved() const { return fReserved; }
+
+    ~WalletRescanReserver()
+    {
+        if (fReserved)
+            pwallet->fScanningWallet = false;
+    }
+};
+
 
 /** 
  * Account information.
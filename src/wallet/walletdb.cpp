@@ -125,6 +125,21 @@ bool CWalletDB::ReadBestBlock(CBlockLocator& locator)
     return batch.Read(std::string("bestblock_nomerkle"), locator);
 }
 
+bool CWalletDB::WriteRescanBlock(const CBlockLocator& locator)
+{
+    return WriteIC(std::string("rescanblock"), locator);
+}
+
+bool CWalletDB::ReadRescanBlock(CBlockLocator& locator)
+{
+    return batch.Read(std::string("rescanblock"), locator) && !locator.vHave.empty();
+}
+
+bool CWalletDB::EraseRescanBlock()
+{
+    return EraseIC(std::string("rescanblock"));
+}
+
 bool CWalletDB::WriteOrderPosNext(int64_t nOrderPosNext)
 {
     return WriteIC(std::string("orderposnext"), nOrderPosNext);
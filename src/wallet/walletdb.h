@@ -189,6 +189,11 @@ public:
     bool WriteBestBlock(const CBlockLocator& locator);
     bool ReadBestBlock(CBlockLocator& locator);
 
+    /** Where a rescan that did not finish got to, for the next start to go on from */
+    bool WriteRescanBlock(const CBlockLocator& locator);
+    bool ReadRescanBlock(CBlockLocator& locator);
+    bool EraseRescanBlock();
+
     bool WriteOrderPosNext(int64_t nOrderPosNext);
 
     bool WriteDefaultKey(const CPubKey& vchPubKey);
@@ -6,6 +6,7 @@
 
 Test the following RPCs:
     - gettxoutsetinfo
+    - getdbstats
     - getdifficulty
     - getbestblockhash
     - getblockhash
@@ -33,11 +34,12 @@ from test_framework.util import (
 class BlockchainTest(FabcoinTestFramework):
     def set_test_params(self):
         self.num_nodes = 1
-        self.extra_args = [['-stopatheight=907']]
+        self.extra_args = [['-stopatheight=907', '-chainstatedbbloombits=12']]
 
     def run_test(self):
         self._test_getchaintxstats()
         self._test_gettxoutsetinfo()
+        self._test_getdbstats()
         self._test_getblockheader()
         self._test_getdifficulty()
         self._test_getnetworkhashps()
@@ -54,7 +56,7 @@ class BlockchainTest(FabcoinTestFramework):
 
     def _test_gettxoutsetinfo(self):
         node = self.nodes[0]
-        res = node.gettxoutsetinfo()
+        res = node.gettxoutsetinfo(True)
 
         assert_equal(res['total_amount'], Decimal('21862.5'))
         assert_equal(res['transactions'], 900)
@@ -67,12 +69,21 @@ class BlockchainTest(FabcoinTestFramework):
         assert size < 64000/2*9
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized_2']), 64)
+        assert_is_hash_string(res['muhash'])
+        assert res['verified']
+
+        self.log.info("Test that gettxoutsetinfo() without verify agrees with the full scan")
+        res_fast = node.gettxoutsetinfo()
+        assert 'transactions' not in res_fast
+        assert 'hash_serialized_2' not in res_fast
+        for key in ['total_amount', 'height', 'txouts', 'bogosize', 'bestblock', 'muhash']:
+            assert_equal(res_fast[key], res[key])
 
         self.log.info("Test that gettxoutsetinfo() works for blockchain with just the genesis block")
         b1hash = node.getblockhash(1)
         node.invalidateblock(b1hash)
 
-        res2 = node.gettxoutsetinfo()
+        res2 = node.gettxoutsetinfo(True)
         assert_equal(res2['transactions'], 0)
         assert_equal(res2['total_amount'], Decimal('0'))
         assert_equal(res2['height'], 0)
@@ -80,11 +91,13 @@ class BlockchainTest(FabcoinTestFramework):
         assert_equal(res2['bogosize'], 0),
         assert_equal(res2['bestblock'], node.getblockhash(0))
         assert_equal(len(res2['hash_serialized_2']), 64)
+        assert res2['verified']
+        assert_equal(node.gettxoutsetinfo()['muhash'], res2['muhash'])
 
         self.log.info("Test that gettxoutsetinfo() returns the same result after invalidate/reconsider block")
         node.reconsiderblock(b1hash)
 
-        res3 = node.gettxoutsetinfo()
+        res3 = node.gettxoutsetinfo(True)
         assert_equal(res['total_amount'], res3['total_amount'])
         assert_equal(res['transactions'], res3['transactions'])
         assert_equal(res['height'], res3['height'])
@@ -92,6 +105,47 @@ class BlockchainTest(FabcoinTestFramework):
         assert_equal(res['bogosize'], res3['bogosize'])
         assert_equal(res['bestblock'], res3['bestblock'])
         assert_equal(res['hash_serialized_2'], res3['hash_serialized_2'])
+        assert_equal(res['muhash'], res3['muhash'])
+        assert res3['verified']
+
+        self.log.info("Test that the digest gettxoutsetinfo() keeps up to date matches a full scan as blocks are disconnected and connected")
+        b898hash = node.getblockhash(898)
+        node.invalidateblock(b898hash)
+        self._check_txoutset_digest(897)
+        node.reconsiderblock(b898hash)
+        self._check_txoutset_digest(900)
+
+    def _check_txoutset_digest(self, height):
+        node = self.nodes[0]
+        res_fast = node.gettxoutsetinfo()
+        res_full = node.gettxoutsetinfo(True)
+        assert res_full['verified']
+        assert_equal(res_fast['height'], height)
+        for key in ['total_amount', 'height', 'txouts', 'bogosize', 'bestblock', 'muhash']:
+            assert_equal(res_fast[key], res_full[key])
+
+    def _test_getdbstats(self):
+        node = self.nodes[0]
+        res = node.getdbstats()
+        assert_equal(res['chainstate']['options']['bloom_bits'], 12)
+        assert_equal(res['blockindex']['options']['bloom_bits'], 10)
+        for db in ['chainstate', 'blockindex']:
+            stats = res[db]
+            assert stats['options']['block_cache'] > 0
+            assert stats['options']['write_buffer'] > 0
+            assert_equal(len(stats['files_per_level']), 7)
+            assert 'Compactions' in stats['leveldb_stats']
+
+        # Startup read the best block ('B') and the last block file ('l');
+        # invalidating and reconsidering blocks above changed coins ('C') and
+        # block index entries ('b').
+        best_block = res['chainstate']['prefixes']['B']
+        assert best_block['read_hits'] > 0
+        assert_equal(best_block['read_bytes'], 32 * best_block['read_hits'])
+        assert res['blockindex']['prefixes']['l']['read_hits'] > 0
+        coins = res['chainstate']['prefixes']['C']
+        assert coins['writes'] + coins['erases'] > 0
+        assert res['blockindex']['prefixes']['b']['writes'] > 0
 
     def _test_getblockheader(self):
         node = self.nodes[0]
@@ -28,8 +28,18 @@ Test is as follows:
   - Restart node0 with -persistmempool. Verify that it has 5
     transactions in its mempool. This tests that -persistmempool=0
     does not overwrite a previously valid mempool stored on disk.
+  - Check that mempool.dat is written in version 2, with a checksum.
+  - Restart node0 with -trustpersistedmempool. Verify that the dump is
+    trusted and gives the same mempool as a fully verified reload.
+  - Tamper with the checksum and restart node0 with
+    -trustpersistedmempool. Verify that it falls back to full validation
+    and still loads the 5 transactions.
+  - Remove mempool.key and restart node0 with -trustpersistedmempool.
+    Verify the same.
 
 """
+import os
+import struct
 import time
 
 from test_framework.test_framework import FabcoinTestFramework
@@ -40,6 +50,29 @@ class MempoolPersistTest(FabcoinTestFramework):
         self.num_nodes = 3
         self.extra_args = [[], ["-persistmempool=0"], []]
 
+    def restart_node0(self, extra_args=[], while_stopped=None):
+        """Restart node0, wait for its mempool reload and return how it was
+        loaded ("trusted" or "verified") and the resulting mempool."""
+        self.stop_node(0)
+        if while_stopped:
+            while_stopped()
+        debug_log = os.path.join(self.nodes[0].datadir, "regtest", "debug.log")
+        log_start = os.path.getsize(debug_log)
+        self.start_node(0, extra_args=extra_args)
+
+        def read_import_line():
+            with open(debug_log, encoding="utf-8") as f:
+                f.seek(log_start)
+                for line in f:
+                    if "Imported mempool transactions from disk" in line:
+                        return line
+            return None
+        wait_until(lambda: read_import_line() is not None)
+        line = read_import_line()
+        assert "5 successes, 0 failed" in line, line
+        mode = "trusted" if "(trusted," in line else "verified"
+        return mode, sorted(self.nodes[0].getrawmempool())
+
     def run_test(self):
         chain_height = self.nodes[0].getblockcount()
         assert_equal(chain_height, 900)
@@ -78,5 +111,35 @@ class MempoolPersistTest(FabcoinTestFramework):
         self.start_node(0)
         wait_until(lambda: len(self.nodes[0].getrawmempool()) == 5)
 
+        mempool_dat = os.path.join(self.nodes[0].datadir, "regtest", "mempool.dat")
+        mempool_key = os.path.join(self.nodes[0].datadir, "regtest", "mempool.key")
+
+        self.log.debug("Verify that the dump is version 2 and round-trips, verified and trusted, to the same mempool.")
+        mode, verified_mempool = self.restart_node0()
+        assert_equal(mode, "verified")
+        assert_equal(len(verified_mempool), 5)
+        with open(mempool_dat, "rb") as f:
+            assert_equal(struct.unpack("<Q", f.read(8))[0], 2)
+        assert os.path.isfile(mempool_key)
+        mode, trusted_mempool = self.restart_node0(["-trustpersistedmempool"])
+        assert_equal(mode, "trusted")
+        assert_equal(trusted_mempool, verified_mempool)
+
+        self.log.debug("Tamper with the checksum. Verify that node0 falls back to full validation.")
+        def tamper_checksum():
+            with open(mempool_dat, "r+b") as f:
+                f.seek(-1, os.SEEK_END)
+                last = f.read(1)[0]
+                f.seek(-1, os.SEEK_END)
+                f.write(bytes([last ^ 0xff]))
+        mode, mempool = self.restart_node0(["-trustpersistedmempool"], tamper_checksum)
+        assert_equal(mode, "verified")
+        assert_equal(mempool, verified_mempool)
+
+        self.log.debug("Remove mempool.key. Verify that node0 falls back to full validation.")
+        mode, mempool = self.restart_node0(["-trustpersistedmempool"], lambda: os.remove(mempool_key))
+        assert_equal(mode, "verified")
+        assert_equal(mempool, verified_mempool)
+
 if __name__ == '__main__':
     MempoolPersistTest().main()
@@ -7,6 +7,7 @@
 - Start a single node and generate 3 blocks.
 - Stop the node and restart it with -reindex. Verify that the node has reindexed up to block 3.
 - Stop the node and restart it with -reindex-chainstate. Verify that the node has reindexed up to block 3.
+- Reindex again with a single import check thread and reader, and with several.
 """
 
 from test_framework.test_framework import FabcoinTestFramework
@@ -19,11 +20,11 @@ class ReindexTest(FabcoinTestFramework):
         self.setup_clean_chain = True
         self.num_nodes = 1
 
-    def reindex(self, justchainstate=False):
+    def reindex(self, justchainstate=False, import_args=[]):
         self.nodes[0].generate(3)
         blockcount = self.nodes[0].getblockcount()
         self.stop_nodes()
-        extra_args = [["-reindex-chainstate" if justchainstate else "-reindex", "-checkblockindex=1"]]
+        extra_args = [["-reindex-chainstate" if justchainstate else "-reindex", "-checkblockindex=1"] + import_args]
         self.start_nodes(extra_args)
         while self.nodes[0].getblockcount() < blockcount:
             time.sleep(0.1)
@@ -35,6 +36,8 @@ class ReindexTest(FabcoinTestFramework):
         self.reindex(True)
         self.reindex(False)
         self.reindex(True)
+        self.reindex(False, ["-importthreads=1", "-importreadahead=1"])
+        self.reindex(False, ["-importthreads=4", "-importreadahead=4"])
 
 if __name__ == '__main__':
     ReindexTest().main()
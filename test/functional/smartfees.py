@@ -258,5 +258,14 @@ class EstimateFeeTest(FabcoinTestFramework):
         self.log.info("Final estimates after emptying mempools")
         check_estimates(self.nodes[1], self.fees_per_kb, 2)
 
+        self.log.info("Check that estimates carry the version of the estimator state they were made from")
+        first = self.nodes[1].estimatesmartfee(2)
+        second = self.nodes[1].estimatesmartfee(2)
+        assert second['estimator_version'] >= first['estimator_version']
+        if second['estimator_version'] == first['estimator_version']:
+            assert_equal(second['feerate'], first['feerate'])
+        self.nodes[1].generate(1)
+        wait_until(lambda: self.nodes[1].estimatesmartfee(2)['estimator_version'] > second['estimator_version'])
+
 if __name__ == '__main__':
     EstimateFeeTest().main()
@@ -78,6 +78,7 @@ BASE_SCRIPTS= [
 
     'rawtransactions.py',
     'reindex.py',
+    'utxo_snapshot.py',
     # vv Tests less than 30s vv
     'keypool-topup.py',
     'zmq_test.py',
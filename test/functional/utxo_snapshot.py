@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test dumptxoutset and -loadtxoutset.
+
+- Mine a chain on node0 and dump its UTXO set, then mine a few more blocks.
+- Give node1 a copy of node0's block files and start it with
+  -reindex-chainstate -loadtxoutset. Verify that it starts at the snapshot's
+  base block, connects the remaining blocks and ends up with the same UTXO set.
+- Verify that a snapshot is refused without -loadtxoutsethash, with a hash
+  other than its own, and when it is damaged.
+"""
+
+import os
+import shutil
+
+from test_framework.test_framework import FabcoinTestFramework
+from test_framework.util import assert_equal, assert_raises_rpc_error, wait_until
+
+class UTXOSnapshotTest(FabcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # node1 only ever learns about blocks through the copied block files
+        self.setup_nodes()
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        node0.generate(110)
+        snapshot_path = os.path.join(self.options.tmpdir, "utxo.dat")
+
+        self.log.info("Dump the UTXO set of node0")
+        res = node0.dumptxoutset(snapshot_path)
+        info = node0.gettxoutsetinfo(True)
+        assert_equal(res['base_height'], 110)
+        assert_equal(res['base_hash'], node0.getbestblockhash())
+        assert_equal(res['coins_written'], info['txouts'])
+        assert_equal(res['hash_serialized_2'], info['hash_serialized_2'])
+        assert_equal(res['path'], snapshot_path)
+        assert_raises_rpc_error(-1, "already exists", node0.dumptxoutset, snapshot_path)
+
+        # Relative paths end up in the data directory
+        res = node0.dumptxoutset("utxo-relative.dat")
+        assert_equal(res['path'], os.path.join(node0.datadir, "regtest", "utxo-relative.dat"))
+        assert os.path.isfile(res['path'])
+
+        node0.generate(5)
+        self.stop_nodes()
+        shutil.rmtree(os.path.join(self.nodes[1].datadir, "regtest", "blocks"))
+        shutil.copytree(os.path.join(node0.datadir, "regtest", "blocks"), os.path.join(self.nodes[1].datadir, "regtest", "blocks"))
+
+        snapshot_hash = res['hash_serialized_2']
+        load_args = ["-reindex-chainstate", "-loadtxoutset=" + snapshot_path]
+
+        self.log.info("Refuse a snapshot without an expected hash, or with another one")
+        self.assert_start_raises_init_error(1, load_args, "-loadtxoutset needs -loadtxoutsethash")
+        self.assert_start_raises_init_error(1, load_args + ["-loadtxoutsethash=" + snapshot_hash[:-2]], "-loadtxoutset needs -loadtxoutsethash")
+        other_hash = snapshot_hash[:-1] + ('0' if snapshot_hash[-1] != '0' else '1')
+        self.assert_start_raises_init_error(1, load_args + ["-loadtxoutsethash=" + other_hash], "is not the expected " + other_hash)
+
+        self.log.info("Refuse a damaged snapshot")
+        damaged_path = os.path.join(self.options.tmpdir, "utxo-damaged.dat")
+        with open(snapshot_path, 'rb') as f:
+            data = bytearray(f.read())
+        data[len(data) // 2] ^= 0x01
+        with open(damaged_path, 'wb') as f:
+            f.write(data)
+        self.assert_start_raises_init_error(1, ["-reindex-chainstate", "-loadtxoutset=" + damaged_path, "-loadtxoutsethash=" + snapshot_hash], "Unable to load UTXO snapshot")
+
+        self.log.info("Load the snapshot into node1")
+        self.start_node(1, load_args + ["-loadtxoutsethash=" + snapshot_hash])
+        node1 = self.nodes[1]
+        wait_until(lambda: node1.getblockcount() == 115, timeout=30)
+        self.start_node(0)
+        assert_equal(node1.getbestblockhash(), self.nodes[0].getbestblockhash())
+        info0 = self.nodes[0].gettxoutsetinfo(True)
+        info1 = node1.gettxoutsetinfo(True)
+        assert_equal(info1['hash_serialized_2'], info0['hash_serialized_2'])
+        assert_equal(info1['muhash'], info0['muhash'])
+        assert info1['verified']
+
+        self.log.info("The loaded chain state survives a restart")
+        self.stop_node(1)
+        self.start_node(1)
+        assert_equal(self.nodes[1].getblockcount(), 115)
+        info1 = self.nodes[1].gettxoutsetinfo(True)
+        assert_equal(info1['hash_serialized_2'], info0['hash_serialized_2'])
+        assert info1['verified']
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()